@@ -12,7 +12,7 @@
 
 #include <input_interface.hpp>
 #include <file_output.hpp>
-#include <queue>
+#include <atomic>
 #include <fuzz.hpp>
 #include <vector>
 #include <string>
@@ -27,6 +27,10 @@ using std::vector;
 using std::string;
 
 #define HW_FRAMES_PER_BUFFER (HW_SAMPLERATE == 44100 ? 512 : 32)
+/* frames read from or written to a file at a time */
+#define FILE_FRAMES_PER_BLOCK 1024
+/* buffers each hardware queue can hold before new ones are dropped */
+#define HW_QUEUE_BUFFERS 64
 #define NUM_CHANNELS 2
 
 class AudioManager
@@ -67,6 +71,26 @@ public:
 	/** @brief sets the next value. */
 	void set_next_value(double val);
 
+	/** @brief reads up to n of the next available values into buf, with
+	    effects applied. Returns the number read, which is only less than n
+	    once no more data is available. */
+	size_t get_next_block(float *buf, size_t n);
+
+	/** @brief reads every remaining value into buf, with effects applied,
+	    for offline renders that need the whole signal at once. Returns the
+	    number read. */
+	size_t read_all(std::vector<float>& buf);
+
+	/** @brief sets the next n values. */
+	void set_next_block(const float *buf, size_t n);
+
+	/** @brief gets the number of frames best read at a time: a whole
+	    hardware buffer for hardware input. */
+	size_t get_block_size() {
+		return input_mode == INPUT_HARDWARE ? HW_FRAMES_PER_BUFFER
+		                                    : FILE_FRAMES_PER_BLOCK;
+	}
+
 	double get_sampling_period() { return 1.0 / data->samplerate; }
 
 	/** @brief flush the values into a file */
@@ -75,9 +99,36 @@ public:
 	struct buffer {
 		float buf[HW_FRAMES_PER_BUFFER];
 	};
+
+	/** @brief fixed size FIFO of buffers passed between the simulator and
+	    the audio callback. All of its storage is allocated up front, so
+	    neither side allocates while audio is running. Safe for one thread
+	    pushing and one thread popping. */
+	struct buffer_queue {
+		buffer slots[HW_QUEUE_BUFFERS];
+		std::atomic<int> head{0};  /**< next slot to pop */
+		std::atomic<int> tail{0};  /**< next slot to push */
+		std::atomic<int> dropped{0};  /**< buffers dropped while full */
+
+		int size() const { return tail - head; }
+		buffer& front() { return slots[head % HW_QUEUE_BUFFERS]; }
+		void pop() { head++; }
+
+		/** @brief copies a buffer in, or drops it if the queue is full */
+		bool push(const buffer& b) {
+			if (size() == HW_QUEUE_BUFFERS) {
+				dropped++;
+				return false;
+			}
+			slots[tail % HW_QUEUE_BUFFERS] = b;
+			tail++;
+			return true;
+		}
+	};
+
 	typedef struct {
-		std::queue<buffer> hw_input_buf;
-		std::queue<buffer> hw_output_buf;
+		buffer_queue hw_input_buf;
+		buffer_queue hw_output_buf;
 		// std::vector<std::queue<buffer>> hw_input_buf;
 		// std::vector<std::queue<buffer>> hw_output_buf;
 		int input_index;
@@ -103,6 +154,7 @@ private:
 
 	bool hw_get_next_value(double *val);
 	bool file_get_next_value(double *val);
+	size_t hw_get_next_block(float *buf, size_t n);
 	void hw_set_next_value(double val);
 	void file_set_next_value(double val);
 
@@ -111,8 +163,18 @@ private:
 	output_t output_mode;
 
 	/* effects */
-	vector<string> effects;
-	float apply_effects(float val, vector<string> effects);
+	typedef enum {
+		EFFECT_REVERB,
+		EFFECT_FUZZ,
+		EFFECT_DELAY,
+		EFFECT_DISTORTION,
+		EFFECT_AMPLIFY,
+	} effect_t;
+
+	/** @brief effect chain, looked up once from the netlist's effect names */
+	vector<effect_t> effects;
+	float apply_effects(float val);
+	void apply_effects(float *buf, size_t n);
 	Fuzz fuzz;
 	Distortion distortion;
 	Delay delay;
@@ -12,62 +12,57 @@
 #define _FILEINPUT_H_
 
 #include <vector>
+#include <string>
+#include <fstream>
+#include <sndfile.hh>
 #include <input_interface.hpp>
 #include <audio_manager.hpp>
 
 /**
- * @brief Class for file inputs.
+ * @brief Class for file inputs. Frames are read from the file as they are
+ * asked for rather than loaded up front, so memory use does not grow with
+ * the length of the file.
  *
  */
 class FileInput : public InputInterface
 {
 public:
-	/* cosntructor that takes in a filename and processes it */
+	/* cosntructor that takes in a filename and opens it */
 	FileInput(const char *filename, AudioManager::filetype_t file_type);
 
-	/** @brief Defines iterator type over lines in the netlist */
-    typedef std::vector<float>::iterator iterator;
-    /** @brief Defines const iterator type over lines in the netlist */
-    typedef std::vector<float>::const_iterator const_iterator;
-
-    /** @brief returns an iterator to the beginning of the audio data */
-    iterator begin() { return frames.begin(); }
-    /** @brief returns an iterator to the end of the audio data */
-    iterator end() { return frames.end(); }
-    /** @brief returns a constant iterator to the beginning of the audio data */
-    const_iterator cbegin() { return frames.begin(); }
-    /** @brief returns a constant iterator to the end of the audio data */
-    const_iterator cend() { return frames.end(); }
-
-    /** @brief returns the number of frames */
+    /** @brief returns the number of frames, or 0 for txt files, whose
+        length is not known until they have been read */
 	int get_num_frames(){ return num_frames; };
 	/** @brief returns the samplerate */
 	int get_samplerate() override { return samplerate; };
 
 	/** @brief returns the next voltage */
 	bool get_next_value(float *val) override;
-	/** @brief resets the current index back to zero */
-	void reset_index() { cur_index = 0; }
-
-	/** @brief saves the file as a cso file */
-	void save(const char* filename);
-
-	/** @brief define subscript operator */
-	float &operator[](int i) {
-		return frames[i];
-	}
+	/** @brief returns up to n of the next voltages */
+	size_t get_next_block(float *buf, size_t n) override;
 
 private:
-	/** @brief vector containing frame data */
-	std::vector<float> frames;
+	/** @brief frames read from a wav file at a time */
+	static constexpr const int CHUNK_FRAMES = 1024;
+
+	/** @brief type of the file being read */
+	AudioManager::filetype_t file_type;
+	/** @brief the wav file being read */
+	SndfileHandle wav;
+	/** @brief the txt file being read */
+	std::ifstream txt;
+	/** @brief the last line read from the txt file */
+	std::string line;
+	/** @brief interleaved frames last read from the wav file */
+	std::vector<float> chunk;
 	/** @brief samplerate of the file */
 	int samplerate;
 	/** @brief number of frames the file contains */
 	int num_frames;
-	/** @brief index get_next_value will serve */
+	/** @brief index of the next frame get_next_value will serve */
 	int cur_index;
 	/** @brief the number of channels the input file had */
 	int channels;
 };
 
-#endif /* _FILEINPUT_H_ */
\ No newline at end of file
+#endif /* _FILEINPUT_H_ */
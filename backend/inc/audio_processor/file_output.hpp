@@ -1,8 +1,7 @@
 /**
  * @file file_output.hpp
  * 
- * @brief conatins the API for FileInput, which parses and manages
- * audio files.
+ * @brief conatins the API for FileOutput, which saves audio data.
  * 
  * @author Joseph Kim
  * 
@@ -11,32 +10,21 @@
 #ifndef _FILEOUTPUT_H_
 #define _FILEOUTPUT_H_
 
-#include <vector>
+#include <fstream>
+#include <stddef.h>
 
 /**
- * @brief Class for file inputs.
+ * @brief Class for file outputs. Frames are written to the file as they
+ * arrive rather than kept in memory, and the frame count in the header is
+ * filled in by finish().
  *
  */
 class FileOutput
 {
 public:
-	/* cosntructor that takes in a filename and processes it */
+	/* cosntructor that takes in a filename and creates it */
 	FileOutput(const char *filename, int samplerate);
 
-	/** @brief Defines iterator type over lines in the netlist */
-    typedef std::vector<float>::iterator iterator;
-    /** @brief Defines const iterator type over lines in the netlist */
-    typedef std::vector<float>::const_iterator const_iterator;
-
-    /** @brief returns an iterator to the beginning of the audio data */
-    iterator begin() { return frames.begin(); }
-    /** @brief returns an iterator to the end of the audio data */
-    iterator end() { return frames.end(); }
-    /** @brief returns a constant iterator to the beginning of the audio data */
-    const_iterator cbegin() { return frames.begin(); }
-    /** @brief returns a constant iterator to the end of the audio data */
-    const_iterator cend() { return frames.end(); }
-
     /** @brief returns the number of frames */
 	int get_num_frames(){ return num_frames; };
 	/** @brief returns the samplerate */
@@ -45,23 +33,27 @@ public:
 	/** @brief returns the next voltage */
 	void set_next_value(float val);
 
-	/** @brief saves the file as a cso file */
-	void finish();
+	/** @brief appends a block of voltages */
+	void set_next_block(const float *buf, size_t n);
 
-	/** @brief define subscript operator */
-	float &operator[](int i) {
-		return frames[i];
-	}
+	/** @brief fills in the frame count and closes the cso file */
+	void finish();
 
 private:
+	/** @brief width the frame count is padded to, so that it can be filled
+	    in once the number of frames is known */
+	static constexpr const int COUNT_WIDTH = 10;
+
 	/** @brief name of the file to create */
 	const char *filename;
-	/** @brief vector containing frame data */
-	std::vector<float> frames;
+	/** @brief the file frames are written to */
+	std::ofstream outfile;
+	/** @brief position of the frame count in the file */
+	std::streampos count_pos;
 	/** @brief samplerate of the file */
 	int samplerate;
 	/** @brief number of frames the file contains */
 	int num_frames;
 };
 
-#endif /* _FILEINPUT_H_ */
\ No newline at end of file
+#endif /* _FILEOUTPUT_H_ */
@@ -10,6 +10,7 @@
 #define _INPUT_INTERFACE_H_
 
 #include <iostream>
+#include <stddef.h>
 
 class InputInterface
 {
@@ -21,6 +22,14 @@ public:
 
 	virtual bool get_next_value(float *val) { return false; }
 
+	/** @brief reads up to n values into buf, returning how many were read */
+	virtual size_t get_next_block(float *buf, size_t n) {
+		size_t count = 0;
+		while (count < n && get_next_value(&buf[count]))
+			count++;
+		return count;
+	}
+
 	virtual int get_samplerate() { return -1; }
 
 private:
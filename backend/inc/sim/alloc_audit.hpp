@@ -0,0 +1,50 @@
+/**
+ *
+ * @file alloc_audit.hpp
+ *
+ * @brief Provides the interface to the allocation audit, which hooks malloc
+ * to catch heap allocations made by the audio path once it is running.
+ *
+ */
+
+#ifndef _ALLOC_AUDIT_H_
+#define _ALLOC_AUDIT_H_
+
+/**
+ * @brief Counts (or aborts on) heap allocations made by threads that have
+ * armed the audit.
+ *
+ * The malloc hooks are only compiled in when building with
+ * `make ALLOC_AUDIT=1`. Otherwise arming the audit does nothing.
+ */
+class AllocAudit
+{
+public:
+
+	/** @brief What happens to allocations made while the audit is armed */
+	typedef enum {
+		AUDIT_OFF,     /**< Allocations are not tracked */
+		AUDIT_REPORT,  /**< Allocations are counted and reported afterwards */
+		AUDIT_ABORT,   /**< The first allocation aborts the simulator */
+	} audit_t;
+
+	/* whether the simulator was built with the malloc hooks */
+	static bool supported();
+
+	/* choose what happens to audited allocations */
+	static void set_mode(audit_t mode);
+
+	/* get what happens to audited allocations */
+	static audit_t get_mode();
+
+	/* start auditing allocations made by the calling thread */
+	static void arm();
+
+	/* stop auditing allocations made by the calling thread */
+	static void disarm();
+
+	/* get the number of audited allocations so far */
+	static long allocations();
+};
+
+#endif /* _ALLOC_AUDIT_H_ */
@@ -0,0 +1,259 @@
+/**
+ *
+ * @file batch.hpp
+ *
+ * @brief Provides the interface to batched circuits, which run several
+ * independent signals (lanes) through one circuit at once, so that every
+ * device evaluation and matrix operation works on a vector of lanes.
+ *
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <circuit.hpp>
+#include <audio_manager.hpp>
+#include <Eigen/Dense>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief Runs a circuit's full MNA system over several independent input
+ * signals at once.
+ *
+ * Every quantity (a matrix entry, an unknown, a device coefficient) is
+ * stored as a column holding its value in each lane, so that the stamps,
+ * device models, LU factorization and substitutions all run down contiguous
+ * columns, which Eigen vectorizes (with AVX under `make NATIVE=1`).
+ *
+ * All lanes share one row ordering, chosen up front by partially pivoting
+ * the circuit's initial jacobian, so that no lane has to swap rows while
+ * factoring. A lane whose pivot comes out too small relative to its column
+ * is instead solved on its own by a dense `LinearSystem`.
+ *
+ * Lanes may also give resistors and capacitors their own values, so that
+ * one input can be run through many variants of a circuit at once.
+ *
+ * A batch only reads from its circuit once started, so batches on separate
+ * threads may share one circuit.
+ *
+ * Lanes run newton's method in lockstep: a lane that has converged stops
+ * taking updates while the others finish. Each lane decides on its own
+ * whether to split a timestep into substeps, and walks them while the
+ * lanes that accepted the whole timestep sit out, so a lane's output never
+ * depends on which other lanes share its batch.
+ */
+class BatchCircuit
+{
+public:
+
+	/** @brief One column per quantity, one row per lane */
+	typedef Eigen::Array<double, Eigen::Dynamic, Eigen::Dynamic> Lanes;
+	/** @brief A flag for each lane */
+	typedef Eigen::Array<bool, Eigen::Dynamic, 1> LaneMask;
+
+	/** @brief Pivots smaller than this fraction of the largest entry below
+	 * them (SPICE's PIVREL) send their lane to a pivoting solver */
+	static constexpr const double PIVOT_TOLERANCE = 1.0e-3;
+
+	/* construct a batch of lanes over a circuit */
+	BatchCircuit(Circuit& circuit, int lanes);
+
+	/* destroy a batch, along with any state set up by `start` */
+	~BatchCircuit();
+
+	/** @brief Gets the number of lanes in the batch */
+	int num_lanes() const { return lanes; }
+
+	/** @brief Gets the newton iteration counts from the last analysis */
+	const NewtonStats& newton_stats() const { return stats; }
+
+	/* give one lane its own value of a resistor or capacitor */
+	void set_resistance(int lane, int device, double resistance);
+	void set_capacitance(int lane, int device, double capacitance);
+
+	/* set up every lane to process blocks of input */
+	void start(double dt);
+
+	/* move every lane to its DC operating point for a constant input */
+	void operating_point(const double *inputs);
+
+	/* run every lane over a block of its input samples */
+	void process(const float *const *in, float *const *out, size_t n);
+
+	/* tear down the state set up by `start` */
+	void stop();
+
+	/* get the delay process() adds to the signals, in samples */
+	int latency() const;
+
+	/* run the circuit over one whole signal per lane */
+	void transient(std::vector<AudioManager*>& signals, bool report = true);
+
+private:
+
+	/** @brief Where a group's coefficients are added into the system */
+	struct Scatter {
+		std::vector<int> entry;     /**< Column of the target entry */
+		std::vector<int> coeff;     /**< Column of the coefficient */
+		std::vector<double> sign;   /**< +1 to add or -1 to subtract */
+
+		/* add a stamp */
+		void add(int entry, int coeff, double sign);
+		/* add every stamp's coefficients into the target */
+		void apply(const Lanes& coeffs, Lanes& target) const;
+	};
+
+	/** @brief Coefficients of a device group in each lane, and where they
+	 * land in the system */
+	struct Group {
+		Lanes lhs_coeffs;  /**< Coefficients scattered into the LHS */
+		Lanes rhs_coeffs;  /**< Coefficients scattered into the RHS */
+		Scatter lhs;       /**< Stamps into the LHS */
+		Scatter rhs;       /**< Stamps into the RHS */
+	};
+
+	Circuit& circuit;  /**< Circuit being run */
+	int lanes;         /**< Number of lanes */
+	int n;             /**< Unknowns in each lane's system */
+	bool running;      /**< Whether the batch has been started */
+	double step_dt;    /**< Timestep the batch was started with */
+
+	/** @brief Device groups of the circuit's stamp program */
+	const StampProgram::ResistorGroup& resistors;
+	const StampProgram::CapacitorGroup& capacitors;
+	const StampProgram::DiodeGroup& diodes;
+	const StampProgram::SourceGroup& sources;
+
+	Lanes conductances;  /**< Conductance of each resistor in each lane */
+	Lanes capacitances;  /**< Capacitance of each capacitor in each lane */
+
+	Group res;     /**< Resistor coefficients */
+	Group caps;    /**< Capacitor coefficients */
+	Group dio;     /**< Diode coefficients */
+	Group src;     /**< Source coefficients */
+
+	/** @brief Row each equation is stored in, after the shared pivoting */
+	std::vector<int> row_at;
+	/** @brief Column of the ground equation's diagonal in `A` */
+	int ground_entry;
+
+	Lanes A;   /**< LHS of each lane, entry (r, c) in column r * n + c */
+	Lanes LU;  /**< LU factors of `A`, with inverted pivots on the diagonal */
+	Lanes B;   /**< RHS of each lane */
+	Lanes x;   /**< Solution (newton update) of each lane */
+
+	/** @brief Absolute newton tolerance of each unknown */
+	Eigen::VectorXd abs_tolerances;
+
+	/** @brief Lanes whose last factorization went through `fallbacks` */
+	LaneMask pivoted;
+	/** @brief Dense systems that factor lanes with poor pivots */
+	std::vector<LinearSystem*> fallbacks;
+
+	Lanes soln;          /**< Solution at the last timestep */
+	Lanes guess;         /**< Solution being iterated on */
+	Lanes substep_soln;  /**< Solution at the start of the current substep */
+	Eigen::ArrayXd u;    /**< Input voltage of each lane */
+	Eigen::ArrayXd last_u;  /**< Input voltage at the last timestep */
+	Eigen::ArrayXd u_next;  /**< Input voltage of the timestep being run */
+	Eigen::ArrayXd y;    /**< Output voltage of each lane */
+	Eigen::ArrayXd y_out;   /**< Decimated output voltage of each lane */
+
+	/*
+	 * Capacitor history in each lane (see `StampProgram::CapacitorGroup`).
+	 */
+	Lanes aux;      /**< History carried between timesteps */
+	Lanes hist;     /**< History current this timestep */
+	Lanes vlast;    /**< Voltage at the last timestep */
+	Lanes ilast;    /**< Current at the last timestep */
+	Eigen::ArrayXd step;       /**< Timestep each lane is being run over */
+	Eigen::ArrayXd last_step;  /**< Last timestep each lane accepted (0
+	                                after a reset) */
+
+	/*
+	 * Diode linearization in each lane.
+	 */
+	Lanes vj;          /**< Voltages last linearized about */
+	LaneMask limited;  /**< Whether the last run limited any voltage */
+
+	/*
+	 * Newton's method in each lane.
+	 */
+	LaneMask active;          /**< Lanes still taking updates */
+	LaneMask converged;       /**< Lanes that converged */
+	Eigen::ArrayXd damping;   /**< Fraction of each update applied */
+	Eigen::ArrayXd last_update;  /**< Largest entry of the last update */
+	Eigen::ArrayXi recoveries;   /**< Restarts after blowing up */
+	LaneMask every_lane;      /**< Every lane, to run them all */
+
+	/*
+	 * Substeps in each lane.
+	 */
+	LaneMask stepping;  /**< Lanes walking the timestep in substeps */
+	std::vector<SubstepWalk> walks;  /**< Where each lane's walk has got */
+
+	/** @brief Scratch space for the largest entry below a pivot */
+	Eigen::ArrayXd colmax;
+
+	/** @brief Extrapolates newton's starting guess for each lane */
+	std::vector<Predictor> guesses;
+	/** @brief Whether each lane's LHS was singular to working precision on
+	 * the last timestep (see `Circuit::singular_step`) */
+	LaneMask singular;
+	/** @brief Lanes running newton's method from a predicted guess */
+	LaneMask predicted;
+	/** @brief Scratch space for one lane's solution */
+	Eigen::VectorXd lane_soln;
+
+	/** @brief Resamples each lane, if the circuit is oversampled */
+	std::vector<Oversampler> resamplers;
+
+	/** @brief Newton iteration counts, per timestep of the whole batch,
+	 * with failures, recoveries and substeps counted in each lane */
+	NewtonStats stats;
+
+	/* lay out where every group's coefficients land */
+	void link();
+
+	/* stamp every lane's system for the current guess */
+	void run_kcl(const Lanes& prev, const Lanes& next, bool lhs);
+
+	/* evaluate each group's coefficients */
+	void evaluate_resistors(const Lanes& next);
+	void evaluate_capacitors(const Lanes& prev, const Lanes& next);
+	void evaluate_diodes(const Lanes& next);
+	void evaluate_sources(const Lanes& next);
+
+	/* factor every lane's LHS */
+	void factor();
+
+	/* solve every lane's system against its RHS, filling in `x` */
+	void solve();
+
+	/* linearize one lane's diodes about a solution on their next run */
+	void reset_junctions(int lane, const Lanes& at);
+
+	/* check whether evaluating one lane at a guess would limit a diode */
+	bool would_limit(int lane, const Eigen::VectorXd& at) const;
+
+	/* apply one lane's newton update, checking whether it converged */
+	bool process_deltas(int lane, double damping);
+
+	/* advance one lane's capacitor history once its step is accepted */
+	void accept(int lane, const Lanes& accepted);
+
+	/* check whether one lane's step can be accepted */
+	bool step_acceptable(int lane, const Lanes& next);
+
+	/* run newton's method on one step of some of the lanes */
+	int run_newton(const Lanes& prev, Lanes& next, const LaneMask& run);
+
+	/* run one timestep, splitting it into substeps when it has to be */
+	int run_substeps(double dt, const Lanes& prev, Lanes& next);
+
+	/* advance every lane by one timestep, from `u_next` */
+	void step_all();
+};
+
+#endif /* _BATCH_H_ */
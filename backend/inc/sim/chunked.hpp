@@ -0,0 +1,65 @@
+/**
+ *
+ * @file chunked.hpp
+ *
+ * @brief Provides the interface to chunked renders, which split one long
+ * signal into chunks that are rendered at the same time.
+ *
+ */
+
+#ifndef _CHUNKED_H_
+#define _CHUNKED_H_
+
+#include <circuit.hpp>
+#include <audio_manager.hpp>
+#include <vector>
+
+/**
+ * @brief Renders a signal as a set of chunks spread across a `WorkPool`.
+ *
+ * A circuit's state at any sample depends on every sample before it, so
+ * a chunk cannot simply start from rest. Instead each chunk starts a
+ * warm-up window early, from the DC operating point for the input at that
+ * point (see `BatchCircuit::operating_point`), and its output over the
+ * warm-up is thrown away. As long as the warm-up is longer than the
+ * circuit's memory (its slowest time constant), the seams between chunks
+ * are inaudible. A verification mode also renders the signal sequentially
+ * and reports how far each seam strays from it.
+ *
+ * The whole signal is held in memory, since chunks read it out of order.
+ */
+class ChunkedRender
+{
+public:
+
+	/* set up a render of a circuit in chunks */
+	ChunkedRender(Circuit& circuit, int chunks, double warmup);
+
+	/* render a whole signal, optionally checking the seams */
+	void run(AudioManager *signal, int jobs, int lanes, bool verify);
+
+private:
+
+	/** @brief One chunk of the signal, in samples */
+	struct Chunk {
+		long warm;   /**< First sample of the warm-up */
+		long start;  /**< First sample kept */
+		long end;    /**< One past the last sample kept */
+	};
+
+	Circuit& circuit;  /**< Circuit being rendered */
+	int num_chunks;    /**< Chunks the signal is split into */
+	double warmup;     /**< Warm-up before each chunk, in seconds */
+
+	/* render a range of chunks as the lanes of one batch */
+	void render(const std::vector<float>& input, double dt,
+	            const std::vector<Chunk>& chunks, int first, int last,
+	            std::vector<float>& output);
+
+	/* report how far the chunked render strays from the sequential one */
+	void report_seams(const std::vector<Chunk>& chunks,
+	                  const std::vector<float>& output,
+	                  const std::vector<float>& reference) const;
+};
+
+#endif /* _CHUNKED_H_ */
@@ -17,9 +17,88 @@
 #define _CIRCUIT_H_
 
 #include <components/component.hpp>
+#include <math.h>
+#include <stamp.hpp>
+#include <reduce.hpp>
+#include <iir.hpp>
+#include <dk.hpp>
+#include <table.hpp>
+#include <compiled.hpp>
+#include <predictor.hpp>
+#include <resample.hpp>
+#include <sink.hpp>
+#include <ostream>
+#include <stdint.h>
 #include <unordered_map>
 #include <vector>
 
+/**
+ * @brief Newton iteration counts gathered over a round of transient analysis.
+ */
+struct NewtonStats {
+	/** @brief Samples needing this many iterations or more share a bin */
+	static constexpr const int HISTOGRAM_BINS = 5;
+
+	long samples;     /**< Number of timesteps run */
+	long iterations;  /**< Total newton iterations across all timesteps */
+	long factorizations;  /**< Times the system was factored */
+	long solves;      /**< Times a factored system was solved */
+	long failures;    /**< Timesteps where newton's method did not converge */
+	long recoveries;  /**< Restarts after a solution stopped being finite */
+	long split_samples;  /**< Timesteps split into substeps */
+	long substeps;    /**< Substeps taken by split timesteps */
+	long newton_rejections;  /**< Steps retried because newton failed */
+	long lte_rejections;     /**< Steps retried because their local
+	                              truncation error was too large */
+	/** @brief histogram[n - 1] counts timesteps that took n iterations */
+	long histogram[HISTOGRAM_BINS];
+
+	/* zero out every count */
+	void reset();
+
+	/* record the number of iterations one timestep took */
+	void record(int iterations);
+
+	/* print a summary of the counts */
+	void report(std::ostream& out, double dt) const;
+};
+
+/**
+ * @brief Where a timestep split into substeps has got to.
+ *
+ * Substeps are dt / max_substeps times a power of two. A rejected substep
+ * is retried at half the size, down to the smallest substep, which is
+ * accepted either way. Once a substep is accepted, the next one may double
+ * again as long as it still ends on the grid of its size, so a timestep
+ * only pays for the substeps where it is hard.
+ */
+struct SubstepWalk {
+	int max_substeps;  /**< Smallest substeps in a timestep */
+	int pos;           /**< Smallest substeps already taken */
+	int len;           /**< Size of the next substep, in smallest substeps */
+
+	/* start walking a timestep, with substeps of half its size */
+	void start(int max_substeps);
+
+	/** @brief Whether the whole timestep has been taken */
+	bool done() const { return pos >= max_substeps; }
+
+	/** @brief Gets the length of the next substep of a timestep `dt` */
+	double substep(double dt) const { return dt * len / max_substeps; }
+
+	/** @brief Interpolates the input at the end of the next substep, from
+	 * the input at the start and end of the timestep */
+	double input(double u0, double u1) const {
+		return u0 + (u1 - u0) * (pos + len) / max_substeps;
+	}
+
+	/* halve the next substep after it was rejected */
+	bool retry();
+
+	/* move past an accepted substep */
+	bool advance(bool acceptable);
+};
+
 /**
  * @brief Circuit class that is used as the primary driver of
  * the simulation.
@@ -28,15 +107,46 @@ class Circuit
 {
 public:
 
+	/** @brief Ways a circuit can be run during transient analysis */
+	typedef enum {
+		METHOD_MNA,  /**< Solve the full MNA system on every timestep */
+		METHOD_IIR,  /**< Run a linear circuit as a compiled IIR filter */
+		METHOD_DK,   /**< Run newton's method over nonlinear devices only */
+		METHOD_TABLE,  /**< Interpolate the DK method's nonlinear solution */
+		METHOD_COMPILED,  /**< Run MNA code generated for the circuit */
+	} method_t;
+
+	/** @brief How newton's method treats the jacobian */
+	typedef enum {
+		NEWTON_FULL,   /**< Refactor the jacobian on every iteration */
+		NEWTON_CHORD,  /**< Reuse the last factorization while it converges */
+	} newton_t;
+
 	/**
 	 * @brief Constructs a circuit.
 	 */
-	Circuit() : next_unknown_id(0) { }
+	Circuit() : next_unknown_id(0), num_nonlinear(0),
+		solver(LinearSystem::SOLVER_AUTO),
+		precision(LinearSystem::PRECISION_DOUBLE), method(METHOD_MNA),
+		reduce(true), ordering(Reduction::ORDER_AMD),
+		predictor(Predictor::PREDICT_NONE),
+		predictor_history(3), newton(NEWTON_FULL), chord_ratio(2.0),
+		reltol(1.0e-3), vntol(1.0e-6), abstol(1.0e-9),
+		max_substeps(16), trtol(7.0), netlist_hash(0),
+		running(METHOD_MNA), resampler(NULL),
+		step_dt(0.0), sys(NULL), single_sys(NULL), reduction(NULL),
+		filter(NULL), compiled(NULL), singular_step(false), predicted(false),
+		last_voltage(0.0) { }
 
 	/**
-	 * @brief Destroys a circuit.
+	 * @brief Destroys a circuit, along with any state set up by `start`.
 	 */
-	~Circuit() { }
+	~Circuit() {
+		delete sys;
+		delete reduction;
+		delete filter;
+		delete compiled;
+	}
 
 	/*
 	 * Insert various components into the circuit.
@@ -48,12 +158,74 @@ public:
 	void register_vin(VoltageIn *vin);
 	void register_vout(VoltageOut *vout);
 
-	void transient(std::vector<double>& timescale,
-		           std::vector<double>& input_signal,
-		           std::vector<double>& output_signal);
+	/* Choose the linear solver backend used during analysis */
+	void set_solver(LinearSystem::solver_t solver);
+
+	/* Choose the precision the MNA system is assembled and solved in */
+	void set_precision(LinearSystem::precision_t precision);
+
+	/** @brief Gets the precision the MNA system is assembled and solved in */
+	LinearSystem::precision_t get_precision() const { return precision; }
+
+	/* Choose how the MNA system is reduced and ordered before it is solved */
+	void set_reduction(bool reduce, Reduction::ordering_t ordering);
+
+	/* Choose how the circuit is run during analysis */
+	void set_method(method_t method);
+
+	/* Choose how newton's method is started on each timestep */
+	void set_predictor(Predictor::predictor_t predictor, int history);
+
+	/* Choose how newton's method treats the jacobian */
+	void set_newton(newton_t newton, double chord_ratio);
+
+	/* Choose the tolerances newton's method converges to */
+	void set_tolerances(double reltol, double vntol, double abstol);
+
+	/* Choose how finely timesteps may be split, and when they are */
+	void set_substepping(int max_substeps, double trtol);
+
+	/* Choose the integration method reactive components are discretized with */
+	void set_integration(StampProgram::integration_t method);
+
+	/** @brief Gets the newton iteration counts from the last analysis */
+	const NewtonStats& newton_stats() const { return stats; }
+
+	/* Choose how many times faster than the input signal the circuit runs */
+	void set_oversampling(int factor, int taps);
+
+	/* Choose where precomputed port tables are cached, and their key */
+	void set_table_cache(const std::string& dir, uint64_t netlist_hash);
+
+	/* Derive the discrete-time state space model of a linear circuit */
+	void to_state_space(double dt, StateSpace& ss);
+
+	/* Derive the nodal DK-method model of a circuit, if it has one */
+	bool to_dk_model(double dt, DkModel& dk);
+
+	/* Describe the circuit's MNA timestep for code generation */
+	void to_compiled(double dt, CompiledCircuit& cc);
+
+	/* Set up the circuit to process blocks of input */
+	void start(double dt);
+
+	/* Run the circuit over a block of input samples */
+	void process(const float *in, float *out, size_t n);
+
+	/* Report on and tear down the state set up by `start` */
+	void stop();
+
+	/* Get the delay process() adds to the signal, in samples */
+	int latency() const;
+
+	/* Run the circuit over the whole signal of its voltage input */
+	void transient(SignalSink *monitor = NULL);
 
 private:
 
+	/* batches run the circuit's own MNA setup and newton settings */
+	friend class BatchCircuit;
+
 	/**@brief Max number of newton iterations for a round of analysis */
 	static constexpr const int MAX_ITERATIONS = 100;
 
@@ -63,10 +235,155 @@ private:
 	int next_unknown_id;
 	/** @brief Total number of unknowns in the circuit */
 	int total_unknowns;
+	/** @brief Number of nonlinear devices (i.e. diodes) in the circuit */
+	int num_nonlinear;
+
+	/** @brief Backend used to solve the system on each newton iteration */
+	LinearSystem::solver_t solver;
+	/** @brief Precision the MNA system is assembled and solved in */
+	LinearSystem::precision_t precision;
+	/** @brief How the circuit is run during transient analysis */
+	method_t method;
+	/** @brief Whether ground and grounded sources are eliminated from the
+	 * MNA system before it is solved */
+	bool reduce;
+	/** @brief Order the unknowns of the reduced MNA system are put in */
+	Reduction::ordering_t ordering;
+
+	/** @brief How newton's method is started on each timestep */
+	Predictor::predictor_t predictor;
+	/** @brief Number of past solutions the predictor extrapolates from */
+	int predictor_history;
+	/** @brief Newton iteration counts from the last analysis */
+	NewtonStats stats;
+
+	/** @brief How newton's method treats the jacobian */
+	newton_t newton;
+	/** @brief Conductance ratio that makes chord newton refactor */
+	double chord_ratio;
+	/** @brief Chord newton refactors when an update is not at least this
+	 * much smaller than the previous one */
+	static constexpr const double CHORD_CONTRACTION = 0.5;
+	/** @brief Relative tolerance on every unknown */
+	double reltol;
+	/** @brief Absolute tolerance on node voltages, in volts */
+	double vntol;
+	/** @brief Absolute tolerance on branch currents, in amps */
+	double abstol;
+	/** @brief Absolute tolerance of each unknown */
+	Eigen::VectorXd abs_tolerances;
+
+	/** @brief Smallest fraction of an update newton's method applies */
+	static constexpr const double MIN_DAMPING = 1.0 / 16;
+	/** @brief Times a timestep restarts after its solution stops being
+	 * finite before newton's method gives up on it */
+	static constexpr const int MAX_RECOVERIES = 3;
+
+	/**
+	 * @brief Checks a newton update to one unknown against its tolerance:
+	 * `reltol` times the larger of the unknown before and after the update,
+	 * plus the unknown's absolute tolerance.
+	 *
+	 * @return True if the update is within the tolerance. Updates that are
+	 * not finite never are.
+	 */
+	static inline bool update_converged(double x, double delta,
+	                                    double reltol, double abs_tolerance) {
+		double magnitude = fmax(fabs(x), fabs(x + delta));
+
+		/* written so that NaN deltas fail the test */
+		return fabs(delta) <= reltol * magnitude + abs_tolerance;
+	}
+
+	/** @brief Damps newton updates that grow from one iteration to the
+	 * next, and relaxes the damping once they shrink */
+	static inline double next_damping(double damping, double update,
+	                                  double last_update) {
+		return (update > last_update) ? fmax(damping / 2, MIN_DAMPING)
+		                              : fmin(damping * 2, 1.0);
+	}
+
+	/** @brief Gets the damping a timestep restarts with after its solution
+	 * stopped being finite for the given number of times */
+	static inline double recovery_damping(int recoveries) {
+		return ldexp(1.0, -recoveries);
+	}
+
+	/** @brief Absolute tolerance on capacitor charge, in coulombs */
+	static constexpr const double CHARGE_TOLERANCE = 1.0e-14;
+	/** @brief Most substeps a timestep is split into (a power of two) */
+	int max_substeps;
+	/** @brief Factor by which local truncation error may exceed its
+	 * tolerance, or 0 to only split timesteps newton fails on */
+	double trtol;
+	/** @brief Solution at the start of the current substep */
+	Eigen::VectorXd substep_soln;
+
+	/** @brief Whether the linear system holds a usable factorization */
+	bool factored;
+	/** @brief Nonlinear device conductances when the system was factored */
+	std::vector<double> factored_conductances;
+
+	/** @brief Port tables with an error bound above this (in volts) are not
+	 * used */
+	static constexpr const double TABLE_TOLERANCE = 1.0e-4;
+
+	/** @brief Directory that precomputed port tables and compiled circuits
+	 * are cached in */
+	std::string table_dir;
+	/** @brief Hash of the circuit's netlist, used to key cached tables */
+	uint64_t netlist_hash;
+
+	/** @brief Pivots of the state transition matrix smaller than this
+	 * (relative to the largest) do not contribute a state */
+	static constexpr const double STATE_RANK_TOLERANCE = 1.0e-10;
 
 	/** @brief vector of components in the circuit */
 	std::vector<Component*> components;
 
+	/** @brief Resamples the signal around the circuit, if it is run faster
+	 * than the input signal */
+	Oversampler oversampler;
+
+	/** @brief How the circuit was started (MNA, IIR, DK or compiled) */
+	method_t running;
+	/** @brief The oversampler, if the circuit was started oversampled */
+	Oversampler *resampler;
+	/** @brief Timestep the circuit was started with */
+	double step_dt;
+	/** @brief System the MNA method solves on each timestep, in double
+	 * precision */
+	LinearSystem *sys;
+	/** @brief System the MNA method solves on each timestep in single
+	 * precision, built in place of `sys` */
+	LinearSystemF *single_sys;
+	/** @brief Reduction `sys` is solved in, if any */
+	Reduction *reduction;
+	/** @brief Filter a linear circuit was compiled into */
+	IirFilter *filter;
+	/** @brief Code a circuit was compiled into for the compiled method */
+	CompiledCircuit *compiled;
+	/** @brief Model a circuit was compiled into for the DK method */
+	DkModel dk;
+	/** @brief Port table the DK model may interpolate from */
+	PortTable table;
+	/** @brief Extrapolates newton's starting guess for the MNA method */
+	Predictor guesses;
+	/** @brief Whether the last timestep's LHS was singular to working
+	 * precision, so that its solution depended on newton's starting guess */
+	bool singular_step;
+	/** @brief Whether newton's method is running from a predicted guess */
+	bool predicted;
+	/** @brief MNA solution at the last timestep */
+	Eigen::VectorXd soln;
+	/** @brief MNA solution being iterated on for the current timestep */
+	Eigen::VectorXd guess;
+	/** @brief Input voltage at the last timestep */
+	double last_voltage;
+
+	/** @brief KCL contributions of every component, flattened by type */
+	StampProgram program;
+
 	/** @brief ground node */
 	int ground_id;
 	/** @brief Circuit's input voltage source */
@@ -74,16 +391,68 @@ private:
 	/** @brief Circuit's output signal */
 	VoltageOut *vout;
 
-	bool process_deltas(const Eigen::VectorXd& deltas,
-		                      Eigen::VectorXd& prev_soln,
-		                      double tolerance = 1.0e-3);
+	template <typename Scalar>
+	bool process_deltas(
+		const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>& deltas,
+		Eigen::VectorXd& prev_soln, double damping = 1.0);
+
+	/* Set up the absolute tolerance of each unknown */
+	void setup_tolerances();
 
 	/* Register a set of unknowns to be tracked while solving the circuit */
 	void register_unknowns(const std::vector<std::string>& unknowns);
 
 	/* Build system of equations from KCL at each node */
+	template <typename Scalar>
 	void run_kcl(double dt, Eigen::VectorXd& soln, Eigen::VectorXd& prev_soln,
-		LinearSystem& sys);
+		BasicLinearSystem<Scalar>& sys);
+
+	/* Work out the reduction of the MNA system from its stamps */
+	Reduction *new_reduction();
+
+	/* Advance the circuit by one timestep with the method it was started with */
+	double step(double u);
+
+	/* Advance the circuit's full MNA system by one timestep */
+	template <typename Scalar>
+	double step_mna(double u, BasicLinearSystem<Scalar>& sys);
+
+	/* Load a DK model's port table from the cache, or build it */
+	bool load_port_table(double dt, const DkModel& dk, PortTable& table);
+
+	/* Run one timestep of the linear part of a circuit from a given state */
+	void probe_step(double dt, LinearSystem& sys, const Eigen::VectorXd& z,
+		int port, Eigen::VectorXd& next);
+
+	/* Probe the linear part of a circuit for its timestep response */
+	void probe_linear(double dt, LinearSystem& sys, Eigen::MatrixXd& F,
+		Eigen::VectorXd& g, Eigen::RowVectorXd& c);
+
+	/* Factor a state transition matrix into a minimal set of states */
+	void reduce_states(const Eigen::MatrixXd& F, Eigen::MatrixXd& U,
+		Eigen::MatrixXd& Wt);
+
+	/* Run newton's method on one timestep */
+	template <typename Scalar>
+	int run_newton(double dt, Eigen::VectorXd& soln,
+		Eigen::VectorXd& prev_soln, BasicLinearSystem<Scalar>& sys,
+		bool& converged);
+
+	/* Check whether a step newton's method has run can be accepted */
+	bool step_acceptable(const Eigen::VectorXd& soln, bool converged);
+
+	/* Run one timestep, splitting it into substeps when it has to be */
+	template <typename Scalar>
+	int run_substeps(double dt, double u0, double u1, Eigen::VectorXd& soln,
+		Eigen::VectorXd& prev_soln, BasicLinearSystem<Scalar>& sys);
+
+	/* Check whether device conductances moved since the last factorization */
+	bool conductances_moved() const;
+
+	/* Advance a circuit with no nonlinear devices by one timestep */
+	template <typename Scalar>
+	void step_linear(double dt, Eigen::VectorXd& soln,
+		Eigen::VectorXd& prev_soln, BasicLinearSystem<Scalar>& sys);
 };
 
 #endif /* _CIRCUIT_H_ */
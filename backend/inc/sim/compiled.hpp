@@ -0,0 +1,116 @@
+/**
+ *
+ * @file compiled.hpp
+ *
+ * @brief Provides the interface to compiled circuits: C++ generated for
+ * one particular circuit, built into a shared object and loaded at run
+ * time.
+ *
+ */
+
+#ifndef _COMPILED_H_
+#define _COMPILED_H_
+
+#include <Eigen/Dense>
+#include <stamp.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A circuit's MNA timestep, compiled ahead of time.
+ *
+ * `source` generates a translation unit that runs one timestep of newton's
+ * method for this circuit alone. Every stamp is written out as its own
+ * statement, with the ground node eliminated and the contributions of
+ * resistors, capacitors and sources to the LHS folded into constants. The
+ * LHS is factored by LU in an elimination order fixed when the code is
+ * generated (partial pivoting of the LHS at rest), unrolled over its
+ * nonzero pattern including fill-in. Linear circuits go one step further:
+ * their factors are constants, so each timestep is a single forward and
+ * back substitution. Should a pivot get too small for the fixed order,
+ * the timestep falls back to a dense QR factorization with column
+ * pivoting, which also copes with a singular LHS.
+ *
+ * `load` builds the source with the system compiler into a shared object
+ * and loads it with `dlopen`, caching the object under the netlist hash
+ * so that later runs skip the compiler.
+ *
+ * Newton's method runs as with the MNA method's defaults (a full jacobian
+ * on every iteration, starting from the last timestep's solution), except
+ * that timesteps are never split into substeps.
+ */
+class CompiledCircuit
+{
+public:
+
+	/** @brief Version of the interface between the simulator and generated
+	 * code, which is checked when a shared object is loaded */
+	static constexpr const int ABI_VERSION = 1;
+
+	/** @brief A pivot smaller than this fraction of the largest entry below
+	 * it makes a timestep fall back to partial pivoting */
+	static constexpr const double PIVOT_TOLERANCE = 1.0e-3;
+
+	/*
+	 * Description of the circuit, filled in by `Circuit::to_compiled`.
+	 */
+	const StampProgram *program;   /**< Circuit's devices */
+	int num_unknowns;              /**< Unknowns, including ground */
+	int ground;                    /**< Unknown index of the ground node */
+	double dt;                     /**< Timestep */
+	Eigen::RowVectorXd output;     /**< Output voltage from the solution */
+	double reltol;                 /**< Newton relative tolerance */
+	Eigen::VectorXd abs_tolerances;  /**< Newton tolerance of each unknown */
+	int max_iterations;            /**< Newton iterations per timestep */
+	int max_recoveries;            /**< Restarts after a solution blows up */
+	double min_damping;            /**< Heaviest damping of newton updates */
+
+	/* construct a compiled circuit with nothing loaded */
+	CompiledCircuit();
+
+	/* unload the shared object, if any */
+	~CompiledCircuit();
+
+	/* generate the translation unit for the circuit */
+	std::string source() const;
+
+	/* build (or find in the cache) and load the shared object */
+	bool load(const std::string& cache_dir, uint64_t netlist_hash);
+
+	/* zero out the state, as if the input had been silent */
+	void reset();
+
+	/* advance by one timestep */
+	double step(double u) { return step_fn(state.data(), u); }
+
+	/* run over a block of input samples */
+	void process(const float *in, float *out, size_t n) {
+		process_fn(state.data(), in, out, n);
+	}
+
+	/* get the newton counts since the last reset */
+	void counts(long *samples, long *iterations, long *failures,
+	            long *fallbacks) const;
+
+private:
+
+	void *handle;               /**< Shared object from `dlopen` */
+	std::vector<double> state;  /**< State of the generated code */
+
+	/*
+	 * Entry points of the generated code.
+	 */
+	void (*reset_fn)(double *state);
+	double (*step_fn)(double *state, double u);
+	void (*process_fn)(double *state, const float *in, float *out, size_t n);
+
+	/* build the source into a shared object with the system compiler */
+	bool build(const std::string& source, const std::string& path) const;
+
+	/* load a shared object, checking that it is compatible */
+	bool open(const std::string& path);
+};
+
+#endif /* _COMPILED_H_ */
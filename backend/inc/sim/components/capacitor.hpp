@@ -46,19 +46,27 @@ public:
 	/* map unknowns into matrix indices in a linear system */
 	void map_unknowns(std::unordered_map<std::string, int> mapping) override;
 
-	/* Adds resistor current contributions into system of KCL equations */
-	void add_contribution(LinearSystem& sys,
-			              Eigen::VectorXd& soln,
-		                  Eigen::VectorXd& prev_soln,
-		                  double dt) override;
+	/* Describe KCL contributions to a stamp program */
+	void compile(StampProgram& prog) override;
+
+	/** @brief Gets the capacitor's name in the netlist */
+	const std::string& get_name() const { return name; }
+
+	/** @brief Gets the capacitance in farads */
+	double get_capacitance() const { return capacitance; }
+
+	/** @brief Gets the capacitor's index among the stamp program's capacitors */
+	int get_device() const { return device; }
 
 private:
+	std::string name;    /**< Name in the netlist */
 	int npos;            /**< Positive terminal */
 	int nneg;            /**< Negative terminal */
 	double capacitance;  /**< Capacitance in farads */
 
 	int n1; /**< Matrix index for unknown npos voltage */
 	int n2; /**< Matrix index for unknown nneg voltage */
+	int device; /**< Index in the stamp program, once compiled */
 };
 
 #endif /* _CAPACITOR_H_ */
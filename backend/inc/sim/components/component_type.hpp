@@ -20,6 +20,8 @@
 #include <linsys.hpp>
 #include <unordered_map>
 
+class StampProgram;
+
 class Component
 {
 public:
@@ -48,20 +50,15 @@ public:
 	virtual std::vector<std::string> unknowns() { return {}; }
 
 	/**
-	 * @brief Adds the contributions of a component into the system of KCL
-	 * equations.
+	 * @brief Describes the component's KCL contributions to a stamp program,
+	 * which replays them each newton iteration.
 	 *
-	 * @param sys The system of equations.
-	 * @param prev_soln The solution from the previous newton iteration.
-	 * @param dt The signal sampling period.
+	 * Called once after `map_unknowns`, so the component's matrix indices
+	 * are already known.
 	 *
-	 * @bug This should eventually be made pure virtual.
+	 * @param prog The stamp program being built for the circuit.
 	 */
-	virtual void add_contribution(LinearSystem& sys,
-		                          Eigen::VectorXd& soln,
-		                          Eigen::VectorXd& prev_soln,
-		                          double dt)
-	{ }
+	virtual void compile(StampProgram& prog) { }
 
 	/**
 	 * @brief Maps the unknowns for a component to the correct indices
@@ -86,15 +83,16 @@ public:
 	static std::string unknown_voltage(int node_id);
 	/* Creates a label for an unknown branch current */
 	static std::string unknown_current(const std::string& name);
+	/* Checks whether a label is for an unknown branch current */
+	static bool is_current(const std::string& unknown);
 
-protected:
 	/* Given a string like "15k" converts it into an appropraite double
 	 * (i.e. 15k -> 15000.0) */
-	double parse_by_unit(const std::string& value);
+	static double parse_by_unit(const std::string& value);
 
 private:
 	/* maps supported unit types to scale factors */
-	double get_unit_scale(const std::string& unit);
+	static double get_unit_scale(const std::string& unit);
 };
 
 #endif /* _COMPONENT_TYPE_H_ */
@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <components/component.hpp>
 #include <linsys.hpp>
+#include <math.h>
 
 class Diode : public Component
 {
@@ -24,10 +25,84 @@ public:
     std::string to_string() override;
     std::vector<std::string> unknowns() override;
     void map_unknowns(std::unordered_map<std::string, int> mapping) override;
-    void add_contribution(LinearSystem& sys,
-                          Eigen::VectorXd& soln,
-                          Eigen::VectorXd& prev_soln,
-                          double dt) override;
+    void compile(StampProgram& prog) override;
+
+    /**
+     * @brief Evaluates the Shockley equation for the current through a diode
+     * and its derivative with respect to the voltage across it.
+     *
+     * @param v Voltage across the diode.
+     * @param is Saturation current.
+     * @param nvt_inv Reciprocal of the emission coefficient times the
+     * thermal voltage.
+     * @param i Filled in with the current through the diode.
+     * @param g Filled in with the diode's small signal conductance.
+     */
+    static inline void model(double v, double is, double nvt_inv,
+                             double *i, double *g) {
+        double e = exp(v * nvt_inv);
+        *i = is * (e - 1);
+        *g = is * e * nvt_inv;
+    }
+
+    /**
+     * @brief Linearizes a diode for newton's method.
+     *
+     * @param v Voltage across the diode at the current guess.
+     * @param vl Voltage to linearize about: `v`, once limited.
+     * @param is Saturation current.
+     * @param nvt_inv Reciprocal of the emission coefficient times the
+     * thermal voltage.
+     * @param g Filled in with the diode's small signal conductance at `vl`.
+     * @param r Filled in with the residual current of the linearization at
+     * `v`.
+     */
+    static inline void linearize(double v, double vl, double is,
+                                 double nvt_inv, double *g, double *r) {
+        double i;
+        model(vl, is, nvt_inv, &i, g);
+        *r = -(i + *g * (v - vl));
+    }
+
+    /**
+     * @brief Gets the voltage above which a diode's current grows so fast
+     * that newton updates to its voltage need to be limited.
+     *
+     * @param is Saturation current.
+     * @param nvt_inv Reciprocal of the emission coefficient times the
+     * thermal voltage.
+     */
+    static inline double critical_voltage(double is, double nvt_inv) {
+        return log(1.0 / (nvt_inv * M_SQRT2 * is)) / nvt_inv;
+    }
+
+    /**
+     * @brief Limits a newton update to a diode's voltage, SPICE style: above
+     * the critical voltage, the update is replaced by the (logarithmic)
+     * voltage change that gives the current the linearization predicted,
+     * rather than letting the exponential overflow.
+     *
+     * @param vnew Proposed voltage across the diode.
+     * @param vold Voltage the diode was last linearized about.
+     * @param nvt_inv Reciprocal of the emission coefficient times the
+     * thermal voltage.
+     * @param vcrit Critical voltage from `critical_voltage`.
+     *
+     * @return The limited voltage, which equals `vnew` if no limiting was
+     * needed.
+     */
+    static inline double limit(double vnew, double vold, double nvt_inv,
+                               double vcrit) {
+        double nvt = 1.0 / nvt_inv;
+        if (vnew <= vcrit || fabs(vnew - vold) <= 2 * nvt)
+            return vnew;
+        if (vold > 0) {
+            double arg = 1 + (vnew - vold) * nvt_inv;
+            return (arg > 0) ? vold + nvt * log(arg) : vcrit;
+        }
+        return nvt * log(vnew * nvt_inv);
+    }
+
 private:
     int npos;
     int nneg;
@@ -47,19 +47,27 @@ public:
 	/* map unknowns into matrix indices in a linear system */
 	void map_unknowns(std::unordered_map<std::string, int> mapping) override;
 
-	/* Adds resistor current contributions into system of KCL equations */
-	void add_contribution(LinearSystem& sys,
-		                  Eigen::VectorXd& soln,
-		                  Eigen::VectorXd& prev_soln,
-		                  double dt) override;
+	/* Describe KCL contributions to a stamp program */
+	void compile(StampProgram& prog) override;
+
+	/** @brief Gets the resistor's name in the netlist */
+	const std::string& get_name() const { return name; }
+
+	/** @brief Gets the resistance in ohms */
+	double get_resistance() const { return resistance; }
+
+	/** @brief Gets the resistor's index among the stamp program's resistors */
+	int get_device() const { return device; }
 
 private:
+	std::string name;     /**< Name of the resistor in the netlist */
 	int npos;             /**< Positive terminal of the resistor */
 	int nneg;             /**< Negative terminal of the resistor */
 	double resistance;    /**< Resistance in ohms */
 
 	int n1; /**< Matrix index for unknown npos voltage */
 	int n2; /**< Matrix index for unknown nneg voltage */
+	int device; /**< Index in the stamp program, once compiled */
 };
 
 #endif /* _RESISTOR_H_ */
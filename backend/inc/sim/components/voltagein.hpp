@@ -42,8 +42,22 @@ public:
 	 */
 	~VoltageIn() { }
 
-	/* Passes back the next voltage in the input signal */
-	bool next_voltage(double *V);
+	/* Reads the next block of voltages in the input signal */
+	size_t read_block(float *block, size_t n);
+
+	/* Gets the number of samples the input signal is best read in */
+	size_t block_size();
+
+	/* Flushes the output once the input signal has run out */
+	void finish();
+
+	/**
+	 * @brief Overrides the source's current voltage, without reading from
+	 * the input signal.
+	 *
+	 * @param voltage The new source voltage.
+	 */
+	void set_voltage(double voltage) { V = voltage; }
 
 	/* Convert a voltage input to a string */
 	std::string to_string() override;
@@ -53,11 +67,8 @@ public:
 	/* map unknowns into matrix indices in a linear system */
 	void map_unknowns(std::unordered_map<std::string, int> mapping) override;
 
-	/* Adds resistor current contributions into system of KCL equations */
-	void add_contribution(LinearSystem& sys,
-		                  Eigen::VectorXd& soln,
-		                  Eigen::VectorXd& prev_soln,
-		                  double dt) override;
+	/* Describe KCL contributions to a stamp program */
+	void compile(StampProgram& prog) override;
 
 	/* Gets the sampling period of input signal */
 	double get_sampling_period();
@@ -40,8 +40,11 @@ public:
 	/* Convert a voltage output to a string */
 	std::string to_string() override;
 
-	/* Measure the potential difference across output terminals */
-	double measure(LinearSystem& sys, Eigen::VectorXd& soln);
+	/* Get the potential difference across output terminals for a solution */
+	double voltage(const Eigen::VectorXd& soln);
+
+	/* Report a block of output voltages to the audio manager */
+	void write_block(const float *block, size_t n);
 
 	std::vector<std::string> unknowns() override;
 	/* map unknowns into matrix indices in a linear system */
@@ -0,0 +1,104 @@
+/**
+ *
+ * @file dk.hpp
+ *
+ * @brief Provides the interface to the nodal DK-method solver, which
+ * precomputes everything about a circuit's linear part so that newton's
+ * method only has to run over the voltages across its nonlinear devices.
+ *
+ */
+
+#ifndef _DK_H_
+#define _DK_H_
+
+#include <Eigen/Dense>
+#include <vector>
+
+class PortTable;
+
+/**
+ * @brief State space model of a circuit's linear part, with the currents
+ * through its k nonlinear devices (ports) as extra inputs:
+ *
+ *     v    = Dp s[n-1] + Ep u[n] - K i(v)
+ *     s[n] = A s[n-1]  + B u[n]  + Ci i(v)
+ *     y[n] = Cy s[n-1] + Dy u[n] + Fy i(v)
+ *
+ * where v holds the port voltages and i(v) the port currents. K is the
+ * Schur complement of the linear part onto the ports, so a circuit only has
+ * a model if its linear part is nonsingular. Each timestep
+ * solves the first equation for v with newton's method on a k x k system,
+ * after which the state and output follow directly. Since the solution only
+ * depends on the k port drives p = Dp s[n-1] + Ep u[n], it can also be looked
+ * up in a precomputed `PortTable` instead.
+ */
+struct DkModel {
+	Eigen::MatrixXd A;      /**< State transition matrix */
+	Eigen::VectorXd B;      /**< Input to state */
+	Eigen::MatrixXd Ci;     /**< Port currents to state */
+	Eigen::MatrixXd Dp;     /**< State to port voltages */
+	Eigen::VectorXd Ep;     /**< Input to port voltages */
+	Eigen::MatrixXd K;      /**< Port currents to port voltages */
+	Eigen::RowVectorXd Cy;  /**< State to output */
+	double Dy;              /**< Input to output */
+	Eigen::RowVectorXd Fy;  /**< Port currents to output */
+
+	std::vector<double> is;       /**< Saturation current of each port */
+	std::vector<double> nvt_inv;  /**< 1 / (N * VT) of each port */
+	std::vector<double> vcrit;    /**< Critical voltage of each port, above
+	                                   which newton updates are limited */
+
+	Eigen::VectorXd s;  /**< Current state */
+	Eigen::VectorXd v;  /**< Port voltages from the last timestep */
+	Eigen::VectorXd i;  /**< Port currents for the current guess */
+	Eigen::VectorXd g;  /**< Port conductances for the current guess */
+	Eigen::VectorXd p;  /**< Port drives for the current timestep */
+
+	long samples;     /**< Number of timesteps run */
+	long iterations;  /**< Total newton iterations across all timesteps */
+	long failures;    /**< Timesteps where newton's method did not converge */
+	long table_hits;  /**< Timesteps solved by interpolating in `table` */
+
+	/** @brief Optional table of port currents, consulted before newton */
+	const PortTable *table;
+
+	/** @brief Max number of newton iterations per timestep */
+	static constexpr const int MAX_ITERATIONS = 100;
+	/** @brief Port voltage update (in volts) below which newton stops */
+	static constexpr const double TOLERANCE = 1.0e-9;
+
+	/**
+	 * @brief Constructs an empty model, with no table attached.
+	 */
+	DkModel() : Dy(0.0), table(NULL) { }
+
+	/* get the number of states in the model */
+	int order() const { return A.rows(); }
+
+	/* get the number of nonlinear ports in the model */
+	int num_ports() const { return K.rows(); }
+
+	/* zero out the model's state and counters */
+	void reset();
+
+	/* advance the model by one sample */
+	double step(double u);
+
+	/* solve for the port voltages and currents given the port drives */
+	bool solve_ports(const Eigen::VectorXd& p);
+
+private:
+	/*
+	 * Scratch space sized by `reset`, so that stepping never allocates.
+	 */
+	Eigen::VectorXd f;       /**< Newton residual */
+	Eigen::VectorXd dv;      /**< Newton update */
+	Eigen::MatrixXd J;       /**< Newton jacobian */
+	Eigen::PartialPivLU<Eigen::MatrixXd> lu;  /**< Factorization of `J` */
+	Eigen::VectorXd s_next;  /**< State for the next timestep */
+
+	/* evaluate the port currents and conductances at the current guess */
+	void evaluate_ports();
+};
+
+#endif /* _DK_H_ */
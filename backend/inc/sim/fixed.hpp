@@ -0,0 +1,62 @@
+/**
+ *
+ * @file fixed.hpp
+ *
+ * @brief Provides the interface to fixed-size solvers, which factor and
+ * solve small linear systems whose size is known at compile time.
+ *
+ */
+
+#ifndef _FIXED_H_
+#define _FIXED_H_
+
+#include <Eigen/Dense>
+
+/**
+ * @brief A solver for systems with a fixed number of unknowns, of a given
+ * scalar type.
+ *
+ * Solvers are instantiated for every size from MIN_UNKNOWNS to
+ * MAX_UNKNOWNS, and `create` picks the one matching a system. Each keeps
+ * its LU factorization in a fixed-size matrix, so it never touches the
+ * heap, and its loops have constant trip counts that the compiler can
+ * unroll. Most circuits (everything in circuits/) are small enough for one.
+ *
+ * Factorization uses partial pivoting, which cannot cope with singular
+ * systems (e.g. floating nodes). `factor` reports those, so that the
+ * caller can fall back to a rank revealing factorization.
+ */
+template <typename Scalar>
+class BasicFixedSolver
+{
+public:
+
+	/** @brief Vector type of the systems the solver is built for */
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+	/** @brief Matrix type of the systems the solver is built for */
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+	/** @brief Smallest system a fixed-size solver is built for (a reduced
+	 * system may be down to a single node) */
+	static constexpr const int MIN_UNKNOWNS = 1;
+	/** @brief Largest system a fixed-size solver is built for */
+	static constexpr const int MAX_UNKNOWNS = 16;
+
+	virtual ~BasicFixedSolver() { }
+
+	/* factor the LHS, returning false if it is singular */
+	virtual bool factor(const Matrix& A) = 0;
+
+	/* solve against the last factorization */
+	virtual void solve(const Vector& B, Vector& x) const = 0;
+
+	/* create a solver for systems of a given size */
+	static BasicFixedSolver *create(int num_unknowns);
+};
+
+/** @brief Fixed-size solver in double precision */
+typedef BasicFixedSolver<double> FixedSolver;
+/** @brief Fixed-size solver in single precision */
+typedef BasicFixedSolver<float> FixedSolverF;
+
+#endif /* _FIXED_H_ */
@@ -0,0 +1,142 @@
+/**
+ *
+ * @file iir.hpp
+ *
+ * @brief Provides the interface to the filters that linear circuits can be
+ * compiled into. A circuit with no nonlinear devices is a discrete-time
+ * linear system once its reactive components are replaced by their companion
+ * models, so it can be run as an IIR filter whose cost only depends on the
+ * number of reactive components rather than the number of nodes.
+ *
+ */
+
+#ifndef _IIR_H_
+#define _IIR_H_
+
+#include <Eigen/Dense>
+#include <vector>
+
+/**
+ * @brief Discrete-time state space model of a single input, single output
+ * system, in the form
+ *
+ *     s[n] = A s[n-1] + B u[n]
+ *     y[n] = C s[n-1] + D u[n]
+ */
+struct StateSpace {
+	Eigen::MatrixXd A;     /**< State transition matrix */
+	Eigen::VectorXd B;     /**< Input to state */
+	Eigen::RowVectorXd C;  /**< State to output */
+	double D;              /**< Direct feedthrough from input to output */
+
+	Eigen::VectorXd s;     /**< Current state */
+	Eigen::VectorXd s_next;  /**< Scratch space for the next state */
+
+	/* get the number of states in the model */
+	int order() const { return A.rows(); }
+
+	/* zero out the model's state */
+	void reset();
+
+	/* advance the model by one sample */
+	double step(double u);
+};
+
+/**
+ * @brief Cascade of second order sections (biquads), each run in transposed
+ * direct form II.
+ *
+ * Section coefficients and state are kept in separate contiguous arrays
+ * (structure-of-arrays), one entry per section.
+ */
+class BiquadCascade
+{
+public:
+
+	/* construct a cascade from the poles and zeros of a state space model */
+	BiquadCascade(const StateSpace& ss);
+
+	/**
+	 * @brief Destroys a biquad cascade.
+	 */
+	~BiquadCascade() { }
+
+	/** @brief Whether the model could be factored into sections at all */
+	bool valid() const { return factored; }
+
+	/** @brief Gets the number of sections in the cascade */
+	int num_sections() const { return b0.size(); }
+
+	/* zero out the state of every section */
+	void reset();
+
+	/* run one sample through the cascade */
+	double process(double u);
+
+private:
+	bool factored;           /**< Whether factoring into sections succeeded */
+	double gain;             /**< Overall gain of the cascade */
+
+	std::vector<double> b0;  /**< Numerator coefficient of z^0 */
+	std::vector<double> b1;  /**< Numerator coefficient of z^-1 */
+	std::vector<double> b2;  /**< Numerator coefficient of z^-2 */
+	std::vector<double> a1;  /**< Denominator coefficient of z^-1 */
+	std::vector<double> a2;  /**< Denominator coefficient of z^-2 */
+	std::vector<double> z1;  /**< First delay element of each section */
+	std::vector<double> z2;  /**< Second delay element of each section */
+};
+
+/**
+ * @brief A linear circuit compiled into a filter. Runs as a biquad cascade
+ * when the model factors accurately, and as the state space model itself
+ * otherwise (e.g. for badly conditioned pole/zero sets).
+ */
+class IirFilter
+{
+public:
+
+	/* compile a state space model into a filter */
+	IirFilter(const StateSpace& ss);
+
+	/**
+	 * @brief Destroys a filter.
+	 */
+	~IirFilter() { }
+
+	/** @brief Whether the filter runs as a cascade of biquads */
+	bool uses_cascade() const { return use_cascade; }
+
+	/** @brief Gets the number of states in the underlying model */
+	int order() const { return ss.order(); }
+
+	/** @brief Gets the number of second order sections in the cascade */
+	int num_sections() const { return cascade.num_sections(); }
+
+	/* zero out the filter's state */
+	void reset();
+
+	/**
+	 * @brief Runs one sample through the filter.
+	 *
+	 * @param u The input sample.
+	 *
+	 * @return The output sample.
+	 */
+	double process(double u) {
+		return use_cascade ? cascade.process(u) : ss.step(u);
+	}
+
+private:
+	/** @brief Number of impulse response samples compared when validating
+	 * the cascade against the state space model */
+	static constexpr const int CHECK_SAMPLES = 512;
+	/** @brief Max error in the cascade's impulse response, relative to the
+	 * impulse response's peak */
+	static constexpr const double CHECK_TOLERANCE = 1.0e-6;
+
+	StateSpace ss;          /**< Model the filter was compiled from */
+	BiquadCascade cascade;  /**< Factored form of the model */
+	bool use_cascade;       /**< Whether the cascade matched the model */
+};
+
+#endif /* _IIR_H_ */
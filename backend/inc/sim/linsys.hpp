@@ -15,20 +15,160 @@
 #define _LINEAR_SYSTEM_H_
 
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <Eigen/SparseLU>
 #include <unordered_map>
 #include <stdio.h>
 #include <errors.hpp>
+#include <fixed.hpp>
+#include <reduce.hpp>
 #include <sstream>
 
+/**
+ * @brief What every linear system has in common, whatever scalar type it
+ * is solved in: the backends and precisions it can be built with.
+ */
+struct LinearSystemBase {
+
+	/** @brief Strategies that can be used to factor the system matrix */
+	typedef enum {
+		SOLVER_AUTO,    /**< Pick a backend based on the number of unknowns */
+		SOLVER_DENSE,   /**< Dense QR factorization of `A` */
+		SOLVER_SPARSE,  /**< Sparse LU of `S`, reusing the symbolic analysis */
+		SOLVER_FIXED,   /**< LU of `A` by a solver built for its size */
+	} solver_t;
+
+	/** @brief Scalar types the system can be assembled and solved in */
+	typedef enum {
+		PRECISION_DOUBLE,  /**< `double`, the default */
+		PRECISION_SINGLE,  /**< `float` */
+	} precision_t;
+
+	/** @brief Systems at least this large use the sparse backend in auto mode */
+	static constexpr const int SPARSE_MIN_UNKNOWNS = 32;
+
+	/* get the human readable name of a solver backend */
+	static const char *solver_name(solver_t solver);
+
+	/* get the human readable name of a precision */
+	static const char *precision_name(precision_t precision);
+
+	/* look up a precision by name */
+	static bool parse_precision(const char *name, precision_t *precision);
+};
+
+/**
+ * @brief Factorizations of a linear system's LHS, by the dense and sparse
+ * backends.
+ */
+template <typename Scalar>
+struct BasicFactorization {
+
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+	typedef Eigen::SparseMatrix<Scalar> SparseMatrix;
+
+	/** @brief Smallest ratio of a sparse LU pivot to the largest entry of
+	 * its column before the LHS is taken to be singular */
+	static constexpr const double PIVOT_TOLERANCE = 1.0e-6;
+
+	/** @brief Sparse LU factorization, whose ordering and fill pattern are
+	 * computed once and reused for as long as the pattern of the LHS holds */
+	Eigen::SparseLU<SparseMatrix, Eigen::COLAMDOrdering<int>> lu;
+
+	/** @brief Sparse LU factorization that keeps the order of the columns,
+	 * used when the LHS has already been put in a fill-reducing order */
+	Eigen::SparseLU<SparseMatrix, Eigen::NaturalOrdering<int>> ordered_lu;
+
+	/** @brief Whether `ordered_lu` is used in place of `lu` */
+	bool preordered;
+
+	/** @brief Dense QR factorization, used by the dense backend */
+	Eigen::ColPivHouseholderQR<Matrix> qr;
+
+	/** @brief Scratch space for solving against `qr` without allocating */
+	Vector work;
+
+	/** @brief Whether the sparse factorization failed and `qr` holds a
+	 * factorization of the sparse LHS instead */
+	bool sparse_fallback;
+
+	/* factor a dense LHS */
+	void factor(const Matrix& A);
+	/* factor a sparse LHS, redoing its symbolic analysis if need be */
+	void factor(const SparseMatrix& A, bool analyze);
+
+	/* solve against the last factorization */
+	void solve(const Vector& B, Vector& x, bool sparse);
+
+	/* solve against `qr` */
+	void qr_solve(const Vector& B, Vector& x);
+};
+
+/** @brief Factorizations of a system in double precision */
+typedef BasicFactorization<double> Factorization;
+
 /**
  * @brief Represents the system of linear equations Ax=B derived from
- * KCL that will be used to solve for unknowns in the circuit.
+ * KCL that will be used to solve for unknowns in the circuit, assembled
+ * and solved in a given scalar type.
  */
-struct LinearSystem {
+template <typename Scalar>
+struct BasicLinearSystem : LinearSystemBase {
+
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
 	int ground;         /**< Circuit's ground node */
-	Eigen::MatrixXd A;  /**< LHS matrix of system of linear equations */
-	Eigen::VectorXd x;  /**< Solution vector */
-	Eigen::VectorXd B;  /**< RHS vector of system of linear equations */
+	solver_t solver;    /**< Backend in use (never SOLVER_AUTO once built) */
+	Matrix A;           /**< LHS matrix of system of linear equations */
+	Vector x;           /**< Solution vector */
+	Vector B;           /**< RHS vector of system of linear equations */
+
+	/** @brief Sparse LHS matrix, used in place of `A` by the sparse backend */
+	Eigen::SparseMatrix<Scalar> S;
+
+	/** @brief Factorizations of `A` or `S` by the dense and sparse backends */
+	BasicFactorization<Scalar> factorization;
+
+	/** @brief Fixed-size solver, used by the fixed backend */
+	BasicFixedSolver<Scalar> *fixed;
+
+	/** @brief Whether the fixed-size factorization failed and
+	 * `factorization` holds a QR factorization of `A` instead */
+	bool fixed_fallback;
+
+	/** @brief Whether `lu` must redo its symbolic analysis before factoring */
+	bool pattern_changed;
+
+	/** @brief Reduction the system is solved in, or NULL to solve the
+	 * circuit's full system. `A`, `S` and the factorizations then only
+	 * cover the unknowns left in it, while `x` and `B` still cover every
+	 * unknown of the circuit */
+	const Reduction *reduction;
+
+	/** @brief LHS rows of the unknowns substituted by the reduction: the
+	 * node's KCL equation and the source's branch equation for each source */
+	Matrix substituted_rows;
+	/** @brief LHS columns of the substituted nodes, in the remaining rows */
+	Matrix substituted_cols;
+	/** @brief Row of `substituted_rows` (or column of `substituted_cols`)
+	 * holding each unknown, or -1 */
+	std::vector<int> substituted_row, substituted_col;
+
+	/** @brief RHS of the reduced system */
+	Vector reduced_B;
+	/** @brief Solution of the reduced system */
+	Vector reduced_x;
+
+	/*
+	 * Copy of the LHS taken by `save_lhs`, e.g. with only the linear
+	 * devices stamped, that `restore_lhs` starts the LHS over from.
+	 */
+	Matrix base_A;                 /**< Saved `A` */
+	Vector base_S;                 /**< Saved nonzeros of `S` */
+	Matrix base_substituted_rows;  /**< Saved `substituted_rows` */
+	Matrix base_substituted_cols;  /**< Saved `substituted_cols` */
 
 	/** @brief Maps the string representations of unknowns to their ids */
 	std::unordered_map<std::string, int> unknowns_map;
@@ -38,25 +178,47 @@ struct LinearSystem {
 	VectorXs unknown_labels; /**< Vector of unknown labels mapping to `x` */
 
 	/* construct a linear system */
-	LinearSystem(int num_unknowns, int ground_id,
-		std::unordered_map<std::string, int> unknowns);
+	BasicLinearSystem(int num_unknowns, int ground_id,
+		std::unordered_map<std::string, int> unknowns,
+		solver_t solver = SOLVER_AUTO, const Reduction *reduction = NULL);
 
 	/* destroy a linear system */
-	~LinearSystem() { }
+	~BasicLinearSystem() {
+		delete fixed;
+	}
 
 	/* Zero our a linear system */
 	void clear();
+	/* Zero out the RHS of a linear system, keeping the LHS */
+	void clear_rhs();
+
+	/* Save the LHS as it stands, to start over from later */
+	void save_lhs();
+	/* Reset the LHS to the one last saved, and zero out the RHS */
+	void restore_lhs();
 
 	/* get a string representation of the system */
 	std::string to_string();
 
 	/* solve the system of linear equations */
-	Eigen::VectorXd& solve();
+	Vector& solve();
+
+	/* factor the LHS of the system */
+	void factor();
+	/* solve for the current RHS using the last factorization of the LHS */
+	Vector& back_substitute();
+
+	/* check whether the last factorization found the LHS singular */
+	bool rank_deficient() const;
 
 	/* add component contributions to the LHS/RHS of the system */
 	void increment_lhs(int r, int c, double delta);
 	void increment_rhs(int r, double delta);
 
+	/* get the address of an entry in the LHS/RHS of the system */
+	Scalar *lhs_slot(int r, int c);
+	Scalar *rhs_slot(int r);
+
 	/**
 	 * @brief Writes a linear system to an output stream.
 	 *
@@ -65,10 +227,22 @@ struct LinearSystem {
 	 *
 	 * @return The updated output stream.
 	 */
-	friend std::ostream& operator<<(std::ostream& out, LinearSystem& sys) {
+	friend std::ostream& operator<<(std::ostream& out,
+		BasicLinearSystem& sys) {
+
 		out << sys.to_string();
 		return out;
 	}
+
+private:
+
+	/* solve against the last factorization of `A` or `S` */
+	void solve_factored(const Vector& rhs, Vector& soln);
 };
 
+/** @brief Linear system in double precision */
+typedef BasicLinearSystem<double> LinearSystem;
+/** @brief Linear system in single precision */
+typedef BasicLinearSystem<float> LinearSystemF;
+
 #endif
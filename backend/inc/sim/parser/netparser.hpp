@@ -96,6 +96,14 @@ public:
      * @return Internal circuit representation of the specified circuit.
      */
     Circuit& as_circuit() { return c; }
+
+    /**
+     * @brief Gets the audio manager for the signal given on the command line.
+     */
+    AudioManager *audio() { return am; }
+
+    /* Open another signal to run through the netlist's effect blocks */
+    AudioManager *open_signal(const char *sigfile, const char *outfile);
 private:
     Component *component_from_tokens(std::vector<std::string>& tokens);
     const char *input_signal_file;       /**< Filepath to input signal */
@@ -104,6 +112,7 @@ private:
     Circuit c;                           /**< Internal circuit representation */
 
     AudioManager *am;
+    std::vector<std::string> effect_blocks;  /**< Effects in the netlist */
 };
 
 #endif /* _NETPARSER_H_ */
@@ -0,0 +1,118 @@
+/**
+ *
+ * @file simplify.hpp
+ *
+ * @brief Provides the interface to netlist simplification, which strips
+ * redundant components and nodes out of a netlist before it is turned into
+ * a circuit.
+ *
+ */
+
+#ifndef _SIMPLIFY_H_
+#define _SIMPLIFY_H_
+
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief Rewrites the component lines of a netlist into an equivalent but
+ * smaller netlist, as seen from its output.
+ *
+ * The passes below are repeated until none of them changes anything:
+ *
+ *   - zero-ohm resistors are collapsed, joining the nodes at their ends
+ *   - resistors, capacitors and diodes with both ends on one node, which
+ *     carry no current, are dropped
+ *   - resistors (and capacitors) in parallel are merged into one
+ *   - resistors in series, through a node nothing else touches, are merged
+ *     into one, and the node between them goes away
+ *   - components dangling from a node nothing else touches, which carry no
+ *     current, are dropped
+ *
+ * Before any of them, every part of the circuit that only meets the rest at
+ * ground, and holds neither the input nor the output, is dropped: no
+ * current can flow between it and the rest, so it cannot affect the output.
+ *
+ * The terminals of the input and output are never removed, and neither is
+ * anything the caller asks to keep (e.g. components being swept). The
+ * components left keep the netlist's order and the name of the first
+ * component merged into them.
+ */
+class NetlistSimplifier
+{
+public:
+    /* create a simplifier for a netlist with the given ground node */
+    NetlistSimplifier(int ground_id);
+
+    /* keep a component as it is, whatever the passes would do to it */
+    void keep(const std::string& name);
+
+    /* simplify the tokenized component lines of a netlist */
+    std::vector<std::vector<std::string>> run(
+        const std::vector<std::vector<std::string>>& lines);
+
+    /** @brief Whether the last run changed the netlist at all */
+    bool changed() const { return components_after != components_before; }
+
+    /* print what the last run removed */
+    void report(std::ostream& out) const;
+
+private:
+    /**
+     * @brief A component line, as the passes see it.
+     */
+    struct Element {
+        std::vector<std::string> tokens;  /**< Tokens of the line */
+        std::string type;  /**< Component identifier, e.g. RESISTOR */
+        int n1;            /**< Node at the (+) terminal */
+        int n2;            /**< Node at the (-) terminal */
+        double value;      /**< Resistance or capacitance, if any */
+        bool device;       /**< Whether the line is a two terminal device
+                                this simplifier understands */
+        bool kept;         /**< Whether the passes must leave it alone */
+        bool removed;      /**< Whether a pass has removed it */
+        bool modified;     /**< Whether its nodes or value have changed */
+    };
+
+    /* whether an element may be merged or dropped */
+    bool removable(const Element& e) const;
+
+    /* whether an element is a resistor, capacitor or diode */
+    static bool passive(const Element& e);
+
+    /* the passes */
+    bool collapse_shorts();
+    bool drop_loops();
+    bool merge_parallel();
+    bool merge_series();
+    bool drop_dangling();
+    void drop_isolated();
+
+    /* the elements touching each node, counted once per terminal */
+    void incidence(std::vector<std::vector<int>>& touching,
+                   std::vector<bool>& observed) const;
+
+    /* count the nodes other than ground that live elements touch */
+    int count_nodes() const;
+
+    int ground_id;                          /**< Ground node */
+    std::unordered_set<std::string> keep_names;  /**< Components to keep */
+    std::vector<Element> elements;          /**< Lines being simplified */
+    int max_node;                           /**< Largest node number */
+
+    /*
+     * What the last run did.
+     */
+    int components_before, components_after;  /**< Component counts */
+    int nodes_before, nodes_after;             /**< Node counts */
+    int shorts;      /**< Zero-ohm resistors collapsed */
+    int loops;       /**< Components with both ends on one node */
+    int parallel;    /**< Components merged into one in parallel */
+    int series;      /**< Resistors merged into one in series */
+    int dangling;    /**< Components dangling from a node */
+    int isolated;    /**< Components cut off from the output */
+};
+
+#endif /* _SIMPLIFY_H_ */
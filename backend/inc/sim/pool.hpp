@@ -0,0 +1,81 @@
+/**
+ *
+ * @file pool.hpp
+ *
+ * @brief Provides the interface to the work pool, a fixed set of threads
+ * that run independent simulation tasks (e.g. rendering one file each).
+ *
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A work-stealing thread pool.
+ *
+ * Each worker has its own queue of tasks. Submitted tasks are dealt out to
+ * the queues in turn; a worker runs its own queue newest first, and once it
+ * runs dry it steals the oldest task from another worker's queue. Since
+ * tasks vary a lot in length (files of different lengths, circuits that
+ * need more newton iterations), this keeps every core busy until the last
+ * few tasks.
+ */
+class WorkPool
+{
+public:
+
+	/** @brief A task, which is told the index of the worker running it */
+	typedef std::function<void(int worker)> task_t;
+
+	/* start a pool of worker threads */
+	WorkPool(int workers = 0);
+
+	/* wait for every task, then stop the workers */
+	~WorkPool();
+
+	/** @brief Gets the number of worker threads */
+	int num_workers() const { return (int) threads.size(); }
+
+	/* queue a task to be run by some worker */
+	void submit(task_t task);
+
+	/* wait until every task submitted so far has run */
+	void wait();
+
+	/* get the number of threads to use by default */
+	static int default_workers();
+
+private:
+
+	/** @brief One worker's queue of tasks */
+	struct Queue {
+		std::mutex lock;           /**< Protects `tasks` */
+		std::deque<task_t> tasks;  /**< Tasks waiting to run */
+	};
+
+	std::vector<std::thread> threads;  /**< Worker threads */
+	std::vector<Queue*> queues;        /**< Queue of each worker */
+	int next_queue;                    /**< Queue the next task goes to */
+
+	std::mutex state_lock;             /**< Protects the counts below */
+	std::condition_variable wake;      /**< Signalled when tasks are queued */
+	std::condition_variable idle;      /**< Signalled when tasks run out */
+	int queued;    /**< Tasks sitting in queues */
+	int pending;   /**< Tasks submitted but not finished */
+	bool stopping; /**< Whether the workers should exit */
+
+	/* take a task from a worker's own queue, or steal one */
+	bool take(int worker, task_t& task);
+
+	/* run tasks until the pool stops */
+	void run(int worker);
+};
+
+#endif /* _POOL_H_ */
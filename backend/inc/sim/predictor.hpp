@@ -0,0 +1,73 @@
+/**
+ *
+ * @file predictor.hpp
+ *
+ * @brief Provides the interface to the newton predictor, which extrapolates
+ * the starting guess for each timestep from the last few accepted solutions.
+ *
+ */
+
+#ifndef _PREDICTOR_H_
+#define _PREDICTOR_H_
+
+#include <Eigen/Dense>
+#include <vector>
+
+/**
+ * @brief Extrapolates the starting guess for newton's method from the last
+ * few accepted solutions, so that most timesteps start close enough to
+ * converge in one or two iterations.
+ */
+class Predictor
+{
+public:
+
+	/** @brief Ways the starting guess can be extrapolated */
+	typedef enum {
+		PREDICT_NONE,        /**< Start from the previous solution */
+		PREDICT_POLYNOMIAL,  /**< Fit a polynomial through past solutions */
+		PREDICT_INPUT,       /**< Scale the last change by the input's */
+	} predictor_t;
+
+	/** @brief Most past solutions a predictor can remember */
+	static constexpr const int MAX_HISTORY = 4;
+
+	/* construct a predictor */
+	Predictor(predictor_t kind = PREDICT_NONE, int history = 3);
+
+	/**
+	 * @brief Destroys a predictor.
+	 */
+	~Predictor() { }
+
+	/* forget every past solution */
+	void reset(int num_unknowns);
+
+	/* fill in the starting guess for the next timestep */
+	void predict(double u, Eigen::VectorXd& guess) const;
+
+	/* record the solution accepted for a timestep */
+	void accept(double u, const Eigen::VectorXd& soln);
+
+	/* get a human readable name for a predictor */
+	static const char *predictor_name(predictor_t kind);
+
+private:
+	/** @brief Input steps smaller than this are too small to scale by */
+	static constexpr const double MIN_INPUT_STEP = 1.0e-9;
+
+	predictor_t kind;   /**< How the guess is extrapolated */
+	int history;        /**< Number of past solutions remembered */
+	int count;          /**< Number of past solutions recorded so far */
+	int newest;         /**< Slot holding the most recent solution */
+
+	std::vector<Eigen::VectorXd> solns;  /**< Ring of past solutions */
+	std::vector<double> inputs;          /**< Input for each past solution */
+
+	/* get the solution from `age` timesteps ago (0 is the most recent) */
+	const Eigen::VectorXd& past(int age) const {
+		return solns[(newest - age + history) % history];
+	}
+};
+
+#endif /* _PREDICTOR_H_ */
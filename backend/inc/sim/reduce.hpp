@@ -0,0 +1,95 @@
+/**
+ *
+ * @file reduce.hpp
+ *
+ * @brief Provides the interface to system reductions, which shrink and
+ * reorder a circuit's MNA system before it is solved.
+ *
+ */
+
+#ifndef _REDUCE_H_
+#define _REDUCE_H_
+
+#include <ostream>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Maps a circuit's unknowns onto the rows and columns of a smaller
+ * system, worked out once from the nonzero pattern of its LHS.
+ *
+ * Two kinds of unknowns are eliminated. The ground node's voltage is always
+ * zero, so its row and column are dropped. A voltage source with one
+ * terminal on ground fixes the voltage of its other terminal, so that
+ * node's update is known before the system is solved. Its column moves to
+ * the RHS, and the source's branch equation leaves the system with it.
+ * Since the branch current only appears in that node's KCL equation, that
+ * equation leaves too, and gives the current back after the solve.
+ *
+ * The remaining unknowns are reordered to keep the factors sparse: by
+ * approximate minimum degree (AMD) or reverse Cuthill-McKee (RCM), both on
+ * the symmetric pattern of the LHS.
+ */
+class Reduction
+{
+public:
+
+	/** @brief Orders the remaining unknowns can be put in */
+	typedef enum {
+		ORDER_NATURAL,  /**< Keep the order of the netlist */
+		ORDER_RCM,      /**< Reverse Cuthill-McKee: narrow the bandwidth */
+		ORDER_AMD,      /**< Approximate minimum degree: limit the fill */
+	} ordering_t;
+
+	/** @brief A grounded voltage source, whose node is substituted */
+	struct Substitution {
+		int node;    /**< Unknown of the voltage at its other terminal */
+		int branch;  /**< Unknown of its branch current */
+	};
+
+	int num_unknowns;    /**< Unknowns in the circuit, including ground */
+	int ground;          /**< Unknown of the ground node's voltage */
+	ordering_t ordering; /**< Order of the remaining unknowns */
+
+	/** @brief Row and column of each unknown in the reduced system, or -1
+	 * if it was eliminated */
+	std::vector<int> index;
+	/** @brief Unknown at each row and column of the reduced system */
+	std::vector<int> unknown;
+	/** @brief Sources whose node is substituted */
+	std::vector<Substitution> substitutions;
+
+	/** @brief Nonzeros in the factors of the reduced system (on its
+	 * symmetric pattern) in the netlist's order and in the chosen one */
+	long natural_fill, ordered_fill;
+
+	/* work out a reduction from the pattern of a circuit's LHS */
+	Reduction(int num_unknowns, int ground,
+		const std::vector<std::pair<int, int>>& pattern,
+		const std::vector<Substitution>& sources, ordering_t ordering);
+
+	/** @brief Gets the number of unknowns left in the reduced system */
+	int size() const { return unknown.size(); }
+
+	/* print how much smaller (and sparser) the system got */
+	void report(std::ostream& out) const;
+
+	/* get the human readable name of an ordering */
+	static const char *ordering_name(ordering_t ordering);
+
+private:
+
+	/* order the unknowns by reverse Cuthill-McKee */
+	static void order_rcm(const std::vector<std::vector<int>>& adj,
+		std::vector<int>& order);
+
+	/* order the unknowns by approximate minimum degree */
+	static void order_amd(const std::vector<std::vector<int>>& adj,
+		std::vector<int>& order);
+
+	/* count the nonzeros in the factors for an elimination order */
+	static long count_fill(const std::vector<std::vector<int>>& adj,
+		const std::vector<int>& order);
+};
+
+#endif /* _REDUCE_H_ */
@@ -0,0 +1,111 @@
+/**
+ *
+ * @file resample.hpp
+ *
+ * @brief Provides the interface to the oversampler, which lets a circuit run
+ * at a multiple of the audio sampling rate so that hard clipping circuits do
+ * not alias their harmonics back into the audible band.
+ *
+ */
+
+#ifndef _RESAMPLE_H_
+#define _RESAMPLE_H_
+
+#include <Eigen/Dense>
+#include <ostream>
+
+/**
+ * @brief Polyphase FIR resampler placed around a circuit: the input signal
+ * is upsampled by `factor` before it reaches the circuit's voltage input,
+ * and the output is decimated back to the audio rate after its voltage
+ * output.
+ *
+ * Both directions share one linear phase lowpass prototype of
+ * factor * taps + 1 coefficients, so the pair delays the signal by exactly
+ * `taps` audio samples.
+ *
+ * Each direction is one matrix-vector or dot product over contiguous
+ * history, which Eigen vectorizes with SSE (or AVX with `make NATIVE=1`).
+ */
+class Oversampler
+{
+public:
+
+	/** @brief Largest supported oversampling factor */
+	static constexpr const int MAX_FACTOR = 8;
+	/** @brief Default number of filter taps per polyphase branch */
+	static constexpr const int DEFAULT_TAPS = 32;
+	/** @brief Cutoff of the lowpass prototype, as a fraction of the audio
+	 * Nyquist frequency */
+	static constexpr const double CUTOFF = 0.95;
+	/** @brief Shape of the Kaiser window, which sets the stopband rejection
+	 * (about 80 dB) */
+	static constexpr const double KAISER_BETA = 8.0;
+
+	/**
+	 * @brief Constructs an oversampler that does not resample.
+	 */
+	Oversampler() : factor(1), taps(0) { reset(); }
+
+	/* choose the oversampling factor and filter taps per branch */
+	void configure(int factor, int taps);
+
+	/* clear all filter history and cost counters */
+	void reset();
+
+	/** @brief Gets the oversampling factor */
+	int get_factor() const { return factor; }
+
+	/** @brief Gets the number of filter taps per polyphase branch */
+	int get_taps() const { return taps; }
+
+	/** @brief Gets the delay through both filters, in audio samples */
+	int latency() const { return taps; }
+
+	/** @brief Whether the upsampled block of the last input is used up */
+	bool needs_input() const { return in_phase == factor; }
+
+	/* upsample the next audio sample into a block of `factor` samples */
+	void push_input(double x);
+
+	/** @brief Gets the next sample of the upsampled block */
+	double pop_input() { return up(in_phase++); }
+
+	/* collect a circuit output, decimating once a block is complete */
+	bool push_output(double v, double *y);
+
+	/** @brief Gets the total time spent resampling, in seconds */
+	double elapsed() const { return seconds; }
+
+	/* print how the cost of a run splits between resampling and the circuit */
+	void report(std::ostream& out, double total_seconds) const;
+
+private:
+
+	int factor;  /**< Oversampling factor */
+	int taps;    /**< Filter taps per polyphase branch */
+
+	/** @brief Upsampling branches: row j computes the j-th sample of each
+	 * block from the last taps + 1 inputs, oldest first */
+	Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+		branches;
+	/** @brief Lowpass prototype, which is symmetric */
+	Eigen::VectorXd h;
+
+	/** @brief Last taps + 1 inputs, stored twice so that they can always be
+	 * read as one contiguous window */
+	Eigen::VectorXd in_hist;
+	int in_pos;     /**< Position of the oldest input in `in_hist` */
+	Eigen::VectorXd up;  /**< Upsampled block of the last input */
+	int in_phase;   /**< Next sample of `up` to hand out */
+
+	/** @brief Last h.size() circuit outputs, stored twice like `in_hist` */
+	Eigen::VectorXd out_hist;
+	int out_pos;    /**< Position of the oldest output in `out_hist` */
+	int out_phase;  /**< Circuit outputs collected in the current block */
+
+	long inputs;    /**< Audio samples upsampled */
+	double seconds; /**< Total time spent resampling */
+};
+
+#endif /* _RESAMPLE_H_ */
@@ -7,10 +7,18 @@
 #ifndef _SIM_H_
 #define _SIM_H_
 
+#include <circuit.hpp>
+#include <alloc_audit.hpp>
 
 /**
  * @brief Struct used to store command line arguments to the simulator.
  */
+/** @brief Most signals that can be run through the circuit as one batch */
+#define MAX_SIGNALS 64
+
+/** @brief Most components that can be swept at once */
+#define MAX_SWEEPS 8
+
 typedef struct {
     const char *circuit_file;  /**< Path to circuit netlist */
     const char *signal_file;   /**< Input signal source */
@@ -18,6 +26,54 @@ typedef struct {
     bool live_output;          /**< Whether to play out the signal live */
     bool live_input;           /**< whether to use live audio input */
     const char *outfile;
+    const char *signal_files[MAX_SIGNALS]; /**< Every signal given, in order
+                                                (the first is `signal_file`) */
+    int num_signals;               /**< Number of signals given */
+    const char *outfiles[MAX_SIGNALS];     /**< Every output file given */
+    int num_outfiles;              /**< Number of output files given */
+    const char *inputs;            /**< Glob (or @list file) of signals to
+                                        render across the work pool */
+    const char *outdir;            /**< Directory pool renders are written
+                                        to, if any */
+    int jobs;                      /**< Worker threads in the pool, or 0 */
+    int lanes;                     /**< Signals each pool task batches */
+    const char *sweeps[MAX_SWEEPS];    /**< Component values to sweep */
+    int num_sweeps;                /**< Number of components swept */
+    int chunks;                    /**< Chunks to render one signal in at
+                                        once, or 0 */
+    double warmup;                 /**< Warm-up before each chunk (seconds),
+                                        or negative for the default */
+    bool verify_seams;             /**< Whether to check chunk seams against
+                                        a sequential render */
+    LinearSystem::solver_t solver; /**< Linear solver backend to use */
+    const char *precision;         /**< Precision overriding the netlist's,
+                                        if any */
+    bool precision_report;         /**< Whether to compare single against
+                                        double precision */
+    Reduction::ordering_t ordering; /**< Order of the reduced system's
+                                         unknowns */
+    bool no_reduce;                /**< Whether to solve the full MNA
+                                        system instead of a reduced one */
+    bool no_simplify;              /**< Whether to keep redundant components
+                                        in the netlist */
+    Circuit::method_t method;      /**< How the circuit should be run */
+    const char *table_cache;       /**< Directory to cache port tables in */
+    Predictor::predictor_t predictor; /**< How newton's method is started */
+    int predictor_history;         /**< Past solutions the predictor fits */
+    Circuit::newton_t newton;      /**< How newton treats the jacobian */
+    double chord_ratio;            /**< Conductance ratio forcing a refactor */
+    double reltol;                 /**< Newton relative tolerance */
+    double vntol;                  /**< Newton node voltage tolerance */
+    double abstol;                 /**< Newton branch current tolerance */
+    const char *integration;       /**< Integration method overriding the
+                                        netlist's, if any */
+    int oversample;                /**< Oversampling factor */
+    int oversample_taps;           /**< Resampling filter taps per branch */
+    int max_substeps;              /**< Most substeps per timestep */
+    double trtol;                  /**< Truncation error tolerance factor,
+                                        or negative for the default */
+    AllocAudit::audit_t alloc_audit; /**< What happens to heap allocations
+                                          after the first sample */
 } simparams_t;
 
 
@@ -0,0 +1,42 @@
+/**
+ *
+ * @file sink.hpp
+ *
+ * @brief Provides the interface to signal sinks, which receive the results
+ * of transient analysis a chunk at a time as they are produced.
+ *
+ */
+
+#ifndef _SINK_H_
+#define _SINK_H_
+
+#include <stddef.h>
+
+/**
+ * @brief Receives the input and output signals of a transient analysis as
+ * the analysis runs, instead of after it has finished, so that nothing has
+ * to hold on to the whole run.
+ *
+ * Chunks arrive in order and never overlap. The time of each sample is not
+ * passed along: sample `first + i` happens at (first + i) * dt.
+ */
+class SignalSink
+{
+public:
+
+	virtual ~SignalSink() { }
+
+	/**
+	 * @brief Takes the next chunk of the signals.
+	 *
+	 * @param first Index of the first sample of the chunk in the run.
+	 * @param dt Sampling period, in seconds.
+	 * @param in Input signal over the chunk.
+	 * @param out Output signal over the chunk, lined up with the input.
+	 * @param n Number of samples in the chunk.
+	 */
+	virtual void write(long first, double dt, const float *in,
+		const float *out, size_t n) = 0;
+};
+
+#endif /* _SINK_H_ */
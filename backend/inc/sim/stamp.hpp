@@ -0,0 +1,333 @@
+/**
+ *
+ * @file stamp.hpp
+ *
+ * @brief Provides the interface to stamp programs, a flattened form of the
+ * circuit's KCL contributions that is built once before analysis and then
+ * replayed on every newton iteration.
+ *
+ */
+
+#ifndef _STAMP_H_
+#define _STAMP_H_
+
+#include <Eigen/Dense>
+#include <linsys.hpp>
+#include <math.h>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A compiled list of matrix updates for every component in a circuit.
+ *
+ * Components describe themselves to the program once (see
+ * `Component::compile`), and are grouped by device type. Linking the program
+ * against a linear system resolves every stamp to the address of the entry
+ * it updates, dropping those that land in the ground row. Running the program
+ * then evaluates each group's coefficients and scatters them into the
+ * system without any virtual calls or ground checks.
+ */
+class StampProgram
+{
+public:
+
+	/** @brief How a stamp combines its coefficient with its target */
+	typedef enum {
+		STAMP_ADD,  /**< Add the coefficient to the target entry */
+		STAMP_SUB,  /**< Subtract the coefficient from the target entry */
+	} update_t;
+
+	/** @brief Integration methods capacitors can be discretized with */
+	typedef enum {
+		INTEGRATE_BE,    /**< Backward Euler: first order, damps highs */
+		INTEGRATE_TRAP,  /**< Trapezoidal rule: second order, no damping */
+		INTEGRATE_BDF2,  /**< Gear's second order backward difference */
+	} integration_t;
+
+	/** @brief Which devices to stamp when running the program */
+	typedef enum {
+		DEVICES_ALL,        /**< Every device in the circuit */
+		DEVICES_LINEAR,     /**< Resistors, capacitors and sources */
+		DEVICES_NONLINEAR,  /**< Diodes */
+	} devices_t;
+
+	/** @brief A single update to an entry of the LHS matrix or RHS vector
+	 * of a linear system solved in the given scalar type */
+	template <typename Scalar>
+	struct Stamp {
+		Scalar *slot;   /**< Entry of the linear system being updated */
+		int coeff;      /**< Index into the owning group's coefficients */
+		update_t kind;  /**< Whether the coefficient is added or subtracted */
+	};
+
+	/** @brief A group's stamps into the system it is linked against */
+	template <typename Scalar>
+	struct StampList {
+		std::vector<Stamp<Scalar>> lhs;  /**< Stamps into the LHS matrix */
+		std::vector<Stamp<Scalar>> rhs;  /**< Stamps into the RHS vector */
+	};
+
+	/**
+	 * @brief Stamps and coefficients shared by every device group.
+	 * Coefficients are always evaluated in double precision. Only the
+	 * stamps into the linked system, of whichever precision it is in, are
+	 * filled in; they round the coefficients as they store them.
+	 */
+	struct Group {
+		std::vector<double> lhs_coeffs;  /**< Coefficients of LHS stamps */
+		std::vector<double> rhs_coeffs;  /**< Coefficients of RHS stamps */
+		StampList<double> stamps;        /**< Stamps into a double precision
+		                                      system */
+		StampList<float> single_stamps;  /**< Stamps into a single precision
+		                                      system */
+
+		/* scatter the group's coefficients into the linear system */
+		void apply();
+		/* scatter only the group's RHS coefficients */
+		void apply_rhs();
+	};
+
+	/** @brief Two terminal devices, stamped like a conductance */
+	struct TwoTerminalGroup : Group {
+		std::vector<int> n1;  /**< Unknown index of (+) terminal voltages */
+		std::vector<int> n2;  /**< Unknown index of (-) terminal voltages */
+	};
+
+	/** @brief Resistors, whose LHS coefficients never change */
+	struct ResistorGroup : TwoTerminalGroup {
+		std::vector<double> g;  /**< Conductances in siemens */
+		void evaluate(const Eigen::VectorXd& guess);
+	};
+
+	/**
+	 * @brief Capacitors, as companion models: a conductance in parallel
+	 * with a history current source, both set by the integration method.
+	 *
+	 * Backward Euler only needs the voltage across each capacitor at the
+	 * last timestep, which the last solution already holds. The other
+	 * methods also carry one history value per capacitor between
+	 * timesteps: the current through it at the last timestep (trapezoidal)
+	 * or the voltage across it two timesteps ago (BDF2).
+	 */
+	struct CapacitorGroup : TwoTerminalGroup {
+		integration_t method;       /**< Integration method */
+		std::vector<double> c;      /**< Capacitances in farads */
+		std::vector<double> aux;    /**< History carried between timesteps */
+		std::vector<double> hist;   /**< History current this timestep */
+		std::vector<double> vlast;  /**< Voltage at the last timestep */
+		std::vector<double> ilast;  /**< Current at the last timestep */
+		double step;       /**< Timestep the models were evaluated for */
+		double last_step;  /**< Last accepted timestep (0 after a reset) */
+		void evaluate(const Eigen::VectorXd& soln,
+		              const Eigen::VectorXd& guess, double dt);
+		void accept(const Eigen::VectorXd& soln);
+		double truncation_ratio(const Eigen::VectorXd& soln, double reltol,
+		                        double chgtol) const;
+
+		/*
+		 * The formulas behind a single capacitor, shared with batched
+		 * circuits, which run them in each lane.
+		 */
+
+		/** @brief Ratio of a timestep to the last accepted one, or 1 if
+		 * there was none */
+		static inline double step_ratio(double dt, double last_step) {
+			return (last_step > 0) ? dt / last_step : 1.0;
+		}
+
+		/**
+		 * @brief Computes a capacitor's companion model (see `evaluate`).
+		 *
+		 * @param method The integration method.
+		 * @param c The capacitance.
+		 * @param dt The timestep.
+		 * @param w Ratio of the timestep to the last one (`step_ratio`).
+		 * @param v1 Voltage across the capacitor at the last timestep.
+		 * @param aux History carried from the last timestep.
+		 * @param geq Filled in with the companion conductance.
+		 * @param hist Filled in with the history current.
+		 */
+		static inline void companion(integration_t method, double c,
+		                             double dt, double w, double v1,
+		                             double aux, double *geq, double *hist) {
+			switch (method) {
+				case INTEGRATE_TRAP:
+					*geq = 2 * c / dt;
+					*hist = *geq * v1 + aux;
+					break;
+				case INTEGRATE_BDF2:
+					*geq = (c / dt) * (1 + 2 * w) / (1 + w);
+					*hist = (c / dt) *
+					        ((1 + w) * v1 - w * w / (1 + w) * aux);
+					break;
+				default:
+					*geq = c / dt;
+					*hist = *geq * v1;
+					break;
+			}
+		}
+
+		/** @brief Gets the history a capacitor carries into the next
+		 * timestep, once its current `i` and last voltage `v1` are known */
+		static inline double carry(integration_t method, double i, double v1,
+		                           double aux) {
+			if (method == INTEGRATE_TRAP)
+				return i;
+			if (method == INTEGRATE_BDF2)
+				return v1;
+			return aux;
+		}
+
+		/**
+		 * @brief Gets a capacitor's local truncation error over its
+		 * tolerance (see `truncation_ratio`).
+		 *
+		 * @param step The timestep.
+		 * @param c The capacitance.
+		 * @param v Voltage across the capacitor at the end of the timestep.
+		 * @param v1 Voltage across it at the start of the timestep.
+		 * @param i Current through it at the end of the timestep.
+		 * @param i1 Current through it at the start of the timestep.
+		 * @param reltol Tolerance on its charge, relative to the larger of
+		 * its charge at the start and end of the timestep.
+		 * @param chgtol Absolute tolerance on its charge, in coulombs.
+		 */
+		static inline double truncation(double step, double c, double v,
+		                                 double v1, double i, double i1,
+		                                 double reltol, double chgtol) {
+			double error = step / 2 * fabs(i - i1);
+			double charge = c * fmax(fabs(v), fabs(v1));
+			return error / (reltol * charge + chgtol);
+		}
+	};
+
+	/** @brief Diodes, linearized about the current newton guess (with
+	 * their voltages limited, see `Diode::limit`) */
+	struct DiodeGroup : TwoTerminalGroup {
+		std::vector<double> is;       /**< Saturation currents */
+		std::vector<double> nvt_inv;  /**< 1 / (N * VT) */
+		std::vector<double> vcrit;    /**< Critical voltages for limiting */
+		std::vector<double> vj;       /**< Voltages last linearized about */
+		bool limited;                 /**< Whether the last evaluation had
+		                                   to limit any voltage */
+		void evaluate(const Eigen::VectorXd& guess);
+	};
+
+	/** @brief Independent voltage sources with a branch current unknown */
+	struct SourceGroup : Group {
+		std::vector<int> n1;  /**< Unknown index of (+) terminal voltages */
+		std::vector<int> n2;  /**< Unknown index of (-) terminal voltages */
+		std::vector<int> ni;  /**< Unknown index of branch currents */
+		std::vector<const double *> V;  /**< Source voltages */
+		void evaluate(const Eigen::VectorXd& guess);
+	};
+
+	/* construct an empty stamp program */
+	StampProgram() {
+		diodes.limited = false;
+		capacitors.method = INTEGRATE_BE;
+		capacitors.step = 0.0;
+		capacitors.last_step = 0.0;
+		base_valid = false;
+		base_step = 0.0;
+		base_last_step = 0.0;
+	}
+
+	/* destroy a stamp program */
+	~StampProgram() { }
+
+	/* add devices to the program, returning their index in their group */
+	int add_resistor(int n1, int n2, double resistance);
+	int add_capacitor(int n1, int n2, double capacitance);
+	void add_diode(int n1, int n2, double is, double n, double vt);
+	void add_source(int n1, int n2, int ni, const double *V);
+
+	/* resolve every stamp against the entries of a linear system */
+	template <typename Scalar>
+	void link(BasicLinearSystem<Scalar>& sys);
+
+	/* list the (row, column) of every LHS entry the program stamps */
+	void lhs_pattern(std::vector<std::pair<int, int>>& entries) const;
+
+	/* stamp devices into the (cleared) linear system */
+	void run(const Eigen::VectorXd& soln, const Eigen::VectorXd& guess,
+	         double dt, devices_t devices = DEVICES_ALL);
+
+	/* stamp every device, restamping the LHS of only the nonlinear ones
+	 * while the linear ones' saved LHS still holds */
+	template <typename Scalar>
+	void run_cached(const Eigen::VectorXd& soln, const Eigen::VectorXd& guess,
+	                double dt, BasicLinearSystem<Scalar>& sys);
+
+	/* stamp only the RHS contributions of devices */
+	void run_rhs(const Eigen::VectorXd& soln, const Eigen::VectorXd& guess,
+	             double dt, devices_t devices = DEVICES_ALL);
+
+	/** @brief Gets the program's nonlinear devices */
+	const DiodeGroup& nonlinear_devices() const { return diodes; }
+
+	/** @brief Gets the program's resistors */
+	const ResistorGroup& resistor_devices() const { return resistors; }
+
+	/** @brief Gets the program's capacitors */
+	const CapacitorGroup& capacitor_devices() const { return capacitors; }
+
+	/** @brief Gets the program's voltage sources */
+	const SourceGroup& source_devices() const { return sources; }
+
+	/** @brief Whether the last run had to limit a nonlinear device's
+	 * voltage, in which case newton's method has not converged yet */
+	bool limited() const { return diodes.limited; }
+
+	/* linearize nonlinear devices about a solution on their next run */
+	void reset_junctions(const Eigen::VectorXd& soln);
+
+	/* check whether running at a guess would limit a nonlinear device */
+	bool would_limit(const Eigen::VectorXd& guess) const;
+
+	/* choose the integration method capacitors are discretized with */
+	void set_integration(integration_t method);
+
+	/** @brief Gets the integration method capacitors are discretized with */
+	integration_t integration() const { return capacitors.method; }
+
+	/* get the number of history values carried between timesteps */
+	int num_history() const;
+
+	/* start history as if the circuit had been resting at a solution */
+	void reset_history(const Eigen::VectorXd& soln);
+
+	/* advance history once a timestep's solution has been accepted */
+	void accept(const Eigen::VectorXd& soln);
+
+	/* estimate the local truncation error of the timestep just solved */
+	double truncation_ratio(const Eigen::VectorXd& soln, double reltol,
+	                        double chgtol) const;
+
+	/* get or overwrite the history carried between timesteps */
+	void get_history(Eigen::VectorXd& history) const;
+	void set_history(const Eigen::VectorXd& history);
+
+	/* get the human readable name of an integration method */
+	static const char *integration_name(integration_t method);
+
+	/* look up an integration method by name */
+	static bool parse_integration(const char *name, integration_t *method);
+
+private:
+	ResistorGroup resistors;    /**< Every resistor in the circuit */
+	CapacitorGroup capacitors;  /**< Every capacitor in the circuit */
+	DiodeGroup diodes;          /**< Every diode in the circuit */
+	SourceGroup sources;        /**< Every voltage source in the circuit */
+
+	/*
+	 * What the LHS saved by `run_cached` was stamped for. It only holds the
+	 * linear devices, whose coefficients only change with the timestep (and
+	 * for BDF2, the one before it).
+	 */
+	bool base_valid;        /**< Whether the linked system has a saved LHS */
+	double base_step;       /**< Timestep it was stamped for */
+	double base_last_step;  /**< Last timestep, if BDF2 depends on it */
+};
+
+#endif /* _STAMP_H_ */
@@ -0,0 +1,93 @@
+/**
+ *
+ * @file sweep.hpp
+ *
+ * @brief Provides the interface to component sweeps, which render one
+ * input signal through many variants of a circuit, each with different
+ * resistor and capacitor values.
+ *
+ */
+
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#include <parser/netparser.hpp>
+#include <audio_manager.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Sweeps resistor and capacitor values over the grid of every
+ * combination of their values.
+ *
+ * The netlist is parsed once and the input is decoded into memory once.
+ * Variants are then run as the lanes of batches (see `BatchCircuit`),
+ * which all read the same input, and the batches are spread across a
+ * `WorkPool`. Each variant's output can be written to its own file, and
+ * its RMS level, peak level and spectral centroid are summarized at the
+ * end.
+ */
+class Sweep
+{
+public:
+
+	/** @brief Length of the frames the spectral centroid is measured over */
+	static constexpr const int SPECTRUM_SIZE = 2048;
+
+	/** @brief Values one component takes across the sweep */
+	struct Axis {
+		std::string name;            /**< Name of the component */
+		std::vector<double> values;  /**< Values in ohms or farads */
+	};
+
+	/** @brief Measurements of one variant's output */
+	struct Metrics {
+		double rms;       /**< RMS level in volts */
+		double peak;      /**< Largest absolute level in volts */
+		double centroid;  /**< Spectral centroid in hertz */
+	};
+
+	/* parse an axis from a specification like "R2=1k:100k:32log" */
+	static bool parse_axis(const std::string& spec, Axis *axis);
+
+	/* add an axis to the sweep */
+	void add_axis(const Axis& axis) { axes.push_back(axis); }
+
+	/* get the number of variants the axes combine into */
+	int num_variants() const;
+
+	/* get the value a variant gives one axis's component */
+	double value(int variant, int axis) const;
+
+	/* render the input through every variant */
+	void run(NetlistParser& parser, AudioManager *input, const char *outdir,
+	         int jobs, int lanes);
+
+	/* print the metrics of every variant as a table */
+	void report(std::ostream& out, char separator = ' ') const;
+
+private:
+
+	/** @brief The device an axis changes in the stamp program */
+	struct Target {
+		bool resistor;  /**< Whether it is a resistor or a capacitor */
+		int device;     /**< Index among the program's devices of its kind */
+	};
+
+	std::vector<Axis> axes;        /**< Components being swept */
+	std::vector<Target> targets;   /**< Device each axis changes */
+	std::vector<Metrics> metrics;  /**< Metrics of each variant */
+
+	/* find the device each axis changes */
+	void resolve(NetlistParser& parser);
+
+	/* render a range of variants as the lanes of one batch */
+	void render(Circuit& c, const std::vector<float>& input, double dt,
+	            const char *outdir, int first, int last);
+
+	/* name the file a variant is written to */
+	std::string output_path(const char *outdir, int variant) const;
+};
+
+#endif /* _SWEEP_H_ */
@@ -0,0 +1,151 @@
+/**
+ *
+ * @file table.hpp
+ *
+ * @brief Provides the interface to precomputed port tables, which store the
+ * solution of a DK model's nonlinear equation over a grid of port drives so
+ * that transient analysis can interpolate instead of running newton's method.
+ *
+ */
+
+#ifndef _TABLE_H_
+#define _TABLE_H_
+
+#include <dk.hpp>
+#include <Eigen/Dense>
+#include <stdint.h>
+#include <cmath>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Port currents of a DK model, tabulated on a uniform grid and
+ * interpolated multilinearly in between.
+ *
+ * The port drives p = Dp s + Ep u can only reach the column space of
+ * [Dp Ep], which often has fewer dimensions than there are ports (e.g. two
+ * antiparallel diodes always see the same voltage), so the grid runs over
+ * coordinates z = P^T p in an orthonormal basis P of that space. The currents
+ * for every port are stored together at each grid point, with the first
+ * coordinate varying fastest, so a lookup touches 2^m nearby runs of k
+ * contiguous values.
+ */
+class PortTable
+{
+public:
+
+	/**
+	 * @brief Constructs an empty table.
+	 */
+	PortTable() : ports(0), dims(0), points(0), lo(0.0), inv_step(0.0),
+		error(0.0), coverage(0.0) { }
+
+	/**
+	 * @brief Destroys a table.
+	 */
+	~PortTable() { }
+
+	/* solve a DK model's nonlinear equation over the whole grid */
+	bool build(const DkModel& dk);
+
+	/* read a table built for a DK model back from disk */
+	bool load(const std::string& path, const DkModel& dk);
+
+	/* write the table to disk */
+	bool save(const std::string& path) const;
+
+	/* hash the contents of a file (e.g. a netlist) to key cached tables */
+	static uint64_t hash_file(const char *path);
+
+	/** @brief Whether the table has been built or loaded */
+	bool valid() const { return ports > 0; }
+
+	/** @brief Gets the number of dimensions of the grid */
+	int num_dims() const { return dims; }
+
+	/** @brief Gets the number of grid points along each dimension */
+	int points_per_dim() const { return points; }
+
+	/** @brief Gets the largest error in the port voltages, found by checking
+	 * the table against newton's method at the center of every cell */
+	double error_bound() const { return error; }
+
+	/** @brief Gets the fraction of grid points that could be solved */
+	double solved_fraction() const { return coverage; }
+
+	/**
+	 * @brief Interpolates the port currents for a set of port drives.
+	 *
+	 * @param p The port drives.
+	 * @param i Filled in with the port currents.
+	 *
+	 * @return True if the drives are within the solved part of the table
+	 * and false otherwise, in which case `i` is clobbered.
+	 */
+	bool lookup(const Eigen::VectorXd& p, Eigen::VectorXd& i) const {
+		double frac[MAX_DIMS];
+		int base = 0;
+
+		for (int d = 0; d < dims; d++) {
+			double x = (basis.col(d).dot(p) - lo) * inv_step;
+			if (!(x >= 0.0 && x < points - 1))
+				return false;
+			int cell = (int) x;
+			frac[d] = x - cell;
+			base += cell * stride[d];
+		}
+
+		i.setZero();
+		for (int corner = 0; corner < (1 << dims); corner++) {
+			double w = 1.0;
+			int at = base;
+			for (int d = 0; d < dims; d++) {
+				if (corner & (1 << d)) {
+					w *= frac[d];
+					at += stride[d];
+				} else {
+					w *= 1.0 - frac[d];
+				}
+			}
+			const double *corner_values = &values[at * ports];
+			for (int j = 0; j < ports; j++)
+				i(j) += w * corner_values[j];
+		}
+
+		/* unsolved grid points are NaN, which poisons any cell using them */
+		return !std::isnan(i.sum());
+	}
+
+private:
+	/** @brief Largest number of grid dimensions a table is built for */
+	static constexpr const int MAX_DIMS = 3;
+	/** @brief Max number of grid points in a table */
+	static constexpr const int MAX_POINTS = 1 << 16;
+	/** @brief Tables cover coordinates in [-RANGE, RANGE] volts */
+	static constexpr const double RANGE = 10.0;
+	/** @brief Pivots of [Dp Ep] smaller than this (relative to the largest)
+	 * do not contribute a grid dimension */
+	static constexpr const double RANK_TOLERANCE = 1.0e-9;
+
+	int ports;               /**< Number of ports in the model */
+	int dims;                /**< Number of grid dimensions */
+	int points;              /**< Grid points along each dimension */
+	int stride[MAX_DIMS];    /**< Distance between grid points along each
+	                              dimension */
+	Eigen::MatrixXd basis;   /**< Orthonormal basis of reachable drives */
+	double lo;               /**< Coordinate at the first grid point */
+	double inv_step;         /**< 1 / spacing between grid points */
+	double error;            /**< Error bound, in volts */
+	double coverage;         /**< Fraction of grid points solved */
+
+	std::vector<double> key;     /**< Model parameters the table solves */
+	std::vector<double> values;  /**< Port currents at each grid point */
+
+	/* set up the grid for a DK model */
+	bool layout(const DkModel& dk);
+
+	/* collect the model parameters that determine the table's contents */
+	static std::vector<double> model_key(const DkModel& dk);
+};
+
+#endif /* _TABLE_H_ */
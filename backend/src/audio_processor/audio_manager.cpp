@@ -9,11 +9,13 @@
 
 #include <audio_manager.hpp>
 #include <fileInput.hpp>
+#include <alloc_audit.hpp>
 #include <iostream>
 #include <assert.h>
 #include <errors.hpp>
 #include <vector>
 #include <string>
+#include <algorithm>
 
 using std::string;
 using std::vector;
@@ -40,6 +42,9 @@ static int callBack(const void *inputBuffer, void *outputBuffer,
 
 	float total;
 
+	/* the callback must never allocate */
+	AllocAudit::arm();
+
 
 	if (data->in) {
 		AudioManager::buffer b;
@@ -51,7 +56,7 @@ static int callBack(const void *inputBuffer, void *outputBuffer,
 			}
 			b.buf[i] = (total / ((float) NUM_CHANNELS));
 		}
-		data->hw_input_buf.push(b); //TODO: Emplace? push?
+		data->hw_input_buf.push(b);
 		data->num_frames += framesPerBuffer;
 		cv.notify_one();
 	}
@@ -66,6 +71,7 @@ static int callBack(const void *inputBuffer, void *outputBuffer,
 		}
 	}
 
+	AllocAudit::disarm();
 	return !data->done  ? 0 : paComplete;
 }
 
@@ -117,27 +123,45 @@ static PaStream* portaudio_init_hw(AudioManager::callback_data *data) {
  *                              API functions                               *
  ****************************************************************************/
 
-float AudioManager::apply_effects(float val, vector<string> effects) {
+float AudioManager::apply_effects(float val) {
 
 	for (auto it = effects.begin(); it < effects.end(); ++it) {
-		if (*it == "REVERB") {
-			val = reverb.apply(val);
-		} else if (*it == "FUZZ") {
-			val = fuzz.apply(val);
-		} else if (*it == "DELAY" ) {
-			val = delay.apply(val);
-		} else if (*it == "DISTORTION" ) {
-			val = distortion.apply(val);
-		} else if (*it == "AMPLIFY") {
-			val = amplify.apply(val);
-		} else {
-			sim_error("invalid pre-effect\n");
+		switch (*it) {
+			case EFFECT_REVERB:     val = reverb.apply(val); break;
+			case EFFECT_FUZZ:       val = fuzz.apply(val); break;
+			case EFFECT_DELAY:      val = delay.apply(val); break;
+			case EFFECT_DISTORTION: val = distortion.apply(val); break;
+			case EFFECT_AMPLIFY:    val = amplify.apply(val); break;
 		}
 	}
 
 	return val;
 }
 
+/* runs a whole block through each effect in turn */
+void AudioManager::apply_effects(float *buf, size_t n) {
+
+	for (auto it = effects.begin(); it < effects.end(); ++it) {
+		switch (*it) {
+			case EFFECT_REVERB:
+				for (size_t i = 0; i < n; i++) buf[i] = reverb.apply(buf[i]);
+				break;
+			case EFFECT_FUZZ:
+				for (size_t i = 0; i < n; i++) buf[i] = fuzz.apply(buf[i]);
+				break;
+			case EFFECT_DELAY:
+				for (size_t i = 0; i < n; i++) buf[i] = delay.apply(buf[i]);
+				break;
+			case EFFECT_DISTORTION:
+				for (size_t i = 0; i < n; i++) buf[i] = distortion.apply(buf[i]);
+				break;
+			case EFFECT_AMPLIFY:
+				for (size_t i = 0; i < n; i++) buf[i] = amplify.apply(buf[i]);
+				break;
+		}
+	}
+}
+
 AudioManager::AudioManager(input_t input_mode, output_t output_mode,
 			 const char *input_filename, const char *output_filename,
 			 filetype_t infile_type,
@@ -149,7 +173,23 @@ AudioManager::AudioManager(input_t input_mode, output_t output_mode,
 	data->out = false;
 	data->done = false;
 	this->output_mode = output_mode;
-	effects = effect_blocks;
+
+	/* look the effects up once, rather than on every sample */
+	for (auto it = effect_blocks.begin(); it < effect_blocks.end(); ++it) {
+		if (*it == "REVERB") {
+			effects.push_back(EFFECT_REVERB);
+		} else if (*it == "FUZZ") {
+			effects.push_back(EFFECT_FUZZ);
+		} else if (*it == "DELAY" ) {
+			effects.push_back(EFFECT_DELAY);
+		} else if (*it == "DISTORTION" ) {
+			effects.push_back(EFFECT_DISTORTION);
+		} else if (*it == "AMPLIFY") {
+			effects.push_back(EFFECT_AMPLIFY);
+		} else {
+			sim_error("invalid pre-effect\n");
+		}
+	}
 
 	/* initialize input */
 	/* TODO: Support hardware modes things */
@@ -210,27 +250,40 @@ bool AudioManager::file_get_next_value(double *val) {
 }
 
 bool AudioManager::hw_get_next_value(double *val) {
+	float x;
 
-	/* wait until there is data to read */
-	static std::unique_lock<std::mutex> lk(m);
+	hw_get_next_block(&x, 1);
+	*val = (double) x;
 
-	cv.wait(lk, [this]{return !(data->num_frames_read >= data->num_frames);});
-	// std::cout << "Hey\n";
-	// while (data->num_frames_read >= data->num_frames) {
-	// 	printf(".\n");
-	// }
+	return true;
+}
 
-	*val = (double) data->hw_input_buf.front().buf[data->input_index++];
+size_t AudioManager::hw_get_next_block(float *buf, size_t n) {
+	size_t count = 0;
 
-	data->input_index = data->input_index % HW_FRAMES_PER_BUFFER;
+	while (count < n) {
+		/* wait until there is data to read */
+		std::unique_lock<std::mutex> lk(m);
+		cv.wait(lk, [this]{return !(data->num_frames_read >= data->num_frames);});
+		lk.unlock();
 
-	if (data->input_index == 0) {
-		data->hw_input_buf.pop();
-	}
+		/* copy out as much of the front buffer as is needed */
+		size_t chunk = std::min(n - count,
+		                        (size_t) (HW_FRAMES_PER_BUFFER - data->input_index));
+		memcpy(buf + count, data->hw_input_buf.front().buf + data->input_index,
+		       chunk * sizeof(float));
+		count += chunk;
 
-	data->num_frames_read++;
+		data->input_index = (data->input_index + chunk) % HW_FRAMES_PER_BUFFER;
 
-	return true;
+		if (data->input_index == 0) {
+			data->hw_input_buf.pop();
+		}
+
+		data->num_frames_read += chunk;
+	}
+
+	return count;
 }
 
 bool AudioManager::get_next_value(double *val) {
@@ -245,7 +298,7 @@ bool AudioManager::get_next_value(double *val) {
 		assert(false);
 	}
 
-	*val = (float) apply_effects((float) *val, effects);
+	*val = (float) apply_effects((float) *val);
 
 	if (stop_simulation) return false;
 	return ret;
@@ -260,7 +313,7 @@ void AudioManager::hw_set_next_value(double val) {
 	temp_out_buffer.buf[output_index++] = (float) val;
 
 	if (output_index == HW_FRAMES_PER_BUFFER) {
-		data->hw_output_buf.emplace(temp_out_buffer);
+		data->hw_output_buf.push(temp_out_buffer);
 		output_index = 0;
 	}
 }
@@ -270,6 +323,48 @@ void AudioManager::set_next_value(double val) {
 	if (output_mode & OUTPUT_HARDWARE) hw_set_next_value(val);
 }
 
+size_t AudioManager::get_next_block(float *buf, size_t n) {
+
+	size_t count;
+
+	if (input_mode == INPUT_FILE)
+		count = in->get_next_block(buf, n);
+	else if (input_mode == INPUT_HARDWARE) {
+		count = hw_get_next_block(buf, n);
+	} else {
+		assert(false);
+	}
+
+	apply_effects(buf, count);
+
+	if (stop_simulation) return 0;
+	return count;
+}
+
+size_t AudioManager::read_all(std::vector<float>& buf) {
+
+	std::vector<float> block(get_block_size());
+	size_t got;
+	buf.clear();
+
+	do {
+		got = get_next_block(block.data(), block.size());
+		buf.insert(buf.end(), block.begin(), block.begin() + got);
+	} while (got == block.size());
+
+	return buf.size();
+}
+
+void AudioManager::set_next_block(const float *buf, size_t n) {
+	if ((output_mode & OUTPUT_FILE) && fout != NULL)
+		fout->set_next_block(buf, n);
+
+	if (output_mode & OUTPUT_HARDWARE) {
+		for (size_t i = 0; i < n; i++)
+			hw_set_next_value(buf[i]);
+	}
+}
+
 void AudioManager::finish() {
 	printf("in finish\n");
 	printf("fout is %p\n", fout);
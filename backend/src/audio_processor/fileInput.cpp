@@ -10,69 +10,69 @@
 
 #include <fileInput.hpp>
 #include <sndfile.h>
-#include <sndfile.hh>
 #include <iostream>
-#include <fstream>
-#include <string>
+#include <algorithm>
 
 using std::ifstream;
 using std::string;
 
 FileInput::FileInput(const char *filename, AudioManager::filetype_t file_type) {
 
-	if (file_type == AudioManager::FILETYPE_WAV) {
-		SndfileHandle file;
-		file = SndfileHandle(filename);
-
-		num_frames = file.frames();
-		samplerate = file.samplerate();
+	this->file_type = file_type;
+	cur_index = 0;
 
-		channels = file.channels();
-		frames.resize(num_frames*channels);
-		int n = file.read(&frames.front(), channels*num_frames);
+	if (file_type == AudioManager::FILETYPE_WAV) {
+		wav = SndfileHandle(filename);
 
-		cur_index = 0;
+		num_frames = wav.frames();
+		samplerate = wav.samplerate();
+		channels = wav.channels();
+		chunk.resize(CHUNK_FRAMES * channels);
 	}
 	else if (file_type == AudioManager::FILETYPE_TXT) {
-		ifstream file(filename);
-		string line;
+		txt.open(filename);
 
-		getline(file, line);
+		getline(txt, line);
 		samplerate = (int) (1.f / stod(line));
 		channels = 1;
 
-		while (getline(file, line)) {
-			frames.push_back(stod(line));
-		}
-
-		num_frames = frames.size();
-		cur_index = 0;
-		channels = 1;
+		/* the frames are not counted up front, that would mean reading the
+		 * whole file twice */
+		num_frames = 0;
 	}
 }
 
-void FileInput::save(const char *filename) {
-
-	FILE* outfile = fopen(filename, "w");
-	for (auto it = frames.begin(); it < frames.end(); it++) {
-		fprintf(outfile, "%f,", *it);
-	}
-	fclose(outfile);
-}
-
 bool FileInput::get_next_value(float *val) {
-	if (cur_index >= num_frames) {
-		return false;
-	}
-	float tmp = 0.f;
-	float inv = 1.f / channels;
-	for (int i = 0; i < channels; i++) {
-		tmp += inv * frames[cur_index++];
-	}
-	*val = tmp;
-	return true;
+	return get_next_block(val, 1) == 1;
 }
 
+size_t FileInput::get_next_block(float *buf, size_t n) {
+	size_t count = 0;
 
+	if (file_type == AudioManager::FILETYPE_TXT) {
+		while (count < n && getline(txt, line))
+			buf[count++] = stod(line);
+	}
+	else {
+		n = std::min(n, (size_t) (num_frames - cur_index));
+		float inv = 1.f / channels;
+		while (count < n) {
+			sf_count_t want = std::min(n - count, (size_t) CHUNK_FRAMES);
+			sf_count_t got = wav.readf(chunk.data(), want);
+			if (got <= 0)
+				break;
+
+			/* mix the channels of each frame down to one */
+			for (sf_count_t f = 0; f < got; f++) {
+				float tmp = 0.f;
+				for (int i = 0; i < channels; i++) {
+					tmp += inv * chunk[f * channels + i];
+				}
+				buf[count++] = tmp;
+			}
+		}
+	}
 
-
+	cur_index += count;
+	return count;
+}
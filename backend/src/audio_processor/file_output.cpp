@@ -1,8 +1,8 @@
 /**
  * @file file_output.cpp
  * 
- * @brief conatins the implementation for FileOutput, which stores and saves
- * audio data.
+ * @brief conatins the implementation for FileOutput, which saves audio
+ * data as it is produced.
  * 
  * @author Joseph Kim
  * 
@@ -11,9 +11,11 @@
 #include <file_output.hpp>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 
 /**
- * @brief Constructs the FileOutput object.
+ * @brief Constructs the FileOutput object, creating the file and writing
+ * its header with room left for the frame count.
  *
  * @param filename The filename to create.
  * @param samplerate The samplerate of the audio data.
@@ -24,23 +26,33 @@ FileOutput::FileOutput(const char *filename, int samplerate) {
 	this->samplerate = samplerate;
 	this->num_frames = 0;
 
+	outfile.open(filename, std::ios::out);
+	if (outfile.is_open()) {
+		outfile << samplerate << "\n";
+		count_pos = outfile.tellp();
+		outfile << std::setw(COUNT_WIDTH) << 0 << "\n";
+	}
+
 }
 
 void FileOutput::set_next_value(float val) {
-	frames.push_back(val);
+	outfile << val << ",";
 	num_frames++;
 }
 
-void FileOutput::finish() {
+void FileOutput::set_next_block(const float *buf, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		outfile << buf[i] << ",";
+	}
+	num_frames += n;
+}
 
-	std::ofstream outfile (filename, std::ios::out);
+void FileOutput::finish() {
 
 	if (outfile.is_open()) {
-		outfile << samplerate << "\n";
-		outfile << num_frames << "\n";
-
-		for (int i = 0; i < num_frames; i++) {
-			outfile << frames[i] << ",";
-		}
+		/* the count is right aligned, so readers skip the padding */
+		outfile.seekp(count_pos);
+		outfile << std::setw(COUNT_WIDTH) << num_frames;
+		outfile.close();
 	}
 }
@@ -0,0 +1,139 @@
+/**
+ *
+ * @file alloc_audit.cpp
+ *
+ * @brief This file contains the implementation of the allocation audit,
+ * including the malloc hooks it is built with.
+ *
+ */
+
+#include <alloc_audit.hpp>
+#include <atomic>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** @brief What happens to audited allocations */
+static volatile AllocAudit::audit_t audit_mode = AllocAudit::AUDIT_OFF;
+
+/** @brief Number of audited allocations so far */
+static std::atomic<long> audited(0);
+
+/** @brief Whether the calling thread has armed the audit */
+static thread_local bool armed = false;
+
+#ifdef CSIM_ALLOC_AUDIT
+
+/*
+ * The hooks below replace the C library's allocation entry points (which C++
+ * operator new and Eigen both go through) and forward to glibc's own
+ * implementations, so they only work on glibc.
+ */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+/**
+ * @brief Records an allocation if the calling thread has armed the audit.
+ * This runs inside malloc, so it must not allocate itself.
+ */
+static void audit_allocation() {
+	if (!armed || audit_mode == AllocAudit::AUDIT_OFF)
+		return;
+
+	audited++;
+	if (audit_mode == AllocAudit::AUDIT_ABORT) {
+		static const char msg[] = "[FATAL SIMULATOR ERROR]: "
+		                          "Heap allocation in the audio path.\n";
+		armed = false;
+		if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) { }
+		abort();
+	}
+}
+
+extern "C" void *malloc(size_t size) __THROW {
+	audit_allocation();
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) __THROW {
+	audit_allocation();
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW {
+	audit_allocation();
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) __THROW {
+	audit_allocation();
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) __THROW {
+	audit_allocation();
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment,
+	size_t size) __THROW {
+
+	audit_allocation();
+	*ptr = __libc_memalign(alignment, size);
+	return (*ptr == NULL) ? ENOMEM : 0;
+}
+
+#endif /* CSIM_ALLOC_AUDIT */
+
+/**
+ * @brief Gets whether the simulator was built with the malloc hooks, i.e.
+ * with `make ALLOC_AUDIT=1`.
+ */
+bool AllocAudit::supported() {
+#ifdef CSIM_ALLOC_AUDIT
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * @brief Selects what happens to allocations made while the audit is armed.
+ *
+ * @param mode The audit mode.
+ */
+void AllocAudit::set_mode(audit_t mode) {
+	audit_mode = mode;
+}
+
+/**
+ * @brief Gets what happens to allocations made while the audit is armed.
+ */
+AllocAudit::audit_t AllocAudit::get_mode() {
+	return audit_mode;
+}
+
+/**
+ * @brief Starts auditing allocations made by the calling thread.
+ */
+void AllocAudit::arm() {
+	armed = true;
+}
+
+/**
+ * @brief Stops auditing allocations made by the calling thread.
+ */
+void AllocAudit::disarm() {
+	armed = false;
+}
+
+/**
+ * @brief Gets the number of allocations made while the audit was armed.
+ */
+long AllocAudit::allocations() {
+	return audited;
+}
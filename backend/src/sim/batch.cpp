@@ -0,0 +1,993 @@
+/**
+ *
+ * @file batch.cpp
+ *
+ * @brief This file contains the implementation of batched circuits, which
+ * run the MNA method over several independent signals at once.
+ *
+ */
+
+#include <batch.hpp>
+#include <alloc_audit.hpp>
+#include <components/component.hpp>
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+
+using std::vector;
+using Eigen::ArrayXd;
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+typedef StampProgram::CapacitorGroup CapacitorGroup;
+
+/**
+ * @brief Adds a stamp to a scatter.
+ *
+ * @param entry Column of the entry being updated.
+ * @param coeff Column of the coefficient added into it.
+ * @param sign +1 to add the coefficient or -1 to subtract it.
+ */
+void BatchCircuit::Scatter::add(int entry, int coeff, double sign) {
+	this->entry.push_back(entry);
+	this->coeff.push_back(coeff);
+	this->sign.push_back(sign);
+}
+
+/**
+ * @brief Adds every stamp's coefficients into its target entry, in every
+ * lane at once.
+ *
+ * @param coeffs The group's coefficients.
+ * @param target The LHS or RHS being stamped.
+ */
+void BatchCircuit::Scatter::apply(const Lanes& coeffs, Lanes& target) const {
+	for (int i = 0; i < (int) entry.size(); i++)
+		target.col(entry[i]) += sign[i] * coeffs.col(coeff[i]);
+}
+
+/**
+ * @brief Constructs a batch of lanes that run a circuit. The circuit must
+ * have all of its components registered, and should not be changed while
+ * the batch is running.
+ *
+ * @param circuit The circuit.
+ * @param lanes The number of lanes (independent signals) to run at once.
+ */
+BatchCircuit::BatchCircuit(Circuit& circuit, int lanes)
+	: circuit(circuit), lanes(lanes), n(0), running(false), step_dt(0.0),
+	  resistors(circuit.program.resistor_devices()),
+	  capacitors(circuit.program.capacitor_devices()),
+	  diodes(circuit.program.nonlinear_devices()),
+	  sources(circuit.program.source_devices()),
+	  ground_entry(0) {
+
+	int nr = resistors.g.size();
+	int nc = capacitors.c.size();
+	conductances = Lanes::Zero(lanes, nr);
+	capacitances = Lanes::Zero(lanes, nc);
+	for (int k = 0; k < nr; k++)
+		conductances.col(k).setConstant(resistors.g[k]);
+	for (int k = 0; k < nc; k++)
+		capacitances.col(k).setConstant(capacitors.c[k]);
+}
+
+/**
+ * @brief Destroys a batch, along with any state set up by `start`.
+ */
+BatchCircuit::~BatchCircuit() {
+	stop();
+}
+
+/**
+ * @brief Changes the resistance of one resistor in one lane, e.g. to sweep
+ * its value across the lanes. Takes effect the next time the batch is
+ * started.
+ *
+ * @param lane The lane.
+ * @param device The resistor's index in the stamp program (see
+ * `Resistor::get_device`).
+ * @param resistance The resistance in ohms.
+ */
+void BatchCircuit::set_resistance(int lane, int device, double resistance) {
+	conductances(lane, device) = 1.0 / resistance;
+}
+
+/**
+ * @brief Changes the capacitance of one capacitor in one lane. Takes effect
+ * the next time the batch is started.
+ *
+ * @param lane The lane.
+ * @param device The capacitor's index in the stamp program (see
+ * `Capacitor::get_device`).
+ * @param capacitance The capacitance in farads.
+ */
+void BatchCircuit::set_capacitance(int lane, int device, double capacitance) {
+	capacitances(lane, device) = capacitance;
+}
+
+/**
+ * @brief Lays out where each device group's coefficients are added into the
+ * system, the same way `StampProgram::link` does, with every equation moved
+ * to the row `row_at` assigns it. Stamps into the ground equation are
+ * dropped.
+ */
+void BatchCircuit::link() {
+	Group *twos[3] = { &res, &caps, &dio };
+	const StampProgram::TwoTerminalGroup *devs[3] = {
+		&resistors, &capacitors, &diodes
+	};
+	int ground = fallbacks[0]->ground;
+
+	/* stamp a conductance between each device's terminals */
+	for (int g = 0; g < 3; g++) {
+		Group& grp = *twos[g];
+		grp.lhs = Scatter();
+		grp.rhs = Scatter();
+
+		for (int k = 0; k < (int) devs[g]->n1.size(); k++) {
+			int n1 = devs[g]->n1[k];
+			int n2 = devs[g]->n2[k];
+			if (n1 != ground) {
+				grp.lhs.add(row_at[n1] * n + n1, k, +1.0);
+				grp.lhs.add(row_at[n1] * n + n2, k, -1.0);
+				grp.rhs.add(row_at[n1], k, +1.0);
+			}
+			if (n2 != ground) {
+				grp.lhs.add(row_at[n2] * n + n2, k, +1.0);
+				grp.lhs.add(row_at[n2] * n + n1, k, -1.0);
+				grp.rhs.add(row_at[n2], k, -1.0);
+			}
+		}
+	}
+
+	/* sources add a branch equation and a branch current */
+	src.lhs = Scatter();
+	src.rhs = Scatter();
+	for (int k = 0; k < (int) sources.n1.size(); k++) {
+		int n1 = sources.n1[k];
+		int n2 = sources.n2[k];
+		int ni = sources.ni[k];
+		if (ni != ground) {
+			src.lhs.add(row_at[ni] * n + n1, k, +1.0);
+			src.lhs.add(row_at[ni] * n + n2, k, -1.0);
+			src.rhs.add(row_at[ni], 2 * k, +1.0);
+		}
+		if (n1 != ground) {
+			src.lhs.add(row_at[n1] * n + ni, k, -1.0);
+			src.rhs.add(row_at[n1], 2 * k + 1, +1.0);
+		}
+		if (n2 != ground) {
+			src.lhs.add(row_at[n2] * n + ni, k, +1.0);
+			src.rhs.add(row_at[n2], 2 * k + 1, -1.0);
+		}
+	}
+
+	ground_entry = row_at[ground] * n + ground;
+}
+
+/**
+ * @brief Computes the current through each resistor in every lane.
+ *
+ * @param next The solution from the previous newton iteration.
+ */
+void BatchCircuit::evaluate_resistors(const Lanes& next) {
+	for (int k = 0; k < (int) resistors.g.size(); k++) {
+		res.rhs_coeffs.col(k) = conductances.col(k) *
+			(next.col(resistors.n2[k]) - next.col(resistors.n1[k]));
+	}
+}
+
+/**
+ * @brief Computes the companion model of each capacitor in every lane, for
+ * the lane's own timestep in `step` (see
+ * `StampProgram::CapacitorGroup::evaluate`).
+ *
+ * @param prev The solution from the previous timestep.
+ * @param next The solution from the previous newton iteration.
+ */
+void BatchCircuit::evaluate_capacitors(const Lanes& prev, const Lanes& next) {
+	for (int k = 0; k < (int) capacitors.c.size(); k++) {
+		int n1 = capacitors.n1[k];
+		int n2 = capacitors.n2[k];
+
+		for (int l = 0; l < lanes; l++) {
+			double geq;
+			double v1 = prev(l, n1) - prev(l, n2);
+			double w = CapacitorGroup::step_ratio(step(l), last_step(l));
+			CapacitorGroup::companion(capacitors.method, capacitances(l, k),
+			                          step(l), w, v1, aux(l, k), &geq,
+			                          &hist(l, k));
+
+			vlast(l, k) = v1;
+			caps.lhs_coeffs(l, k) = geq;
+			caps.rhs_coeffs(l, k) = hist(l, k) -
+			                        geq * (next(l, n1) - next(l, n2));
+		}
+	}
+}
+
+/**
+ * @brief Linearizes each diode about the current guess in every lane that
+ * is still taking newton updates, limiting voltages first like
+ * `StampProgram::DiodeGroup::evaluate`. Lanes that have stopped keep the
+ * voltages they were last linearized about.
+ *
+ * @param next The solution from the previous newton iteration.
+ */
+void BatchCircuit::evaluate_diodes(const Lanes& next) {
+	limited.setConstant(false);
+
+	for (int k = 0; k < (int) diodes.is.size(); k++) {
+		int n1 = diodes.n1[k];
+		int n2 = diodes.n2[k];
+		double nvt_inv = diodes.nvt_inv[k];
+
+		for (int l = 0; l < lanes; l++) {
+			double v = next(l, n1) - next(l, n2);
+			if (active(l)) {
+				double lim = Diode::limit(v, vj(l, k), nvt_inv,
+				                          diodes.vcrit[k]);
+				limited(l) = limited(l) || (lim != v);
+				vj(l, k) = lim;
+			}
+			Diode::linearize(v, vj(l, k), diodes.is[k], nvt_inv,
+			                 &dio.lhs_coeffs(l, k), &dio.rhs_coeffs(l, k));
+		}
+	}
+}
+
+/**
+ * @brief Computes the branch equation residual and current of each source
+ * in every lane. The circuit's only source is its voltage input, which
+ * takes each lane's own input voltage.
+ *
+ * @param next The solution from the previous newton iteration.
+ */
+void BatchCircuit::evaluate_sources(const Lanes& next) {
+	for (int k = 0; k < (int) sources.n1.size(); k++) {
+		src.rhs_coeffs.col(2 * k) = u -
+			(next.col(sources.n1[k]) - next.col(sources.n2[k]));
+		src.rhs_coeffs.col(2 * k + 1) = next.col(sources.ni[k]);
+	}
+}
+
+/**
+ * @brief Stamps every lane's system for the current guess, over each lane's
+ * timestep in `step`.
+ *
+ * @param prev The solution from the previous timestep.
+ * @param next The solution from the previous newton iteration.
+ * @param lhs Whether to restamp the LHS too, or only the RHS.
+ */
+void BatchCircuit::run_kcl(const Lanes& prev, const Lanes& next, bool lhs) {
+	evaluate_resistors(next);
+	evaluate_capacitors(prev, next);
+	evaluate_sources(next);
+	if (diodes.is.size() > 0)
+		evaluate_diodes(next);
+
+	Group *groups[4] = { &res, &caps, &src, &dio };
+
+	B.setZero();
+	for (Group *grp : groups)
+		grp->rhs.apply(grp->rhs_coeffs, B);
+
+	if (lhs) {
+		A.setZero();
+		A.col(ground_entry).setConstant(1.0);
+		for (Group *grp : groups)
+			grp->lhs.apply(grp->lhs_coeffs, A);
+	}
+}
+
+/**
+ * @brief Factors every lane's LHS into `LU`, using the row order shared by
+ * every lane. The pivots are stored inverted, so that the substitutions
+ * only multiply.
+ *
+ * Any lane that meets a pivot smaller than PIVOT_TOLERANCE times the
+ * largest entry below it would lose accuracy without row swaps, so it is
+ * factored by its fallback system instead.
+ */
+void BatchCircuit::factor() {
+	LU = A;
+	pivoted.setConstant(false);
+
+	for (int k = 0; k < n; k++) {
+		int kk = k * n + k;
+
+		/* check each lane's pivot against the rest of its column */
+		colmax = LU.col(kk).abs();
+		for (int i = k + 1; i < n; i++)
+			colmax = colmax.max(LU.col(i * n + k).abs());
+		pivoted = pivoted || (LU.col(kk).abs() <= PIVOT_TOLERANCE * colmax);
+
+		LU.col(kk) = LU.col(kk).inverse();
+		for (int i = k + 1; i < n; i++) {
+			int ik = i * n + k;
+			if ((LU.col(ik) == 0.0).all())
+				continue;
+
+			LU.col(ik) *= LU.col(kk);
+			for (int j = k + 1; j < n; j++)
+				LU.col(i * n + j) -= LU.col(ik) * LU.col(k * n + j);
+		}
+	}
+
+	/* factor lanes with poor pivots one at a time, with pivoting */
+	for (int l = 0; l < lanes; l++) {
+		if (!pivoted(l))
+			continue;
+
+		LinearSystem& sys = *fallbacks[l];
+		for (int r = 0; r < n; r++) {
+			for (int c = 0; c < n; c++)
+				sys.A(r, c) = A(l, row_at[r] * n + c);
+		}
+		sys.factor();
+	}
+}
+
+/**
+ * @brief Solves every lane's system against its RHS with the last
+ * factorization, filling in `x`.
+ */
+void BatchCircuit::solve() {
+	x = B;
+
+	/* forward substitution through L, whose diagonal is all ones */
+	for (int i = 1; i < n; i++) {
+		for (int j = 0; j < i; j++)
+			x.col(i) -= LU.col(i * n + j) * x.col(j);
+	}
+
+	/* back substitution through U */
+	for (int i = n - 1; i >= 0; i--) {
+		for (int j = i + 1; j < n; j++)
+			x.col(i) -= LU.col(i * n + j) * x.col(j);
+		x.col(i) *= LU.col(i * n + i);
+	}
+
+	for (int l = 0; l < lanes; l++) {
+		if (!pivoted(l))
+			continue;
+
+		LinearSystem& sys = *fallbacks[l];
+		for (int r = 0; r < n; r++)
+			sys.B(r) = B(l, row_at[r]);
+		x.row(l) = sys.back_substitute().transpose().array();
+	}
+}
+
+/**
+ * @brief Makes one lane's diodes linearize about a solution the next time
+ * they are evaluated.
+ *
+ * @param lane The lane.
+ * @param at The solution.
+ */
+void BatchCircuit::reset_junctions(int lane, const Lanes& at) {
+	for (int k = 0; k < (int) diodes.is.size(); k++)
+		vj(lane, k) = at(lane, diodes.n1[k]) - at(lane, diodes.n2[k]);
+}
+
+/**
+ * @brief Checks whether evaluating one lane's diodes at a guess would limit
+ * any of their voltages (see `StampProgram::would_limit`).
+ *
+ * @param lane The lane.
+ * @param at The guess, for that lane alone.
+ *
+ * @return True if any diode would be limited and false otherwise.
+ */
+bool BatchCircuit::would_limit(int lane, const VectorXd& at) const {
+	for (int k = 0; k < (int) diodes.is.size(); k++) {
+		double v = at(diodes.n1[k]) - at(diodes.n2[k]);
+		if (Diode::limit(v, vj(lane, k), diodes.nvt_inv[k],
+		                 diodes.vcrit[k]) != v)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Applies one lane's newton update to its guess, checking it against
+ * the same tolerances as `Circuit::process_deltas`.
+ *
+ * @param lane The lane.
+ * @param damping Fraction of the update to apply.
+ *
+ * @return True if the lane has converged and false otherwise.
+ */
+bool BatchCircuit::process_deltas(int lane, double damping) {
+	bool done = true;
+	for (int r = 0; r < n; r++) {
+		done = done && Circuit::update_converged(guess(lane, r), x(lane, r),
+		                                         circuit.reltol,
+		                                         abs_tolerances(r));
+		guess(lane, r) += damping * x(lane, r);
+	}
+	return done;
+}
+
+/**
+ * @brief Advances one lane's capacitor history once its step has been
+ * accepted (see `StampProgram::CapacitorGroup::accept`).
+ *
+ * @param lane The lane.
+ * @param accepted The accepted solution.
+ */
+void BatchCircuit::accept(int lane, const Lanes& accepted) {
+	for (int k = 0; k < (int) capacitors.c.size(); k++) {
+		double v = accepted(lane, capacitors.n1[k]) -
+		           accepted(lane, capacitors.n2[k]);
+		ilast(lane, k) = caps.lhs_coeffs(lane, k) * v - hist(lane, k);
+		aux(lane, k) = CapacitorGroup::carry(capacitors.method,
+		                                     ilast(lane, k), vlast(lane, k),
+		                                     aux(lane, k));
+	}
+	last_step(lane) = step(lane);
+}
+
+/**
+ * @brief Checks whether one lane can accept the step newton's method has
+ * just run (see `Circuit::step_acceptable`).
+ *
+ * @param lane The lane.
+ * @param next The step's solution.
+ *
+ * @return True if the lane can accept the step and false otherwise.
+ */
+bool BatchCircuit::step_acceptable(int lane, const Lanes& next) {
+	if (!converged(lane)) {
+		stats.newton_rejections++;
+		return false;
+	}
+
+	if (circuit.trtol <= 0)
+		return true;
+
+	double worst = 0.0;
+	for (int k = 0; k < (int) capacitors.c.size(); k++) {
+		double v = next(lane, capacitors.n1[k]) -
+		           next(lane, capacitors.n2[k]);
+		double i = caps.lhs_coeffs(lane, k) * v - hist(lane, k);
+		worst = fmax(worst, CapacitorGroup::truncation(step(lane),
+			capacitances(lane, k), v, vlast(lane, k), i, ilast(lane, k),
+			circuit.reltol, Circuit::CHARGE_TOLERANCE));
+	}
+
+	if (worst > circuit.trtol) {
+		stats.lte_rejections++;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Runs newton's method on one step of some of the lanes (see
+ * `Circuit::run_newton`), each over its own timestep in `step`. Every lane
+ * is restamped and refactored on every iteration, until every lane has
+ * converged or given up, but only the lanes being run take updates.
+ * Damping and recoveries are tracked per lane.
+ *
+ * @param prev The solution from the previous step.
+ * @param next Starting guess, updated in place with the new solution.
+ * @param run The lanes to run. The rest are left as they are.
+ *
+ * @return The number of iterations run.
+ */
+int BatchCircuit::run_newton(const Lanes& prev, Lanes& next,
+	const LaneMask& run) {
+
+	for (int l = 0; l < lanes; l++) {
+		if (!run(l))
+			continue;
+		converged(l) = false;
+		damping(l) = 1.0;
+		last_update(l) = INFINITY;
+		recoveries(l) = 0;
+	}
+	active = run;
+	int iter;
+
+	for (iter = 0; iter < Circuit::MAX_ITERATIONS && active.any(); iter++) {
+		run_kcl(prev, next, true);
+		factor();
+		solve();
+		stats.factorizations++;
+		stats.solves++;
+
+		for (int l = 0; l < lanes; l++) {
+			if (!active(l))
+				continue;
+
+			double update = x.row(l).abs().maxCoeff();
+			if (!std::isfinite(update)) {
+				if (recoveries(l) == Circuit::MAX_RECOVERIES) {
+					active(l) = false;
+					continue;
+				}
+				recoveries(l)++;
+				stats.recoveries++;
+				next.row(l) = prev.row(l);
+				reset_junctions(l, prev);
+				damping(l) = Circuit::recovery_damping(recoveries(l));
+				last_update(l) = INFINITY;
+				continue;
+			}
+
+			/* restart like `Circuit::run_newton` if the LHS is singular */
+			if (predicted(l) && pivoted(l) &&
+			    fallbacks[l]->rank_deficient()) {
+				predicted(l) = false;
+				next.row(l) = prev.row(l);
+				reset_junctions(l, prev);
+				damping(l) = 1.0;
+				last_update(l) = INFINITY;
+				continue;
+			}
+
+			damping(l) = Circuit::next_damping(damping(l), update,
+			                                   last_update(l));
+			last_update(l) = update;
+
+			converged(l) = process_deltas(l, damping(l)) && !limited(l);
+			active(l) = !converged(l);
+		}
+	}
+
+	for (int l = 0; l < lanes; l++) {
+		if (run(l) && !converged(l) && !next.row(l).allFinite()) {
+			next.row(l) = prev.row(l);
+			reset_junctions(l, prev);
+		}
+	}
+
+	return iter;
+}
+
+/**
+ * @brief Runs one timestep of every lane (see `Circuit::run_substeps`).
+ * Each lane that cannot accept the whole timestep walks it in substeps of
+ * its own, while the lanes that could sit out, so that no lane's solution
+ * depends on the others. The input of a lane in substeps is interpolated
+ * linearly from `last_u` to `u_next` across the timestep.
+ *
+ * @param dt The timestep.
+ * @param prev The solution from the previous timestep.
+ * @param next Starting guess, updated in place with the new solution.
+ *
+ * @return The number of newton iterations run, over all substeps.
+ */
+int BatchCircuit::run_substeps(double dt, const Lanes& prev, Lanes& next) {
+	int max_substeps = circuit.max_substeps;
+	step.setConstant(dt);
+	int iterations = run_newton(prev, next, every_lane);
+	predicted.setConstant(false);
+
+	for (int l = 0; l < lanes; l++) {
+		stepping(l) = !step_acceptable(l, next) && max_substeps > 1;
+		if (stepping(l)) {
+			stats.split_samples++;
+			substep_soln.row(l) = prev.row(l);
+			reset_junctions(l, prev);
+			walks[l].start(max_substeps);
+			continue;
+		}
+
+		if (!converged(l))
+			stats.failures++;
+		accept(l, next);
+	}
+
+	while (stepping.any()) {
+		for (int l = 0; l < lanes; l++) {
+			if (!stepping(l))
+				continue;
+			step(l) = walks[l].substep(dt);
+			u(l) = walks[l].input(last_u(l), u_next(l));
+			next.row(l) = substep_soln.row(l);
+		}
+
+		iterations += run_newton(substep_soln, next, stepping);
+
+		for (int l = 0; l < lanes; l++) {
+			if (!stepping(l))
+				continue;
+
+			bool acceptable = step_acceptable(l, next);
+			if (!acceptable && walks[l].retry()) {
+				reset_junctions(l, substep_soln);
+				continue;
+			}
+
+			if (!converged(l))
+				stats.failures++;
+			accept(l, next);
+			substep_soln.row(l) = next.row(l);
+			stats.substeps++;
+			walks[l].advance(acceptable);
+
+			if (walks[l].done()) {
+				stepping(l) = false;
+				u(l) = u_next(l);
+			}
+		}
+	}
+
+	return iterations;
+}
+
+/**
+ * @brief Advances every lane by one timestep, with `u_next` as the input,
+ * filling in `y` with each lane's output.
+ */
+void BatchCircuit::step_all() {
+	u = u_next;
+	guess = soln;
+
+	/* linear circuits were factored up front */
+	if (circuit.num_nonlinear == 0) {
+		run_kcl(soln, guess, false);
+		solve();
+		guess += x;
+		for (int l = 0; l < lanes; l++)
+			accept(l, guess);
+	}
+
+	else {
+		bool predicting = circuit.predictor != Predictor::PREDICT_NONE;
+		if (predicting) {
+			/* drop predictions like `Circuit::step_mna` does */
+			for (int l = 0; l < lanes; l++) {
+				lane_soln = guess.row(l).transpose().matrix();
+				guesses[l].predict(u(l), lane_soln);
+				predicted(l) = !singular(l) && !would_limit(l, lane_soln);
+				if (predicted(l))
+					guess.row(l) = lane_soln.transpose().array();
+			}
+		}
+
+		int iterations = run_substeps(step_dt, soln, guess);
+		stats.record(iterations);
+		for (int l = 0; l < lanes; l++)
+			singular(l) = pivoted(l) && fallbacks[l]->rank_deficient();
+
+		if (predicting) {
+			for (int l = 0; l < lanes; l++) {
+				lane_soln = guess.row(l).transpose().matrix();
+				guesses[l].accept(u(l), lane_soln);
+			}
+		}
+	}
+
+	soln = guess;
+	last_u = u;
+	for (int l = 0; l < lanes; l++) {
+		lane_soln = soln.row(l).transpose().matrix();
+		y(l) = circuit.vout->voltage(lane_soln);
+	}
+}
+
+/**
+ * @brief Sets up every lane to process blocks of input, as if its input
+ * had been silent. State carries over from one call to `process` to the
+ * next until `stop` is called.
+ *
+ * The row order shared by every lane comes from partially pivoting the
+ * circuit's jacobian at rest.
+ *
+ * @param dt Sampling period of the input signals. With oversampling, the
+ * circuit itself runs at a fraction of it.
+ */
+void BatchCircuit::start(double dt) {
+	stop();
+
+	int factor_os = circuit.oversampler.get_factor();
+	step_dt = dt / factor_os;
+	n = circuit.total_unknowns;
+
+	for (int l = 0; l < lanes; l++) {
+		fallbacks.push_back(new LinearSystem(n, circuit.ground_id,
+			circuit.unknowns, LinearSystem::SOLVER_DENSE));
+	}
+
+	/* the same tolerances as `Circuit::setup_tolerances`, kept here so that
+	   batches on other threads never write to the circuit */
+	abs_tolerances.resize(n);
+	for (const auto& unknown : circuit.unknowns) {
+		abs_tolerances(unknown.second) = Component::is_current(unknown.first)
+		                                 ? circuit.abstol : circuit.vntol;
+	}
+
+	A = Lanes::Zero(lanes, n * n);
+	LU = Lanes::Zero(lanes, n * n);
+	B = Lanes::Zero(lanes, n);
+	x = Lanes::Zero(lanes, n);
+	pivoted = LaneMask::Constant(lanes, false);
+	soln = Lanes::Zero(lanes, n);
+	guess = Lanes::Zero(lanes, n);
+	substep_soln = Lanes::Zero(lanes, n);
+	u = ArrayXd::Zero(lanes);
+	last_u = ArrayXd::Zero(lanes);
+	u_next = ArrayXd::Zero(lanes);
+	y = ArrayXd::Zero(lanes);
+	y_out = ArrayXd::Zero(lanes);
+
+	int nr = resistors.g.size();
+	int nc = capacitors.c.size();
+	int nd = diodes.is.size();
+	int ns = sources.n1.size();
+	res.lhs_coeffs = conductances;
+	res.rhs_coeffs = Lanes::Zero(lanes, nr);
+	caps.lhs_coeffs = Lanes::Zero(lanes, nc);
+	caps.rhs_coeffs = Lanes::Zero(lanes, nc);
+	dio.lhs_coeffs = Lanes::Zero(lanes, nd);
+	dio.rhs_coeffs = Lanes::Zero(lanes, nd);
+	src.lhs_coeffs = Lanes::Ones(lanes, ns);
+	src.rhs_coeffs = Lanes::Zero(lanes, 2 * ns);
+
+	aux = Lanes::Zero(lanes, nc);
+	hist = Lanes::Zero(lanes, nc);
+	vlast = Lanes::Zero(lanes, nc);
+	ilast = Lanes::Zero(lanes, nc);
+	vj = Lanes::Zero(lanes, nd);
+	step = ArrayXd::Constant(lanes, step_dt);
+	last_step = ArrayXd::Zero(lanes);
+	limited = LaneMask::Constant(lanes, false);
+	active = LaneMask::Constant(lanes, true);
+	converged = LaneMask::Constant(lanes, true);
+	damping = ArrayXd::Ones(lanes);
+	last_update = ArrayXd::Zero(lanes);
+	recoveries = Eigen::ArrayXi::Zero(lanes);
+	every_lane = LaneMask::Constant(lanes, true);
+	stepping = LaneMask::Constant(lanes, false);
+	walks.assign(lanes, SubstepWalk());
+	colmax = ArrayXd::Zero(lanes);
+	lane_soln = VectorXd::Zero(n);
+
+	/* pick the shared row order from the jacobian at rest */
+	row_at.resize(n);
+	for (int r = 0; r < n; r++)
+		row_at[r] = r;
+	link();
+	run_kcl(soln, guess, true);
+
+	MatrixXd rest(n, n);
+	for (int r = 0; r < n; r++) {
+		for (int c = 0; c < n; c++)
+			rest(r, c) = A(0, r * n + c);
+	}
+	Eigen::PartialPivLU<MatrixXd> order(rest);
+	for (int r = 0; r < n; r++)
+		row_at[r] = order.permutationP().indices()(r);
+	link();
+
+	/* the stamp above must not leave any history behind */
+	vj.setZero();
+	aux.setZero();
+	vlast.setZero();
+	ilast.setZero();
+	last_step.setZero();
+
+	/* linear circuits have a constant LHS - factor it once up front */
+	if (circuit.num_nonlinear == 0) {
+		run_kcl(soln, guess, true);
+		factor();
+	}
+
+	guesses.assign(lanes, Predictor(circuit.predictor,
+	                                circuit.predictor_history));
+	for (Predictor& p : guesses)
+		p.reset(n);
+	singular = LaneMask::Constant(lanes, false);
+	predicted = LaneMask::Constant(lanes, false);
+
+	resamplers.assign(factor_os > 1 ? lanes : 0, Oversampler());
+	for (Oversampler& os : resamplers)
+		os.configure(factor_os, circuit.oversampler.get_taps());
+
+	stats.reset();
+	running = true;
+}
+
+/**
+ * @brief Moves every lane to the DC operating point of its circuit for a
+ * constant input, as if that input had been applied forever: capacitors
+ * carry no current, so they are stamped as open circuits (an infinite
+ * timestep). Lanes whose operating point cannot be found stay at rest.
+ * Must be called right after `start`.
+ *
+ * @param inputs Input voltage of each lane.
+ */
+void BatchCircuit::operating_point(const double *inputs) {
+	for (int l = 0; l < lanes; l++)
+		u(l) = inputs[l];
+	u_next = u;
+	last_u = u;
+
+	guess = soln;
+	step.setConstant(INFINITY);
+	run_newton(soln, guess, every_lane);
+	for (int l = 0; l < lanes; l++) {
+		if (!converged(l))
+			guess.row(l).setZero();
+		reset_junctions(l, guess);
+	}
+	soln = guess;
+
+	/* start history as if the circuit had been resting there */
+	for (int k = 0; k < (int) capacitors.c.size(); k++) {
+		int n1 = capacitors.n1[k];
+		int n2 = capacitors.n2[k];
+		vlast.col(k) = soln.col(n1) - soln.col(n2);
+		if (capacitors.method == StampProgram::INTEGRATE_BDF2)
+			aux.col(k) = vlast.col(k);
+		else
+			aux.col(k).setZero();
+	}
+	ilast.setZero();
+	last_step.setZero();
+	step.setConstant(step_dt);
+
+	/* newton left the LHS factored for the operating point */
+	if (circuit.num_nonlinear == 0) {
+		run_kcl(soln, guess, true);
+		factor();
+	}
+	stats.reset();
+}
+
+/**
+ * @brief Tears down the state set up by `start`. Does nothing if the batch
+ * was not started.
+ */
+void BatchCircuit::stop() {
+	if (!running)
+		return;
+
+	for (LinearSystem *sys : fallbacks)
+		delete sys;
+	fallbacks.clear();
+	running = false;
+}
+
+/**
+ * @brief Gets the delay, in input samples, between a sample going into
+ * `process` and its response coming out, which comes from the resampling
+ * filters when the circuit is oversampled.
+ */
+int BatchCircuit::latency() const {
+	return circuit.latency();
+}
+
+/**
+ * @brief Runs every lane over a block of its input samples, picking up from
+ * where the last block left off. The batch must have been started. Like
+ * `Circuit::process`, this never allocates.
+ *
+ * @param in Input voltages of each lane.
+ * @param out Filled in with the output voltages of each lane. Lanes may
+ * alias their input.
+ * @param n Number of samples in the block.
+ */
+void BatchCircuit::process(const float *const *in, float *const *out,
+	size_t n) {
+
+	if (resamplers.empty()) {
+		for (size_t i = 0; i < n; i++) {
+			for (int l = 0; l < lanes; l++)
+				u_next(l) = in[l][i];
+			step_all();
+			for (int l = 0; l < lanes; l++)
+				out[l][i] = (float) y(l);
+		}
+		return;
+	}
+
+	int factor_os = resamplers[0].get_factor();
+	for (size_t i = 0; i < n; i++) {
+		for (int l = 0; l < lanes; l++)
+			resamplers[l].push_input(in[l][i]);
+
+		for (int j = 0; j < factor_os; j++) {
+			for (int l = 0; l < lanes; l++)
+				u_next(l) = resamplers[l].pop_input();
+			step_all();
+			for (int l = 0; l < lanes; l++)
+				resamplers[l].push_output(y(l), &y_out(l));
+		}
+
+		for (int l = 0; l < lanes; l++)
+			out[l][i] = (float) y_out(l);
+	}
+}
+
+/**
+ * @brief Runs the circuit over one whole signal per lane (see
+ * `Circuit::transient`). Signals may have different lengths: a lane that
+ * runs out is fed silence while the others finish, and only its own
+ * samples are written out. They must share a sampling rate, as every lane
+ * steps the same timestep.
+ *
+ * @param signals Where each lane's signal comes from and goes to, one per
+ * lane. Each is finished once the batch is done.
+ * @param report Whether to print the newton and allocation statistics,
+ * which batches run from a pool leave out.
+ */
+void BatchCircuit::transient(vector<AudioManager*>& signals, bool report) {
+	double dt = signals[0]->get_sampling_period();
+	for (int l = 1; l < lanes; l++) {
+		if (signals[l]->get_sampling_period() != dt)
+			sim_error("Signals run as one batch must share a sampling rate.");
+	}
+	start(dt);
+
+	size_t block_size = signals[0]->get_block_size();
+	vector<vector<float>> in(lanes, vector<float>(block_size));
+	vector<vector<float>> out(lanes, vector<float>(block_size));
+	vector<const float*> in_ptrs(lanes);
+	vector<float*> out_ptrs(lanes);
+	for (int l = 0; l < lanes; l++) {
+		in_ptrs[l] = in[l].data();
+		out_ptrs[l] = out[l].data();
+	}
+
+	/* samples read from each lane, until it runs out (then -1) */
+	vector<long> length(lanes, -1);
+	long pos = 0;
+	long lag = latency();
+
+	while (true) {
+		long end = pos;
+		for (int l = 0; l < lanes; l++) {
+			size_t got = 0;
+			if (length[l] < 0) {
+				got = signals[l]->get_next_block(in[l].data(), block_size);
+				if (got < block_size)
+					length[l] = pos + got;
+			}
+			std::fill(in[l].begin() + got, in[l].end(), 0.0f);
+			end = std::max(end, (length[l] < 0 ? pos + (long) block_size
+			                                    : length[l]) + lag);
+		}
+
+		size_t n = std::min((long) block_size, end - pos);
+		if (n == 0)
+			break;
+		process(in_ptrs.data(), out_ptrs.data(), n);
+
+		/* output t answers input t - lag */
+		for (int l = 0; l < lanes; l++) {
+			long from = std::max(pos, lag);
+			long to = pos + n;
+			if (length[l] >= 0)
+				to = std::min(to, length[l] + lag);
+			if (to > from)
+				signals[l]->set_next_block(out[l].data() + (from - pos),
+				                           to - from);
+		}
+		pos += n;
+
+		/* everything past the first block must run without allocating */
+		AllocAudit::arm();
+	}
+
+	AllocAudit::disarm();
+	stop();
+
+	if (report && circuit.num_nonlinear > 0)
+		stats.report(std::cout, step_dt);
+
+	if (report && AllocAudit::supported() &&
+		AllocAudit::get_mode() != AllocAudit::AUDIT_OFF) {
+		std::cout << "Audio path made " << AllocAudit::allocations()
+		          << " heap allocation(s) after the first block."
+		          << std::endl;
+	}
+
+	for (AudioManager *am : signals)
+		am->finish();
+}
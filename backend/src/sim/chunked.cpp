@@ -0,0 +1,202 @@
+/**
+ *
+ * @file chunked.cpp
+ *
+ * @brief This file contains the implementation of chunked renders, which
+ * let one long signal use every core.
+ *
+ */
+
+#include <chunked.hpp>
+#include <batch.hpp>
+#include <pool.hpp>
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+
+using std::vector;
+
+/**
+ * @brief Sets up a render of a circuit in chunks. The circuit must have
+ * all of its components registered.
+ *
+ * @param circuit The circuit.
+ * @param chunks Number of chunks to split signals into.
+ * @param warmup Length of the warm-up before each chunk, in seconds.
+ */
+ChunkedRender::ChunkedRender(Circuit& circuit, int chunks, double warmup)
+	: circuit(circuit), num_chunks(chunks), warmup(warmup) { }
+
+/**
+ * @brief Renders a range of chunks as the lanes of one batch, writing the
+ * samples each keeps into the output. Lanes that run out of their chunk
+ * before the others are fed silence.
+ *
+ * @param input The whole input signal.
+ * @param dt Sampling period of the input.
+ * @param chunks Every chunk.
+ * @param first The first chunk in the range.
+ * @param last One past the last chunk in the range.
+ * @param output The whole output signal, of which this range's samples
+ * are filled in.
+ */
+void ChunkedRender::render(const vector<float>& input, double dt,
+	const vector<Chunk>& chunks, int first, int last, vector<float>& output) {
+
+	int lanes = last - first;
+	BatchCircuit batch(circuit, lanes);
+	batch.start(dt);
+
+	/* chunks that start at the beginning start from rest, like a
+	   sequential render. Others start from the average input over their
+	   warm-up, which is close to what slow capacitors have settled on */
+	vector<double> rest(lanes, 0.0);
+	for (int l = 0; l < lanes; l++) {
+		const Chunk& ch = chunks[first + l];
+		if (ch.warm == 0)
+			continue;
+		for (long t = ch.warm; t < ch.start; t++)
+			rest[l] += input[t];
+		rest[l] /= (ch.start - ch.warm);
+	}
+	batch.operating_point(rest.data());
+
+	long len = input.size();
+	long lag = batch.latency();
+	long total = 0;
+	for (int l = 0; l < lanes; l++) {
+		const Chunk& ch = chunks[first + l];
+		total = std::max(total, ch.end + lag - ch.warm);
+	}
+
+	size_t block_size = FILE_FRAMES_PER_BLOCK;
+	vector<vector<float>> in(lanes, vector<float>(block_size));
+	vector<vector<float>> out(lanes, vector<float>(block_size));
+	vector<const float*> in_ptrs(lanes);
+	vector<float*> out_ptrs(lanes);
+	for (int l = 0; l < lanes; l++) {
+		in_ptrs[l] = in[l].data();
+		out_ptrs[l] = out[l].data();
+	}
+
+	for (long pos = 0; pos < total; pos += block_size) {
+		size_t n = std::min((long) block_size, total - pos);
+		for (int l = 0; l < lanes; l++) {
+			long from = chunks[first + l].warm + pos;
+			for (size_t i = 0; i < n; i++)
+				in[l][i] = (from + (long) i < len) ? input[from + i] : 0.0f;
+		}
+
+		batch.process(in_ptrs.data(), out_ptrs.data(), n);
+
+		/* output j answers input warm + j - lag */
+		for (int l = 0; l < lanes; l++) {
+			const Chunk& ch = chunks[first + l];
+			for (size_t i = 0; i < n; i++) {
+				long t = ch.warm + pos + i - lag;
+				if (t >= ch.start && t < ch.end)
+					output[t] = out[l][i];
+			}
+		}
+	}
+
+	batch.stop();
+}
+
+/**
+ * @brief Prints the largest difference between the chunked and sequential
+ * renders just after each seam (over one warm-up window), and anywhere in
+ * the signal.
+ *
+ * @param chunks Every chunk.
+ * @param output The chunked render.
+ * @param reference The sequential render.
+ */
+void ChunkedRender::report_seams(const vector<Chunk>& chunks,
+	const vector<float>& output, const vector<float>& reference) const {
+
+	double peak = 0.0;
+	double worst = 0.0;
+	long worst_at = 0;
+	for (long t = 0; t < (long) output.size(); t++) {
+		double error = fabs(output[t] - reference[t]);
+		peak = fmax(peak, fabs(reference[t]));
+		if (error > worst) {
+			worst = error;
+			worst_at = t;
+		}
+	}
+
+	for (int i = 1; i < (int) chunks.size(); i++) {
+		const Chunk& ch = chunks[i];
+		long window = std::max(ch.start - ch.warm, 1L);
+		double error = 0.0;
+		for (long t = ch.start; t < std::min(ch.end, ch.start + window); t++)
+			error = fmax(error, fabs(output[t] - reference[t]));
+		std::cout << "Seam " << i << " at sample " << ch.start
+		          << ": largest error " << error << " V." << std::endl;
+	}
+
+	std::cout << "Largest error against the sequential render: " << worst
+	          << " V at sample " << worst_at << " ("
+	          << (peak > 0 ? 100.0 * worst / peak : 0.0)
+	          << "% of the peak level)." << std::endl;
+}
+
+/**
+ * @brief Renders a whole signal in chunks on a work-stealing pool, then
+ * writes it out in order. Each task runs a batch of up to `lanes` chunks.
+ *
+ * @param signal The signal, which is finished once rendered.
+ * @param jobs Number of worker threads, or 0 for one per core.
+ * @param lanes Number of chunks each task runs as one batch.
+ * @param verify Whether to also render the signal sequentially (as one
+ * more task) and report the error at each seam.
+ */
+void ChunkedRender::run(AudioManager *signal, int jobs, int lanes,
+	bool verify) {
+
+	vector<float> input;
+	long len = signal->read_all(input);
+	double dt = signal->get_sampling_period();
+
+	/* split into chunks, each warming up from an earlier sample */
+	long warm = lround(warmup / dt);
+	long size = std::max((len + num_chunks - 1) / num_chunks, 1L);
+	vector<Chunk> chunks;
+	for (long start = 0; start < len; start += size) {
+		Chunk ch = { std::max(start - warm, 0L), start,
+		             std::min(start + size, len) };
+		chunks.push_back(ch);
+	}
+
+	vector<float> output(len);
+	vector<float> reference(verify ? len : 0);
+	vector<Chunk> whole = { { 0, 0, len } };
+
+	WorkPool pool(jobs);
+	std::cout << "Rendering " << chunks.size() << " chunk(s) of " << size
+	          << " sample(s), each after a warm-up of " << warm
+	          << " sample(s), on " << pool.num_workers() << " thread(s)."
+	          << std::endl;
+
+	/* the sequential reference is rendered as one more task */
+	if (verify && len > 0) {
+		pool.submit([&](int) {
+			render(input, dt, whole, 0, 1, reference);
+		});
+	}
+	for (int first = 0; first < (int) chunks.size(); first += lanes) {
+		int last = std::min(first + lanes, (int) chunks.size());
+		pool.submit([&, first, last](int) {
+			render(input, dt, chunks, first, last, output);
+		});
+	}
+	pool.wait();
+
+	if (verify)
+		report_seams(chunks, output, reference);
+
+	signal->set_next_block(output.data(), len);
+	signal->finish();
+}
@@ -13,14 +13,132 @@
  */
 
 #include <circuit.hpp>
+#include <alloc_audit.hpp>
 #include <parser/netparser.hpp>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
 #include <math.h>
+#include <sys/stat.h>
 
 using std::vector;
 using std::string;
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
+using Eigen::RowVectorXd;
+
+/**
+ * @brief Zeros out every count.
+ */
+void NewtonStats::reset() {
+	samples = 0;
+	iterations = 0;
+	factorizations = 0;
+	solves = 0;
+	failures = 0;
+	recoveries = 0;
+	split_samples = 0;
+	substeps = 0;
+	newton_rejections = 0;
+	lte_rejections = 0;
+	for (int b = 0; b < HISTOGRAM_BINS; b++)
+		histogram[b] = 0;
+}
+
+/**
+ * @brief Records the number of newton iterations one timestep took.
+ *
+ * @param iterations The number of iterations.
+ */
+void NewtonStats::record(int iterations) {
+	int bin = (iterations < 1) ? 0 : std::min(iterations, HISTOGRAM_BINS) - 1;
+	histogram[bin]++;
+	this->iterations += iterations;
+	samples++;
+}
+
+/**
+ * @brief Prints the average number of iterations per timestep, the share
+ * of timesteps that took each number of iterations, and how often the system
+ * was factored and solved per second of signal.
+ *
+ * @param out Stream to print to.
+ * @param dt Input signal sampling period.
+ */
+void NewtonStats::report(std::ostream& out, double dt) const {
+	if (samples == 0)
+		return;
+
+	out << "Newton averaged " << (double) iterations / samples
+	    << " iteration(s) per sample (";
+	for (int b = 0; b < HISTOGRAM_BINS; b++) {
+		out << (b > 0 ? ", " : "") << b + 1
+		    << (b == HISTOGRAM_BINS - 1 ? "+" : "") << ": "
+		    << 100.0 * histogram[b] / samples << "%";
+	}
+	out << ")." << std::endl;
+
+	out << "Newton failed to converge on " << failures << " sample(s), and "
+	    << "recovered from " << recoveries << " non-finite solution(s)."
+	    << std::endl;
+
+	if (split_samples > 0) {
+		out << "Split " << split_samples << " sample(s) into " << substeps
+		    << " substep(s), after retrying " << newton_rejections
+		    << " step(s) newton failed on and " << lte_rejections
+		    << " with too much truncation error." << std::endl;
+	}
+
+	double seconds = samples * dt;
+	out << "Factored the system " << factorizations << " time(s) for "
+	    << solves << " solve(s): " << factorizations / seconds
+	    << " factorizations/s, " << solves / seconds
+	    << " solves/s of signal." << std::endl;
+}
+
+/**
+ * @brief Starts walking a timestep, with substeps of half its size.
+ *
+ * @param max_substeps Smallest substeps in the timestep (a power of two).
+ */
+void SubstepWalk::start(int max_substeps) {
+	this->max_substeps = max_substeps;
+	pos = 0;
+	len = max_substeps / 2;
+}
+
+/**
+ * @brief Halves the next substep after it was rejected.
+ *
+ * @return True if the substep is to be retried at the smaller size, and
+ * false if it already was the smallest, in which case it has to be accepted.
+ */
+bool SubstepWalk::retry() {
+	if (len <= 1)
+		return false;
+	len /= 2;
+	return true;
+}
+
+/**
+ * @brief Moves past an accepted substep, doubling the next one if it still
+ * lines up with the grid of the larger size.
+ *
+ * @param acceptable Whether the substep passed, rather than being accepted
+ * as the smallest substep anyway.
+ *
+ * @return True if the next substep doubled.
+ */
+bool SubstepWalk::advance(bool acceptable) {
+	pos += len;
+	if (acceptable && pos % (2 * len) == 0 && pos + 2 * len <= max_substeps) {
+		len *= 2;
+		return true;
+	}
+	return false;
+}
 
 /**
  * @brief Records the unknown variables associated with a component.
@@ -57,6 +175,7 @@ void Circuit::register_ground(int node_id) {
 void Circuit::register_resistor(Resistor *r) {
 	register_unknowns(r->unknowns());
 	r->map_unknowns(unknowns);
+	r->compile(program);
 	components.push_back(r);
 }
 
@@ -70,12 +189,21 @@ void Circuit::register_resistor(Resistor *r) {
 void Circuit::register_capacitor(Capacitor *c) {
 	register_unknowns(c->unknowns());
 	c->map_unknowns(unknowns);
+	c->compile(program);
 	components.push_back(c);
 }
 
+/**
+ * @brief Adds a new diode to the circuit. Since diodes are nonlinear, this
+ * also rules out the linear fast path in transient analysis.
+ *
+ * @param d The diode.
+ */
 void Circuit::register_diode(Diode *d) {
+	num_nonlinear++;
 	register_unknowns(d->unknowns());
 	d->map_unknowns(unknowns);
+	d->compile(program);
 	components.push_back(d);
 }
 
@@ -90,6 +218,7 @@ void Circuit::register_vin(VoltageIn *vin) {
 	this->vin = vin;
 	register_unknowns(vin->unknowns());
 	vin->map_unknowns(unknowns);
+	vin->compile(program);
 	components.push_back(vin);
 }
 
@@ -106,51 +235,1061 @@ void Circuit::register_vout(VoltageOut *vout) {
 	vout->map_unknowns(unknowns);
 }
 
+/**
+ * @brief Selects the backend used to solve the linear system on each
+ * newton iteration.
+ *
+ * @param solver The solver backend. SOLVER_AUTO (the default) chooses
+ * between the dense and sparse backends based on the number of unknowns.
+ */
+void Circuit::set_solver(LinearSystem::solver_t solver) {
+	this->solver = solver;
+}
+
+/**
+ * @brief Selects the precision the MNA system is assembled, factored and
+ * solved in. Devices are always evaluated, and solutions always kept, in
+ * double precision, so that newton's method converges against a double
+ * precision residual either way; in single precision only its updates are
+ * as accurate as a float. Other methods always run in double precision.
+ *
+ * @param precision The precision. PRECISION_DOUBLE is the default.
+ */
+void Circuit::set_precision(LinearSystem::precision_t precision) {
+	this->precision = precision;
+}
+
+/**
+ * @brief Selects how the MNA system is reduced before it is solved.
+ *
+ * @param reduce Whether to eliminate ground and the nodes fixed by grounded
+ * voltage sources from the system (the default), or solve it in full.
+ * @param ordering Order to put the unknowns left in a reduced system in.
+ * ORDER_AMD (the default) keeps the sparse backend's factors the sparsest.
+ */
+void Circuit::set_reduction(bool reduce, Reduction::ordering_t ordering) {
+	this->reduce = reduce;
+	this->ordering = ordering;
+}
+
+/**
+ * @brief Selects how the circuit is run during transient analysis.
+ *
+ * @param method METHOD_MNA (the default) solves the circuit's full system
+ * of equations on every timestep. METHOD_IIR compiles a linear circuit into
+ * an IIR filter first, and is ignored for circuits with nonlinear devices.
+ * METHOD_DK precomputes the circuit's linear part so that newton's method
+ * only runs over its nonlinear devices, and METHOD_TABLE interpolates its
+ * solution from a precomputed table wherever possible. METHOD_COMPILED
+ * generates and compiles code for the circuit's MNA timestep (see
+ * `CompiledCircuit`).
+ */
+void Circuit::set_method(method_t method) {
+	this->method = method;
+}
+
+/**
+ * @brief Selects how newton's method is started on each timestep.
+ *
+ * @param predictor PREDICT_NONE (the default) starts from the previous
+ * timestep's solution. PREDICT_POLYNOMIAL extrapolates a polynomial through
+ * the last `history` solutions, and PREDICT_INPUT scales the last change in
+ * the solution by the change in the input.
+ * @param history Number of past solutions used by PREDICT_POLYNOMIAL.
+ */
+void Circuit::set_predictor(Predictor::predictor_t predictor, int history) {
+	this->predictor = predictor;
+	this->predictor_history = history;
+}
+
+/**
+ * @brief Selects how newton's method treats the jacobian.
+ *
+ * @param newton NEWTON_FULL (the default) refactors the system on every
+ * iteration. NEWTON_CHORD keeps reusing the last factorization while it
+ * still converges.
+ * @param chord_ratio How far (as a ratio) a device's conductance may move
+ * before NEWTON_CHORD refactors the system.
+ */
+void Circuit::set_newton(newton_t newton, double chord_ratio) {
+	this->newton = newton;
+	this->chord_ratio = chord_ratio;
+}
+
+/**
+ * @brief Selects the tolerances newton's method converges to. A delta to an
+ * unknown x is within tolerance when |delta| <= reltol |x| + abs, where abs
+ * is `vntol` for node voltages and `abstol` for branch currents.
+ *
+ * @param reltol Relative tolerance.
+ * @param vntol Absolute tolerance for node voltages, in volts.
+ * @param abstol Absolute tolerance for branch currents, in amps.
+ */
+void Circuit::set_tolerances(double reltol, double vntol, double abstol) {
+	this->reltol = reltol;
+	this->vntol = vntol;
+	this->abstol = abstol;
+}
+
+/**
+ * @brief Selects when timesteps of a circuit with nonlinear devices are
+ * split into substeps: when newton's method fails to converge, or when the
+ * local truncation error of the capacitors exceeds `trtol` times its
+ * tolerance (see `StampProgram::truncation_ratio`). The output is still
+ * produced once per timestep.
+ *
+ * @param max_substeps Most substeps a timestep is split into, which must be
+ * a power of two. 1 never splits timesteps.
+ * @param trtol Factor by which the local truncation error may exceed its
+ * tolerance, or 0 to only split timesteps that newton's method fails on.
+ */
+void Circuit::set_substepping(int max_substeps, double trtol) {
+	this->max_substeps = max_substeps;
+	this->trtol = trtol;
+}
+
+/**
+ * @brief Selects the integration method capacitors are discretized with on
+ * every timestep. Backward Euler damps high frequencies, so the second order
+ * methods stay accurate at lower sampling rates: the trapezoidal rule adds
+ * no damping of its own, while BDF2 still damps a little, which keeps it
+ * from ringing on stiff circuits.
+ *
+ * @param method The integration method.
+ */
+void Circuit::set_integration(StampProgram::integration_t method) {
+	program.set_integration(method);
+}
+
+/**
+ * @brief Selects how many times faster than the input signal the circuit is
+ * run. Oversampling keeps the harmonics of hard clipping circuits from
+ * aliasing back into the audible band, at the cost of running the circuit
+ * (and the resampling filters) more often.
+ *
+ * @param factor Oversampling factor: 1 (no oversampling), 2, 4 or 8.
+ * @param taps Resampling filter taps per polyphase branch.
+ */
+void Circuit::set_oversampling(int factor, int taps) {
+	oversampler.configure(factor, taps);
+}
+
+/**
+ * @brief Selects where precomputed port tables and compiled circuits are
+ * cached on disk.
+ *
+ * @param dir Directory to keep tables in. It is created when the first table
+ * is saved.
+ * @param netlist_hash Hash of the circuit's netlist. Tables are keyed by it
+ * (and the sampling rate), so editing the netlist builds a new table.
+ */
+void Circuit::set_table_cache(const string& dir, uint64_t netlist_hash) {
+	table_dir = dir;
+	this->netlist_hash = netlist_hash;
+}
+
+/**
+ * @brief Loads the port table for a DK model from the cache, building (and
+ * caching) it if it is missing or was built for a different model.
+ *
+ * @param dt Input signal sampling period.
+ * @param dk The DK model.
+ * @param table Table to be loaded or built.
+ *
+ * @return True if the table is ready and false if it could not be built.
+ */
+bool Circuit::load_port_table(double dt, const DkModel& dk, PortTable& table) {
+	std::ostringstream name;
+	name << table_dir << "/" << std::hex << std::setw(16) << std::setfill('0')
+	     << netlist_hash << std::dec << "-" << lround(1.0 / dt) << ".tbl";
+	string path = name.str();
+
+	bool cached = !table_dir.empty() && table.load(path, dk);
+	if (!cached && !table.build(dk))
+		return false;
+
+	std::cout << (cached ? "Loaded" : "Built") << " port table over "
+	          << table.num_dims() << " dimension(s) with "
+	          << table.points_per_dim() << " point(s) each, "
+	          << 100 * table.solved_fraction() << "% solved, error bound "
+	          << table.error_bound() << " V." << std::endl;
+
+	if (!cached && !table_dir.empty()) {
+		mkdir(table_dir.c_str(), 0755);
+		if (!table.save(path))
+			std::cerr << "Failed to cache port table in " << path << std::endl;
+	}
+	return true;
+}
+
+/**
+ * @brief Runs one timestep of the linear part of a circuit from a given
+ * state, with the input voltage already set.
+ *
+ * The state z = [x; h] holds the previous timestep's solution x and the
+ * history h the integration method carries between timesteps (see
+ * `StampProgram::num_history`), so z[n] depends only on z[n-1] and the
+ * inputs to the timestep.
+ *
+ * @param dt Input signal sampling period.
+ * @param sys Linear system whose LHS holds the linear devices, factored.
+ * @param z State at the previous timestep.
+ * @param port Nonlinear device to drive a unit current through, or -1 for
+ * none.
+ * @param next Filled in with the state after the timestep.
+ */
+void Circuit::probe_step(double dt, LinearSystem& sys, const VectorXd& z,
+	int port, VectorXd& next) {
+
+	const StampProgram::DiodeGroup& ports = program.nonlinear_devices();
+	int n = total_unknowns;
+	int m = z.size() - n;
+	VectorXd x = z.head(n);
+	VectorXd h = z.tail(m);
+
+	program.set_history(h);
+	sys.clear_rhs();
+	program.run_rhs(x, VectorXd::Zero(n), dt, StampProgram::DEVICES_LINEAR);
+	if (port >= 0) {
+		sys.increment_rhs(ports.n1[port], -1.0);
+		sys.increment_rhs(ports.n2[port], 1.0);
+	}
+	x = sys.back_substitute();
+	program.accept(x);
+	program.get_history(h);
+
+	next.resize(n + m);
+	next << x, h;
+}
+
+/**
+ * @brief Probes the linear part of a circuit (everything but its nonlinear
+ * devices) for how one timestep maps the previous timestep's state and the
+ * input voltage to the new state, z[n] = F z[n-1] + g u[n].
+ *
+ * The state is the previous timestep's solution, followed by any history
+ * the integration method carries between timesteps (see `probe_step`).
+ * F and g are found by stepping the circuit from one unit input at a time
+ * against the (constant, factored once) LHS of the linear devices.
+ *
+ * @param dt Input signal sampling period.
+ * @param sys Linear system the program is linked against. Its LHS is left
+ * factored for any further probing.
+ * @param F Filled in with the response to the previous timestep's state.
+ * @param g Filled in with the response to the input voltage.
+ * @param c Filled in with the row that measures the output voltage from a
+ * state.
+ */
+void Circuit::probe_linear(double dt, LinearSystem& sys, MatrixXd& F,
+	VectorXd& g, RowVectorXd& c) {
+
+	int n = total_unknowns;
+	int states = n + program.num_history();
+	VectorXd zero = VectorXd::Zero(n);
+	VectorXd probe = VectorXd::Zero(states);
+	VectorXd next;
+	F.resize(states, states);
+	c = RowVectorXd::Zero(states);
+
+	/* the LHS of the linear devices does not depend on the solution */
+	sys.clear();
+	program.run(zero, zero, dt, StampProgram::DEVICES_LINEAR);
+	sys.factor();
+
+	/* response to each entry in the previous timestep's state */
+	vin->set_voltage(0.0);
+	for (int m = 0; m < states; m++) {
+		probe(m) = 1.0;
+		probe_step(dt, sys, probe, -1, next);
+		F.col(m) = next;
+		if (m < n)
+			c(m) = vout->voltage(probe);
+		probe(m) = 0.0;
+	}
+
+	/* response to the input voltage */
+	vin->set_voltage(1.0);
+	probe_step(dt, sys, probe, -1, g);
+	vin->set_voltage(0.0);
+}
+
+/**
+ * @brief Picks the state of a circuit from its state transition matrix.
+ *
+ * F only has as many independent columns as the circuit has independent
+ * reactive components, so a rank revealing factorization F = U W^T gives a
+ * state s = W^T x that is usually far smaller than the solution x.
+ *
+ * @param F Response of a timestep to the previous timestep's solution.
+ * @param U Filled in with the map from state to solution.
+ * @param Wt Filled in with the map from solution to state.
+ */
+void Circuit::reduce_states(const MatrixXd& F, MatrixXd& U, MatrixXd& Wt) {
+	int n = F.rows();
+
+	Eigen::ColPivHouseholderQR<MatrixXd> qr;
+	qr.setThreshold(STATE_RANK_TOLERANCE);
+	qr.compute(F);
+
+	int r = qr.rank();
+	U = qr.householderQ() * MatrixXd::Identity(n, r);
+	MatrixXd R = qr.matrixR().topRows(r);
+	R.triangularView<Eigen::StrictlyLower>().setZero();
+	Wt = R * qr.colsPermutation().transpose();
+}
+
+/**
+ * @brief Derives the discrete-time state space model of a circuit with no
+ * nonlinear devices.
+ *
+ * With z[n] = F z[n-1] + g u[n] (see `probe_linear`) and F = U W^T (see
+ * `reduce_states`), the state s = W^T z gives A = W^T U, B = W^T g,
+ * C = c U and D = c g, where c measures the output voltage from z.
+ *
+ * @param dt Input signal sampling period.
+ * @param ss State space model to be filled in.
+ */
+void Circuit::to_state_space(double dt, StateSpace& ss) {
+	LinearSystem sys(total_unknowns, ground_id, unknowns,
+		LinearSystem::SOLVER_DENSE);
+	program.link(sys);
+
+	MatrixXd F, U, Wt;
+	VectorXd g;
+	RowVectorXd c;
+	probe_linear(dt, sys, F, g, c);
+	reduce_states(F, U, Wt);
+
+	ss.A = Wt * U;
+	ss.B = Wt * g;
+	ss.C = c * U;
+	ss.D = c.dot(g);
+	ss.reset();
+}
+
+/**
+ * @brief Derives the nodal DK-method model of a circuit.
+ *
+ * Treating the current i through each nonlinear device as an input to the
+ * circuit's linear part makes each timestep z[n] = F z[n-1] + g u[n] + Q i,
+ * where each column of Q is the linear part's response to a unit current
+ * through one device. With the state s = W^T z from `reduce_states` and the
+ * rows of Nv measuring the voltage across each device, the port voltages are
+ * v = Nv U s + Nv g u + Nv Q i, leaving newton's method to solve only for v.
+ *
+ * Nodes that only connect to the rest of the circuit through nonlinear
+ * devices (e.g. in a bridge rectifier) leave the linear part singular. Such
+ * circuits have no DK model: only the nonlinear devices pin those nodes
+ * down, so K would have no finite entries.
+ *
+ * @param dt Input signal sampling period.
+ * @param dk DK model to be filled in.
+ *
+ * @return False if the linear part is singular, leaving `dk` untouched.
+ */
+bool Circuit::to_dk_model(double dt, DkModel& dk) {
+	const StampProgram::DiodeGroup& ports = program.nonlinear_devices();
+	int k = ports.n1.size();
+
+	LinearSystem sys(total_unknowns, ground_id, unknowns, LinearSystem::SOLVER_DENSE);
+	program.link(sys);
+
+	MatrixXd F, U, Wt;
+	VectorXd g;
+	RowVectorXd c;
+	probe_linear(dt, sys, F, g, c);
+	if (sys.factorization.qr.rank() < total_unknowns)
+		return false;
+	reduce_states(F, U, Wt);
+
+	/* response to a unit current through each port, and each port's voltage */
+	int states = F.rows();
+	VectorXd zero = VectorXd::Zero(states);
+	VectorXd next;
+	MatrixXd Q(states, k);
+	MatrixXd Nv = MatrixXd::Zero(k, states);
+	for (int p = 0; p < k; p++) {
+		probe_step(dt, sys, zero, p, next);
+		Q.col(p) = next;
+
+		Nv(p, ports.n1[p]) += 1.0;
+		Nv(p, ports.n2[p]) -= 1.0;
+	}
+
+	dk.A = Wt * U;
+	dk.B = Wt * g;
+	dk.Ci = Wt * Q;
+	dk.Dp = Nv * U;
+	dk.Ep = Nv * g;
+	dk.K = -Nv * Q;
+	dk.Cy = c * U;
+	dk.Dy = c.dot(g);
+	dk.Fy = c * Q;
+	dk.is = ports.is;
+	dk.nvt_inv = ports.nvt_inv;
+	dk.reset();
+	return true;
+}
+
+/**
+ * @brief Describes the circuit's MNA timestep for code generation: its
+ * devices and unknowns, how the output is measured from the solution, and
+ * the settings newton's method runs with.
+ *
+ * @param dt Input signal sampling period.
+ * @param cc Compiled circuit to be filled in.
+ */
+void Circuit::to_compiled(double dt, CompiledCircuit& cc) {
+	setup_tolerances();
+
+	cc.program = &program;
+	cc.num_unknowns = total_unknowns;
+	cc.ground = unknowns[Component::unknown_voltage(ground_id)];
+	cc.dt = dt;
+	cc.reltol = reltol;
+	cc.abs_tolerances = abs_tolerances;
+	cc.max_iterations = MAX_ITERATIONS;
+	cc.max_recoveries = MAX_RECOVERIES;
+	cc.min_damping = MIN_DAMPING;
+
+	VectorXd probe = VectorXd::Zero(total_unknowns);
+	cc.output = RowVectorXd::Zero(total_unknowns);
+	for (int i = 0; i < total_unknowns; i++) {
+		probe(i) = 1.0;
+		cc.output(i) = vout->voltage(probe);
+		probe(i) = 0.0;
+	}
+}
+
+/**
+ * @brief Works out the reduction the MNA method solves the circuit's system
+ * in, from the entries its devices stamp. Every voltage source with one
+ * terminal on ground is a candidate for substitution.
+ *
+ * @return The reduction, owned by the caller.
+ */
+Reduction *Circuit::new_reduction() {
+	int ground = unknowns[Component::unknown_voltage(ground_id)];
+	const StampProgram::SourceGroup& sources = program.source_devices();
+
+	std::vector<Reduction::Substitution> candidates;
+	for (int k = 0; k < (int) sources.ni.size(); k++) {
+		if (sources.n2[k] == ground && sources.n1[k] != ground)
+			candidates.push_back({ sources.n1[k], sources.ni[k] });
+		else if (sources.n1[k] == ground && sources.n2[k] != ground)
+			candidates.push_back({ sources.n2[k], sources.ni[k] });
+	}
+
+	std::vector<std::pair<int, int>> pattern;
+	program.lhs_pattern(pattern);
+	return new Reduction(total_unknowns, ground, pattern, candidates,
+	                     ordering);
+}
+
 /**
  * @brief Processes the deltas vector produced after each newton iteration.
  *
- * Updates the current solution based on the delta vector if the simulation
- * has not yet converged.
+ * Updates the current solution based on the delta vector, scaled down by
+ * the damping factor. The iteration has converged once every delta is
+ * within its unknown's tolerance: `reltol` times the unknown's magnitude,
+ * plus `vntol` for node voltages or `abstol` for branch currents.
  *
  * @param deltas The delta vector.
  * @param prev_soln The previous solution from the last newton iteration.
- * @param tolerance The threshold at which iteration should stop.
+ * @param damping Fraction of the delta to apply.
  *
- * @return True if the solution has converged and false otherwise.
+ * @return True if the solution has converged and false otherwise. Deltas
+ * that are not finite never converge.
  */
-bool Circuit::process_deltas(const VectorXd& deltas, VectorXd& prev_soln,
-	double tolerance) {
-
-	/* find the largest of all the deltas */
-	double max_delta = fabs(deltas(0));
-	for (int r = 0; r < total_unknowns; r++)
-		max_delta = fmax(fabs(deltas(r)), max_delta);
+template <typename Scalar>
+bool Circuit::process_deltas(
+	const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>& deltas,
+	VectorXd& prev_soln, double damping) {
 
-	/* converged - no more work to do */
-	bool converged = (max_delta < tolerance || isnan(max_delta));
-
-	/* update current solution and continue with newton iterations */
+	bool converged = true;
 	for (int r = 0; r < total_unknowns; r++) {
-		prev_soln(r) += deltas(r);
+		converged = converged && update_converged(prev_soln(r), deltas(r),
+		                                          reltol, abs_tolerances(r));
+		prev_soln(r) += damping * deltas(r);
 	}
 
 	return converged;
 }
 
+/**
+ * @brief Sets up the absolute tolerance of each unknown: `vntol` for node
+ * voltages and `abstol` for branch currents.
+ */
+void Circuit::setup_tolerances() {
+	abs_tolerances.resize(total_unknowns);
+	for (const auto& unknown : unknowns) {
+		abs_tolerances(unknown.second) = Component::is_current(unknown.first)
+		                                 ? abstol : vntol;
+	}
+}
+
 /**
  * @brief Produces a system of equations by running KCL at each node in the
  * circuit.
  *
+ * Rather than asking each component for its contribution, this replays the
+ * circuit's stamp program, which must already be linked against `sys`. The
+ * linear devices' LHS is cached in the system between calls, so that only
+ * the nonlinear devices' is restamped for as long as the timestep holds.
+ *
  * @param dt Input signal sampling period.
+ * @param soln The solution from the previous timestep.
  * @param prev_soln The solution on the previous newton iteration.
  * @param sys The system of linear equations to be filled in.
  */
+template <typename Scalar>
 void Circuit::run_kcl(double dt, VectorXd& soln, VectorXd& prev_soln,
-	LinearSystem& sys) {
+	BasicLinearSystem<Scalar>& sys) {
 
-	sys.clear();
-	for (auto c : components) {
-		c->add_contribution(sys, soln, prev_soln, dt);
+	program.run_cached(soln, prev_soln, dt, sys);
+}
+
+/**
+ * @brief Checks whether any nonlinear device's conductance has moved by more
+ * than `chord_ratio` since the LHS was last factored.
+ */
+bool Circuit::conductances_moved() const {
+	const vector<double>& g = program.nonlinear_devices().lhs_coeffs;
+	for (int k = 0; k < (int) g.size(); k++) {
+		if (g[k] > chord_ratio * factored_conductances[k] ||
+			factored_conductances[k] > chord_ratio * g[k])
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Runs newton's method on one timestep of a circuit with nonlinear
+ * devices.
+ *
+ * With NEWTON_FULL, every iteration restamps and refactors the system. With
+ * NEWTON_CHORD, iterations only restamp the RHS (the residual at the current
+ * guess) and solve it against the last factorization, which may be from an
+ * earlier timestep. The system is only refactored when a device's
+ * conductance has moved by more than `chord_ratio` since then, or when the
+ * updates stop shrinking by at least CHORD_CONTRACTION per iteration.
+ *
+ * Diode voltages are limited as they are stamped (see `Diode::limit`), and
+ * an iteration that had to limit one never counts as converged. Updates that
+ * grow from one iteration to the next are damped, and the damping relaxes
+ * again once they shrink. If the solution stops being finite, the timestep
+ * restarts from the previous timestep's solution with heavier damping, at
+ * most MAX_RECOVERIES times. A timestep started from a predicted guess also
+ * restarts from the previous solution once its LHS is rank deficient.
+ *
+ * @param dt Input signal sampling period.
+ * @param soln The solution from the previous timestep.
+ * @param prev_soln Starting guess, updated in place with the new solution.
+ * @param sys The linear system the stamp program is linked against.
+ * @param converged Filled in with whether newton's method converged.
+ *
+ * @return The number of iterations run.
+ */
+template <typename Scalar>
+int Circuit::run_newton(double dt, VectorXd& soln, VectorXd& prev_soln,
+	BasicLinearSystem<Scalar>& sys, bool& converged) {
+
+	converged = false;
+	bool stalled = false;
+	double last_update = INFINITY;
+	double damping = 1.0;
+	int recoveries = 0;
+	int iter;
+
+	for (iter = 0; iter < MAX_ITERATIONS && !converged; iter++) {
+		bool refactor = true;
+
+		if (newton == NEWTON_CHORD && factored && !stalled) {
+			sys.clear_rhs();
+			program.run_rhs(soln, prev_soln, dt);
+			refactor = conductances_moved();
+		}
+
+		if (refactor) {
+			run_kcl(dt, soln, prev_soln, sys);
+			sys.factor();
+			factored = true;
+			factored_conductances = program.nonlinear_devices().lhs_coeffs;
+			stats.factorizations++;
+
+			/* the unknowns a singular LHS leaves unsettled stay wherever
+			 * the guess put them, so restart from the last timestep
+			 * rather than let a prediction change the solution */
+			if (predicted && sys.rank_deficient()) {
+				predicted = false;
+				prev_soln = soln;
+				program.reset_junctions(soln);
+				damping = 1.0;
+				last_update = INFINITY;
+				continue;
+			}
+		}
+
+		const auto& deltas = sys.back_substitute();
+		stats.solves++;
+
+		/* restart from the last timestep if the solution blew up */
+		double update = deltas.cwiseAbs().maxCoeff();
+		if (!std::isfinite(update)) {
+			if (recoveries == MAX_RECOVERIES)
+				break;
+			recoveries++;
+			stats.recoveries++;
+			prev_soln = soln;
+			program.reset_junctions(soln);
+			damping = recovery_damping(recoveries);
+			last_update = INFINITY;
+			factored = false;
+			continue;
+		}
+
+		/* chord iterations that stop contracting need a fresh jacobian */
+		stalled = !refactor && (update > CHORD_CONTRACTION * last_update);
+
+		damping = next_damping(damping, update, last_update);
+		last_update = update;
+
+		converged = process_deltas(deltas, prev_soln, damping) &&
+		            !program.limited();
+	}
+
+	if (!converged) {
+		/* never carry a solution that blew up into the next timestep */
+		if (!prev_soln.allFinite()) {
+			prev_soln = soln;
+			program.reset_junctions(soln);
+			factored = false;
+		}
+	}
+
+	return iter;
+}
+
+/**
+ * @brief Checks whether a step newton's method has run can be accepted: it
+ * must have converged, and the local truncation error of the capacitors
+ * must be within `trtol` times its tolerance (unless `trtol` is 0). Rejected
+ * steps are counted in the newton stats.
+ *
+ * @param soln The step's solution.
+ * @param converged Whether newton's method converged on the step.
+ *
+ * @return True if the step can be accepted and false otherwise.
+ */
+bool Circuit::step_acceptable(const VectorXd& soln, bool converged) {
+	if (!converged) {
+		stats.newton_rejections++;
+		return false;
+	}
+
+	if (trtol > 0 &&
+		program.truncation_ratio(soln, reltol, CHARGE_TOLERANCE) > trtol) {
+		stats.lte_rejections++;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Runs one timestep of a circuit with nonlinear devices, splitting it
+ * into substeps if the whole timestep cannot be accepted (see
+ * `step_acceptable`).
+ *
+ * A split timestep is walked in substeps (see `SubstepWalk`), with the
+ * input voltage interpolated linearly across the timestep.
+ *
+ * @param dt Input signal sampling period.
+ * @param u0 Input voltage at the previous timestep.
+ * @param u1 Input voltage at this timestep, which the voltage input holds.
+ * @param soln The solution from the previous timestep.
+ * @param prev_soln Starting guess, updated in place with the new solution.
+ * @param sys The linear system the stamp program is linked against.
+ *
+ * @return The number of newton iterations run, over all substeps.
+ */
+template <typename Scalar>
+int Circuit::run_substeps(double dt, double u0, double u1, VectorXd& soln,
+	VectorXd& prev_soln, BasicLinearSystem<Scalar>& sys) {
+
+	bool converged;
+	int iterations = run_newton(dt, soln, prev_soln, sys, converged);
+	bool acceptable = step_acceptable(prev_soln, converged);
+	if (acceptable || max_substeps <= 1) {
+		if (!converged)
+			stats.failures++;
+		program.accept(prev_soln);
+		return iterations;
+	}
+
+	/* substeps change the companion models, so the LHS has to change too */
+	stats.split_samples++;
+	predicted = false;
+	substep_soln = soln;
+	program.reset_junctions(soln);
+	factored = false;
+
+	SubstepWalk walk;
+	walk.start(max_substeps);
+	while (!walk.done()) {
+		vin->set_voltage(walk.input(u0, u1));
+
+		prev_soln = substep_soln;
+		iterations += run_newton(walk.substep(dt), substep_soln, prev_soln,
+		                         sys, converged);
+		acceptable = step_acceptable(prev_soln, converged);
+
+		if (!acceptable && walk.retry()) {
+			program.reset_junctions(substep_soln);
+			factored = false;
+			continue;
+		}
+
+		if (!converged)
+			stats.failures++;
+		program.accept(prev_soln);
+		substep_soln = prev_soln;
+		stats.substeps++;
+		if (walk.advance(acceptable))
+			factored = false;
+	}
+
+	vin->set_voltage(u1);
+	factored = false;
+	return iterations;
+}
+
+/**
+ * @brief Advances a circuit with no nonlinear devices by one timestep.
+ *
+ * Without any nonlinear devices, the LHS of the system only depends on the
+ * circuit's topology and the sampling period, so it is factored once before
+ * analysis starts. Each timestep then only restamps the RHS and does a single
+ * forward/back substitution: a single newton step from any starting point
+ * already lands on the exact solution of a linear system.
+ *
+ * @param dt Input signal sampling period.
+ * @param soln The solution from the previous timestep.
+ * @param prev_soln Starting guess, updated in place with the new solution.
+ * @param sys The linear system, whose LHS has already been factored.
+ */
+template <typename Scalar>
+void Circuit::step_linear(double dt, VectorXd& soln, VectorXd& prev_soln,
+	BasicLinearSystem<Scalar>& sys) {
+
+	sys.clear_rhs();
+	program.run_rhs(soln, prev_soln, dt);
+	prev_soln += sys.back_substitute().template cast<double>();
+}
+
+/**
+ * @brief Sets up the circuit to process blocks of input: compiles it for
+ * the chosen analysis method and zeros out its state, as if the input had
+ * been silent. State carries over from one call to `process` to the next
+ * until `stop` is called.
+ *
+ * @param dt Sampling period of the input signal. With oversampling, the
+ * circuit itself runs at a fraction of it.
+ */
+void Circuit::start(double dt) {
+	stop();
+
+	resampler = (oversampler.get_factor() > 1) ? &oversampler : NULL;
+	oversampler.reset();
+	step_dt = dt / oversampler.get_factor();
+
+	running = method;
+	if (method == METHOD_IIR && num_nonlinear > 0) {
+		std::cerr << "Circuit has nonlinear devices, so it cannot be "
+		          << "compiled into an IIR filter. Using MNA instead."
+		          << std::endl;
+		running = METHOD_MNA;
+	}
+
+	if (running == METHOD_DK || running == METHOD_TABLE) {
+		dk = DkModel();
+		if (!to_dk_model(step_dt, dk)) {
+			std::cerr << "Circuit has nodes that only its nonlinear devices "
+			          << "connect to, so it has no DK model. Using MNA "
+			          << "instead." << std::endl;
+			running = METHOD_MNA;
+		}
+	}
+
+	if (running == METHOD_IIR) {
+		StateSpace ss;
+		to_state_space(step_dt, ss);
+		filter = new IirFilter(ss);
+
+		if (filter->uses_cascade()) {
+			std::cout << "Compiled circuit into " << filter->num_sections()
+			          << " second order section(s), order "
+			          << filter->order() << "." << std::endl;
+		} else {
+			std::cout << "Compiled circuit into a state space model of "
+			          << "order " << filter->order() << "." << std::endl;
+		}
+	}
+
+	else if (running == METHOD_DK || running == METHOD_TABLE) {
+		std::cout << "Compiled circuit into a DK model of order "
+		          << dk.order() << " with " << dk.num_ports()
+		          << " nonlinear port(s)." << std::endl;
+
+		if (running == METHOD_TABLE) {
+			if (!load_port_table(step_dt, dk, table))
+				std::cerr << "Could not build a port table for this "
+				          << "circuit. Using newton's method instead."
+				          << std::endl;
+			else if (table.error_bound() > TABLE_TOLERANCE)
+				std::cerr << "Port table is not accurate to within "
+				          << TABLE_TOLERANCE << " V. Using newton's method "
+				          << "instead." << std::endl;
+			else
+				dk.table = &table;
+		}
+		running = METHOD_DK;
+	}
+
+	else if (running == METHOD_COMPILED) {
+		compiled = new CompiledCircuit();
+		to_compiled(step_dt, *compiled);
+		if (!compiled->load(table_dir, netlist_hash)) {
+			std::cerr << "Could not compile this circuit. Using MNA "
+			          << "instead." << std::endl;
+			delete compiled;
+			compiled = NULL;
+			running = METHOD_MNA;
+		}
+
+		/* the generated code only runs full newton over whole timesteps */
+		else {
+			if (max_substeps > 1)
+				std::cerr << "Compiled circuits never split timesteps into "
+				          << "substeps. Pass --max-substeps 1 to compare "
+				          << "with the MNA method." << std::endl;
+			if (newton != NEWTON_FULL)
+				std::cerr << "Compiled circuits always use full newton."
+				          << std::endl;
+			if (predictor != Predictor::PREDICT_NONE)
+				std::cerr << "Compiled circuits never use a predictor."
+				          << std::endl;
+		}
+	}
+
+	if (precision == LinearSystem::PRECISION_SINGLE && running != METHOD_MNA)
+		std::cerr << "Single precision only applies to the MNA method."
+		          << std::endl;
+
+	if (running == METHOD_MNA) {
+		if (reduce) {
+			reduction = new_reduction();
+			reduction->report(std::cout);
+		}
+		if (precision == LinearSystem::PRECISION_SINGLE) {
+			single_sys = new LinearSystemF(total_unknowns, ground_id,
+			                               unknowns, solver, reduction);
+			program.link(*single_sys);
+		} else {
+			sys = new LinearSystem(total_unknowns, ground_id, unknowns,
+			                       solver, reduction);
+			program.link(*sys);
+		}
+
+		soln = VectorXd::Zero(total_unknowns);
+		guess = VectorXd::Zero(total_unknowns);
+		substep_soln = VectorXd::Zero(total_unknowns);
+		last_voltage = 0.0;
+
+		/* linear circuits have a constant LHS - factor it once up front */
+		if (num_nonlinear == 0 && single_sys != NULL) {
+			run_kcl(step_dt, soln, guess, *single_sys);
+			single_sys->factor();
+		} else if (num_nonlinear == 0) {
+			run_kcl(step_dt, soln, guess, *sys);
+			sys->factor();
+		}
+
+		guesses = Predictor(predictor, predictor_history);
+		guesses.reset(total_unknowns);
+		singular_step = false;
+		stats.reset();
+		setup_tolerances();
+		program.reset_junctions(soln);
+		program.reset_history(soln);
+		factored = false;
+	}
+}
+
+/**
+ * @brief Reports on and tears down the state set up by `start`. Does nothing
+ * if the circuit was not started.
+ */
+void Circuit::stop() {
+	if (sys != NULL || single_sys != NULL) {
+		if (num_nonlinear > 0)
+			stats.report(std::cout, step_dt);
+		delete sys;
+		delete single_sys;
+		sys = NULL;
+		single_sys = NULL;
+	}
+
+	if (reduction != NULL) {
+		delete reduction;
+		reduction = NULL;
+	}
+
+	if (filter != NULL) {
+		delete filter;
+		filter = NULL;
+	}
+
+	if (running == METHOD_DK && dk.samples > 0) {
+		std::cout << "DK solver averaged "
+		          << (double) dk.iterations / dk.samples
+		          << " newton iteration(s) per sample";
+		if (dk.table != NULL)
+			std::cout << ", interpolated " << dk.table_hits << " of "
+			          << dk.samples << " sample(s)";
+		if (dk.failures > 0)
+			std::cout << ", failed to converge on " << dk.failures
+			          << " sample(s)";
+		std::cout << "." << std::endl;
+	}
+
+	if (compiled != NULL) {
+		long samples, iterations, failures, fallbacks;
+		compiled->counts(&samples, &iterations, &failures, &fallbacks);
+		if (num_nonlinear > 0 && samples > 0) {
+			std::cout << "Compiled circuit averaged "
+			          << (double) iterations / samples
+			          << " newton iteration(s) per sample";
+			if (fallbacks > 0)
+				std::cout << ", fell back to pivoting on " << fallbacks
+				          << " iteration(s)";
+			if (failures > 0)
+				std::cout << ", failed to converge on " << failures
+				          << " sample(s)";
+			std::cout << "." << std::endl;
+		}
+		delete compiled;
+		compiled = NULL;
+	}
+	running = METHOD_MNA;
+}
+
+/**
+ * @brief Gets the delay, in input samples, between a sample going into
+ * `process` and its response coming out. This is only nonzero when the
+ * circuit is oversampled, from the resampling filters.
+ */
+int Circuit::latency() const {
+	return (oversampler.get_factor() > 1) ? oversampler.latency() : 0;
+}
+
+/**
+ * @brief Advances the circuit's full MNA system by one timestep, running
+ * newton's method (in substeps if need be) if it has nonlinear devices.
+ *
+ * @param u Input voltage for the timestep.
+ * @param sys The MNA system, in the precision the circuit was started in.
+ *
+ * @return The output voltage.
+ */
+template <typename Scalar>
+double Circuit::step_mna(double u, BasicLinearSystem<Scalar>& sys) {
+	vin->set_voltage(u);
+	guess = soln;
+
+	/* no newton iterations needed for linear circuits */
+	if (num_nonlinear == 0) {
+		step_linear(step_dt, soln, guess, sys);
+		program.accept(guess);
+	}
+
+	/* start from the previous timestep's solution, or extrapolate */
+	else {
+		guesses.predict(u, guess);
+
+		/* a prediction must not change the solution newton converges to:
+		 * drop it if a device would have to be limited to reach it from
+		 * the previous solution, or if the LHS was singular (see
+		 * `run_newton`) */
+		if (singular_step || program.would_limit(guess))
+			guess = soln;
+		predicted = (guess != soln);
+
+		int iterations = run_substeps(step_dt, last_voltage, u, soln, guess,
+		                              sys);
+		predicted = false;
+		singular_step = sys.rank_deficient();
+		guesses.accept(u, guess);
+		stats.record(iterations);
+	}
+
+	soln = guess;
+	last_voltage = u;
+	return vout->voltage(soln);
+}
+
+/**
+ * @brief Advances the circuit by one timestep with the method it was
+ * started with.
+ *
+ * @param u Input voltage for the timestep.
+ *
+ * @return The output voltage.
+ */
+double Circuit::step(double u) {
+	switch (running) {
+		case METHOD_IIR: return filter->process(u);
+		case METHOD_DK:  return dk.step(u);
+		case METHOD_COMPILED: return compiled->step(u);
+		default:
+			if (single_sys != NULL)
+				return step_mna(u, *single_sys);
+			return step_mna(u, *sys);
+	}
+}
+
+/**
+ * @brief Runs the circuit over a block of input samples, picking up from
+ * where the last block left off. The circuit must have been started.
+ *
+ * Nothing here reads from or writes to the outside world or allocates, so
+ * blocks can be driven from an audio callback as well as from a file. When
+ * the circuit is oversampled, the input is upsampled on its way in and the
+ * output decimated on its way out, which delays the output by `latency`
+ * samples.
+ *
+ * @param in Input voltages.
+ * @param out Filled in with the output voltages. May alias `in`.
+ * @param n Number of samples in the block.
+ */
+void Circuit::process(const float *in, float *out, size_t n) {
+	if (resampler == NULL && running == METHOD_COMPILED) {
+		compiled->process(in, out, n);
+		return;
+	}
+
+	if (resampler == NULL) {
+		for (size_t i = 0; i < n; i++)
+			out[i] = (float) step(in[i]);
+		return;
+	}
+
+	int factor = resampler->get_factor();
+	for (size_t i = 0; i < n; i++) {
+		double y = 0.0;
+		resampler->push_input(in[i]);
+		for (int j = 0; j < factor; j++)
+			resampler->push_output(step(resampler->pop_input()), &y);
+		out[i] = (float) y;
 	}
 }
 
@@ -158,48 +1297,84 @@ void Circuit::run_kcl(double dt, VectorXd& soln, VectorXd& prev_soln,
  * @brief Runs transient analysis on a circuit agains the signal provided
  * by the VoltageIn circuit component.
  *
- * @param timescale Vector to be filled with all the time values produced
- * during analysis.
+ * @param monitor Sink that is handed the input and output signals a block
+ * at a time as they are produced (e.g. to plot them), or NULL.
  *
- * @param input_signal The input signal provided by the VoltageIn component.
+ * The signal is read, run through `process` and written back out a block at
+ * a time, so memory use does not grow with the length of the signal. After
+ * the first block, nothing allocates. That is checked by the allocation
+ * audit when it is enabled.
  *
- * @param output_signal The output signal measured across the nodes specified
- * by the VoltageOut component.
- *
- * This function destructively modifies all three vectors by populating them
- * with the simulation results.
+ * When the circuit is oversampled, the end of the input is padded with
+ * `latency` samples of silence and the first `latency` outputs are dropped,
+ * so that the output lines up with the input. The monitor's input is held
+ * back by the same amount.
  */
-void Circuit::transient(vector<double>& timescale,
-	                    vector<double>& input_signal,
-	                    vector<double>& output_signal) {
+void Circuit::transient(SignalSink *monitor) {
 
+	auto start_time = std::chrono::steady_clock::now();
 	double dt = vin->get_sampling_period();
-	double t = 0;
-	double voltage;
 
-	LinearSystem sys(total_unknowns, ground_id, unknowns);
-	VectorXd prev_soln(total_unknowns);
-	VectorXd soln(total_unknowns);
-	soln.setZero();
+	start(dt);
 
-	while(vin->next_voltage(&voltage)) {
-		timescale.push_back(t);
-		input_signal.push_back(voltage);
-		bool converged = false;
+	size_t block_size = vin->block_size();
+	vector<float> in(block_size);
+	vector<float> out(block_size);
+	int padding = latency();
+	int skip = latency();
 
-		/* save solution from previous timestep */
-		prev_soln = soln;
+	/* inputs whose outputs the monitor has not been handed yet */
+	vector<float> pending;
+	pending.reserve(latency() + block_size);
+	long written = 0;
 
-		/* run at most MAX_ITERATIONS iterations of newton's method */
-		for (int iter = 0; iter < MAX_ITERATIONS && !converged; iter++) {
-			run_kcl(dt, soln, prev_soln, sys);
-			auto deltas = sys.solve();
-			converged = process_deltas(deltas, prev_soln);
+	while (true) {
+		size_t n = vin->read_block(in.data(), block_size);
+		if (n > 0) {
+			if (monitor != NULL)
+				pending.insert(pending.end(), in.begin(), in.begin() + n);
+		} else if (padding > 0) {
+			n = std::min((size_t) padding, block_size);
+			std::fill(in.begin(), in.begin() + n, 0.0f);
+			padding -= n;
+		} else {
+			break;
 		}
 
-		/* record solution for this timestep and advance simulation time */
-		soln = prev_soln;
-		output_signal.push_back(vout->measure(sys, soln));
-		t += dt;
+		process(in.data(), out.data(), n);
+
+		/* drop the resampling filters' delay off the front of the output */
+		size_t drop = std::min((size_t) skip, n);
+		size_t ready = n - drop;
+		skip -= drop;
+		vout->write_block(out.data() + drop, ready);
+
+		if (monitor != NULL && ready > 0) {
+			monitor->write(written, dt, pending.data(), out.data() + drop,
+			               ready);
+			pending.erase(pending.begin(), pending.begin() + ready);
+		}
+		written += ready;
+
+		/* everything past the first block must run without allocating */
+		AllocAudit::arm();
+	}
+
+	AllocAudit::disarm();
+	stop();
+
+	if (AllocAudit::supported() &&
+		AllocAudit::get_mode() != AllocAudit::AUDIT_OFF) {
+		std::cout << "Audio path made " << AllocAudit::allocations()
+		          << " heap allocation(s) after the first block."
+		          << std::endl;
 	}
+
+	if (resampler != NULL) {
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start_time;
+		oversampler.report(std::cout, elapsed.count());
+	}
+
+	vin->finish();
 }
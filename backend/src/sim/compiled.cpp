@@ -0,0 +1,850 @@
+/**
+ *
+ * @file compiled.cpp
+ *
+ * @brief This file contains the implementation of compiled circuits: the
+ * code generator for a circuit's MNA timestep, and the building, caching
+ * and loading of the shared objects it is compiled into.
+ *
+ */
+
+#include <compiled.hpp>
+#include <components/component.hpp>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+using std::endl;
+
+/** @brief Compiler used to build generated code, unless CSIM_CXX is set
+ * (to a command, optionally followed by arguments) */
+#define DEFAULT_CXX "g++"
+
+/** @brief Flags generated code is built with */
+#define CXX_FLAGS "-std=c++17 -O2 -fPIC -shared"
+
+/*
+ * Layout of the state the generated code keeps: newton counts, then the
+ * last solution, capacitor history and diode junction voltages.
+ */
+#define STATE_SAMPLES 0
+#define STATE_ITERATIONS 1
+#define STATE_FAILURES 2
+#define STATE_FALLBACKS 3
+#define STATE_SOLUTION 4
+
+/**
+ * @brief Formats a constant so that the compiler reads it back exactly.
+ *
+ * @param value The constant.
+ *
+ * @return A double literal, parenthesized if negative.
+ */
+static string literal(double value) {
+	char buf[40];
+	snprintf(buf, sizeof(buf), "%.17g", value);
+	string s = buf;
+	if (s.find_first_of(".en") == string::npos)
+		s += ".0";
+	return (value < 0) ? "(" + s + ")" : s;
+}
+
+/**
+ * @brief Writes the voltage between two unknowns of the solution `x`, with
+ * the ground node folded away.
+ *
+ * @param var Name of the array holding the solution (less ground).
+ * @param red Index of each unknown in that array, or -1 for ground.
+ * @param a The (+) unknown.
+ * @param b The (-) unknown.
+ *
+ * @return The expression.
+ */
+static string voltage(const char *var, const vector<int>& red, int a, int b) {
+	std::ostringstream out;
+	if (red[a] < 0 && red[b] < 0)
+		out << "0.0";
+	else if (red[b] < 0)
+		out << var << "[" << red[a] << "]";
+	else if (red[a] < 0)
+		out << "-" << var << "[" << red[b] << "]";
+	else
+		out << "(" << var << "[" << red[a] << "] - " << var << "["
+		    << red[b] << "])";
+	return out.str();
+}
+
+/**
+ * @brief Computes an FNV-1a hash of a string.
+ *
+ * @param s The string.
+ *
+ * @return The hash.
+ */
+static uint64_t hash_string(const string& s) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (char c : s) {
+		hash ^= (uint64_t) (unsigned char) c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * @brief Constructs a compiled circuit, with no description and nothing
+ * loaded yet.
+ */
+CompiledCircuit::CompiledCircuit()
+	: program(NULL), num_unknowns(0), ground(0), dt(0.0), reltol(0.0),
+	  max_iterations(0), max_recoveries(0), min_damping(1.0), handle(NULL),
+	  reset_fn(NULL), step_fn(NULL), process_fn(NULL) { }
+
+/**
+ * @brief Unloads the shared object, if one was loaded.
+ */
+CompiledCircuit::~CompiledCircuit() {
+	if (handle != NULL)
+		dlclose(handle);
+}
+
+/**
+ * @brief Generates the translation unit for the circuit.
+ *
+ * Stamps are laid out in the order the stamp program applies them, so
+ * that every entry of the system sums its contributions in the same order
+ * as the interpreted MNA method does.
+ *
+ * @return The source, or an empty string if the circuit's LHS is singular
+ * at rest (so that no elimination order can be chosen).
+ */
+string CompiledCircuit::source() const {
+	const StampProgram::ResistorGroup& res = program->resistor_devices();
+	const StampProgram::CapacitorGroup& caps = program->capacitor_devices();
+	const StampProgram::DiodeGroup& diodes = program->nonlinear_devices();
+	const StampProgram::SourceGroup& srcs = program->source_devices();
+	StampProgram::integration_t method = program->integration();
+
+	int m = num_unknowns - 1;
+	int nc = caps.c.size();
+	int nd = diodes.is.size();
+	bool linear = (nd == 0);
+
+	/* unknowns less ground */
+	vector<int> red(num_unknowns);
+	for (int i = 0; i < num_unknowns; i++)
+		red[i] = (i == ground) ? -1 : (i < ground ? i : i - 1);
+
+	/*
+	 * Lay out every stamp. LHS entries fold their resistor, capacitor and
+	 * source contributions into a constant (diodes come last), and RHS
+	 * entries collect the names of the values they sum.
+	 */
+	struct Entry {
+		bool stamped = false;
+		double constant = 0.0;
+		vector<std::pair<int, int>> diodes;  /* sign and diode index */
+	};
+	vector<vector<Entry>> lhs(m, vector<Entry>(m));
+	vector<string> rhs(m, "0.0");
+
+	auto stamp_lhs = [&](int r, int c, int sign, double coeff, int diode) {
+		if (red[r] < 0 || red[c] < 0)
+			return;
+		Entry& e = lhs[red[r]][red[c]];
+		e.stamped = true;
+		if (diode < 0)
+			e.constant += sign * coeff;
+		else
+			e.diodes.push_back(std::make_pair(sign, diode));
+	};
+	auto stamp_rhs = [&](int r, int sign, const string& value) {
+		if (red[r] >= 0)
+			rhs[red[r]] += (sign > 0 ? " + " : " - ") + value;
+	};
+	auto stamp_two_terminal = [&](int n1, int n2, double coeff, int diode,
+	                              const string& value) {
+		stamp_lhs(n1, n1, +1, coeff, diode);
+		stamp_lhs(n2, n2, +1, coeff, diode);
+		stamp_lhs(n1, n2, -1, coeff, diode);
+		stamp_lhs(n2, n1, -1, coeff, diode);
+		stamp_rhs(n1, +1, value);
+		stamp_rhs(n2, -1, value);
+	};
+
+	vector<double> geq(nc);
+	for (int k = 0; k < (int) res.g.size(); k++) {
+		stamp_two_terminal(res.n1[k], res.n2[k], res.lhs_coeffs[k], -1,
+		                   "ir" + std::to_string(k));
+	}
+	for (int k = 0; k < nc; k++) {
+		/* the conductance only depends on the (fixed) timestep */
+		double hist;
+		StampProgram::CapacitorGroup::companion(method, caps.c[k], dt, 1.0,
+		                                        0.0, 0.0, &geq[k], &hist);
+		stamp_two_terminal(caps.n1[k], caps.n2[k], geq[k], -1,
+		                   "ic" + std::to_string(k));
+	}
+	for (int k = 0; k < (int) srcs.n1.size(); k++) {
+		string is = "is" + std::to_string(k);
+		stamp_lhs(srcs.ni[k], srcs.n1[k], +1, 1.0, -1);
+		stamp_lhs(srcs.ni[k], srcs.n2[k], -1, 1.0, -1);
+		stamp_lhs(srcs.n1[k], srcs.ni[k], -1, 1.0, -1);
+		stamp_lhs(srcs.n2[k], srcs.ni[k], +1, 1.0, -1);
+		stamp_rhs(srcs.ni[k], +1, "vs" + std::to_string(k));
+		stamp_rhs(srcs.n1[k], +1, is);
+		stamp_rhs(srcs.n2[k], -1, is);
+	}
+	for (int k = 0; k < nd; k++) {
+		stamp_two_terminal(diodes.n1[k], diodes.n2[k], 0.0, k,
+		                   "id" + std::to_string(k));
+	}
+
+	/* pick the elimination order by partial pivoting the LHS at rest */
+	vector<vector<double>> W(m, vector<double>(m, 0.0));
+	for (int i = 0; i < m; i++) {
+		for (int j = 0; j < m; j++) {
+			W[i][j] = lhs[i][j].constant;
+			for (const auto& d : lhs[i][j].diodes) {
+				int k = d.second;
+				W[i][j] += d.first * diodes.is[k] * diodes.nvt_inv[k];
+			}
+		}
+	}
+	vector<int> order(m);
+	for (int i = 0; i < m; i++)
+		order[i] = i;
+	vector<double> inv_diag(m);
+	for (int k = 0; k < m; k++) {
+		int p = k;
+		for (int i = k + 1; i < m; i++) {
+			if (fabs(W[i][k]) > fabs(W[p][k]))
+				p = i;
+		}
+		if (W[p][k] == 0.0)
+			return "";
+		std::swap(W[k], W[p]);
+		std::swap(order[k], order[p]);
+
+		inv_diag[k] = 1.0 / W[k][k];
+		for (int i = k + 1; i < m; i++) {
+			double l = W[i][k] * inv_diag[k];
+			W[i][k] = l;
+			for (int j = k + 1; j < m; j++)
+				W[i][j] -= l * W[k][j];
+		}
+	}
+	vector<int> position(m);
+	for (int p = 0; p < m; p++)
+		position[order[p]] = p;
+
+	/* nonzero pattern of the LHS in elimination order */
+	vector<vector<bool>> pattern(m, vector<bool>(m));
+	for (int p = 0; p < m; p++) {
+		for (int j = 0; j < m; j++)
+			pattern[p][j] = lhs[order[p]][j].stamped;
+	}
+
+	std::ostringstream out;
+	out << "/* Generated by csim for one circuit. Do not edit. */\n"
+	    << "#include <float.h>\n"
+	    << "#include <math.h>\n"
+	    << "#include <stddef.h>\n\n"
+	    << "#define M " << m << "\n"
+	    << "#define AUX " << STATE_SOLUTION + m << "\n"
+	    << "#define VJ " << STATE_SOLUTION + m + nc << "\n"
+	    << "#define STATE " << STATE_SOLUTION + m + nc + nd << "\n\n";
+
+	if (!linear) {
+		out << "static inline double limit(double vnew, double vold, "
+		       "double nvt, double nvt_inv,\n"
+		    << "                           double vcrit) {\n"
+		    << "\tif (vnew <= vcrit || fabs(vnew - vold) <= 2 * nvt)\n"
+		    << "\t\treturn vnew;\n"
+		    << "\tif (vold > 0) {\n"
+		    << "\t\tdouble arg = 1 + (vnew - vold) * nvt_inv;\n"
+		    << "\t\treturn (arg > 0) ? vold + nvt * log(arg) : vcrit;\n"
+		    << "\t}\n"
+		    << "\treturn nvt * log(vnew * nvt_inv);\n"
+		    << "}\n\n";
+
+		/* the LHS, with rows in elimination order */
+		out << "static inline void lhs(double a[M][M], const double *gd) {\n";
+		for (int p = 0; p < m; p++) {
+			for (int j = 0; j < m; j++) {
+				const Entry& e = lhs[order[p]][j];
+				if (!e.stamped)
+					continue;
+				out << "\ta[" << p << "][" << j << "] = "
+				    << literal(e.constant);
+				for (const auto& d : e.diodes) {
+					out << (d.first > 0 ? " + " : " - ") << "gd["
+					    << d.second << "]";
+				}
+				out << ";\n";
+			}
+		}
+		out << "}\n\n";
+
+		/* LU without pivoting, over the pattern and its fill-in */
+		out << "static inline bool factor(double a[M][M], double *d) {\n";
+		for (int k = 0; k < m; k++) {
+			bool below = false;
+			for (int i = k + 1; i < m; i++) {
+				if (!pattern[i][k])
+					continue;
+				string col = "col" + std::to_string(k);
+				if (below)
+					out << "\t" << col << " = fmax(" << col << ", ";
+				else
+					out << "\tdouble " << col << " = (";
+				out << "fabs(a[" << i << "][" << k << "]));\n";
+				below = true;
+			}
+			if (below)
+				out << "\tif (!(fabs(a[" << k << "][" << k << "]) > "
+				    << literal(PIVOT_TOLERANCE) << " * col" << k
+				    << "))\n\t\treturn false;\n";
+			else
+				out << "\tif (!(fabs(a[" << k << "][" << k
+				    << "]) > 0.0))\n\t\treturn false;\n";
+
+			out << "\td[" << k << "] = 1.0 / a[" << k << "][" << k << "];\n";
+			for (int i = k + 1; i < m; i++) {
+				if (!pattern[i][k])
+					continue;
+				out << "\ta[" << i << "][" << k << "] *= d[" << k << "];\n";
+				for (int j = k + 1; j < m; j++) {
+					if (!pattern[k][j])
+						continue;
+					if (pattern[i][j]) {
+						out << "\ta[" << i << "][" << j << "] -= a[" << i
+						    << "][" << k << "] * a[" << k << "][" << j
+						    << "];\n";
+					} else {
+						out << "\ta[" << i << "][" << j << "] = -(a[" << i
+						    << "][" << k << "] * a[" << k << "][" << j
+						    << "]);\n";
+						pattern[i][j] = true;
+					}
+				}
+			}
+		}
+		out << "\treturn true;\n}\n\n";
+	}
+
+	/* forward and back substitution, with constant factors if linear */
+	out << (linear ? "static inline void solve(double *b) {\n"
+	               : "static inline void solve(const double a[M][M], "
+	                 "const double *d, double *b) {\n");
+	auto factor_entry = [&](int i, int j) -> string {
+		if (linear)
+			return literal(W[i][j]);
+		return "a[" + std::to_string(i) + "][" + std::to_string(j) + "]";
+	};
+	auto used = [&](int i, int j) -> bool {
+		return linear ? (W[i][j] != 0.0) : (bool) pattern[i][j];
+	};
+	for (int i = 1; i < m; i++) {
+		for (int j = 0; j < i; j++) {
+			if (used(i, j))
+				out << "\tb[" << i << "] -= " << factor_entry(i, j)
+				    << " * b[" << j << "];\n";
+		}
+	}
+	for (int i = m - 1; i >= 0; i--) {
+		for (int j = i + 1; j < m; j++) {
+			if (used(i, j))
+				out << "\tb[" << i << "] -= " << factor_entry(i, j)
+				    << " * b[" << j << "];\n";
+		}
+		out << "\tb[" << i << "] *= "
+		    << (linear ? literal(inv_diag[i]) : "d[" + std::to_string(i) + "]")
+		    << ";\n";
+	}
+	out << "}\n\n";
+
+	if (!linear) {
+		/*
+		 * A QR factorization with column pivoting, like the MNA method's
+		 * fallback, reveals the rank of a singular LHS (e.g. nodes left
+		 * floating by reverse biased diodes). Unknowns beyond the rank are
+		 * left where they are. A column counts towards the rank by Eigen's
+		 * rule, so that both methods settle the same unknowns: its norm must
+		 * stay above epsilon times the largest column norm of the LHS.
+		 */
+		out << "static void solve_pivoting(const double *gd, double *b) {\n"
+		    << "\tdouble a[M][M] = {};\n"
+		    << "\tint cols[M];\n"
+		    << "\tdouble y[M];\n"
+		    << "\tlhs(a, gd);\n"
+		    << "\tdouble largest = 0.0;\n"
+		    << "\tfor (int i = 0; i < M; i++) {\n"
+		    << "\t\tcols[i] = i;\n"
+		    << "\t\tfor (int j = 0; j < M; j++) {\n"
+		    << "\t\t\tif (!(fabs(a[i][j]) <= largest))\n"
+		    << "\t\t\t\tlargest = fabs(a[i][j]);\n"
+		    << "\t\t}\n"
+		    << "\t}\n"
+		    << "\tif (!isfinite(largest)) {\n"
+		    << "\t\tfor (int i = 0; i < M; i++)\n"
+		    << "\t\t\tb[i] = NAN;\n"
+		    << "\t\treturn;\n"
+		    << "\t}\n\n"
+		    << "\tint rank = 0;\n"
+		    << "\tdouble max_norm = 0.0;\n"
+		    << "\tfor (int j = 0; j < M; j++) {\n"
+		    << "\t\tdouble norm = 0.0;\n"
+		    << "\t\tfor (int i = 0; i < M; i++)\n"
+		    << "\t\t\tnorm += a[i][j] * a[i][j];\n"
+		    << "\t\tmax_norm = fmax(max_norm, norm);\n"
+		    << "\t}\n"
+		    << "\tdouble rank_floor = max_norm * DBL_EPSILON * DBL_EPSILON / M;\n"
+		    << "\tfor (int k = 0; k < M; k++) {\n"
+		    << "\t\tint q = k;\n"
+		    << "\t\tdouble best = -1.0;\n"
+		    << "\t\tfor (int j = k; j < M; j++) {\n"
+		    << "\t\t\tdouble norm = 0.0;\n"
+		    << "\t\t\tfor (int i = k; i < M; i++)\n"
+		    << "\t\t\t\tnorm += a[i][j] * a[i][j];\n"
+		    << "\t\t\tif (norm > best) {\n"
+		    << "\t\t\t\tbest = norm;\n"
+		    << "\t\t\t\tq = j;\n"
+		    << "\t\t\t}\n"
+		    << "\t\t}\n"
+		    << "\t\tfor (int i = 0; i < M; i++) {\n"
+		    << "\t\t\tdouble t = a[i][k];\n"
+		    << "\t\t\ta[i][k] = a[i][q];\n"
+		    << "\t\t\ta[i][q] = t;\n"
+		    << "\t\t}\n"
+		    << "\t\tint c = cols[k];\n"
+		    << "\t\tcols[k] = cols[q];\n"
+		    << "\t\tcols[q] = c;\n\n"
+		    << "\t\tif (!(best >= rank_floor * (M - k)))\n"
+		    << "\t\t\tbreak;\n"
+		    << "\t\tdouble alpha = sqrt(best);\n"
+		    << "\t\trank = k + 1;\n\n"
+		    << "\t\t/* reflect the column onto the diagonal */\n"
+		    << "\t\tif (a[k][k] > 0)\n"
+		    << "\t\t\talpha = -alpha;\n"
+		    << "\t\tdouble v0 = a[k][k] - alpha;\n"
+		    << "\t\tdouble vv = v0 * v0;\n"
+		    << "\t\tfor (int i = k + 1; i < M; i++)\n"
+		    << "\t\t\tvv += a[i][k] * a[i][k];\n"
+		    << "\t\tfor (int j = k + 1; j < M; j++) {\n"
+		    << "\t\t\tdouble dot = v0 * a[k][j];\n"
+		    << "\t\t\tfor (int i = k + 1; i < M; i++)\n"
+		    << "\t\t\t\tdot += a[i][k] * a[i][j];\n"
+		    << "\t\t\tdouble scale = 2 * dot / vv;\n"
+		    << "\t\t\ta[k][j] -= scale * v0;\n"
+		    << "\t\t\tfor (int i = k + 1; i < M; i++)\n"
+		    << "\t\t\t\ta[i][j] -= scale * a[i][k];\n"
+		    << "\t\t}\n"
+		    << "\t\tdouble dot = v0 * b[k];\n"
+		    << "\t\tfor (int i = k + 1; i < M; i++)\n"
+		    << "\t\t\tdot += a[i][k] * b[i];\n"
+		    << "\t\tdouble scale = 2 * dot / vv;\n"
+		    << "\t\tb[k] -= scale * v0;\n"
+		    << "\t\tfor (int i = k + 1; i < M; i++)\n"
+		    << "\t\t\tb[i] -= scale * a[i][k];\n"
+		    << "\t\ta[k][k] = alpha;\n"
+		    << "\t}\n\n"
+		    << "\tfor (int i = M - 1; i >= 0; i--) {\n"
+		    << "\t\ty[i] = 0.0;\n"
+		    << "\t\tif (i >= rank)\n"
+		    << "\t\t\tcontinue;\n"
+		    << "\t\tdouble v = b[i];\n"
+		    << "\t\tfor (int j = i + 1; j < rank; j++)\n"
+		    << "\t\t\tv -= a[i][j] * y[j];\n"
+		    << "\t\ty[i] = v / a[i][i];\n"
+		    << "\t}\n"
+		    << "\tfor (int j = 0; j < M; j++)\n"
+		    << "\t\tb[cols[j]] = y[j];\n"
+		    << "}\n\n";
+	}
+
+	/* one timestep */
+	out << "static double step(double *s, double u) {\n"
+	    << "\tdouble *x = s + " << STATE_SOLUTION << ";\n"
+	    << "\tdouble *aux = s + AUX;\n";
+	if (!linear)
+		out << "\tdouble *vj = s + VJ;\n";
+	out << "\tdouble soln[M];\n"
+	    << "\tfor (int r = 0; r < M; r++)\n"
+	    << "\t\tsoln[r] = x[r];\n"
+	    << "\t(void) aux;\n\n";
+
+	for (int k = 0; k < nc; k++) {
+		string v1 = voltage("soln", red, caps.n1[k], caps.n2[k]);
+		out << "\tdouble vlast" << k << " = " << v1 << ";\n";
+		out << "\tdouble hist" << k << " = ";
+		if (method == StampProgram::INTEGRATE_TRAP)
+			out << literal(geq[k]) << " * vlast" << k << " + aux[" << k << "]";
+		else if (method == StampProgram::INTEGRATE_BDF2)
+			out << literal(caps.c[k] / dt) << " * (2.0 * vlast" << k
+			    << " - 0.5 * aux[" << k << "])";
+		else
+			out << literal(geq[k]) << " * vlast" << k;
+		out << ";\n";
+	}
+
+	/* the residual at the current guess, in elimination order */
+	std::ostringstream residual;
+	for (int k = 0; k < (int) res.g.size(); k++) {
+		residual << "\tdouble ir" << k << " = " << literal(res.g[k]) << " * "
+		         << voltage("x", red, res.n2[k], res.n1[k]) << ";\n";
+	}
+	for (int k = 0; k < nc; k++) {
+		residual << "\tdouble ic" << k << " = hist" << k << " - "
+		         << literal(geq[k]) << " * "
+		         << voltage("x", red, caps.n1[k], caps.n2[k]) << ";\n";
+	}
+	for (int k = 0; k < (int) srcs.n1.size(); k++) {
+		residual << "\tdouble vs" << k << " = u - "
+		         << voltage("x", red, srcs.n1[k], srcs.n2[k]) << ";\n"
+		         << "\tdouble is" << k << " = x[" << red[srcs.ni[k]]
+		         << "];\n";
+	}
+	residual << "\tdouble b[M];\n";
+	for (int r = 0; r < m; r++)
+		residual << "\tb[" << position[r] << "] = " << rhs[r] << ";\n";
+
+	/* the output voltage */
+	std::ostringstream output_expr;
+	output_expr << "0.0";
+	for (int i = 0; i < num_unknowns; i++) {
+		if (output(i) == 0.0 || red[i] < 0)
+			continue;
+		if (output(i) == 1.0)
+			output_expr << " + x[" << red[i] << "]";
+		else if (output(i) == -1.0)
+			output_expr << " - x[" << red[i] << "]";
+		else
+			output_expr << " + " << literal(output(i)) << " * x[" << red[i]
+			            << "]";
+	}
+
+	if (linear) {
+		out << "\n" << residual.str()
+		    << "\tsolve(b);\n"
+		    << "\tfor (int r = 0; r < M; r++)\n"
+		    << "\t\tx[r] += b[r];\n"
+		    << "\ts[" << STATE_SAMPLES << "] += 1;\n";
+	} else {
+		out << "\n\tbool converged = false;\n"
+		    << "\tdouble last_update = INFINITY;\n"
+		    << "\tdouble damping = 1.0;\n"
+		    << "\tint recoveries = 0;\n"
+		    << "\tint iter;\n"
+		    << "\tfor (iter = 0; iter < " << max_iterations
+		    << " && !converged; iter++) {\n"
+		    << "\tbool limited = false;\n"
+		    << "\tdouble gd[" << nd << "];\n";
+		for (int k = 0; k < nd; k++) {
+			double nvt_inv = diodes.nvt_inv[k];
+			out << "\tdouble id" << k << ";\n"
+			    << "\t{\n"
+			    << "\t\tdouble v = "
+			    << voltage("x", red, diodes.n1[k], diodes.n2[k]) << ";\n"
+			    << "\t\tdouble vl = limit(v, vj[" << k << "], "
+			    << literal(1.0 / nvt_inv) << ", " << literal(nvt_inv) << ", "
+			    << literal(diodes.vcrit[k]) << ");\n"
+			    << "\t\tlimited = limited || (vl != v);\n"
+			    << "\t\tvj[" << k << "] = vl;\n"
+			    << "\t\tdouble e = exp(vl * " << literal(nvt_inv) << ");\n"
+			    << "\t\tdouble i = " << literal(diodes.is[k])
+			    << " * (e - 1);\n"
+			    << "\t\tgd[" << k << "] = " << literal(diodes.is[k])
+			    << " * e * " << literal(nvt_inv) << ";\n"
+			    << "\t\tid" << k << " = -(i + gd[" << k << "] * (v - vl));\n"
+			    << "\t}\n";
+		}
+		out << residual.str()
+		    << "\tdouble a[M][M];\n"
+		    << "\tdouble d[M];\n"
+		    << "\tlhs(a, gd);\n"
+		    << "\tif (factor(a, d)) {\n"
+		    << "\t\tsolve(a, d, b);\n"
+		    << "\t} else {\n"
+		    << "\t\tsolve_pivoting(gd, b);\n"
+		    << "\t\ts[" << STATE_FALLBACKS << "] += 1;\n"
+		    << "\t}\n\n";
+
+		/* restart from the last timestep if the solution blew up */
+		out << "\tdouble update = 0.0;\n"
+		    << "\tfor (int r = 0; r < M; r++) {\n"
+		    << "\t\tif (!(fabs(b[r]) <= update))\n"
+		    << "\t\t\tupdate = fabs(b[r]);\n"
+		    << "\t}\n"
+		    << "\tif (!isfinite(update)) {\n"
+		    << "\t\tif (recoveries == " << max_recoveries << ")\n"
+		    << "\t\t\tbreak;\n"
+		    << "\t\trecoveries++;\n"
+		    << "\t\tfor (int r = 0; r < M; r++)\n"
+		    << "\t\t\tx[r] = soln[r];\n";
+		for (int k = 0; k < nd; k++) {
+			out << "\t\tvj[" << k << "] = "
+			    << voltage("x", red, diodes.n1[k], diodes.n2[k]) << ";\n";
+		}
+		out << "\t\tdamping = ldexp(1.0, -recoveries);\n"
+		    << "\t\tlast_update = INFINITY;\n"
+		    << "\t\tcontinue;\n"
+		    << "\t}\n\n";
+
+		/* damp updates that grow, then take the update */
+		out << "\tif (update > last_update)\n"
+		    << "\t\tdamping = fmax(damping / 2, " << literal(min_damping)
+		    << ");\n"
+		    << "\telse\n"
+		    << "\t\tdamping = fmin(damping * 2, 1.0);\n"
+		    << "\tlast_update = update;\n\n"
+		    << "\tbool within = true;\n";
+		for (int i = 0; i < num_unknowns; i++) {
+			int r = red[i];
+			if (r < 0)
+				continue;
+			out << "\twithin = within && (fabs(b[" << r << "]) <= "
+			    << literal(reltol) << " * fmax(fabs(x[" << r
+			    << "]), fabs(x[" << r << "] + b[" << r << "])) + "
+			    << literal(abs_tolerances(i)) << ");\n"
+			    << "\tx[" << r << "] += damping * b[" << r << "];\n";
+		}
+		out << "\tconverged = within && !limited;\n"
+		    << "\t}\n\n";
+
+		/* never carry a solution that blew up into the next timestep */
+		out << "\ts[" << STATE_SAMPLES << "] += 1;\n"
+		    << "\ts[" << STATE_ITERATIONS << "] += iter;\n"
+		    << "\tif (!converged) {\n"
+		    << "\t\ts[" << STATE_FAILURES << "] += 1;\n"
+		    << "\t\tbool finite = true;\n"
+		    << "\t\tfor (int r = 0; r < M; r++)\n"
+		    << "\t\t\tfinite = finite && isfinite(x[r]);\n"
+		    << "\t\tif (!finite) {\n"
+		    << "\t\t\tfor (int r = 0; r < M; r++)\n"
+		    << "\t\t\t\tx[r] = soln[r];\n";
+		for (int k = 0; k < nd; k++) {
+			out << "\t\t\tvj[" << k << "] = "
+			    << voltage("x", red, diodes.n1[k], diodes.n2[k]) << ";\n";
+		}
+		out << "\t\t}\n"
+		    << "\t}\n";
+	}
+
+	/* advance the capacitors' history */
+	for (int k = 0; k < nc; k++) {
+		if (method == StampProgram::INTEGRATE_TRAP) {
+			out << "\taux[" << k << "] = " << literal(geq[k]) << " * "
+			    << voltage("x", red, caps.n1[k], caps.n2[k]) << " - hist"
+			    << k << ";\n";
+		} else if (method == StampProgram::INTEGRATE_BDF2) {
+			out << "\taux[" << k << "] = vlast" << k << ";\n";
+		}
+	}
+	out << "\treturn " << output_expr.str() << ";\n"
+	    << "}\n\n";
+
+	out << "extern \"C\" {\n\n"
+	    << "int csim_abi(void) {\n"
+	    << "\treturn " << ABI_VERSION << ";\n"
+	    << "}\n\n"
+	    << "int csim_state_size(void) {\n"
+	    << "\treturn STATE;\n"
+	    << "}\n\n"
+	    << "void csim_reset(double *s) {\n"
+	    << "\tfor (int i = 0; i < STATE; i++)\n"
+	    << "\t\ts[i] = 0.0;\n"
+	    << "}\n\n"
+	    << "double csim_step(double *s, double u) {\n"
+	    << "\treturn step(s, u);\n"
+	    << "}\n\n"
+	    << "void csim_process(double *s, const float *in, float *out, "
+	       "size_t n) {\n"
+	    << "\tfor (size_t i = 0; i < n; i++)\n"
+	    << "\t\tout[i] = (float) step(s, in[i]);\n"
+	    << "}\n\n"
+	    << "}\n";
+
+	return out.str();
+}
+
+/**
+ * @brief Runs the compiler and waits for it to finish.
+ *
+ * @param args The compiler followed by its arguments.
+ *
+ * @return True if the compiler ran and succeeded and false otherwise.
+ */
+static bool run_compiler(const vector<string>& args) {
+	if (args.empty())
+		return false;
+
+	vector<char*> argv;
+	for (const string& arg : args)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(NULL);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0) {
+		execvp(argv[0], argv.data());
+		_exit(127);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			return false;
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * @brief Builds generated source into a shared object with the system
+ * compiler (CSIM_CXX, or g++ by default). The source is kept next to the
+ * object, and both are written under temporary names first so that runs
+ * racing to fill the cache never see a partial object.
+ *
+ * @param source The generated source.
+ * @param path Path of the shared object, ending in ".so".
+ *
+ * @return True if the object was built and false otherwise.
+ */
+bool CompiledCircuit::build(const string& source, const string& path) const {
+	string base = path.substr(0, path.size() - 3);
+	string tmp = base + "." + std::to_string(getpid());
+
+	std::ofstream file(tmp + ".cpp");
+	file << source;
+	file.close();
+	if (!file)
+		return false;
+
+	/* the compiler is run directly rather than through a shell, so paths
+	   are passed through untouched whatever characters they hold */
+	const char *cxx = getenv("CSIM_CXX");
+	vector<string> args;
+	std::istringstream words(string(cxx != NULL ? cxx : DEFAULT_CXX) + " " +
+	                         CXX_FLAGS);
+	for (string word; words >> word; )
+		args.push_back(word);
+	args.push_back("-o");
+	args.push_back(tmp + ".so");
+	args.push_back(tmp + ".cpp");
+
+	if (!run_compiler(args)) {
+		remove((tmp + ".cpp").c_str());
+		remove((tmp + ".so").c_str());
+		return false;
+	}
+
+	rename((tmp + ".cpp").c_str(), (base + ".cpp").c_str());
+	return rename((tmp + ".so").c_str(), path.c_str()) == 0;
+}
+
+/**
+ * @brief Loads a shared object built from generated source, and sizes
+ * the state to match it.
+ *
+ * @param path Path of the shared object.
+ *
+ * @return True if it was loaded and its interface matches ABI_VERSION.
+ */
+bool CompiledCircuit::open(const string& path) {
+	void *lib = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (lib == NULL)
+		return false;
+
+	int (*abi_fn)(void) = (int (*)(void)) dlsym(lib, "csim_abi");
+	int (*size_fn)(void) = (int (*)(void)) dlsym(lib, "csim_state_size");
+	reset_fn = (void (*)(double *)) dlsym(lib, "csim_reset");
+	step_fn = (double (*)(double *, double)) dlsym(lib, "csim_step");
+	process_fn = (void (*)(double *, const float *, float *, size_t))
+		dlsym(lib, "csim_process");
+
+	if (abi_fn == NULL || size_fn == NULL || reset_fn == NULL ||
+		step_fn == NULL || process_fn == NULL || abi_fn() != ABI_VERSION) {
+		dlclose(lib);
+		return false;
+	}
+
+	if (handle != NULL)
+		dlclose(handle);
+	handle = lib;
+	state.assign(size_fn(), 0.0);
+	return true;
+}
+
+/**
+ * @brief Loads the circuit's shared object from the cache, building it
+ * first if it is not there yet. Objects are named after the netlist's
+ * hash, the sampling rate and a hash of the generated source, so that
+ * any change to the circuit or its settings builds a new one.
+ *
+ * @param cache_dir Directory shared objects are cached in, or empty for
+ * /tmp.
+ * @param netlist_hash Hash of the netlist's contents.
+ *
+ * @return True if the circuit was loaded and false otherwise.
+ */
+bool CompiledCircuit::load(const string& cache_dir, uint64_t netlist_hash) {
+	string code = source();
+	if (code.empty())
+		return false;
+
+	string dir = cache_dir.empty() ? "/tmp" : cache_dir;
+	std::ostringstream name;
+	name << dir << "/" << std::hex << std::setw(16) << std::setfill('0')
+	     << netlist_hash << std::dec << "-" << lround(1.0 / dt) << "-"
+	     << std::hex << std::setw(16) << hash_string(code) << ".so";
+	string path = name.str();
+
+	bool cached = (access(path.c_str(), R_OK) == 0) && open(path);
+	if (!cached) {
+		mkdir(dir.c_str(), 0755);
+		if (!build(code, path) || !open(path))
+			return false;
+	}
+
+	std::cout << (cached ? "Loaded compiled circuit from "
+	                     : "Compiled circuit into ") << path << "." << endl;
+	reset();
+	return true;
+}
+
+/**
+ * @brief Zeros out the state: the solution, capacitor history and junction
+ * voltages, as well as the newton counts.
+ */
+void CompiledCircuit::reset() {
+	reset_fn(state.data());
+}
+
+/**
+ * @brief Gets the newton counts since the last reset.
+ *
+ * @param samples Filled in with the number of timesteps run.
+ * @param iterations Filled in with the total newton iterations.
+ * @param failures Filled in with the timesteps newton did not converge on.
+ * @param fallbacks Filled in with the newton iterations that fell back to
+ * a pivoting factorization.
+ */
+void CompiledCircuit::counts(long *samples, long *iterations,
+	long *failures, long *fallbacks) const {
+
+	*samples = state[STATE_SAMPLES];
+	*iterations = state[STATE_ITERATIONS];
+	*failures = state[STATE_FAILURES];
+	*fallbacks = state[STATE_FALLBACKS];
+}
@@ -12,6 +12,7 @@
  */
 
 #include <components/component.hpp>
+#include <stamp.hpp>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -29,6 +30,8 @@ using std::unordered_map;
  * this circuit element.
  */
 Capacitor::Capacitor(const vector<string>& tokens) {
+	name = tokens[1];
+	device = -1;
 	npos = stoi(tokens[2]);
 	nneg = stoi(tokens[3]);
 	capacitance = parse_by_unit(tokens[4]);
@@ -72,27 +75,10 @@ void Capacitor::map_unknowns(unordered_map<string, int> mappings) {
 }
 
 /**
- * @brief Adds the contributions of this capacitor to the system of KCL
- * equations.
+ * @brief Adds this capacitor to the circuit's stamp program.
  *
- * @param sys The system of equations.
- * @param soln The solution from the previous timestep.
- * @param prev_soln The solution from the previous newton iteration.
- * @param dt The sampling period.
+ * @param prog The stamp program.
  */
-void Capacitor::add_contribution(LinearSystem& sys, VectorXd& soln,
-	VectorXd& prev_soln, double dt) {
-
-	float C = capacitance;
-	sys.increment_lhs(n1, n1, +C/dt);
-	sys.increment_lhs(n2, n2, +C/dt);
-	sys.increment_lhs(n1, n2, -C/dt);
-	sys.increment_lhs(n2, n1, -C/dt);
-
-	double vt0 = prev_soln(n1) - prev_soln(n2);
-	double vt1 = soln(n1) - soln(n2);
-	double di = (vt1 - vt0) * (C / dt);
-
-	sys.increment_rhs(n1, +di);
-	sys.increment_rhs(n2, -di);
+void Capacitor::compile(StampProgram& prog) {
+	device = prog.add_capacitor(n1, n2, capacitance);
 }
@@ -103,3 +103,15 @@ string Component::unknown_current(const string& name) {
 	sstream << "unknown_current_" << name;
 	return sstream.str();
 }
+
+/**
+ * @brief Checks whether a string identifier is for an unknown branch current
+ * (as opposed to a node voltage).
+ *
+ * @param unknown The string identifier.
+ *
+ * @return True if it was created by `unknown_current` and false otherwise.
+ */
+bool Component::is_current(const string& unknown) {
+	return unknown.compare(0, 16, "unknown_current_") == 0;
+}
@@ -19,6 +19,7 @@
 #include <string>
 #include <unordered_map>
 #include <components/component.hpp>
+#include <stamp.hpp>
 #include <iostream>
 #include <sstream>
 
@@ -87,25 +88,10 @@ void Diode::map_unknowns(unordered_map<string, int> mappings) {
 }
 
 /**
- * @brief Adds the contributions of this diode to the KCL equations at
- * the appropriate places in the system matrix.
+ * @brief Adds this diode to the circuit's stamp program.
  *
- * @param sys The linear system to manipulate.
- * @param soln System solution from previous timestep.
- * @param prev_soln System solution form previous newton iteration.
- * @param dt Time step for the simulator.
+ * @param prog The stamp program.
  */
-void Diode::add_contribution(LinearSystem& sys, VectorXd& soln,
-    VectorXd& prev_soln, double dt) {
-
-    double denom_inv = 1.0 / (this->N * this->VT);
-    double prev_soln_delta = prev_soln(n1) - prev_soln(n2);
-    double current_val = IS * (exp(prev_soln_delta * denom_inv) - 1);
-    double current_deriv = IS * exp(prev_soln_delta * denom_inv) * denom_inv;
-    sys.increment_lhs(n1, n1, +current_deriv);
-    sys.increment_lhs(n1, n2, -current_deriv);
-    sys.increment_lhs(n2, n1, -current_deriv);
-    sys.increment_lhs(n2, n2, +current_deriv);
-    sys.increment_rhs(n1, -current_val);
-    sys.increment_rhs(n2, +current_val);
+void Diode::compile(StampProgram& prog) {
+    prog.add_diode(n1, n2, IS, N, VT);
 }
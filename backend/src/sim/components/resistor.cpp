@@ -12,6 +12,7 @@
  */
 
 #include <components/component.hpp>
+#include <stamp.hpp>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -29,6 +30,8 @@ using Eigen::VectorXd;
  * of the resistor.
  */
 Resistor::Resistor(const vector<string>& tokens) {
+	name = tokens[1];
+	device = -1;
 	npos = stoi(tokens[2]);
 	nneg = stoi(tokens[3]);
 	resistance = parse_by_unit(tokens[4]);
@@ -76,31 +79,10 @@ void Resistor::map_unknowns(unordered_map<string, int> mappings) {
 }
 
 /**
- * @brief Adds the contributions of this resistor to the KCL equations
- * to the approprate places in the system matrix.
+ * @brief Adds this resistor to the circuit's stamp program.
  *
- * @param sys The linear system to update.
- * @param prev_soln The previous solution to the system.
- * @param dt The time step for the system.
- *
- * @bug Right now this is a stand-alone function, but ultimately it is
- * designed to override a virtual `add_contribution` method in the component
- * class.
+ * @param prog The stamp program.
  */
-void Resistor::add_contribution(LinearSystem& sys, VectorXd& soln,
-	VectorXd& prev_soln, double dt) {
-
-	/* find the indices of the unknowns this resistor impacts */
-	double conductance = 1.0 / resistance;
-
-	/* adjust LHS of the system */
-	sys.increment_lhs(n1, n1, +conductance);
-	sys.increment_lhs(n2, n2, +conductance);
-	sys.increment_lhs(n1, n2, -conductance);
-	sys.increment_lhs(n2, n1, -conductance);
-
-	/* adjust RHS of the system */
-	double rhs_delta = conductance * (prev_soln(n2) - prev_soln(n1));
-	sys.increment_rhs(n1, +rhs_delta);
-	sys.increment_rhs(n2, -rhs_delta);
+void Resistor::compile(StampProgram& prog) {
+	device = prog.add_resistor(n1, n2, resistance);
 }
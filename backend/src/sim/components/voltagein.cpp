@@ -12,6 +12,7 @@
  */
 
 #include <components/component.hpp>
+#include <stamp.hpp>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -79,21 +80,33 @@ void VoltageIn::map_unknowns(unordered_map<string, int> mappings) {
 }
 
 /**
- * @brief Fetches the next voltage reading in the input signal.
+ * @brief Reads the next block of voltages in the input signal.
  *
- * @param voltage A pointer to be filled in with the next voltage, if one
- * exists.
+ * @param block Filled in with the voltages.
+ * @param n Most voltages to read.
  *
- * @return True if there was a new voltage in the input signal and false
- * otherwise. If this function returns false, the value of `*voltage` is
- * undefined.
+ * @return The number of voltages read, which is only less than `n` once the
+ * input signal has run out. Once this returns 0, `finish` should be called
+ * once analysis is done.
  */
-bool VoltageIn::next_voltage(double *voltage) {
-	bool ret = am->get_next_value(voltage);
-	if (!ret)
-		am->finish();
-	this->V = *voltage;
-	return ret;
+size_t VoltageIn::read_block(float *block, size_t n) {
+	return am->get_next_block(block, n);
+}
+
+/**
+ * @brief Gets the number of samples the input signal is best read in at a
+ * time, e.g. the size of the audio hardware's buffers for live input.
+ */
+size_t VoltageIn::block_size() {
+	return am->get_block_size();
+}
+
+/**
+ * @brief Flushes the output signal (e.g. to a file) and stops any live
+ * audio once the input signal has run out.
+ */
+void VoltageIn::finish() {
+	am->finish();
 }
 
 /**
@@ -104,25 +117,11 @@ double VoltageIn::get_sampling_period() {
 }
 
 /**
- * @brief Adds the KCL contributions of a voltage source to the system
- * of KCL equations.
+ * @brief Adds this voltage source to the circuit's stamp program. The
+ * program reads the source's current voltage on every iteration.
  *
- * @param sys The system of equations.
- * @param soln The solution to the system from the last timestep.
- * @param prev_soln The solution to the system from the last newton iteration.
- * @param dt The sampling period.
+ * @param prog The stamp program.
  */
-void VoltageIn::add_contribution(LinearSystem& sys, VectorXd& soln,
-	VectorXd& prev_soln, double dt) {
-
-	/* add LHS contribution */
-	sys.increment_lhs(ni, n1, +1);
-	sys.increment_lhs(ni, n2, -1);
-	sys.increment_lhs(n1, ni, -1);
-	sys.increment_lhs(n2, ni, +1);
-
-	/* add RHS contribution */
-	sys.increment_rhs(ni, V - (prev_soln(n1) - prev_soln(n2)));
-	sys.increment_rhs(n1, +prev_soln(ni));
-	sys.increment_rhs(n2, -prev_soln(ni));
+void VoltageIn::compile(StampProgram& prog) {
+	prog.add_source(n1, n2, ni, &V);
 }
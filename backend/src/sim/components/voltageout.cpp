@@ -63,17 +63,26 @@ void VoltageOut::map_unknowns(unordered_map<string, int> mappings) {
 }
 
 /**
- * @brief Measures the voltage across the output terminals.
+ * @brief Computes the voltage across the output terminals for a given
+ * solution, without reporting it anywhere.
  *
- * @param sys The (solved) system of linear equations.
+ * @param soln A solution to the circuit's system of equations.
  *
- * @return The potential difference across the output terminals of
- * the circuit in volts.
+ * @return The potential difference across the output terminals in volts.
  */
-double VoltageOut::measure(LinearSystem& sys, VectorXd& soln) {
+double VoltageOut::voltage(const VectorXd& soln) {
 	double npos_voltage = soln(npid);
 	double nneg_voltage = soln(nnid);
-	double vout = npos_voltage - nneg_voltage;
-	am->set_next_value(vout);
-	return vout;
+	return npos_voltage - nneg_voltage;
+}
+
+/**
+ * @brief Reports a block of output voltages to the audio manager as the next
+ * samples of the output signal.
+ *
+ * @param block The output voltages.
+ * @param n Number of voltages in the block.
+ */
+void VoltageOut::write_block(const float *block, size_t n) {
+	am->set_next_block(block, n);
 }
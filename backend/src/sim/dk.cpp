@@ -0,0 +1,130 @@
+/**
+ *
+ * @file dk.cpp
+ *
+ * @brief This file contains the implementation of the nodal DK-method
+ * solver, which runs newton's method over only the nonlinear ports of a
+ * circuit.
+ *
+ */
+
+#include <dk.hpp>
+#include <table.hpp>
+#include <components/component.hpp>
+#include <math.h>
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+/**
+ * @brief Zeros out the model's state, port voltages and counters.
+ */
+void DkModel::reset() {
+	int k = num_ports();
+	s = VectorXd::Zero(order());
+	v = VectorXd::Zero(k);
+	i = VectorXd::Zero(k);
+	g = VectorXd::Zero(k);
+	p = VectorXd::Zero(k);
+	f = VectorXd::Zero(k);
+	dv = VectorXd::Zero(k);
+	J = MatrixXd::Identity(k, k);
+	lu = Eigen::PartialPivLU<MatrixXd>(k);
+	s_next = VectorXd::Zero(order());
+	vcrit.resize(k);
+	for (int j = 0; j < k; j++)
+		vcrit[j] = Diode::critical_voltage(is[j], nvt_inv[j]);
+	samples = 0;
+	iterations = 0;
+	failures = 0;
+	table_hits = 0;
+}
+
+/**
+ * @brief Evaluates the current and conductance of every port at the current
+ * port voltages.
+ */
+void DkModel::evaluate_ports() {
+	for (int k = 0; k < num_ports(); k++)
+		Diode::model(v(k), is[k], nvt_inv[k], &i(k), &g(k));
+}
+
+/**
+ * @brief Solves f(v) = v - p + K i(v) = 0 for the port voltages with
+ * newton's method, starting from the current port voltages. The newton
+ * update uses the k x k Jacobian J = I + K diag(g(v)), and is limited per
+ * port like the diodes in the full system (see `Diode::limit`).
+ *
+ * @param p The port voltages the linear part alone would produce.
+ *
+ * @return True if newton's method converged and false otherwise. Either way,
+ * `v`, `i` and `g` are left at the last guess.
+ */
+bool DkModel::solve_ports(const VectorXd& p) {
+	bool converged = (num_ports() == 0);
+
+	evaluate_ports();
+	for (int iter = 0; iter < MAX_ITERATIONS && !converged; iter++) {
+		f = v - p;
+		f.noalias() += K * i;
+		J.noalias() = K * g.asDiagonal();
+		J.diagonal().array() += 1.0;
+
+		lu.compute(J);
+		dv.noalias() = lu.solve(f);
+		bool limited = false;
+		for (int k = 0; k < num_ports(); k++) {
+			double vnew = Diode::limit(v(k) - dv(k), v(k), nvt_inv[k], vcrit[k]);
+			limited = limited || (vnew != v(k) - dv(k));
+			v(k) = vnew;
+		}
+		evaluate_ports();
+
+		iterations++;
+		double max_delta = dv.cwiseAbs().maxCoeff();
+		if (!std::isfinite(max_delta))
+			return false;
+		converged = (max_delta < TOLERANCE) && !limited;
+	}
+
+	return converged;
+}
+
+/**
+ * @brief Advances the model by one sample.
+ *
+ * The port currents are interpolated from `table` when one is attached and
+ * covers the current port drives, and solved for with newton's method
+ * (starting from the previous timestep's port voltages) otherwise.
+ *
+ * @param u The input sample.
+ *
+ * @return The output sample.
+ */
+double DkModel::step(double u) {
+	p.noalias() = Dp * s;
+	p += Ep * u;
+
+	if (table != NULL && table->lookup(p, i)) {
+		/* keep the port voltages current in case newton is needed later */
+		v = p;
+		v.noalias() -= K * i;
+		table_hits++;
+	} else if (!solve_ports(p)) {
+		failures++;
+
+		/* never carry port voltages that blew up into the next sample */
+		if (!v.allFinite()) {
+			v.setZero();
+			evaluate_ports();
+		}
+	}
+	samples++;
+
+	double y = Cy.dot(s) + Dy * u + Fy.dot(i);
+	s_next.noalias() = A * s;
+	s_next += B * u;
+	s_next.noalias() += Ci * i;
+	s.swap(s_next);
+	return y;
+}
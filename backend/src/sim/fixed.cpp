@@ -0,0 +1,135 @@
+/**
+ *
+ * @file fixed.cpp
+ *
+ * @brief This file contains the implementation of fixed-size solvers for
+ * small linear systems.
+ *
+ */
+
+#include <fixed.hpp>
+#include <limits>
+#include <math.h>
+#include <utility>
+
+/**
+ * @brief LU factorization with partial pivoting of an N by N system.
+ */
+template <typename Scalar, int N>
+class FixedLu : public BasicFixedSolver<Scalar>
+{
+public:
+
+	typedef typename BasicFixedSolver<Scalar>::Vector Vector;
+	typedef typename BasicFixedSolver<Scalar>::Matrix Matrix;
+
+	/**
+	 * @brief Factors the LHS in place, in the style of Doolittle: L (with
+	 * a unit diagonal) below the diagonal of `LU` and U on and above it.
+	 *
+	 * @param A The LHS, which must be N by N.
+	 *
+	 * @return False if a pivot is negligible next to the largest entry of
+	 * the LHS, i.e. the system is singular to working precision.
+	 */
+	bool factor(const Matrix& A) override {
+		LU = A;
+		Scalar tolerance = N * std::numeric_limits<Scalar>::epsilon() *
+		                   LU.cwiseAbs().maxCoeff();
+
+		for (int k = 0; k < N; k++) {
+			int p = k;
+			Scalar pivot = fabs(LU(k, k));
+			for (int i = k + 1; i < N; i++) {
+				if (fabs(LU(i, k)) > pivot) {
+					pivot = fabs(LU(i, k));
+					p = i;
+				}
+			}
+			if (!(pivot > tolerance))
+				return false;
+
+			perm[k] = p;
+			if (p != k)
+				LU.row(k).swap(LU.row(p));
+
+			inv_diag[k] = 1 / LU(k, k);
+			for (int i = k + 1; i < N; i++) {
+				Scalar l = LU(i, k) * inv_diag[k];
+				LU(i, k) = l;
+				for (int j = k + 1; j < N; j++)
+					LU(i, j) -= l * LU(k, j);
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Solves against the last factorization by forward and back
+	 * substitution.
+	 *
+	 * @param B The RHS, of length N.
+	 * @param x Filled in with the solution, of length N.
+	 */
+	void solve(const Vector& B, Vector& x) const override {
+		Eigen::Matrix<Scalar, N, 1> y = B;
+		for (int k = 0; k < N; k++) {
+			if (perm[k] != k)
+				std::swap(y(k), y(perm[k]));
+		}
+
+		for (int i = 1; i < N; i++) {
+			for (int j = 0; j < i; j++)
+				y(i) -= LU(i, j) * y(j);
+		}
+		for (int i = N - 1; i >= 0; i--) {
+			for (int j = i + 1; j < N; j++)
+				y(i) -= LU(i, j) * y(j);
+			y(i) *= inv_diag[i];
+		}
+
+		x = y;
+	}
+
+private:
+
+	Eigen::Matrix<Scalar, N, N> LU;  /**< L and U factors */
+	int perm[N];                     /**< Row swapped with each row */
+	Scalar inv_diag[N];              /**< Reciprocals of U's diagonal */
+};
+
+/**
+ * @brief Creates a fixed-size solver of size N or larger, up to
+ * MAX_UNKNOWNS, that matches a system.
+ *
+ * @param num_unknowns The number of unknowns in the system.
+ *
+ * @return The solver, or NULL if none matches.
+ */
+template <typename Scalar, int N>
+static BasicFixedSolver<Scalar> *create_from(int num_unknowns) {
+	if constexpr (N > FixedSolver::MAX_UNKNOWNS) {
+		/* none is this large */
+		return NULL;
+	} else {
+		if (num_unknowns == N)
+			return new FixedLu<Scalar, N>();
+		return create_from<Scalar, N + 1>(num_unknowns);
+	}
+}
+
+/**
+ * @brief Creates the fixed-size solver for a system.
+ *
+ * @param num_unknowns The number of unknowns in the system.
+ *
+ * @return The solver, which the caller owns, or NULL if the system is
+ * smaller than MIN_UNKNOWNS or larger than MAX_UNKNOWNS.
+ */
+template <typename Scalar>
+BasicFixedSolver<Scalar> *BasicFixedSolver<Scalar>::create(int num_unknowns) {
+	return create_from<Scalar, MIN_UNKNOWNS>(num_unknowns);
+}
+
+template class BasicFixedSolver<double>;
+template class BasicFixedSolver<float>;
@@ -0,0 +1,367 @@
+/**
+ *
+ * @file iir.cpp
+ *
+ * @brief This file contains the implementation of the filters that linear
+ * circuits are compiled into, including factoring a state space model into
+ * a cascade of second order sections.
+ *
+ */
+
+#include <iir.hpp>
+#include <Eigen/Eigenvalues>
+#include <complex>
+#include <algorithm>
+#include <math.h>
+
+using std::vector;
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+using Eigen::MatrixXcd;
+using Eigen::VectorXcd;
+
+typedef std::complex<double> cplx;
+
+/** @brief Roots with a relative imaginary part below this are real */
+static const double REAL_TOLERANCE = 1.0e-9;
+
+/** @brief Zeros further than this from the origin are treated as infinite */
+static const double MAX_ZERO_MAGNITUDE = 1.0e+8;
+
+/**
+ * @brief Poles and zeros making up a single second (or first) order section.
+ */
+struct Section {
+	vector<cplx> poles;  /**< One or two poles */
+	vector<cplx> zeros;  /**< At most as many zeros as poles */
+};
+
+/****************************************************************************
+ *                                StateSpace                                *
+ ****************************************************************************/
+
+/**
+ * @brief Zeros out the model's state.
+ */
+void StateSpace::reset() {
+	s = VectorXd::Zero(A.rows());
+	s_next = VectorXd::Zero(A.rows());
+}
+
+/**
+ * @brief Advances the model by one sample.
+ *
+ * @param u The input sample.
+ *
+ * @return The output sample.
+ */
+double StateSpace::step(double u) {
+	double y = C.dot(s) + D * u;
+	s_next.noalias() = A * s;
+	s_next += B * u;
+	s.swap(s_next);
+	return y;
+}
+
+/**
+ * @brief Evaluates the transfer function of a state space model,
+ * H(z) = D + C (zI - A)^-1 B, at a point in the complex plane.
+ *
+ * @param ss The state space model.
+ * @param z The point to evaluate the transfer function at.
+ *
+ * @return The value of the transfer function.
+ */
+static cplx transfer_function(const StateSpace& ss, cplx z) {
+	int r = ss.order();
+	if (r == 0)
+		return ss.D;
+
+	MatrixXcd M = -ss.A.cast<cplx>();
+	M.diagonal().array() += z;
+	VectorXcd v = M.partialPivLu().solve(ss.B.cast<cplx>());
+	return ss.D + (ss.C.cast<cplx>() * v)(0);
+}
+
+/****************************************************************************
+ *                              BiquadCascade                               *
+ ****************************************************************************/
+
+/**
+ * @brief Checks whether a root should be treated as real.
+ *
+ * @param z The root.
+ */
+static bool is_real(cplx z) {
+	return fabs(z.imag()) <= REAL_TOLERANCE * fmax(1.0, std::abs(z));
+}
+
+/**
+ * @brief Distance from a root to the closest pole of a section.
+ *
+ * @param s The section.
+ * @param z The root.
+ */
+static double distance(const Section& s, cplx z) {
+	double d = INFINITY;
+	for (cplx p : s.poles)
+		d = fmin(d, std::abs(z - p));
+	return d;
+}
+
+/**
+ * @brief Groups poles into sections: one per complex conjugate pair, then
+ * real poles paired off in order of magnitude, with a first order section
+ * for any real pole left over.
+ *
+ * @param poles Every pole of the model.
+ * @param sections Vector to be filled with the sections.
+ */
+static void group_poles(const VectorXcd& poles, vector<Section>& sections) {
+	vector<double> real_poles;
+
+	for (int i = 0; i < poles.size(); i++) {
+		cplx p = poles(i);
+		if (is_real(p))
+			real_poles.push_back(p.real());
+		else if (p.imag() > 0)
+			sections.push_back({ { p, std::conj(p) }, { } });
+	}
+
+	std::sort(real_poles.begin(), real_poles.end(),
+		[](double a, double b) { return fabs(a) > fabs(b); });
+
+	for (int i = 0; i < (int) real_poles.size(); i += 2) {
+		Section s;
+		s.poles.push_back(real_poles[i]);
+		if (i + 1 < (int) real_poles.size())
+			s.poles.push_back(real_poles[i + 1]);
+		sections.push_back(s);
+	}
+}
+
+/**
+ * @brief Assigns zeros to sections, pairing each zero with the section
+ * whose poles are closest to it. Complex conjugate pairs are placed first
+ * since they need a section with room for two zeros.
+ *
+ * @param zeros Every finite zero of the model.
+ * @param sections The sections built by `group_poles`.
+ *
+ * @return True if every zero found a section and false otherwise.
+ */
+static bool assign_zeros(const vector<cplx>& zeros, vector<Section>& sections) {
+	vector<double> real_zeros;
+	vector<cplx> complex_zeros;
+
+	for (cplx z : zeros) {
+		if (is_real(z))
+			real_zeros.push_back(z.real());
+		else if (z.imag() > 0)
+			complex_zeros.push_back(z);
+	}
+
+	for (cplx z : complex_zeros) {
+		Section *best = NULL;
+		for (Section& s : sections) {
+			if (s.poles.size() == 2 && s.zeros.empty() &&
+				(best == NULL || distance(s, z) < distance(*best, z)))
+				best = &s;
+		}
+		if (best == NULL)
+			return false;
+		best->zeros = { z, std::conj(z) };
+	}
+
+	for (double z : real_zeros) {
+		Section *best = NULL;
+		for (Section& s : sections) {
+			if (s.zeros.size() < s.poles.size() &&
+				(best == NULL || distance(s, z) < distance(*best, z)))
+				best = &s;
+		}
+		if (best == NULL)
+			return false;
+		best->zeros.push_back(z);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Constructs a biquad cascade with the same transfer function as a
+ * state space model.
+ *
+ * The poles are the eigenvalues of `A`. The zeros are the finite generalized
+ * eigenvalues of the model's system matrix, [A B; -C -D] v = z [I 0; 0 0] v.
+ * Once poles and zeros are grouped into sections, the overall gain is
+ * matched against the model's transfer function at whichever point on the
+ * unit circle the cascade's response is largest.
+ *
+ * @param ss The state space model.
+ */
+BiquadCascade::BiquadCascade(const StateSpace& ss) {
+	int r = ss.order();
+	factored = false;
+	gain = ss.D;
+
+	if (r == 0) {
+		factored = true;
+		return;
+	}
+
+	/* poles of the model */
+	Eigen::EigenSolver<MatrixXd> poles(ss.A, false);
+	if (poles.info() != Eigen::Success)
+		return;
+
+	/* zeros of the model */
+	MatrixXd M(r + 1, r + 1);
+	MatrixXd N = MatrixXd::Zero(r + 1, r + 1);
+	M << ss.A, ss.B, -ss.C, -ss.D;
+	N.topLeftCorner(r, r).setIdentity();
+
+	Eigen::GeneralizedEigenSolver<MatrixXd> pencil(M, N, false);
+	if (pencil.info() != Eigen::Success)
+		return;
+
+	vector<cplx> zeros;
+	for (int i = 0; i < r + 1; i++) {
+		cplx alpha = pencil.alphas()(i);
+		double beta = pencil.betas()(i);
+		if (beta == 0.0 || std::abs(alpha) > MAX_ZERO_MAGNITUDE * fabs(beta))
+			continue;
+		zeros.push_back(alpha / beta);
+	}
+
+	vector<Section> sections;
+	group_poles(poles.eigenvalues(), sections);
+	if (!assign_zeros(zeros, sections))
+		return;
+
+	/* expand each section's roots into coefficients */
+	for (const Section& s : sections) {
+		int q = s.poles.size();
+		int m = s.zeros.size();
+
+		cplx num[3] = { 1.0, 0.0, 0.0 };
+		for (int i = 0; i < m; i++) {
+			num[2] = num[2] - s.zeros[i] * num[1];
+			num[1] = num[1] - s.zeros[i] * num[0];
+		}
+
+		/* missing zeros sit at infinity, i.e. they delay the numerator */
+		double b[3] = { 0.0, 0.0, 0.0 };
+		for (int i = 0; i <= m; i++)
+			b[i + q - m] = num[i].real();
+
+		b0.push_back(b[0]);
+		b1.push_back(b[1]);
+		b2.push_back(b[2]);
+
+		if (q == 2) {
+			a1.push_back(-(s.poles[0] + s.poles[1]).real());
+			a2.push_back((s.poles[0] * s.poles[1]).real());
+		} else {
+			a1.push_back(-s.poles[0].real());
+			a2.push_back(0.0);
+		}
+	}
+
+	/* match the overall gain where the cascade's response is largest */
+	static const double test_angles[] = { 0.0, M_PI / 4, M_PI / 2,
+	                                      3 * M_PI / 4, M_PI };
+	cplx best_z = 1.0;
+	cplx best_response = 0.0;
+	for (double theta : test_angles) {
+		cplx z = std::polar(1.0, theta);
+		cplx w = 1.0 / z;
+		cplx response = 1.0;
+		for (int k = 0; k < num_sections(); k++) {
+			response *= (b0[k] + b1[k] * w + b2[k] * w * w) /
+			            (1.0 + a1[k] * w + a2[k] * w * w);
+		}
+		if (std::abs(response) > std::abs(best_response)) {
+			best_z = z;
+			best_response = response;
+		}
+	}
+
+	if (std::abs(best_response) == 0.0)
+		return;
+
+	gain = (transfer_function(ss, best_z) / best_response).real();
+	factored = true;
+	reset();
+}
+
+/**
+ * @brief Zeros out the state of every section.
+ */
+void BiquadCascade::reset() {
+	z1.assign(b0.size(), 0.0);
+	z2.assign(b0.size(), 0.0);
+}
+
+/**
+ * @brief Runs one sample through the cascade.
+ *
+ * @param u The input sample.
+ *
+ * @return The output sample.
+ */
+double BiquadCascade::process(double u) {
+	double x = gain * u;
+	int n = b0.size();
+	for (int k = 0; k < n; k++) {
+		double y = b0[k] * x + z1[k];
+		z1[k] = b1[k] * x - a1[k] * y + z2[k];
+		z2[k] = b2[k] * x - a2[k] * y;
+		x = y;
+	}
+	return x;
+}
+
+/****************************************************************************
+ *                                IirFilter                                 *
+ ****************************************************************************/
+
+/**
+ * @brief Compiles a state space model into a filter.
+ *
+ * The model is factored into a biquad cascade, whose impulse response is
+ * then checked against the model's own. If factoring failed or the two
+ * disagree, the filter falls back to running the state space model.
+ *
+ * @param model The state space model.
+ */
+IirFilter::IirFilter(const StateSpace& model) : ss(model), cascade(model) {
+	use_cascade = cascade.valid();
+
+	if (use_cascade) {
+		double peak = 0.0;
+		double error = 0.0;
+
+		reset();
+		for (int n = 0; n < CHECK_SAMPLES && use_cascade; n++) {
+			double u = (n == 0) ? 1.0 : 0.0;
+			double expected = ss.step(u);
+			double actual = cascade.process(u);
+			peak = fmax(peak, fabs(expected));
+			error = fmax(error, fabs(expected - actual));
+			use_cascade = std::isfinite(actual);
+		}
+
+		use_cascade = use_cascade && (error <= CHECK_TOLERANCE * peak);
+	}
+
+	reset();
+}
+
+/**
+ * @brief Zeros out the filter's state.
+ */
+void IirFilter::reset() {
+	ss.reset();
+	cascade.reset();
+}
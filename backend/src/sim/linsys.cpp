@@ -12,28 +12,235 @@
 #include <linsys.hpp>
 #include <components/component.hpp>
 #include <iostream>
+#include <math.h>
+#include <strings.h>
 
 using std::endl;
 
+/**
+ * @brief Gets the smallest pivot of a sparse LU factorization, relative
+ * to the largest entry of the LHS column it was taken from. A small ratio
+ * means the pivot was mostly cancelled out by elimination, i.e. the LHS
+ * is singular to working precision. SparseLU keeps the diagonal of U in
+ * the supernodes of L.
+ *
+ * @param lu The factorization.
+ * @param A The LHS it factored.
+ *
+ * @return The smallest ratio of a pivot to its column's largest entry.
+ */
+template <typename SparseLu, typename Scalar>
+static double smallest_pivot(const SparseLu& lu,
+	const Eigen::SparseMatrix<Scalar>& A) {
+
+	Eigen::RowVectorXd scale(A.cols());
+	for (Eigen::Index j = 0; j < A.cols(); j++) {
+		double largest = 0.0;
+		for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(A, j);
+		     it; ++it)
+			largest = fmax(largest, fabs(it.value()));
+		scale(j) = largest;
+	}
+	scale = scale * lu.colsPermutation().inverse();
+
+	const typename SparseLu::SCMatrix& L = lu.matrixL().m_mapL;
+	double ratio = INFINITY;
+	for (Eigen::Index j = 0; j < L.cols(); j++) {
+		typename SparseLu::SCMatrix::InnerIterator it(L, j);
+		for (; it; ++it) {
+			if (it.index() == j) {
+				ratio = fmin(ratio, fabs(it.value()) / scale(j));
+				break;
+			}
+		}
+	}
+	return ratio;
+}
+
+/**
+ * @brief Factors a dense LHS with `qr`.
+ *
+ * @param A The LHS.
+ */
+template <typename Scalar>
+void BasicFactorization<Scalar>::factor(const Matrix& A) {
+	qr.compute(A);
+}
+
+/**
+ * @brief Factors a sparse LHS with `lu`, falling back to `qr` if it is
+ * numerically singular. SparseLU only gives up on exactly zero pivots, so
+ * this also falls back once a pivot is below PIVOT_TOLERANCE of its
+ * column, as the fixed backend does on negligible pivots.
+ *
+ * @param A The LHS, compressed.
+ * @param analyze Whether the pattern of the LHS has changed, so that the
+ * ordering and symbolic factorization must be redone first.
+ */
+template <typename Scalar>
+void BasicFactorization<Scalar>::factor(const SparseMatrix& A, bool analyze) {
+
+	if (preordered) {
+		if (analyze)
+			ordered_lu.analyzePattern(A);
+		ordered_lu.factorize(A);
+	} else {
+		if (analyze)
+			lu.analyzePattern(A);
+		lu.factorize(A);
+	}
+
+	/* numerically singular - fall back to a rank revealing factorization */
+	Eigen::ComputationInfo info = preordered ? ordered_lu.info() : lu.info();
+	sparse_fallback = (info != Eigen::Success);
+	if (!sparse_fallback) {
+		double pivot = preordered ? smallest_pivot(ordered_lu, A)
+		                          : smallest_pivot(lu, A);
+		sparse_fallback = !(pivot > PIVOT_TOLERANCE);
+	}
+	if (sparse_fallback)
+		qr.compute(Matrix(A));
+}
+
+/**
+ * @brief Solves against the last factorization, storing the solution in
+ * `x`. The dense backend never allocates here. Eigen's sparse LU allocates
+ * scratch space on every solve.
+ *
+ * @param B The RHS.
+ * @param x The solution.
+ * @param sparse Whether the LHS was factored by the sparse backend.
+ */
+template <typename Scalar>
+void BasicFactorization<Scalar>::solve(const Vector& B, Vector& x,
+	bool sparse) {
+
+	if (sparse && !sparse_fallback && preordered)
+		x = ordered_lu.solve(B);
+	else if (sparse && !sparse_fallback)
+		x = lu.solve(B);
+	else
+		qr_solve(B, x);
+}
+
+/**
+ * @brief Solves against `qr`, storing the solution in `x`. This is the
+ * same least squares solve as `qr.solve(B)`, but works in `work` instead
+ * of allocating.
+ *
+ * @param B The RHS.
+ * @param x The solution.
+ */
+template <typename Scalar>
+void BasicFactorization<Scalar>::qr_solve(const Vector& B, Vector& x) {
+
+	int rank = qr.nonzeroPivots();
+	if (rank == 0) {
+		x.setZero();
+		return;
+	}
+
+	/* work = Q^T B, applying Q's householder reflectors one at a time
+	 * (Eigen's own routine for this allocates scratch space) */
+	const Matrix& QR = qr.matrixQR();
+	int n = B.size();
+	work = B;
+	for (int k = 0; k < rank; k++) {
+		int len = n - k - 1;
+		Scalar dot = work(k) + QR.col(k).tail(len).dot(work.tail(len));
+		Scalar scale = qr.hCoeffs()(k) * dot;
+		work(k) -= scale;
+		work.tail(len) -= scale * QR.col(k).tail(len);
+	}
+
+	/* work = R^-1 Q^T B, over the columns with nonzero pivots */
+	QR.topLeftCorner(rank, rank)
+	  .template triangularView<Eigen::Upper>().solveInPlace(work.head(rank));
+
+	/* undo the column pivoting, leaving the remaining unknowns at zero */
+	const auto& perm = qr.colsPermutation().indices();
+	for (int i = 0; i < rank; i++)
+		x(perm(i)) = work(i);
+	for (int i = rank; i < (int) x.size(); i++)
+		x(perm(i)) = 0.0;
+}
+
 /**
  * @brief Constructs a new linear system.
  *
+ * @param num_unknowns The number of unknowns in the system.
  * @param ground_id The ground node identifier.
+ * @param unknowns Maps unknown labels to their matrix indices.
+ * @param solver The backend used to factor the system. SOLVER_AUTO picks the
+ * sparse backend for systems of at least SPARSE_MIN_UNKNOWNS unknowns, and
+ * the fixed backend for smaller ones. The fixed backend gives way to the
+ * dense one for systems it has no solver for.
+ * @param reduction Reduction to solve the system in, which must outlive
+ * it, or NULL to solve the full system. Backends are picked by the size
+ * of the reduced system.
  */
-LinearSystem::LinearSystem(int num_unknowns, int ground_id,
-	std::unordered_map<std::string, int> unknowns) {
+template <typename Scalar>
+BasicLinearSystem<Scalar>::BasicLinearSystem(int num_unknowns,
+	int ground_id, std::unordered_map<std::string, int> unknowns,
+	solver_t solver, const Reduction *reduction) {
 
 	ground = unknowns[Component::unknown_voltage(ground_id)];
+	this->reduction = reduction;
+	int size = (reduction != NULL) ? reduction->size() : num_unknowns;
+
+	fixed = NULL;
+	fixed_fallback = false;
+	if (solver == SOLVER_AUTO) {
+		solver = (size >= SPARSE_MIN_UNKNOWNS) ? SOLVER_SPARSE
+		                                       : SOLVER_FIXED;
+	}
+	if (solver == SOLVER_FIXED) {
+		fixed = BasicFixedSolver<Scalar>::create(size);
+		if (fixed == NULL)
+			solver = SOLVER_DENSE;
+	}
+	this->solver = solver;
+	pattern_changed = true;
+	factorization.sparse_fallback = false;
+	factorization.preordered = (reduction != NULL &&
+		reduction->ordering != Reduction::ORDER_NATURAL);
+
+	if (solver == SOLVER_SPARSE) {
+		S = Eigen::SparseMatrix<Scalar>(size, size);
+		if (reduction == NULL)
+			S.coeffRef(ground, ground) = 1.0;
+	} else {
+		A = Matrix(size, size);
+		A.setZero();
+		if (reduction == NULL)
+			A(ground, ground) = 1.0;
+	}
 
-	A = Eigen::MatrixXd(num_unknowns, num_unknowns);
-	A.setZero();
-	A(ground, ground) = 1.0;
-	x = Eigen::VectorXd(num_unknowns);
+	x = Vector(num_unknowns);
 	x.setZero();
 
-	B = Eigen::VectorXd(num_unknowns);
+	B = Vector(num_unknowns);
 	B.setZero();
 
+	factorization.work = Vector(size);
+
+	/* substituted unknowns keep their rows and columns to the side */
+	if (reduction != NULL) {
+		int k = reduction->substitutions.size();
+		substituted_rows = Matrix::Zero(2 * k, num_unknowns);
+		substituted_cols = Matrix::Zero(num_unknowns, k);
+		substituted_row.assign(num_unknowns, -1);
+		substituted_col.assign(num_unknowns, -1);
+		for (int s = 0; s < k; s++) {
+			const Reduction::Substitution& sub = reduction->substitutions[s];
+			substituted_row[sub.node] = 2 * s;
+			substituted_row[sub.branch] = 2 * s + 1;
+			substituted_col[sub.node] = s;
+		}
+		reduced_B = Vector::Zero(size);
+		reduced_x = Vector::Zero(size);
+	}
+
 	unknowns_map = unknowns;
 	unknown_labels = VectorXs(num_unknowns);
 
@@ -44,15 +251,134 @@ LinearSystem::LinearSystem(int num_unknowns, int ground_id,
 	}
 }
 
+/**
+ * @brief Gets the human readable name of a solver backend.
+ *
+ * @param solver The solver backend.
+ *
+ * @return Name of the backend, as accepted on the command line.
+ */
+const char *LinearSystemBase::solver_name(solver_t solver) {
+	switch (solver) {
+		case SOLVER_DENSE:  return "dense";
+		case SOLVER_SPARSE: return "sparse";
+		case SOLVER_FIXED:  return "fixed";
+		default:            return "auto";
+	}
+}
+
+/**
+ * @brief Gets the human readable name of a precision.
+ *
+ * @param precision The precision.
+ *
+ * @return Name of the precision, as accepted on the command line.
+ */
+const char *LinearSystemBase::precision_name(precision_t precision) {
+	return (precision == PRECISION_SINGLE) ? "single" : "double";
+}
+
+/**
+ * @brief Looks up a precision by the name `precision_name` gives it.
+ *
+ * @param name The name, in any case.
+ * @param precision Filled in with the precision.
+ *
+ * @return True if the name is known and false otherwise.
+ */
+bool LinearSystemBase::parse_precision(const char *name,
+	precision_t *precision) {
+
+	precision_t precisions[] = { PRECISION_DOUBLE, PRECISION_SINGLE };
+	for (precision_t p : precisions) {
+		if (strcasecmp(name, precision_name(p)) == 0) {
+			*precision = p;
+			return true;
+		}
+	}
+	return false;
+}
+
 /**
  * @brief Zeros out a linear system, and reinitializes the first equation:
- * setting the ground voltage to zero.
+ * setting the ground voltage to zero (unless the system is reduced, which
+ * leaves ground out altogether).
+ *
+ * In sparse mode the nonzero pattern of `S` is kept, so the stamps written
+ * on the next newton iteration land in entries that already exist.
  */
-void LinearSystem::clear() {
-	A.setZero();
+template <typename Scalar>
+void BasicLinearSystem<Scalar>::clear() {
+	if (solver == SOLVER_SPARSE) {
+		if (!S.isCompressed()) {
+			S.makeCompressed();
+			pattern_changed = true;
+		}
+		S.coeffs().setZero();
+		if (reduction == NULL)
+			S.coeffRef(ground, ground) = 1.0;
+	} else {
+		A.setZero();
+		if (reduction == NULL)
+			A(ground, ground) = 1.0;
+	}
+	if (reduction != NULL) {
+		substituted_rows.setZero();
+		substituted_cols.setZero();
+	}
+	x.setZero();
+	B.setZero();
+}
+
+/**
+ * @brief Zeros out the RHS of a linear system. The LHS, and any
+ * factorization of it, is left untouched.
+ */
+template <typename Scalar>
+void BasicLinearSystem<Scalar>::clear_rhs() {
+	x.setZero();
+	B.setZero();
+}
+
+/**
+ * @brief Saves a copy of the LHS as it stands, so that `restore_lhs` can
+ * start over from it instead of from zero. The nonzero pattern of `S` must
+ * not change until the copy is restored. Saving once ahead of time sizes
+ * the copy, so that later saves never allocate.
+ */
+template <typename Scalar>
+void BasicLinearSystem<Scalar>::save_lhs() {
+	if (solver == SOLVER_SPARSE) {
+		if (!S.isCompressed()) {
+			S.makeCompressed();
+			pattern_changed = true;
+		}
+		base_S = Eigen::Map<const Vector>(S.valuePtr(), S.nonZeros());
+	} else {
+		base_A = A;
+	}
+	if (reduction != NULL) {
+		base_substituted_rows = substituted_rows;
+		base_substituted_cols = substituted_cols;
+	}
+}
+
+/**
+ * @brief Resets the LHS to the copy last saved by `save_lhs`, and zeros
+ * out the RHS. Like `clear`, but starting from the saved LHS.
+ */
+template <typename Scalar>
+void BasicLinearSystem<Scalar>::restore_lhs() {
+	if (solver == SOLVER_SPARSE)
+		Eigen::Map<Vector>(S.valuePtr(), S.nonZeros()) = base_S;
+	else
+		A = base_A;
+	if (reduction != NULL) {
+		substituted_rows = base_substituted_rows;
+		substituted_cols = base_substituted_cols;
+	}
 	x.setZero();
 	B.setZero();
-	A(ground, ground) = 1.0;
 }
 
 /**
@@ -60,12 +386,16 @@ void LinearSystem::clear() {
  *
  * @return Text representation of the linear system of equations.
  */
-std::string LinearSystem::to_string() {
+template <typename Scalar>
+std::string BasicLinearSystem<Scalar>::to_string() {
 	std::ostringstream sysstream;
 	sysstream << "---------------------------------------------------------"
 	          << "Linear System: " << endl
 	          << "Ground node is: " << ground << endl
-		      << "A = "      << endl << A << endl << endl
+	          << "Solver is: " << solver_name(solver) << endl
+		      << "A = "      << endl
+		      << (solver == SOLVER_SPARSE ? Matrix(S) : A)
+		      << endl << endl
 		      << "x = "      << endl << x << endl << endl
 		      << "B = "      << endl << B << endl << endl
 		      << "Labels = " << endl << unknown_labels << endl << endl
@@ -80,11 +410,137 @@ std::string LinearSystem::to_string() {
  *
  * @return The solution vector `x` to the system Ax = B.
  */
-Eigen::VectorXd& LinearSystem::solve() {
-	x = A.colPivHouseholderQr().solve(B);
+template <typename Scalar>
+typename BasicLinearSystem<Scalar>::Vector&
+BasicLinearSystem<Scalar>::solve() {
+	factor();
+	return back_substitute();
+}
+
+/**
+ * @brief Factors the LHS of the system, so that it can be solved against
+ * one or more RHS vectors with `back_substitute`.
+ *
+ * In sparse mode, the symbolic analysis (column ordering and fill pattern)
+ * is only redone when a new nonzero has been stamped into `S` since the
+ * last analysis, which leaves `S` uncompressed. Once the circuit's pattern
+ * has settled, each call only redoes the numeric factorization.
+ *
+ * The fixed backend falls back to the dense one's QR factorization if the
+ * LHS is singular.
+ */
+template <typename Scalar>
+void BasicLinearSystem<Scalar>::factor() {
+	if (solver == SOLVER_FIXED) {
+		fixed_fallback = !fixed->factor(A);
+		if (fixed_fallback)
+			factorization.factor(A);
+		return;
+	}
+
+	if (solver != SOLVER_SPARSE) {
+		factorization.factor(A);
+		return;
+	}
+
+	/* pattern changed - redo the ordering and symbolic factorization */
+	if (!S.isCompressed()) {
+		S.makeCompressed();
+		pattern_changed = true;
+	}
+
+	factorization.factor(S, pattern_changed);
+	pattern_changed = false;
+}
+
+/**
+ * @brief Solves the system against the current RHS, reusing the last
+ * factorization of the LHS. After calling this function, the `x` vector
+ * will contain the solution.
+ *
+ * A reduced system first takes the substituted node voltages from their
+ * sources' branch equations and moves their columns to the RHS. After the
+ * solve, each source's branch current comes out of its node's KCL
+ * equation.
+ *
+ * The dense and fixed backends never allocate here. Eigen's sparse LU
+ * allocates scratch space on every solve.
+ *
+ * @return The solution vector `x` to the system Ax = B.
+ */
+template <typename Scalar>
+typename BasicLinearSystem<Scalar>::Vector&
+BasicLinearSystem<Scalar>::back_substitute() {
+	if (reduction == NULL) {
+		solve_factored(B, x);
+		return x;
+	}
+
+	const std::vector<Reduction::Substitution>& subs = reduction->substitutions;
+	int k = subs.size();
+	for (int s = 0; s < k; s++) {
+		x(subs[s].node) = B(subs[s].branch) /
+		                  substituted_rows(2 * s + 1, subs[s].node);
+		x(subs[s].branch) = 0.0;
+	}
+
+	for (int i = 0; i < reduction->size(); i++) {
+		int r = reduction->unknown[i];
+		reduced_B(i) = B(r);
+		for (int s = 0; s < k; s++)
+			reduced_B(i) -= substituted_cols(r, s) * x(subs[s].node);
+	}
+
+	solve_factored(reduced_B, reduced_x);
+	for (int i = 0; i < reduction->size(); i++)
+		x(reduction->unknown[i]) = reduced_x(i);
+	x(ground) = 0.0;
+
+	for (int s = 0; s < k; s++) {
+		Scalar residual = B(subs[s].node) - substituted_rows.row(2 * s).dot(x);
+		x(subs[s].branch) = residual /
+		                    substituted_rows(2 * s, subs[s].branch);
+	}
 	return x;
 }
 
+/**
+ * @brief Checks whether the last factorization of the LHS found it singular
+ * to working precision, so that QR only settled some of the unknowns and
+ * left the rest at zero (see `qr_solve`). Newton's method then leaves
+ * those unknowns wherever its starting guess had them.
+ *
+ * @return True if the LHS was rank deficient and false otherwise.
+ */
+template <typename Scalar>
+bool BasicLinearSystem<Scalar>::rank_deficient() const {
+	bool used_qr = (solver == SOLVER_FIXED) ? fixed_fallback :
+	               (solver != SOLVER_SPARSE || factorization.sparse_fallback);
+	const Eigen::ColPivHouseholderQR<Matrix>& qr = factorization.qr;
+	return used_qr && qr.nonzeroPivots() < qr.cols();
+}
+
+/**
+ * @brief Solves against the last factorization of the LHS with whichever
+ * backend factored it.
+ *
+ * @param rhs The RHS, of the size of `A` (or `S`).
+ * @param soln Filled in with the solution, of the same size.
+ */
+template <typename Scalar>
+void BasicLinearSystem<Scalar>::solve_factored(const Vector& rhs,
+	Vector& soln) {
+
+	if (solver == SOLVER_FIXED) {
+		if (fixed_fallback)
+			factorization.qr_solve(rhs, soln);
+		else
+			fixed->solve(rhs, soln);
+	} else {
+		factorization.solve(rhs, soln, solver == SOLVER_SPARSE);
+	}
+}
+
 /**
  * @brief Increments the LHS of the system of equations at a given
  * position by a provided delta.
@@ -93,9 +549,11 @@ Eigen::VectorXd& LinearSystem::solve() {
  * @param c The column to update.
  * @param delta The value to increment by.
  */
-void LinearSystem::increment_lhs(int r, int c, double delta) {
-	if (r != ground)
-		A(r, c) += delta;
+template <typename Scalar>
+void BasicLinearSystem<Scalar>::increment_lhs(int r, int c, double delta) {
+	Scalar *slot = lhs_slot(r, c);
+	if (slot != NULL)
+		*slot += delta;
 }
 
 /**
@@ -104,7 +562,68 @@ void LinearSystem::increment_lhs(int r, int c, double delta) {
  *
  * @param r The row to update.	 * @param delta The value to increment by.
  */
-void LinearSystem::increment_rhs(int r, double delta) {
+template <typename Scalar>
+void BasicLinearSystem<Scalar>::increment_rhs(int r, double delta) {
 	if (r != ground)
 		B(r) += delta;
 }
+
+/**
+ * @brief Gets the address of an entry in the LHS of the system, so that
+ * it can be updated directly without going through `increment_lhs`.
+ *
+ * In sparse mode the entry must already be part of the nonzero pattern
+ * (i.e. it has been passed to `increment_lhs` before the last `clear`),
+ * otherwise inserting it would move the addresses of other entries.
+ *
+ * @param r The row of the entry.
+ * @param c The column of the entry.
+ *
+ * @return Address of the entry, or NULL if the entry is in the ground row
+ * (or, in a reduced system, a column that never needs to be read) and
+ * should never be written.
+ */
+template <typename Scalar>
+Scalar *BasicLinearSystem<Scalar>::lhs_slot(int r, int c) {
+	if (r == ground)
+		return NULL;
+
+	if (reduction != NULL) {
+		if (c == ground)
+			return NULL;
+		if (substituted_row[r] >= 0)
+			return &substituted_rows(substituted_row[r], c);
+		if (substituted_col[c] >= 0)
+			return &substituted_cols(r, substituted_col[c]);
+
+		/* substituted branch currents never reach the remaining rows */
+		if (reduction->index[c] < 0)
+			return NULL;
+		r = reduction->index[r];
+		c = reduction->index[c];
+	}
+
+	if (solver == SOLVER_SPARSE)
+		return &S.coeffRef(r, c);
+	return &A(r, c);
+}
+
+/**
+ * @brief Gets the address of an entry in the RHS of the system.
+ *
+ * @param r The row of the entry.
+ *
+ * @return Address of the entry, or NULL if the entry is in the ground row
+ * and should never be written.
+ */
+template <typename Scalar>
+Scalar *BasicLinearSystem<Scalar>::rhs_slot(int r) {
+	if (r == ground)
+		return NULL;
+	return &B(r);
+}
+
+template struct BasicFactorization<double>;
+template struct BasicFactorization<float>;
+template struct BasicLinearSystem<double>;
+template struct BasicLinearSystem<float>;
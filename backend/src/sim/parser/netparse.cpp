@@ -18,6 +18,7 @@
 #include <memory>
 #include <assert.h>
 #include <parser/netparser.hpp>
+#include <parser/simplify.hpp>
 #include <iostream>
 #include <components/component.hpp>
 #include <errors.hpp>
@@ -241,7 +242,7 @@ NetlistParser::NetlistParser(simparams_t *params) {
                                         AudioManager::FILETYPE_NONE;
 
 
-    vector<string> effect_blocks = get_effect_blocks(ni);
+    effect_blocks = get_effect_blocks(ni);
 
     this->am = new AudioManager(
         input_source,
@@ -253,17 +254,50 @@ NetlistParser::NetlistParser(simparams_t *params) {
 
     input_signal_file = sigfile;
 
+    ground_id = -1;
+    vector<vector<string>> lines;
     for (auto it = ni.begin(); it != ni.end(); it++) {
         const string& line = *it;
         vector<string> tokens = tokenize(line);
         if (tokens[0] == "GROUND") {
             ground_id = stoi(tokens[1]);
         }
+        else if (tokens[0] == "INTEGRATION") {
+            StampProgram::integration_t method;
+            if (tokens.size() < 2 ||
+                !StampProgram::parse_integration(tokens[1].c_str(), &method))
+                sim_error("Unknown integration method in '%s'", line.c_str());
+            c.set_integration(method);
+        }
+        else if (tokens[0] == "PRECISION") {
+            LinearSystem::precision_t precision;
+            if (tokens.size() < 2 ||
+                !LinearSystem::parse_precision(tokens[1].c_str(), &precision))
+                sim_error("Unknown precision in '%s'", line.c_str());
+            c.set_precision(precision);
+        }
         else {
-            Component *c = component_from_tokens(tokens);
-            if (c != NULL) {
-                components.push_back(c);
-            }
+            lines.push_back(tokens);
+        }
+    }
+
+    /* strip redundant components before any of them reach the circuit,
+     * leaving alone the ones being swept */
+    if (!params->no_simplify && ground_id >= 0) {
+        NetlistSimplifier simplifier(ground_id);
+        for (int i = 0; i < params->num_sweeps; i++) {
+            string spec = params->sweeps[i];
+            simplifier.keep(spec.substr(0, spec.find('=')));
+        }
+        lines = simplifier.run(lines);
+        if (simplifier.changed())
+            simplifier.report(std::cout);
+    }
+
+    for (vector<string>& tokens : lines) {
+        Component *c = component_from_tokens(tokens);
+        if (c != NULL) {
+            components.push_back(c);
         }
     }
 
@@ -278,6 +312,38 @@ NetlistParser::NetlistParser(simparams_t *params) {
 NetlistParser::~NetlistParser() {
 }
 
+/**
+ * @brief Gets the components parsed from the netlist.
+ *
+ * @return Every component in the netlist, in the order they appear.
+ */
+vector<Component*> NetlistParser::get_components() {
+    return components;
+}
+
+/**
+ * @brief Opens another signal file to be run through the same circuit and
+ * effect blocks as the one given on the command line, e.g. for batches.
+ *
+ * @param sigfile The input signal file.
+ * @param outfile The output file, or NULL to discard the output.
+ *
+ * @return A newly constructed AudioManager for the signal.
+ */
+AudioManager *NetlistParser::open_signal(const char *sigfile,
+                                         const char *outfile) {
+
+    AudioManager::output_t outputs = outfile != NULL
+                                     ? AudioManager::OUTPUT_FILE : 0;
+    return new AudioManager(
+        AudioManager::INPUT_FILE,
+        outputs,
+        sigfile,
+        outfile,
+        get_filetype(sigfile),
+        effect_blocks);
+}
+
 /**
  * @brief Creates a component from a vector of tokens found on a single line
  * in a netlist.
@@ -0,0 +1,432 @@
+/**
+ *
+ * @file simplify.cpp
+ *
+ * @brief Contains the implementation of netlist simplification: the passes
+ * that merge and drop redundant components before a circuit is built.
+ *
+ */
+
+#include <parser/simplify.hpp>
+#include <components/component.hpp>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+using std::vector;
+using std::string;
+
+/**
+ * @brief Writes a value back out for a netlist, with every digit needed to
+ * read it back exactly.
+ *
+ * @param value The value.
+ *
+ * @return The value as a netlist token.
+ */
+static string value_token(double value) {
+    std::ostringstream token;
+    token << std::setprecision(17) << value;
+    return token.str();
+}
+
+/**
+ * @brief Constructs a netlist simplifier.
+ *
+ * @param ground_id The netlist's ground node.
+ */
+NetlistSimplifier::NetlistSimplifier(int ground_id)
+    : ground_id(ground_id), max_node(0), components_before(0),
+      components_after(0), nodes_before(0), nodes_after(0), shorts(0),
+      loops(0), parallel(0), series(0), dangling(0), isolated(0) {
+}
+
+/**
+ * @brief Keeps a component out of every pass: it is never merged or
+ * dropped, and the nodes at its ends never go away.
+ *
+ * @param name The component's name in the netlist.
+ */
+void NetlistSimplifier::keep(const string& name) {
+    keep_names.insert(name);
+}
+
+/**
+ * @brief Simplifies the component lines of a netlist.
+ *
+ * @param lines Tokenized lines, one per component. Lines for anything other
+ * than resistors, capacitors, diodes and the input and output are passed
+ * through untouched.
+ *
+ * @return The lines of the simplified netlist, in their original order.
+ */
+vector<vector<string>> NetlistSimplifier::run(
+    const vector<vector<string>>& lines) {
+
+    elements.clear();
+    max_node = ground_id;
+    for (const vector<string>& tokens : lines) {
+        Element e;
+        e.tokens = tokens;
+        e.type = tokens[0];
+        e.n1 = e.n2 = -1;
+        e.value = 0.0;
+        e.removed = false;
+        e.modified = false;
+        e.kept = tokens.size() > 1 && keep_names.count(tokens[1]) > 0;
+
+        bool valued = (e.type == Resistor::IDENTIFIER ||
+                       e.type == Capacitor::IDENTIFIER);
+        e.device = (valued || e.type == Diode::IDENTIFIER ||
+                    e.type == VoltageIn::IDENTIFIER ||
+                    e.type == VoltageOut::IDENTIFIER) &&
+                   tokens.size() >= (valued ? 5u : 4u);
+        if (e.device) {
+            e.n1 = stoi(tokens[2]);
+            e.n2 = stoi(tokens[3]);
+            if (valued)
+                e.value = Component::parse_by_unit(tokens[4]);
+            e.device = (e.n1 >= 0 && e.n2 >= 0);
+            max_node = std::max(max_node, std::max(e.n1, e.n2));
+        }
+        elements.push_back(e);
+    }
+
+    components_before = 0;
+    for (const Element& e : elements)
+        components_before += e.device;
+    nodes_before = count_nodes();
+    shorts = loops = parallel = series = dangling = isolated = 0;
+
+    drop_isolated();
+    bool progress = true;
+    while (progress) {
+        progress = collapse_shorts();
+        progress = drop_loops() || progress;
+        progress = merge_parallel() || progress;
+        progress = merge_series() || progress;
+        progress = drop_dangling() || progress;
+    }
+
+    vector<vector<string>> simplified;
+    components_after = 0;
+    for (Element& e : elements) {
+        if (e.removed)
+            continue;
+        if (e.modified) {
+            e.tokens[2] = std::to_string(e.n1);
+            e.tokens[3] = std::to_string(e.n2);
+            if (e.tokens.size() >= 5 && e.type != Diode::IDENTIFIER &&
+                e.type != VoltageIn::IDENTIFIER &&
+                e.type != VoltageOut::IDENTIFIER)
+                e.tokens[4] = value_token(e.value);
+        }
+        components_after += e.device;
+        simplified.push_back(e.tokens);
+    }
+    nodes_after = count_nodes();
+    return simplified;
+}
+
+/**
+ * @brief Checks whether an element is a resistor, capacitor or diode: the
+ * components the passes may merge or drop.
+ *
+ * @param e The element.
+ */
+bool NetlistSimplifier::passive(const Element& e) {
+    return e.type == Resistor::IDENTIFIER || e.type == Capacitor::IDENTIFIER ||
+           e.type == Diode::IDENTIFIER;
+}
+
+/**
+ * @brief Checks whether an element may be merged or dropped.
+ *
+ * @param e The element.
+ */
+bool NetlistSimplifier::removable(const Element& e) const {
+    return e.device && !e.removed && !e.kept && passive(e);
+}
+
+/**
+ * @brief Lists the live elements touching each node, once per terminal
+ * (the output measures its nodes without touching them), and marks the
+ * nodes that must stay: ground, the input's and output's terminals and the
+ * ends of kept components.
+ *
+ * @param touching Filled in with the elements touching each node.
+ * @param observed Filled in with whether each node must stay.
+ */
+void NetlistSimplifier::incidence(vector<vector<int>>& touching,
+                                  vector<bool>& observed) const {
+    touching.assign(max_node + 1, vector<int>());
+    observed.assign(max_node + 1, false);
+    observed[ground_id] = true;
+
+    for (int i = 0; i < (int) elements.size(); i++) {
+        const Element& e = elements[i];
+        if (!e.device || e.removed)
+            continue;
+        if (!passive(e) || e.kept)
+            observed[e.n1] = observed[e.n2] = true;
+        if (e.type != VoltageOut::IDENTIFIER) {
+            touching[e.n1].push_back(i);
+            touching[e.n2].push_back(i);
+        }
+    }
+}
+
+/**
+ * @brief Collapses zero-ohm resistors, renaming the node at one end to the
+ * node at the other everywhere (keeping ground, or else the lower node).
+ * Links that would short out the input are left alone.
+ *
+ * @return Whether any link was collapsed.
+ */
+bool NetlistSimplifier::collapse_shorts() {
+    bool progress = false;
+    for (Element& link : elements) {
+        if (!removable(link) || link.type != Resistor::IDENTIFIER ||
+            link.value != 0.0 || link.n1 == link.n2)
+            continue;
+
+        bool shorts_input = false;
+        for (const Element& e : elements) {
+            if (e.device && !e.removed && e.type == VoltageIn::IDENTIFIER &&
+                std::minmax(e.n1, e.n2) == std::minmax(link.n1, link.n2))
+                shorts_input = true;
+        }
+        if (shorts_input)
+            continue;
+
+        int from = std::max(link.n1, link.n2);
+        int to = std::min(link.n1, link.n2);
+        if (from == ground_id)
+            std::swap(from, to);
+
+        link.removed = true;
+        for (Element& e : elements) {
+            if (!e.device || e.removed)
+                continue;
+            if (e.n1 == from) {
+                e.n1 = to;
+                e.modified = true;
+            }
+            if (e.n2 == from) {
+                e.n2 = to;
+                e.modified = true;
+            }
+        }
+        shorts++;
+        progress = true;
+    }
+    return progress;
+}
+
+/**
+ * @brief Drops components with both ends on the same node.
+ *
+ * @return Whether any component was dropped.
+ */
+bool NetlistSimplifier::drop_loops() {
+    bool progress = false;
+    for (Element& e : elements) {
+        if (removable(e) && e.n1 == e.n2) {
+            e.removed = true;
+            loops++;
+            progress = true;
+        }
+    }
+    return progress;
+}
+
+/**
+ * @brief Merges resistors between the same pair of nodes into the first of
+ * them, adding their conductances, and likewise capacitors, adding their
+ * capacitances.
+ *
+ * @return Whether anything was merged.
+ */
+bool NetlistSimplifier::merge_parallel() {
+    bool progress = false;
+    for (int i = 0; i < (int) elements.size(); i++) {
+        Element& a = elements[i];
+        if (!removable(a) || a.type == Diode::IDENTIFIER)
+            continue;
+
+        for (int j = i + 1; j < (int) elements.size(); j++) {
+            Element& b = elements[j];
+            if (!removable(b) || b.type != a.type ||
+                std::minmax(a.n1, a.n2) != std::minmax(b.n1, b.n2))
+                continue;
+
+            if (a.type == Resistor::IDENTIFIER)
+                a.value = a.value * b.value / (a.value + b.value);
+            else
+                a.value += b.value;
+            a.modified = true;
+            b.removed = true;
+            parallel++;
+            progress = true;
+        }
+    }
+    return progress;
+}
+
+/**
+ * @brief Merges pairs of resistors that meet at a node nothing else touches
+ * into the first of them, adding their resistances. The node between them
+ * goes away.
+ *
+ * @return Whether anything was merged.
+ */
+bool NetlistSimplifier::merge_series() {
+    vector<vector<int>> touching;
+    vector<bool> observed;
+    incidence(touching, observed);
+
+    bool progress = false;
+    for (int node = 0; node <= max_node; node++) {
+        const vector<int>& t = touching[node];
+        if (observed[node] || t.size() != 2 || t[0] == t[1])
+            continue;
+
+        Element& a = elements[t[0]];
+        Element& b = elements[t[1]];
+        if (!removable(a) || !removable(b) ||
+            a.type != Resistor::IDENTIFIER || b.type != Resistor::IDENTIFIER)
+            continue;
+
+        /* the lists predate this pass's merges, but a merge only moves a
+         * terminal onto the node a removed resistor held, so a node listed
+         * with two live resistors is still touched by just those two */
+        int b_far = (b.n1 == node) ? b.n2 : b.n1;
+        if (a.n1 == node)
+            a.n1 = b_far;
+        else
+            a.n2 = b_far;
+        a.value += b.value;
+        a.modified = true;
+        b.removed = true;
+        series++;
+        progress = true;
+    }
+    return progress;
+}
+
+/**
+ * @brief Drops components hanging off a node that nothing else touches.
+ * No current can flow through them.
+ *
+ * @return Whether anything was dropped.
+ */
+bool NetlistSimplifier::drop_dangling() {
+    vector<vector<int>> touching;
+    vector<bool> observed;
+    incidence(touching, observed);
+
+    bool progress = false;
+    for (int node = 0; node <= max_node; node++) {
+        if (observed[node] || touching[node].size() != 1)
+            continue;
+
+        Element& e = elements[touching[node][0]];
+        if (!removable(e))
+            continue;
+        e.removed = true;
+        dangling++;
+        progress = true;
+    }
+    return progress;
+}
+
+/**
+ * @brief Drops every part of the circuit that meets the rest only at
+ * ground and holds neither the input, the output nor a kept component.
+ * Parts are found as the connected components of the circuit's graph with
+ * ground taken out.
+ */
+void NetlistSimplifier::drop_isolated() {
+    /* union-find over the nodes, joined by every component */
+    vector<int> parent(max_node + 1);
+    for (int node = 0; node <= max_node; node++)
+        parent[node] = node;
+    auto find = [&](int node) {
+        while (parent[node] != node) {
+            parent[node] = parent[parent[node]];
+            node = parent[node];
+        }
+        return node;
+    };
+
+    for (const Element& e : elements) {
+        if (e.device && e.n1 != ground_id && e.n2 != ground_id)
+            parent[find(e.n1)] = find(e.n2);
+    }
+
+    vector<bool> needed(max_node + 1, false);
+    for (const Element& e : elements) {
+        if (e.device && (!passive(e) || e.kept)) {
+            needed[find(e.n1)] = true;
+            needed[find(e.n2)] = true;
+        }
+    }
+
+    for (Element& e : elements) {
+        if (!removable(e))
+            continue;
+        int node = (e.n1 != ground_id) ? e.n1 : e.n2;
+        if (node != ground_id && !needed[find(node)]) {
+            e.removed = true;
+            isolated++;
+        }
+    }
+}
+
+/**
+ * @brief Counts the nodes other than ground that live components touch.
+ *
+ * @return The number of nodes.
+ */
+int NetlistSimplifier::count_nodes() const {
+    vector<bool> seen(max_node + 1, false);
+    int nodes = 0;
+    for (const Element& e : elements) {
+        if (!e.device || e.removed)
+            continue;
+        for (int node : { e.n1, e.n2 }) {
+            if (node != ground_id && !seen[node]) {
+                seen[node] = true;
+                nodes++;
+            }
+        }
+    }
+    return nodes;
+}
+
+/**
+ * @brief Prints how much smaller the last run made the netlist, and which
+ * passes removed what.
+ *
+ * @param out Stream to print to.
+ */
+void NetlistSimplifier::report(std::ostream& out) const {
+    out << "Simplified the netlist from " << components_before << " to "
+        << components_after << " component(s) and from " << nodes_before
+        << " to " << nodes_after << " node(s):";
+
+    const char *sep = " ";
+    auto item = [&](int count, const char *what) {
+        if (count > 0) {
+            out << sep << count << " " << what;
+            sep = ", ";
+        }
+    };
+    item(shorts, "zero-ohm link(s) collapsed");
+    item(loops, "shorted component(s) dropped");
+    item(parallel, "parallel component(s) merged");
+    item(series, "series resistor(s) merged");
+    item(dangling, "dangling component(s) dropped");
+    item(isolated, "component(s) cut off from the output dropped");
+    out << "." << std::endl;
+}
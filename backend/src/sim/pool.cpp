@@ -0,0 +1,146 @@
+/**
+ *
+ * @file pool.cpp
+ *
+ * @brief This file contains the implementation of the work-stealing pool
+ * used to run independent simulations across every core.
+ *
+ */
+
+#include <pool.hpp>
+
+using std::mutex;
+using std::unique_lock;
+using std::lock_guard;
+
+/**
+ * @brief Starts a pool of worker threads, which wait for tasks.
+ *
+ * @param workers Number of worker threads, or 0 to use one per core.
+ */
+WorkPool::WorkPool(int workers) : next_queue(0), queued(0), pending(0),
+	stopping(false) {
+
+	if (workers <= 0)
+		workers = default_workers();
+
+	for (int i = 0; i < workers; i++)
+		queues.push_back(new Queue());
+	for (int i = 0; i < workers; i++)
+		threads.push_back(std::thread(&WorkPool::run, this, i));
+}
+
+/**
+ * @brief Waits for every task to run, then stops and joins the workers.
+ */
+WorkPool::~WorkPool() {
+	wait();
+	{
+		lock_guard<mutex> guard(state_lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (std::thread& t : threads)
+		t.join();
+	for (Queue *q : queues)
+		delete q;
+}
+
+/**
+ * @brief Gets the number of workers a pool uses by default: one per core
+ * the system reports, or one if it cannot tell.
+ */
+int WorkPool::default_workers() {
+	int cores = std::thread::hardware_concurrency();
+	return cores > 0 ? cores : 1;
+}
+
+/**
+ * @brief Queues a task to be run by some worker. Tasks are dealt out to
+ * the workers' queues in turn, and may be stolen by idle workers.
+ *
+ * @param task The task.
+ */
+void WorkPool::submit(task_t task) {
+	Queue& q = *queues[next_queue];
+	next_queue = (next_queue + 1) % queues.size();
+	{
+		lock_guard<mutex> guard(q.lock);
+		q.tasks.push_back(task);
+	}
+	{
+		lock_guard<mutex> guard(state_lock);
+		queued++;
+		pending++;
+	}
+	wake.notify_one();
+}
+
+/**
+ * @brief Waits until every task submitted so far has finished running.
+ */
+void WorkPool::wait() {
+	unique_lock<mutex> guard(state_lock);
+	idle.wait(guard, [this] { return pending == 0; });
+}
+
+/**
+ * @brief Takes the newest task from a worker's own queue or, if it is
+ * empty, the oldest task from the first other queue that has one.
+ *
+ * @param worker The worker.
+ * @param task Filled in with the task taken.
+ *
+ * @return True if a task was taken and false if every queue was empty.
+ */
+bool WorkPool::take(int worker, task_t& task) {
+	int n = queues.size();
+	for (int i = 0; i < n; i++) {
+		Queue& q = *queues[(worker + i) % n];
+		lock_guard<mutex> guard(q.lock);
+		if (q.tasks.empty())
+			continue;
+
+		if (i == 0) {
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		} else {
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Main loop of a worker: runs tasks as long as any are queued, and
+ * sleeps until more are submitted or the pool stops.
+ *
+ * @param worker Index of the worker.
+ */
+void WorkPool::run(int worker) {
+	task_t task;
+	while (true) {
+		if (take(worker, task)) {
+			{
+				lock_guard<mutex> guard(state_lock);
+				queued--;
+			}
+
+			task(worker);
+			task = nullptr;
+
+			lock_guard<mutex> guard(state_lock);
+			if (--pending == 0)
+				idle.notify_all();
+			continue;
+		}
+
+		unique_lock<mutex> guard(state_lock);
+		wake.wait(guard, [this] { return stopping || queued > 0; });
+		if (stopping && queued <= 0)
+			return;
+	}
+}
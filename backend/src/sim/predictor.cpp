@@ -0,0 +1,114 @@
+/**
+ *
+ * @file predictor.cpp
+ *
+ * @brief This file contains the implementation of the newton predictor.
+ *
+ */
+
+#include <predictor.hpp>
+#include <algorithm>
+#include <math.h>
+
+using Eigen::VectorXd;
+
+/**
+ * @brief Binomial coefficients used to extrapolate a polynomial through
+ * equally spaced points: row n holds the weights of the last n solutions.
+ */
+static const double EXTRAPOLATION_WEIGHTS[][Predictor::MAX_HISTORY] = {
+	{ 0,  0,  0,  0 },
+	{ 1,  0,  0,  0 },
+	{ 2, -1,  0,  0 },
+	{ 3, -3,  1,  0 },
+	{ 4, -6,  4, -1 },
+};
+
+/**
+ * @brief Constructs a predictor.
+ *
+ * @param kind How the guess is extrapolated.
+ * @param history Number of past solutions to fit a polynomial through,
+ * clamped to [1, MAX_HISTORY]. Two is a linear fit, three a quadratic fit.
+ * The input predictor always uses the last two solutions.
+ */
+Predictor::Predictor(predictor_t kind, int history) : kind(kind) {
+	if (kind == PREDICT_NONE)
+		history = 1;
+	if (kind == PREDICT_INPUT)
+		history = 2;
+	this->history = std::min(std::max(history, 1), MAX_HISTORY);
+	reset(0);
+}
+
+/**
+ * @brief Forgets every past solution.
+ *
+ * @param num_unknowns Size of the solutions that will be recorded.
+ */
+void Predictor::reset(int num_unknowns) {
+	solns.assign(history, VectorXd::Zero(num_unknowns));
+	inputs.assign(history, 0.0);
+	count = 0;
+	newest = 0;
+}
+
+/**
+ * @brief Fills in the starting guess for newton's method on the next
+ * timestep. Until enough solutions have been recorded, the guess is the
+ * most recent solution (or left as is if there are none).
+ *
+ * @param u The input for the next timestep.
+ * @param guess Filled in with the starting guess.
+ */
+void Predictor::predict(double u, VectorXd& guess) const {
+	if (count == 0)
+		return;
+
+	if (kind == PREDICT_INPUT) {
+		/* assume the solution moves in proportion to the input */
+		double du = inputs[newest] - inputs[(newest + 1) % history];
+		if (count == 2 && fabs(du) > MIN_INPUT_STEP) {
+			double scale = (u - inputs[newest]) / du;
+			guess = past(0) + scale * (past(0) - past(1));
+		} else {
+			guess = past(0);
+		}
+		return;
+	}
+
+	int used = std::min(count, history);
+	guess = EXTRAPOLATION_WEIGHTS[used][0] * past(0);
+	for (int age = 1; age < used; age++)
+		guess += EXTRAPOLATION_WEIGHTS[used][age] * past(age);
+}
+
+/**
+ * @brief Records the solution accepted for a timestep.
+ *
+ * @param u The input for the timestep.
+ * @param soln The accepted solution.
+ */
+void Predictor::accept(double u, const VectorXd& soln) {
+	newest = (newest + 1) % history;
+	solns[newest] = soln;
+	inputs[newest] = u;
+	if (count < history)
+		count++;
+}
+
+/**
+ * @brief Gets a human readable name for a predictor.
+ *
+ * @param kind The predictor.
+ */
+const char *Predictor::predictor_name(predictor_t kind) {
+	switch (kind) {
+		case PREDICT_POLYNOMIAL:
+			return "polynomial";
+		case PREDICT_INPUT:
+			return "input";
+		default:
+			return "none";
+	}
+}
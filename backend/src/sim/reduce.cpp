@@ -0,0 +1,293 @@
+/**
+ *
+ * @file reduce.cpp
+ *
+ * @brief This file contains the implementation of system reductions: the
+ * elimination of ground and grounded sources, and the fill-reducing
+ * orderings of the unknowns that remain.
+ *
+ */
+
+#include <reduce.hpp>
+#include <Eigen/Sparse>
+#include <Eigen/OrderingMethods>
+#include <algorithm>
+
+using std::vector;
+using std::pair;
+
+/**
+ * @brief Works out a reduction of a circuit's MNA system.
+ *
+ * @param num_unknowns The number of unknowns in the circuit.
+ * @param ground Unknown of the ground node's voltage.
+ * @param pattern Every (row, column) entry of the LHS that is ever
+ * stamped, as unknowns.
+ * @param sources Voltage sources with one terminal on ground, as the node
+ * at their other terminal and their branch current. Each is substituted
+ * unless its node was already eliminated, or its branch current shows up
+ * anywhere a source's would not.
+ * @param ordering Order to put the remaining unknowns in.
+ */
+Reduction::Reduction(int num_unknowns, int ground,
+	const vector<pair<int, int>>& pattern, const vector<Substitution>& sources,
+	ordering_t ordering)
+	: num_unknowns(num_unknowns), ground(ground), ordering(ordering) {
+
+	vector<vector<int>> row_cols(num_unknowns), col_rows(num_unknowns);
+	for (const auto& e : pattern) {
+		row_cols[e.first].push_back(e.second);
+		col_rows[e.second].push_back(e.first);
+	}
+
+	vector<bool> eliminated(num_unknowns, false);
+	eliminated[ground] = true;
+
+	/* the branch current must only couple to the node (and ground) */
+	auto only = [&](const vector<int>& entries, int node) {
+		for (int e : entries) {
+			if (e != node && e != ground)
+				return false;
+		}
+		return !entries.empty();
+	};
+	for (const Substitution& s : sources) {
+		if (eliminated[s.node] || eliminated[s.branch] ||
+			!only(row_cols[s.branch], s.node) ||
+			!only(col_rows[s.branch], s.node))
+			continue;
+
+		eliminated[s.node] = true;
+		eliminated[s.branch] = true;
+		substitutions.push_back(s);
+	}
+
+	/* symmetric pattern of what is left, in the netlist's order */
+	vector<int> kept;
+	vector<int> local(num_unknowns, -1);
+	for (int i = 0; i < num_unknowns; i++) {
+		if (!eliminated[i]) {
+			local[i] = kept.size();
+			kept.push_back(i);
+		}
+	}
+	int n = kept.size();
+	vector<vector<int>> adj(n);
+	for (const auto& e : pattern) {
+		int r = local[e.first], c = local[e.second];
+		if (r < 0 || c < 0 || r == c)
+			continue;
+		adj[r].push_back(c);
+		adj[c].push_back(r);
+	}
+	for (auto& a : adj) {
+		std::sort(a.begin(), a.end());
+		a.erase(std::unique(a.begin(), a.end()), a.end());
+	}
+
+	vector<int> natural(n);
+	for (int i = 0; i < n; i++)
+		natural[i] = i;
+
+	vector<int> order = natural;
+	if (ordering == ORDER_RCM)
+		order_rcm(adj, order);
+	else if (ordering == ORDER_AMD)
+		order_amd(adj, order);
+
+	index.assign(num_unknowns, -1);
+	unknown.resize(n);
+	for (int k = 0; k < n; k++) {
+		unknown[k] = kept[order[k]];
+		index[unknown[k]] = k;
+	}
+
+	natural_fill = count_fill(adj, natural);
+	ordered_fill = count_fill(adj, order);
+}
+
+/**
+ * @brief Orders unknowns by reverse Cuthill-McKee: a breadth first search
+ * from a node at the edge of the graph, visiting the neighbors of each
+ * node in order of increasing degree, reversed. Each connected component
+ * is ordered in turn.
+ *
+ * @param adj Neighbors of each unknown.
+ * @param order Filled in with the unknown at each position.
+ */
+void Reduction::order_rcm(const vector<vector<int>>& adj, vector<int>& order) {
+	int n = adj.size();
+	vector<int> level(n, -1);
+	vector<bool> visited(n, false);
+	order.clear();
+
+	/*
+	 * Breadth first search over the unvisited nodes, visiting neighbors in
+	 * order of increasing degree. Leaves the nodes reached in `reached`
+	 * and their levels in `level`, and returns the deepest level.
+	 */
+	vector<int> reached;
+	auto search = [&](int start) {
+		for (int v : reached)
+			level[v] = -1;
+		reached.assign(1, start);
+		level[start] = 0;
+		for (size_t head = 0; head < reached.size(); head++) {
+			int v = reached[head];
+			size_t first = reached.size();
+			for (int u : adj[v]) {
+				if (level[u] < 0 && !visited[u]) {
+					level[u] = level[v] + 1;
+					reached.push_back(u);
+				}
+			}
+			std::stable_sort(reached.begin() + first, reached.end(),
+				[&](int a, int b) { return adj[a].size() < adj[b].size(); });
+		}
+		return level[reached.back()];
+	};
+
+	for (int seed = 0; seed < n; seed++) {
+		if (visited[seed])
+			continue;
+
+		/* move the start out to a pseudo-peripheral node: the deepest
+		 * level's smallest degree node, for as long as that gets deeper */
+		int start = seed;
+		int depth = search(start);
+		for (;;) {
+			int candidate = reached.back();
+			for (int v : reached) {
+				if (level[v] == depth && adj[v].size() < adj[candidate].size())
+					candidate = v;
+			}
+			int next_depth = search(candidate);
+			if (next_depth <= depth)
+				break;
+			start = candidate;
+			depth = next_depth;
+		}
+
+		search(start);
+		for (int v : reached) {
+			visited[v] = true;
+			order.push_back(v);
+		}
+	}
+
+	std::reverse(order.begin(), order.end());
+}
+
+/**
+ * @brief Orders unknowns by approximate minimum degree, with Eigen's
+ * implementation.
+ *
+ * @param adj Neighbors of each unknown.
+ * @param order Filled in with the unknown at each position.
+ */
+void Reduction::order_amd(const vector<vector<int>>& adj, vector<int>& order) {
+	int n = adj.size();
+	vector<Eigen::Triplet<double>> entries;
+	for (int i = 0; i < n; i++) {
+		entries.push_back(Eigen::Triplet<double>(i, i, 1.0));
+		for (int j : adj[i])
+			entries.push_back(Eigen::Triplet<double>(i, j, 1.0));
+	}
+	Eigen::SparseMatrix<double> pattern(n, n);
+	pattern.setFromTriplets(entries.begin(), entries.end());
+
+	Eigen::AMDOrdering<int> amd;
+	Eigen::AMDOrdering<int>::PermutationType perm;
+	amd(pattern, perm);
+
+	order.resize(n);
+	for (int k = 0; k < n; k++)
+		order[k] = perm.indices()(k);
+}
+
+/**
+ * @brief Counts the nonzeros in the LU factors of a matrix with a
+ * symmetric pattern, eliminated in a given order, without pivoting. Each
+ * row of L is found by walking the elimination tree up from its
+ * nonzeros, so this takes time proportional to the count.
+ *
+ * @param adj Neighbors of each unknown.
+ * @param order The unknown at each position.
+ *
+ * @return Nonzeros in L and U together, counting the diagonal once.
+ */
+long Reduction::count_fill(const vector<vector<int>>& adj,
+	const vector<int>& order) {
+
+	int n = adj.size();
+	vector<int> position(n);
+	for (int k = 0; k < n; k++)
+		position[order[k]] = k;
+
+	/* elimination tree, with path compression through `ancestor` */
+	vector<int> parent(n, -1), ancestor(n, -1);
+	for (int i = 0; i < n; i++) {
+		for (int u : adj[order[i]]) {
+			int r = position[u];
+			if (r >= i)
+				continue;
+			while (ancestor[r] != -1 && ancestor[r] != i) {
+				int next = ancestor[r];
+				ancestor[r] = i;
+				r = next;
+			}
+			if (ancestor[r] == -1) {
+				ancestor[r] = i;
+				parent[r] = i;
+			}
+		}
+	}
+
+	/* row i of L holds every node on the paths up from its nonzeros */
+	long below = 0;
+	vector<int> mark(n, -1);
+	for (int i = 0; i < n; i++) {
+		mark[i] = i;
+		for (int u : adj[order[i]]) {
+			for (int r = position[u]; r < i && mark[r] != i; r = parent[r]) {
+				mark[r] = i;
+				below++;
+			}
+		}
+	}
+
+	return n + 2 * below;
+}
+
+/**
+ * @brief Prints how much smaller the reduced system is than the circuit's
+ * full one, and how sparse its factors stay in the chosen order.
+ *
+ * @param out Stream to print to.
+ */
+void Reduction::report(std::ostream& out) const {
+	out << "Reduced the MNA system from " << num_unknowns << " to "
+	    << size() << " unknown(s), eliminating ground";
+	if (!substitutions.empty())
+		out << " and " << substitutions.size() << " grounded source(s)";
+	out << ". Ordered by " << ordering_name(ordering) << ": "
+	    << ordered_fill << " nonzero(s) in the factors";
+	if (ordering != ORDER_NATURAL)
+		out << ", against " << natural_fill << " in netlist order";
+	out << "." << std::endl;
+}
+
+/**
+ * @brief Gets the human readable name of an ordering.
+ *
+ * @param ordering The ordering.
+ *
+ * @return Name of the ordering, as accepted on the command line.
+ */
+const char *Reduction::ordering_name(ordering_t ordering) {
+	switch (ordering) {
+		case ORDER_RCM: return "rcm";
+		case ORDER_AMD: return "amd";
+		default:        return "natural";
+	}
+}
@@ -0,0 +1,168 @@
+/**
+ *
+ * @file resample.cpp
+ *
+ * @brief This file contains the implementation of the oversampler, which
+ * resamples the signal around a circuit with polyphase FIR filters.
+ *
+ */
+
+#include <resample.hpp>
+#include <chrono>
+#include <cmath>
+
+using Eigen::VectorXd;
+
+typedef std::chrono::steady_clock resample_clock;
+
+/**
+ * @brief Evaluates the zeroth order modified Bessel function of the first
+ * kind, which shapes the Kaiser window.
+ *
+ * @param x Argument of the function.
+ */
+static double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; term > 1.0e-12 * sum; k++) {
+		double half = x / (2 * k);
+		term *= half * half;
+		sum += term;
+	}
+	return sum;
+}
+
+/**
+ * @brief Gets the number of seconds elapsed since a point in time.
+ *
+ * @param start The point in time.
+ */
+static double seconds_since(resample_clock::time_point start) {
+	return std::chrono::duration<double>(resample_clock::now() - start).count();
+}
+
+/**
+ * @brief Designs the filters for an oversampling factor. The lowpass
+ * prototype is a Kaiser windowed sinc that cuts off just below the audio
+ * Nyquist frequency, with unity gain at DC.
+ *
+ * @param factor Oversampling factor: 1 (no resampling), 2, 4 or 8.
+ * @param taps Filter taps per polyphase branch. More taps give a sharper
+ * cutoff (and less aliasing) at the cost of more work and latency.
+ */
+void Oversampler::configure(int factor, int taps) {
+	this->factor = factor;
+	this->taps = (factor > 1) ? taps : 0;
+
+	int n = factor * this->taps + 1;
+	double center = (n - 1) / 2.0;
+	double cutoff = CUTOFF * 0.5 / factor;
+	double norm = bessel_i0(KAISER_BETA);
+
+	h.resize(n);
+	for (int i = 0; i < n; i++) {
+		double t = i - center;
+		double sinc = (t == 0) ? 2 * cutoff
+		                       : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+		double r = (n > 1) ? t / center : 0.0;
+		h(i) = sinc * bessel_i0(KAISER_BETA * sqrt(1 - r * r)) / norm;
+	}
+	h /= h.sum();
+
+	/* branch j of the upsampler only sees every factor-th coefficient, and
+	 * each upsampled sample is scaled back up by the zeros stuffed around it */
+	branches.setZero(factor, this->taps + 1);
+	for (int j = 0; j < factor; j++) {
+		for (int k = 0; k <= this->taps && j + k * factor < n; k++)
+			branches(j, this->taps - k) = factor * h(j + k * factor);
+	}
+
+	reset();
+}
+
+/**
+ * @brief Clears all filter history, as if the input had been silent, along
+ * with the cost counters.
+ */
+void Oversampler::reset() {
+	in_hist.setZero(2 * (taps + 1));
+	out_hist.setZero(2 * h.size());
+	up.setZero(factor);
+	in_pos = 0;
+	out_pos = 0;
+	in_phase = factor;
+	out_phase = 0;
+	inputs = 0;
+	seconds = 0.0;
+}
+
+/**
+ * @brief Upsamples the next audio sample into a block of `factor` samples,
+ * which are then handed out by `pop_input`.
+ *
+ * @param x The audio sample.
+ */
+void Oversampler::push_input(double x) {
+	auto start = resample_clock::now();
+
+	int len = taps + 1;
+	in_hist(in_pos) = x;
+	in_hist(in_pos + len) = x;
+	in_pos = (in_pos + 1) % len;
+
+	up.noalias() = branches * in_hist.segment(in_pos, len);
+	in_phase = 0;
+	inputs++;
+
+	seconds += seconds_since(start);
+}
+
+/**
+ * @brief Collects the next output of the circuit. Once a whole block of
+ * `factor` outputs has been collected, it is decimated into one audio
+ * sample, which lags the input by `latency` samples.
+ *
+ * @param v The circuit output.
+ * @param y Filled in with the next audio sample, if there is one.
+ *
+ * @return True if an audio sample was produced and false otherwise.
+ */
+bool Oversampler::push_output(double v, double *y) {
+	auto start = resample_clock::now();
+
+	int len = h.size();
+	out_hist(out_pos) = v;
+	out_hist(out_pos + len) = v;
+	out_pos = (out_pos + 1) % len;
+
+	/* each audio sample lines up with the first output of its block */
+	bool ready = (out_phase == 0);
+	if (ready)
+		*y = h.dot(out_hist.segment(out_pos, len));
+	out_phase = (out_phase + 1) % factor;
+
+	seconds += seconds_since(start);
+	return ready;
+}
+
+/**
+ * @brief Prints how the cost of a run of transient analysis splits between
+ * resampling and running the circuit, so that the cost of a higher internal
+ * rate can be weighed against its reduced aliasing.
+ *
+ * @param out Stream to print to.
+ * @param total_seconds Total time the run took, in seconds.
+ */
+void Oversampler::report(std::ostream& out, double total_seconds) const {
+	double circuit_seconds = total_seconds - seconds;
+	double per_sample = (inputs > 0) ? 1.0e6 / inputs : 0.0;
+
+	out << "Oversampled " << factor << "x with " << taps << " taps per "
+	    << "branch (" << latency() << " samples of latency)." << std::endl;
+	out << "  resampling: " << seconds << " s ("
+	    << seconds * per_sample << " us per sample)" << std::endl;
+	out << "  circuit:    " << circuit_seconds << " s ("
+	    << circuit_seconds * per_sample << " us per sample, "
+	    << circuit_seconds * per_sample / factor << " us per step)"
+	    << std::endl;
+}
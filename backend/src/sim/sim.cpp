@@ -18,11 +18,22 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <circuit.hpp>
+#include <batch.hpp>
+#include <pool.hpp>
+#include <sweep.hpp>
+#include <chunked.hpp>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include <chrono>
+#include <fstream>
+#include <glob.h>
 #include <sim.hpp>
+#include <alloc_audit.hpp>
+#include <sink.hpp>
 #include  <signal.h>
+#include <math.h>
 
 using Eigen::MatrixXd;
 using Eigen::Upper;
@@ -51,6 +62,66 @@ static int plotter_fd[2];
 #define ENABLE_PLOTTING 0xff
 #define LIVE_INPUT 0x13
 #define LIVE_OUTPUT 0x69
+#define SOLVER 0x70
+#define METHOD 0x71
+#define TABLE_CACHE 0x72
+#define PREDICTOR 0x100
+#define PREDICTOR_HISTORY 0x101
+#define NEWTON 0x102
+#define CHORD_RATIO 0x103
+#define RELTOL 0x104
+#define VNTOL 0x105
+#define ABSTOL 0x106
+#define ALLOC_AUDIT 0x107
+#define INTEGRATION 0x108
+#define OVERSAMPLE 0x109
+#define OVERSAMPLE_TAPS 0x10a
+#define MAX_SUBSTEPS 0x10b
+#define TRTOL 0x10c
+#define JOBS 0x10d
+#define INPUTS 0x10e
+#define OUTDIR 0x10f
+#define LANES 0x110
+#define SWEEP 0x111
+#define CHUNKS 0x112
+#define WARMUP 0x113
+#define VERIFY_SEAMS 0x114
+#define PRECISION 0x115
+#define PRECISION_REPORT 0x116
+#define COMPILE 0x117
+#define ORDERING 0x118
+#define NO_REDUCE 0x119
+#define NO_SIMPLIFY 0x11A
+
+/** @brief Number of past solutions the poly predictor fits by default */
+#define DEFAULT_PREDICTOR_HISTORY 3
+
+/** @brief Conductance ratio that makes chord newton refactor by default */
+#define DEFAULT_CHORD_RATIO 2.0
+
+/** @brief Default newton tolerances: relative, node voltage (volts) and
+ * branch current (amps) */
+#define DEFAULT_RELTOL 1.0e-3
+#define DEFAULT_VNTOL 1.0e-6
+#define DEFAULT_ABSTOL 1.0e-9
+
+/** @brief Most substeps a timestep is split into by default */
+#define DEFAULT_MAX_SUBSTEPS 16
+
+/** @brief Factor by which local truncation error may exceed its tolerance
+ * by default (SPICE's TRTOL) */
+#define DEFAULT_TRTOL 7.0
+
+/** @brief Directory precomputed port tables are cached in by default */
+#define DEFAULT_TABLE_CACHE ".csim_tables"
+
+/** @brief Sweep variants each thread runs as one batch by default, since
+ * they all share one input */
+#define DEFAULT_SWEEP_LANES 8
+
+/** @brief Warm-up before each chunk of a chunked render by default, in
+ * seconds */
+#define DEFAULT_WARMUP 0.1
 
 /** @brief Ratio to convert milliseconds to seconds */
 #define MS_TO_S 1000
@@ -146,6 +217,257 @@ static int launch_plotter() {
     return pid;
 }
 
+/**
+ * @brief Streams the results of transient analysis to the plotting script
+ * through its pipe as they are produced, one line per sample.
+ */
+class PlotterSink : public SignalSink
+{
+public:
+
+    /**
+     * @brief Takes over the write side of the plotter's pipe.
+     *
+     * @param fd The pipe's write descriptor.
+     */
+    PlotterSink(int fd) {
+        pipe = fdopen(fd, "w");
+        if (pipe == NULL)
+            sim_error("Failed to open pipe to plotter process.");
+    }
+
+    /**
+     * @brief Writes a chunk of the signals to the plotter. The time of each
+     * sample is worked out from its index rather than recorded.
+     *
+     * @param first Index of the first sample of the chunk in the run.
+     * @param dt Sampling period, in seconds.
+     * @param in Input signal over the chunk.
+     * @param out Output signal over the chunk.
+     * @param n Number of samples in the chunk.
+     */
+    void write(long first, double dt, const float *in, const float *out,
+        size_t n) override {
+
+        for (size_t i = 0; i < n; i++)
+            fprintf(pipe, "%f %f %f\n", (first + i) * dt, in[i], out[i]);
+    }
+
+    /**
+     * @brief Closes the pipe, after which the plotter sees EOF.
+     */
+    void close() {
+        if (fclose(pipe) != 0)
+            sim_error("Failed to close pipe's write fd in parent process.");
+    }
+
+private:
+
+    FILE *pipe;   /**< Buffered stream over the pipe's write side */
+};
+
+/**
+ * @brief Gets the most memory the simulator has had resident at once.
+ *
+ * @return The peak resident set size, in megabytes.
+ */
+static double peak_rss_mb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+        return 0.0;
+
+    /* Linux reports kilobytes, macOS bytes */
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+/**
+ * @brief Expands the `--inputs` argument into a list of signal files.
+ *
+ * @param spec Either a glob pattern, or `@` followed by the path of a file
+ * listing one signal file per line.
+ *
+ * @return The signal files, in order.
+ */
+static vector<string> expand_inputs(const char *spec) {
+    vector<string> files;
+
+    if (spec[0] == '@') {
+        std::ifstream list(spec + 1);
+        if (!list)
+            sim_error("Failed to open input list %s.", spec + 1);
+        string line;
+        while (std::getline(list, line)) {
+            if (!line.empty())
+                files.push_back(line);
+        }
+        return files;
+    }
+
+    glob_t matches;
+    if (glob(spec, 0, NULL, &matches) != 0)
+        sim_error("No signal files match %s.", spec);
+    for (size_t i = 0; i < matches.gl_pathc; i++)
+        files.push_back(matches.gl_pathv[i]);
+    globfree(&matches);
+    return files;
+}
+
+/**
+ * @brief Names the file a signal is rendered to in the output directory:
+ * the signal's file name, with its extension replaced by `.txt`.
+ *
+ * @param outdir The output directory.
+ * @param signal Path of the signal file.
+ */
+static string output_path(const char *outdir, const string& signal) {
+    size_t slash = signal.find_last_of('/');
+    string name = signal.substr(slash == string::npos ? 0 : slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != string::npos && dot > 0)
+        name = name.substr(0, dot);
+    return string(outdir) + "/" + name + ".txt";
+}
+
+/**
+ * @brief Creates the output directory if it does not exist yet, so renders
+ * are not run only to have their outputs dropped.
+ *
+ * @param outdir The output directory.
+ */
+static void make_outdir(const char *outdir) {
+    struct stat st;
+    mkdir(outdir, 0755);
+    if (stat(outdir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        access(outdir, W_OK) != 0) {
+        sim_error("Cannot write to output directory %s.", outdir);
+    }
+}
+
+/**
+ * @brief Renders every signal through the circuit on a work-stealing pool.
+ * Each task runs a batch of up to `lanes` signals sampled at the same
+ * rate; batches share the one
+ * parsed circuit, which none of them write to. The parser is not safe to
+ * share between threads, so every signal is opened before any task runs.
+ *
+ * @param parser The netlist parser, whose own audio manager already has
+ * the first signal open.
+ * @param c The circuit.
+ * @param inputs Every signal file to render.
+ * @param outputs The file each signal is rendered to, or empty to discard
+ * the renders.
+ * @param jobs Number of worker threads, or 0 for one per core.
+ * @param lanes Number of signals each task runs as one batch.
+ */
+static void render_all(NetlistParser& parser, Circuit& c,
+                       const vector<string>& inputs,
+                       const vector<string>& outputs, int jobs, int lanes) {
+
+    vector<AudioManager*> signals;
+    signals.push_back(parser.audio());
+    for (size_t i = 1; i < inputs.size(); i++) {
+        signals.push_back(parser.open_signal(inputs[i].c_str(),
+            outputs.empty() ? NULL : outputs[i].c_str()));
+    }
+
+    WorkPool pool(jobs);
+    cout << "Rendering " << inputs.size() << " signal(s) on "
+         << pool.num_workers() << " thread(s), " << lanes
+         << " per batch." << endl;
+
+    /* a batch steps every lane by the same timestep, so it only takes
+     * consecutive signals sampled at the same rate */
+    for (size_t first = 0, last; first < inputs.size(); first = last) {
+        double dt = signals[first]->get_sampling_period();
+        for (last = first + 1; last < inputs.size() &&
+                               last < first + lanes; last++) {
+            if (signals[last]->get_sampling_period() != dt)
+                break;
+        }
+
+        pool.submit([&, first, last](int worker) {
+            vector<AudioManager*> batch_signals(signals.begin() + first,
+                                                signals.begin() + last);
+            BatchCircuit batch(c, batch_signals.size());
+            batch.transient(batch_signals, false);
+        });
+    }
+
+    pool.wait();
+    for (size_t i = 1; i < signals.size(); i++)
+        delete signals[i];
+}
+
+/**
+ * @brief Renders a signal through a circuit in both double and single
+ * precision, and reports how long each took and how far the single
+ * precision render strays from the double precision one. The render in
+ * the precision the circuit was set up for is then written out.
+ *
+ * @param c The circuit.
+ * @param signal The signal, which is finished once rendered.
+ */
+static void report_precision(Circuit& c, AudioManager *signal) {
+    vector<float> input;
+    size_t len = signal->read_all(input);
+    double dt = signal->get_sampling_period();
+
+    const LinearSystem::precision_t precisions[] = {
+        LinearSystem::PRECISION_DOUBLE, LinearSystem::PRECISION_SINGLE
+    };
+    LinearSystem::precision_t kept = c.get_precision();
+    vector<float> outputs[2];
+    double seconds[2];
+
+    for (int p = 0; p < 2; p++) {
+        outputs[p].resize(len);
+        c.set_precision(precisions[p]);
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        c.start(dt);
+        for (size_t pos = 0; pos < len; pos += FILE_FRAMES_PER_BLOCK) {
+            size_t n = std::min(len - pos, (size_t) FILE_FRAMES_PER_BLOCK);
+            c.process(&input[pos], &outputs[p][pos], n);
+        }
+        c.stop();
+        auto t1 = std::chrono::high_resolution_clock::now();
+        seconds[p] = std::chrono::duration<double>(t1 - t0).count();
+    }
+    c.set_precision(kept);
+
+    double peak = 0.0;
+    double worst = 0.0;
+    double sum_squares = 0.0;
+    size_t worst_at = 0;
+    for (size_t t = 0; t < len; t++) {
+        double error = fabs(outputs[1][t] - outputs[0][t]);
+        peak = fmax(peak, fabs(outputs[0][t]));
+        sum_squares += error * error;
+        if (error > worst) {
+            worst = error;
+            worst_at = t;
+        }
+    }
+    double rms = (len > 0) ? sqrt(sum_squares / len) : 0.0;
+
+    cout << "Double precision took " << seconds[0] << " secs, single "
+         << "precision took " << seconds[1] << " secs ("
+         << seconds[0] / seconds[1] << "x)." << endl;
+    cout << "Single precision error: largest " << worst << " V at sample "
+         << worst_at << ", RMS " << rms << " V";
+    if (peak > 0 && rms > 0)
+        cout << " (" << 20 * log10(rms / peak) << " dB from the peak level)";
+    cout << "." << endl;
+
+    int p = (kept == LinearSystem::PRECISION_SINGLE) ? 1 : 0;
+    signal->set_next_block(outputs[p].data(), len);
+    signal->finish();
+}
+
 /**
  * @brief Shows the usage instructions for the program and exits, indicating
  * a failure.
@@ -159,15 +481,238 @@ static void usage(char *argv[]) {
     const char *usage_string = "-c CIRCUIT_NETLIST -s SIGNAL_FILE -o OUTFILE";
     fprintf(stderr, "Usage: %s %s\n", argv[0], usage_string);
     fprintf(stderr, "\t-c [--circuit]     Circuit netlist file to simulate\n");
-    fprintf(stderr, "\t-s [--signal]      Input signal source\n");
-    fprintf(stderr, "\t-o [--outfile]   Output audio file\n");
+    fprintf(stderr, "\t-s [--signal]      Input signal source (repeat to run "
+                    "up to %d signals as one batch)\n", MAX_SIGNALS);
+    fprintf(stderr, "\t-o [--outfile]   Output audio file (one per signal "
+                    "in a batch)\n");
     fprintf(stderr, "\t   [--live-input]  Use live input\n");
     fprintf(stderr, "\t   [--live-output] Play signal as it's being processed\n");
     fprintf(stderr, "\t[--plot]         Plot the results after simulation\n");
+    fprintf(stderr, "\t   [--solver]      Linear solver: auto, dense, sparse, "
+                    "fixed\n");
+    fprintf(stderr, "\t   [--precision]   MNA system precision: double, single "
+                    "(overrides the netlist)\n");
+    fprintf(stderr, "\t   [--precision-report] Compare single against double "
+                    "precision\n");
+    fprintf(stderr, "\t   [--ordering]    Unknown ordering: amd, rcm, natural\n");
+    fprintf(stderr, "\t   [--no-reduce]   Solve the full MNA system, ground "
+                    "and all\n");
+    fprintf(stderr, "\t   [--no-simplify] Keep redundant components in the "
+                    "netlist\n");
+    fprintf(stderr, "\t   [--method]      Analysis method: mna, iir, dk, table, "
+                    "compiled\n");
+    fprintf(stderr, "\t   [--compile]     Same as --method compiled\n");
+    fprintf(stderr, "\t   [--table-cache] Directory to cache port tables and "
+                    "compiled circuits in\n");
+    fprintf(stderr, "\t   [--predictor]   Newton predictor: none, poly, input\n");
+    fprintf(stderr, "\t   [--predictor-history] Solutions fit by poly (1-%d)\n",
+        Predictor::MAX_HISTORY);
+    fprintf(stderr, "\t   [--newton]      Newton jacobian: full, chord\n");
+    fprintf(stderr, "\t   [--chord-ratio] Conductance ratio forcing a refactor\n");
+    fprintf(stderr, "\t   [--reltol]      Newton relative tolerance\n");
+    fprintf(stderr, "\t   [--vntol]       Newton node voltage tolerance (V)\n");
+    fprintf(stderr, "\t   [--abstol]      Newton branch current tolerance (A)\n");
+    fprintf(stderr, "\t   [--alloc-audit] Heap allocations after the first "
+                    "block: off, report, abort\n");
+    fprintf(stderr, "\t   [--integration] Capacitor integration: be, trap, "
+                    "bdf2 (overrides the netlist)\n");
+    fprintf(stderr, "\t   [--max-substeps] Most substeps a timestep is split "
+                    "into (power of 2, 1 = never)\n");
+    fprintf(stderr, "\t   [--trtol]       Truncation error tolerance factor "
+                    "(0 = split on newton failures only)\n");
+    fprintf(stderr, "\t   [--oversample]  Run the circuit at 1, 2, 4 or %dx the "
+                    "signal's rate\n", Oversampler::MAX_FACTOR);
+    fprintf(stderr, "\t   [--oversample-taps] Resampling filter taps per branch "
+                    "(default %d)\n", Oversampler::DEFAULT_TAPS);
+    fprintf(stderr, "\t   [--inputs]      Glob (quoted) or @list file of "
+                    "signals to render in parallel\n");
+    fprintf(stderr, "\t   [--jobs]        Threads rendering signals (default "
+                    "one per core)\n");
+    fprintf(stderr, "\t   [--outdir]      Directory parallel renders are "
+                    "written to\n");
+    fprintf(stderr, "\t   [--lanes]       Signals (or sweep variants) each "
+                    "thread runs as one batch (default 1, or %d for sweeps)\n",
+                    DEFAULT_SWEEP_LANES);
+    fprintf(stderr, "\t   [--chunks]      Render one signal as this many "
+                    "chunks at once\n");
+    fprintf(stderr, "\t   [--warmup]      Warm-up before each chunk in seconds "
+                    "(default %g)\n", DEFAULT_WARMUP);
+    fprintf(stderr, "\t   [--verify-seams] Compare chunk seams against a "
+                    "sequential render\n");
+    fprintf(stderr, "\t   [--sweep]       Sweep a resistor or capacitor: "
+                    "R2=1k:100k:32log, R2=1k:10k:10 or C1={10n,22n} "
+                    "(repeat to sweep every combination)\n");
 
     exit(EXIT_FAILURE);
 }
 
+/**
+ * @brief Maps the argument to the --solver flag to a solver backend.
+ *
+ * @param name The backend name given on the command line.
+ * @param argv The argument vector used to invoke this program.
+ *
+ * @return The matching backend. Unknown names print the usage and exit.
+ */
+static LinearSystem::solver_t parse_solver(const char *name, char *argv[]) {
+    if (strcmp(name, "auto") == 0)
+        return LinearSystem::SOLVER_AUTO;
+    if (strcmp(name, "dense") == 0)
+        return LinearSystem::SOLVER_DENSE;
+    if (strcmp(name, "sparse") == 0)
+        return LinearSystem::SOLVER_SPARSE;
+    if (strcmp(name, "fixed") == 0)
+        return LinearSystem::SOLVER_FIXED;
+
+    fprintf(stderr, "Unknown solver '%s'\n", name);
+    usage(argv);
+    return LinearSystem::SOLVER_AUTO;
+}
+
+/**
+ * @brief Maps the argument to the --ordering flag to an ordering.
+ *
+ * @param name The ordering name given on the command line.
+ * @param argv The argument vector used to invoke this program.
+ *
+ * @return The matching ordering. Unknown names print the usage and exit.
+ */
+static Reduction::ordering_t parse_ordering(const char *name, char *argv[]) {
+    if (strcmp(name, "amd") == 0)
+        return Reduction::ORDER_AMD;
+    if (strcmp(name, "rcm") == 0)
+        return Reduction::ORDER_RCM;
+    if (strcmp(name, "natural") == 0)
+        return Reduction::ORDER_NATURAL;
+
+    fprintf(stderr, "Unknown ordering '%s'\n", name);
+    usage(argv);
+    return Reduction::ORDER_AMD;
+}
+
+/**
+ * @brief Maps the argument to the --method flag to an analysis method.
+ *
+ * @param name The method name given on the command line.
+ * @param argv The argument vector used to invoke this program.
+ *
+ * @return The matching method. Unknown names print the usage and exit.
+ */
+static Circuit::method_t parse_method(const char *name, char *argv[]) {
+    if (strcmp(name, "mna") == 0)
+        return Circuit::METHOD_MNA;
+    if (strcmp(name, "iir") == 0)
+        return Circuit::METHOD_IIR;
+    if (strcmp(name, "dk") == 0)
+        return Circuit::METHOD_DK;
+    if (strcmp(name, "table") == 0)
+        return Circuit::METHOD_TABLE;
+    if (strcmp(name, "compiled") == 0)
+        return Circuit::METHOD_COMPILED;
+
+    fprintf(stderr, "Unknown method '%s'\n", name);
+    usage(argv);
+    return Circuit::METHOD_MNA;
+}
+
+/**
+ * @brief Maps the argument to the --predictor flag to a newton predictor.
+ *
+ * @param name The predictor name given on the command line.
+ * @param argv The argument vector used to invoke this program.
+ *
+ * @return The matching predictor. Unknown names print the usage and exit.
+ */
+static Predictor::predictor_t parse_predictor(const char *name, char *argv[]) {
+    if (strcmp(name, "none") == 0)
+        return Predictor::PREDICT_NONE;
+    if (strcmp(name, "poly") == 0)
+        return Predictor::PREDICT_POLYNOMIAL;
+    if (strcmp(name, "input") == 0)
+        return Predictor::PREDICT_INPUT;
+
+    fprintf(stderr, "Unknown predictor '%s'\n", name);
+    usage(argv);
+    return Predictor::PREDICT_NONE;
+}
+
+/**
+ * @brief Maps the argument to the --newton flag to a newton mode.
+ *
+ * @param name The mode name given on the command line.
+ * @param argv The argument vector used to invoke this program.
+ *
+ * @return The matching mode. Unknown names print the usage and exit.
+ */
+static Circuit::newton_t parse_newton(const char *name, char *argv[]) {
+    if (strcmp(name, "full") == 0)
+        return Circuit::NEWTON_FULL;
+    if (strcmp(name, "chord") == 0)
+        return Circuit::NEWTON_CHORD;
+
+    fprintf(stderr, "Unknown newton mode '%s'\n", name);
+    usage(argv);
+    return Circuit::NEWTON_FULL;
+}
+
+/**
+ * @brief Maps the argument to the --alloc-audit flag to an audit mode.
+ *
+ * @param name The mode name given on the command line.
+ * @param argv The argument vector used to invoke this program.
+ *
+ * @return The matching mode. Unknown names print the usage and exit.
+ */
+static AllocAudit::audit_t parse_alloc_audit(const char *name, char *argv[]) {
+    if (strcmp(name, "off") == 0)
+        return AllocAudit::AUDIT_OFF;
+    if (strcmp(name, "report") == 0)
+        return AllocAudit::AUDIT_REPORT;
+    if (strcmp(name, "abort") == 0)
+        return AllocAudit::AUDIT_ABORT;
+
+    fprintf(stderr, "Unknown allocation audit mode '%s'\n", name);
+    usage(argv);
+    return AllocAudit::AUDIT_OFF;
+}
+
+/**
+ * @brief Maps the argument to the --precision flag to a precision.
+ *
+ * @param name The precision name given on the command line.
+ * @param argv The argument vector used to invoke this program.
+ *
+ * @return The matching precision. Unknown names print the usage and exit.
+ */
+static LinearSystem::precision_t parse_precision(const char *name,
+                                                 char *argv[]) {
+    LinearSystem::precision_t precision = LinearSystem::PRECISION_DOUBLE;
+    if (!LinearSystem::parse_precision(name, &precision)) {
+        fprintf(stderr, "Unknown precision '%s'\n", name);
+        usage(argv);
+    }
+    return precision;
+}
+
+/**
+ * @brief Maps the argument to the --integration flag to an integration
+ * method.
+ *
+ * @param name The method name given on the command line.
+ * @param argv The argument vector used to invoke this program.
+ *
+ * @return The matching method. Unknown names print the usage and exit.
+ */
+static StampProgram::integration_t parse_integration(const char *name,
+                                                     char *argv[]) {
+    StampProgram::integration_t method = StampProgram::INTEGRATE_BE;
+    if (!StampProgram::parse_integration(name, &method)) {
+        fprintf(stderr, "Unknown integration method '%s'\n", name);
+        usage(argv);
+    }
+    return method;
+}
+
 /**
  * @brief Parses the command line arguments and fills the results into
  * a `simparams_t` struct.
@@ -192,12 +737,46 @@ void parse_command_line(int argc, char *argv[], simparams_t *params) {
         {"live-output",    no_argument,       0, LIVE_OUTPUT },
         {"outfile", required_argument, 0, 'o' },
         {"plot",    no_argument,       0, ENABLE_PLOTTING },
+        {"solver",  required_argument, 0, SOLVER },
+        {"precision", required_argument, 0, PRECISION },
+        {"precision-report", no_argument, 0, PRECISION_REPORT },
+        {"ordering", required_argument, 0, ORDERING },
+        {"no-reduce", no_argument,     0, NO_REDUCE },
+        {"no-simplify", no_argument,   0, NO_SIMPLIFY },
+        {"method",  required_argument, 0, METHOD },
+        {"compile", no_argument,       0, COMPILE },
+        {"table-cache", required_argument, 0, TABLE_CACHE },
+        {"predictor", required_argument, 0, PREDICTOR },
+        {"predictor-history", required_argument, 0, PREDICTOR_HISTORY },
+        {"newton",  required_argument, 0, NEWTON },
+        {"chord-ratio", required_argument, 0, CHORD_RATIO },
+        {"reltol",  required_argument, 0, RELTOL },
+        {"vntol",   required_argument, 0, VNTOL },
+        {"abstol",  required_argument, 0, ABSTOL },
+        {"alloc-audit", required_argument, 0, ALLOC_AUDIT },
+        {"integration", required_argument, 0, INTEGRATION },
+        {"oversample", required_argument, 0, OVERSAMPLE },
+        {"oversample-taps", required_argument, 0, OVERSAMPLE_TAPS },
+        {"max-substeps", required_argument, 0, MAX_SUBSTEPS },
+        {"trtol",   required_argument, 0, TRTOL },
+        {"jobs",    required_argument, 0, JOBS },
+        {"inputs",  required_argument, 0, INPUTS },
+        {"outdir",  required_argument, 0, OUTDIR },
+        {"lanes",   required_argument, 0, LANES },
+        {"sweep",   required_argument, 0, SWEEP },
+        {"chunks",  required_argument, 0, CHUNKS },
+        {"warmup",  required_argument, 0, WARMUP },
+        {"verify-seams", no_argument,  0, VERIFY_SEAMS },
+        {0,         0,                 0, 0 },
     };
 
     int c;  /* Command line option identifier */
 
     /* zero out all of the simulator parameters */
     memset(params, 0, sizeof(*params));
+    params->trtol = -1.0;
+    params->warmup = -1.0;
+    params->ordering = Reduction::ORDER_AMD;
 
     /* parse all command line options */
     while ((c = getopt_long(argc, argv, "c:s:o:h", options, NULL)) != -1) {
@@ -206,10 +785,18 @@ void parse_command_line(int argc, char *argv[], simparams_t *params) {
                 params->circuit_file = optarg;
                 break;
             case 's':
-                params->signal_file = optarg;
+                if (params->num_signals == MAX_SIGNALS)
+                    usage(argv);
+                if (params->signal_file == NULL)
+                    params->signal_file = optarg;
+                params->signal_files[params->num_signals++] = optarg;
                 break;
             case 'o':
-                params->outfile = optarg;
+                if (params->num_outfiles == MAX_SIGNALS)
+                    usage(argv);
+                if (params->outfile == NULL)
+                    params->outfile = optarg;
+                params->outfiles[params->num_outfiles++] = optarg;
                 break;
             case ENABLE_PLOTTING:
                 params->plot = true;
@@ -220,6 +807,119 @@ void parse_command_line(int argc, char *argv[], simparams_t *params) {
             case LIVE_OUTPUT:
                 params->live_output = true;
                 break;
+            case SOLVER:
+                params->solver = parse_solver(optarg, argv);
+                break;
+            case ORDERING:
+                params->ordering = parse_ordering(optarg, argv);
+                break;
+            case NO_REDUCE:
+                params->no_reduce = true;
+                break;
+            case NO_SIMPLIFY:
+                params->no_simplify = true;
+                break;
+            case METHOD:
+                params->method = parse_method(optarg, argv);
+                break;
+            case COMPILE:
+                params->method = Circuit::METHOD_COMPILED;
+                break;
+            case TABLE_CACHE:
+                params->table_cache = optarg;
+                break;
+            case PREDICTOR:
+                params->predictor = parse_predictor(optarg, argv);
+                break;
+            case PREDICTOR_HISTORY:
+                params->predictor_history = atoi(optarg);
+                break;
+            case NEWTON:
+                params->newton = parse_newton(optarg, argv);
+                break;
+            case CHORD_RATIO:
+                params->chord_ratio = atof(optarg);
+                if (params->chord_ratio <= 1.0)
+                    usage(argv);
+                break;
+            case RELTOL:
+                params->reltol = atof(optarg);
+                break;
+            case VNTOL:
+                params->vntol = atof(optarg);
+                break;
+            case ABSTOL:
+                params->abstol = atof(optarg);
+                break;
+            case ALLOC_AUDIT:
+                params->alloc_audit = parse_alloc_audit(optarg, argv);
+                break;
+            case OVERSAMPLE:
+                params->oversample = atoi(optarg);
+                if (params->oversample < 1 ||
+                    params->oversample > Oversampler::MAX_FACTOR ||
+                    (params->oversample & (params->oversample - 1)) != 0)
+                    usage(argv);
+                break;
+            case OVERSAMPLE_TAPS:
+                params->oversample_taps = atoi(optarg);
+                if (params->oversample_taps < 1)
+                    usage(argv);
+                break;
+            case MAX_SUBSTEPS:
+                params->max_substeps = atoi(optarg);
+                if (params->max_substeps < 1 ||
+                    (params->max_substeps & (params->max_substeps - 1)) != 0)
+                    usage(argv);
+                break;
+            case TRTOL:
+                params->trtol = atof(optarg);
+                break;
+            case JOBS:
+                params->jobs = atoi(optarg);
+                if (params->jobs < 1)
+                    usage(argv);
+                break;
+            case INPUTS:
+                params->inputs = optarg;
+                break;
+            case OUTDIR:
+                params->outdir = optarg;
+                break;
+            case SWEEP:
+                if (params->num_sweeps == MAX_SWEEPS)
+                    usage(argv);
+                params->sweeps[params->num_sweeps++] = optarg;
+                break;
+            case CHUNKS:
+                params->chunks = atoi(optarg);
+                if (params->chunks < 1)
+                    usage(argv);
+                break;
+            case WARMUP:
+                params->warmup = atof(optarg);
+                if (params->warmup < 0)
+                    usage(argv);
+                break;
+            case VERIFY_SEAMS:
+                params->verify_seams = true;
+                break;
+            case LANES:
+                params->lanes = atoi(optarg);
+                if (params->lanes < 1 || params->lanes > MAX_SIGNALS)
+                    usage(argv);
+                break;
+            case INTEGRATION:
+                parse_integration(optarg, argv);
+                params->integration = optarg;
+                break;
+            case PRECISION:
+                parse_precision(optarg, argv);
+                params->precision = optarg;
+                break;
+            case PRECISION_REPORT:
+                params->precision_report = true;
+                break;
             case 'h':
                 usage(argv);
                 break;
@@ -231,7 +931,39 @@ void parse_command_line(int argc, char *argv[], simparams_t *params) {
 
     /* user must specify these options */
     if (params->circuit_file == NULL ||
-        (params->signal_file == NULL && !params->live_input)) {
+        (params->signal_file == NULL && params->inputs == NULL &&
+         !params->live_input)) {
+        usage(argv);
+    }
+
+    /* the pool names its own output files, except for chunked renders */
+    bool chunked = params->chunks > 0;
+    bool pooled = params->jobs > 0 || params->inputs != NULL ||
+                  params->num_sweeps > 0 || chunked;
+    if (pooled && (params->live_input || params->live_output ||
+                   (params->num_outfiles > 0 && !chunked))) {
+        usage(argv);
+    }
+
+    /* sweeps and chunked renders run one signal */
+    if ((params->num_sweeps > 0 || chunked) &&
+        (params->num_signals != 1 || params->inputs != NULL ||
+         params->num_outfiles > 1 || (params->num_sweeps > 0 && chunked))) {
+        usage(argv);
+    }
+
+    /* precision reports render one signal from a file, twice */
+    if (params->precision_report &&
+        (pooled || params->num_signals != 1 || params->live_input ||
+         params->live_output)) {
+        usage(argv);
+    }
+
+    /* batches pair each signal with its own output file, if any */
+    if (params->num_signals > 1 &&
+        (params->live_input || params->live_output ||
+         (params->num_outfiles != 0 &&
+          params->num_outfiles != params->num_signals))) {
         usage(argv);
     }
 }
@@ -247,28 +979,157 @@ void parse_command_line(int argc, char *argv[], simparams_t *params) {
 int main(int argc, char *argv[]) {
     simparams_t params;
     int plotter_pid;
-    vector<double> timescale;
-    vector<double> input_signal;
-    vector<double> output_signal;
+    PlotterSink *plotter = NULL;
 
     /* install sigusr1 handler for comm. with frontend */
     signal(SIGUSR1, sigusr1_handler);
 
     parse_command_line(argc, argv, &params);
+
+    /* the pool renders every -s signal and every --inputs match */
+    bool chunked = params.chunks > 0;
+    bool sweeping = params.num_sweeps > 0;
+    bool pooled = !sweeping && !chunked &&
+                  (params.jobs > 0 || params.inputs != NULL);
+    vector<string> inputs;
+    vector<string> outputs;
+    if (pooled) {
+        for (int i = 0; i < params.num_signals; i++)
+            inputs.push_back(params.signal_files[i]);
+        if (params.inputs != NULL) {
+            vector<string> matches = expand_inputs(params.inputs);
+            inputs.insert(inputs.end(), matches.begin(), matches.end());
+        }
+        if (inputs.empty())
+            sim_error("No signal files to render.");
+
+        if (params.outdir != NULL) {
+            for (const string& in : inputs)
+                outputs.push_back(output_path(params.outdir, in));
+        }
+
+        /* the parser opens the first signal itself */
+        params.signal_file = inputs[0].c_str();
+        params.outfile = outputs.empty() ? NULL : outputs[0].c_str();
+    }
+
+    /* pool renders and sweeps write into the output directory */
+    if (params.outdir != NULL && (pooled || sweeping))
+        make_outdir(params.outdir);
+
     NetlistParser parser(&params);
 
     /* launch the plotting script if the user requested it */
-    if (params.plot)
+    if (params.plot) {
         plotter_pid = launch_plotter();
+        plotter = new PlotterSink(plotter_fd[PIPE_SIDE_WRITE]);
+    }
 
     /* read circuit description from netlist */
     Circuit& c = parser.as_circuit();
+    c.set_solver(params.solver);
+    c.set_reduction(!params.no_reduce, params.ordering);
+    c.set_method(params.method);
+    c.set_predictor(params.predictor, params.predictor_history > 0
+                                          ? params.predictor_history
+                                          : DEFAULT_PREDICTOR_HISTORY);
+    c.set_newton(params.newton, params.chord_ratio > 0 ? params.chord_ratio
+                                                       : DEFAULT_CHORD_RATIO);
+    c.set_tolerances(params.reltol > 0 ? params.reltol : DEFAULT_RELTOL,
+                     params.vntol > 0 ? params.vntol : DEFAULT_VNTOL,
+                     params.abstol > 0 ? params.abstol : DEFAULT_ABSTOL);
+    c.set_substepping(params.max_substeps > 0 ? params.max_substeps
+                                              : DEFAULT_MAX_SUBSTEPS,
+                      params.trtol >= 0 ? params.trtol : DEFAULT_TRTOL);
+    if (params.integration != NULL)
+        c.set_integration(parse_integration(params.integration, argv));
+    if (params.precision != NULL)
+        c.set_precision(parse_precision(params.precision, argv));
+    c.set_oversampling(params.oversample > 0 ? params.oversample : 1,
+                       params.oversample_taps > 0 ? params.oversample_taps
+                                                  : Oversampler::DEFAULT_TAPS);
+    c.set_table_cache(params.table_cache ? params.table_cache
+                                         : DEFAULT_TABLE_CACHE,
+                      PortTable::hash_file(params.circuit_file));
+
+    /* the malloc hooks have to be compiled in */
+    if (params.alloc_audit != AllocAudit::AUDIT_OFF &&
+        !AllocAudit::supported()) {
+        cerr << "This build cannot audit allocations. Rebuild with "
+             << "`make ALLOC_AUDIT=1`." << endl;
+    }
+    AllocAudit::set_mode(params.alloc_audit);
 
     /* get starting time */
     auto t0 = std::chrono::high_resolution_clock::now();
 
-    /* run transient analysis */
-    c.transient(timescale, input_signal, output_signal);
+    /* run transient analysis, over every signal at once if given several */
+    if (chunked) {
+        if (params.plot)
+            cerr << "Plotting is not supported for chunked renders." << endl;
+        if (params.method != Circuit::METHOD_MNA)
+            cerr << "Chunked renders always use the MNA method." << endl;
+
+        ChunkedRender render(c, params.chunks, params.warmup >= 0
+                                               ? params.warmup
+                                               : DEFAULT_WARMUP);
+        render.run(parser.audio(), params.jobs,
+                   params.lanes > 0 ? params.lanes : 1, params.verify_seams);
+    } else if (sweeping) {
+        Sweep sweep;
+        for (int i = 0; i < params.num_sweeps; i++) {
+            Sweep::Axis axis;
+            if (!Sweep::parse_axis(params.sweeps[i], &axis))
+                sim_error("Invalid sweep '%s'.", params.sweeps[i]);
+            sweep.add_axis(axis);
+        }
+
+        if (params.plot)
+            cerr << "Plotting is not supported for sweeps." << endl;
+        if (params.method != Circuit::METHOD_MNA)
+            cerr << "Sweeps always use the MNA method." << endl;
+
+        sweep.run(parser, parser.audio(), params.outdir, params.jobs,
+                  params.lanes > 0 ? params.lanes : DEFAULT_SWEEP_LANES);
+    } else if (pooled) {
+        if (params.plot)
+            cerr << "Plotting is not supported for parallel renders." << endl;
+        if (params.method != Circuit::METHOD_MNA)
+            cerr << "Parallel renders always use the MNA method." << endl;
+
+        render_all(parser, c, inputs, outputs, params.jobs,
+                   params.lanes > 0 ? params.lanes : 1);
+    } else if (params.num_signals > 1) {
+        vector<AudioManager*> signals;
+        signals.push_back(parser.audio());
+        for (int i = 1; i < params.num_signals; i++) {
+            signals.push_back(parser.open_signal(params.signal_files[i],
+                params.num_outfiles > 0 ? params.outfiles[i] : NULL));
+        }
+
+        if (params.plot)
+            cerr << "Plotting is not supported for batches." << endl;
+        if (params.method != Circuit::METHOD_MNA)
+            cerr << "Batches always use the MNA method." << endl;
+
+        cout << "Running " << params.num_signals << " signals as one batch."
+             << endl;
+        BatchCircuit batch(c, params.num_signals);
+        batch.transient(signals);
+
+        for (int i = 1; i < params.num_signals; i++)
+            delete signals[i];
+    } else if (params.precision_report) {
+        if (params.plot)
+            cerr << "Plotting is not supported for precision reports." << endl;
+        if (params.method != Circuit::METHOD_MNA)
+            cerr << "Precision reports always use the MNA method." << endl;
+
+        c.set_method(Circuit::METHOD_MNA);
+        report_precision(c, parser.audio());
+    } else {
+        c.transient(plotter);
+    }
 
     /* get ending time and print timing summary */
     auto t1 = std::chrono::high_resolution_clock::now();
@@ -277,23 +1138,18 @@ int main(int argc, char *argv[]) {
     double elapsed_s = static_cast<float>(elapsed_ms) / MS_TO_S;
     cout << "Transient analysis finished in " << elapsed_s << " secs." << endl;
 
-    /* Pass data into plotting script, wait for plotter to complete */
-    if (params.plot) {
+    cout << "Peak memory use: " << peak_rss_mb() << " MB." << endl;
 
-        /* Write data into pipe to communicate with plotter */
-        for (int i = 0; i < timescale.size(); i++) {
-            dprintf(plotter_fd[PIPE_SIDE_WRITE], "%f %f %f\n",
-                timescale[i], input_signal[i], output_signal[i]);
-        }
+    /* the plotter has been fed as the analysis ran, wait for it to finish */
+    if (params.plot) {
 
         /* close the write side of the PIPE, child should see EOF now */
-        if (close(plotter_fd[PIPE_SIDE_WRITE]) < 0)
-            sim_error("Failed to close pipe's read fd in parent process.");
+        plotter->close();
+        delete plotter;
 
         /* wait for child to exit */
         waitpid(plotter_pid, NULL, 0);
     }
 
-
     return 0;
 }
@@ -0,0 +1,691 @@
+/**
+ *
+ * @file stamp.cpp
+ *
+ * @brief This file contains the implementation of stamp programs, which
+ * assemble the KCL equations each newton iteration with tight loops over
+ * flat arrays of precomputed matrix updates.
+ *
+ */
+
+#include <stamp.hpp>
+#include <components/component.hpp>
+#include <math.h>
+#include <strings.h>
+
+using std::vector;
+using std::pair;
+using Eigen::VectorXd;
+
+/** @brief Maps an update kind to the sign applied to its coefficient */
+static const double update_sign[] = { +1.0, -1.0 };
+
+/**
+ * @brief A stamp whose target is still described by its row and column,
+ * before the program is linked against a linear system.
+ */
+struct PendingStamp {
+	int row;                     /**< Row of the target entry */
+	int col;                     /**< Column of the target (unused for RHS) */
+	int coeff;                   /**< Index into the group's coefficients */
+	StampProgram::update_t kind; /**< Whether to add or subtract */
+};
+
+/**
+ * @brief Lays out the stamps of a group of two terminal devices. Each device
+ * `k` contributes its LHS coefficient `k` as a conductance between its
+ * terminals and its RHS coefficient `k` as a current from (+) to (-).
+ *
+ * @param grp The device group.
+ * @param lhs Vector to be filled with pending LHS stamps.
+ * @param rhs Vector to be filled with pending RHS stamps.
+ */
+static void layout_two_terminal(const StampProgram::TwoTerminalGroup& grp,
+	vector<PendingStamp>& lhs, vector<PendingStamp>& rhs) {
+
+	for (int k = 0; k < (int) grp.n1.size(); k++) {
+		int n1 = grp.n1[k];
+		int n2 = grp.n2[k];
+		lhs.push_back({ n1, n1, k, StampProgram::STAMP_ADD });
+		lhs.push_back({ n2, n2, k, StampProgram::STAMP_ADD });
+		lhs.push_back({ n1, n2, k, StampProgram::STAMP_SUB });
+		lhs.push_back({ n2, n1, k, StampProgram::STAMP_SUB });
+		rhs.push_back({ n1, -1, k, StampProgram::STAMP_ADD });
+		rhs.push_back({ n2, -1, k, StampProgram::STAMP_SUB });
+	}
+}
+
+/**
+ * @brief Lays out the stamps of a group of voltage sources. Each source `k`
+ * uses LHS coefficient `k` (always 1), RHS coefficient `2k` for its branch
+ * equation and RHS coefficient `2k+1` for its branch current.
+ *
+ * @param grp The source group.
+ * @param lhs Vector to be filled with pending LHS stamps.
+ * @param rhs Vector to be filled with pending RHS stamps.
+ */
+static void layout_sources(const StampProgram::SourceGroup& grp,
+	vector<PendingStamp>& lhs, vector<PendingStamp>& rhs) {
+
+	for (int k = 0; k < (int) grp.n1.size(); k++) {
+		int n1 = grp.n1[k];
+		int n2 = grp.n2[k];
+		int ni = grp.ni[k];
+		lhs.push_back({ ni, n1, k, StampProgram::STAMP_ADD });
+		lhs.push_back({ ni, n2, k, StampProgram::STAMP_SUB });
+		lhs.push_back({ n1, ni, k, StampProgram::STAMP_SUB });
+		lhs.push_back({ n2, ni, k, StampProgram::STAMP_ADD });
+		rhs.push_back({ ni, -1, 2 * k,     StampProgram::STAMP_ADD });
+		rhs.push_back({ n1, -1, 2 * k + 1, StampProgram::STAMP_ADD });
+		rhs.push_back({ n2, -1, 2 * k + 1, StampProgram::STAMP_SUB });
+	}
+}
+
+/**
+ * @brief Gets the stamps a group keeps for a double precision system.
+ */
+static StampProgram::StampList<double>& linked_stamps(
+	StampProgram::Group& grp, LinearSystem&) {
+	return grp.stamps;
+}
+
+/**
+ * @brief Gets the stamps a group keeps for a single precision system.
+ */
+static StampProgram::StampList<float>& linked_stamps(
+	StampProgram::Group& grp, LinearSystemF&) {
+	return grp.single_stamps;
+}
+
+/**
+ * @brief Resolves the pending stamps of a group into the entries of a linear
+ * system. Stamps landing in the ground row are dropped.
+ *
+ * @param grp The group whose stamps are being resolved.
+ * @param sys The linear system the program will write into.
+ * @param lhs Pending LHS stamps for the group.
+ * @param rhs Pending RHS stamps for the group.
+ */
+template <typename Scalar>
+static void resolve(StampProgram::Group& grp, BasicLinearSystem<Scalar>& sys,
+	const vector<PendingStamp>& lhs, const vector<PendingStamp>& rhs) {
+
+	grp.stamps = StampProgram::StampList<double>();
+	grp.single_stamps = StampProgram::StampList<float>();
+	StampProgram::StampList<Scalar>& stamps = linked_stamps(grp, sys);
+
+	for (const PendingStamp& p : lhs) {
+		Scalar *slot = sys.lhs_slot(p.row, p.col);
+		if (slot != NULL)
+			stamps.lhs.push_back({ slot, p.coeff, p.kind });
+	}
+
+	for (const PendingStamp& p : rhs) {
+		Scalar *slot = sys.rhs_slot(p.row);
+		if (slot != NULL)
+			stamps.rhs.push_back({ slot, p.coeff, p.kind });
+	}
+}
+
+/**
+ * @brief Scatters coefficients into a linear system through its stamps.
+ *
+ * @param stamps The stamps.
+ * @param coeffs The coefficients they read.
+ */
+template <typename Scalar>
+static inline void scatter(const vector<StampProgram::Stamp<Scalar>>& stamps,
+	const vector<double>& coeffs) {
+
+	for (const StampProgram::Stamp<Scalar>& s : stamps)
+		*s.slot += update_sign[s.kind] * coeffs[s.coeff];
+}
+
+/****************************************************************************
+ *                              Device Groups                               *
+ ****************************************************************************/
+
+/**
+ * @brief Scatters the group's coefficients into the linear system.
+ */
+void StampProgram::Group::apply() {
+	scatter(stamps.lhs, lhs_coeffs);
+	scatter(single_stamps.lhs, lhs_coeffs);
+	apply_rhs();
+}
+
+/**
+ * @brief Scatters the group's RHS coefficients into the linear system,
+ * leaving the LHS matrix untouched.
+ */
+void StampProgram::Group::apply_rhs() {
+	scatter(stamps.rhs, rhs_coeffs);
+	scatter(single_stamps.rhs, rhs_coeffs);
+}
+
+/**
+ * @brief Computes the current through each resistor for the current guess.
+ *
+ * @param guess The solution from the previous newton iteration.
+ */
+void StampProgram::ResistorGroup::evaluate(const VectorXd& guess) {
+	for (int k = 0; k < (int) g.size(); k++)
+		rhs_coeffs[k] = g[k] * (guess(n2[k]) - guess(n1[k]));
+}
+
+/**
+ * @brief Computes the companion model of each capacitor.
+ *
+ * With h = dt, the current through a capacitor on this timestep is
+ *
+ *     backward Euler:  i = C/h (v - v1)
+ *     trapezoidal:     i = 2C/h (v - v1) - i1
+ *     BDF2:            i = C/h ((1+2w)/(1+w) v - (1+w) v1 + w^2/(1+w) v2)
+ *
+ * where v1 and v2 are its voltages one and two timesteps ago, i1 its last
+ * current and w the ratio of this timestep to the last one (1 unless the
+ * timestep is being split, which reduces BDF2 to C/h (3/2 v - 2 v1 +
+ * 1/2 v2)). Each is a conductance geq (the LHS coefficient) less a
+ * history current that is fixed for the whole timestep. The RHS is the
+ * residual at the guess, hist - geq v.
+ *
+ * @param soln The solution from the previous timestep.
+ * @param guess The solution from the previous newton iteration.
+ * @param dt The sampling period.
+ */
+void StampProgram::CapacitorGroup::evaluate(const VectorXd& soln,
+	const VectorXd& guess, double dt) {
+
+	double w = step_ratio(dt, last_step);
+	step = dt;
+
+	for (int k = 0; k < (int) c.size(); k++) {
+		double geq;
+		double v = guess(n1[k]) - guess(n2[k]);
+		double v1 = soln(n1[k]) - soln(n2[k]);
+		companion(method, c[k], dt, w, v1, aux[k], &geq, &hist[k]);
+
+		vlast[k] = v1;
+		lhs_coeffs[k] = geq;
+		rhs_coeffs[k] = hist[k] - geq * v;
+	}
+}
+
+/**
+ * @brief Advances the history of each capacitor once a timestep's solution
+ * has been accepted. The companion models must have been evaluated for the
+ * timestep.
+ *
+ * @param soln The accepted solution.
+ */
+void StampProgram::CapacitorGroup::accept(const VectorXd& soln) {
+	for (int k = 0; k < (int) c.size(); k++) {
+		double v = soln(n1[k]) - soln(n2[k]);
+		ilast[k] = lhs_coeffs[k] * v - hist[k];
+		aux[k] = carry(method, ilast[k], vlast[k], aux[k]);
+	}
+	last_step = step;
+}
+
+/**
+ * @brief Estimates the local truncation error each capacitor picked up on
+ * the timestep just solved, from how much its charge's second derivative
+ * makes it stray from a straight line over the timestep: h/2 |i - i1|.
+ * This is the error term of backward Euler, and a conservative bound for
+ * the second order methods. The companion models must have been evaluated
+ * for the timestep.
+ *
+ * @param soln The timestep's solution.
+ * @param reltol Tolerance on each capacitor's charge, relative to the larger
+ * of its charge at the start and end of the timestep.
+ * @param chgtol Absolute tolerance on each capacitor's charge, in coulombs.
+ *
+ * @return The largest ratio of a capacitor's error to its tolerance.
+ */
+double StampProgram::CapacitorGroup::truncation_ratio(const VectorXd& soln,
+	double reltol, double chgtol) const {
+
+	double worst = 0.0;
+	for (int k = 0; k < (int) c.size(); k++) {
+		double v = soln(n1[k]) - soln(n2[k]);
+		double i = lhs_coeffs[k] * v - hist[k];
+		worst = fmax(worst, truncation(step, c[k], v, vlast[k], i, ilast[k],
+		                               reltol, chgtol));
+	}
+	return worst;
+}
+
+/**
+ * @brief Linearizes each diode about the current guess.
+ *
+ * Voltages that moved too far up the exponential since the diode was last
+ * linearized are limited first. The RHS is then the residual of the
+ * linearization (about the limited voltage) at the guess itself.
+ *
+ * @param guess The solution from the previous newton iteration.
+ */
+void StampProgram::DiodeGroup::evaluate(const VectorXd& guess) {
+	limited = false;
+	for (int k = 0; k < (int) is.size(); k++) {
+		double v = guess(n1[k]) - guess(n2[k]);
+		double vl = Diode::limit(v, vj[k], nvt_inv[k], vcrit[k]);
+		limited = limited || (vl != v);
+		vj[k] = vl;
+
+		Diode::linearize(v, vl, is[k], nvt_inv[k], &lhs_coeffs[k],
+		                 &rhs_coeffs[k]);
+	}
+}
+
+/**
+ * @brief Computes the branch equation residual and current of each source.
+ *
+ * @param guess The solution from the previous newton iteration.
+ */
+void StampProgram::SourceGroup::evaluate(const VectorXd& guess) {
+	for (int k = 0; k < (int) V.size(); k++) {
+		rhs_coeffs[2 * k] = *V[k] - (guess(n1[k]) - guess(n2[k]));
+		rhs_coeffs[2 * k + 1] = guess(ni[k]);
+	}
+}
+
+/****************************************************************************
+ *                              StampProgram                                *
+ ****************************************************************************/
+
+/**
+ * @brief Adds a resistor to the program.
+ *
+ * @param n1 Unknown index of the (+) terminal voltage.
+ * @param n2 Unknown index of the (-) terminal voltage.
+ * @param resistance The resistance in ohms.
+ *
+ * @return The resistor's index in the program's resistors.
+ */
+int StampProgram::add_resistor(int n1, int n2, double resistance) {
+	resistors.n1.push_back(n1);
+	resistors.n2.push_back(n2);
+	resistors.g.push_back(1.0 / resistance);
+	resistors.lhs_coeffs.push_back(1.0 / resistance);
+	resistors.rhs_coeffs.push_back(0.0);
+	return resistors.g.size() - 1;
+}
+
+/**
+ * @brief Adds a capacitor to the program.
+ *
+ * @param n1 Unknown index of the (+) terminal voltage.
+ * @param n2 Unknown index of the (-) terminal voltage.
+ * @param capacitance The capacitance in farads.
+ *
+ * @return The capacitor's index in the program's capacitors.
+ */
+int StampProgram::add_capacitor(int n1, int n2, double capacitance) {
+	capacitors.n1.push_back(n1);
+	capacitors.n2.push_back(n2);
+	capacitors.c.push_back(capacitance);
+	capacitors.aux.push_back(0.0);
+	capacitors.hist.push_back(0.0);
+	capacitors.vlast.push_back(0.0);
+	capacitors.ilast.push_back(0.0);
+	capacitors.lhs_coeffs.push_back(0.0);
+	capacitors.rhs_coeffs.push_back(0.0);
+	return capacitors.c.size() - 1;
+}
+
+/**
+ * @brief Adds a diode to the program.
+ *
+ * @param n1 Unknown index of the anode voltage.
+ * @param n2 Unknown index of the cathode voltage.
+ * @param is Saturation current.
+ * @param n Emission coefficient.
+ * @param vt Thermal voltage.
+ */
+void StampProgram::add_diode(int n1, int n2, double is, double n, double vt) {
+	diodes.n1.push_back(n1);
+	diodes.n2.push_back(n2);
+	diodes.is.push_back(is);
+	diodes.nvt_inv.push_back(1.0 / (n * vt));
+	diodes.vcrit.push_back(Diode::critical_voltage(is, 1.0 / (n * vt)));
+	diodes.vj.push_back(0.0);
+	diodes.lhs_coeffs.push_back(0.0);
+	diodes.rhs_coeffs.push_back(0.0);
+}
+
+/**
+ * @brief Adds an independent voltage source to the program.
+ *
+ * @param n1 Unknown index of the (+) terminal voltage.
+ * @param n2 Unknown index of the (-) terminal voltage.
+ * @param ni Unknown index of the branch current through the source.
+ * @param V Location of the source voltage, read on every iteration.
+ */
+void StampProgram::add_source(int n1, int n2, int ni, const double *V) {
+	sources.n1.push_back(n1);
+	sources.n2.push_back(n2);
+	sources.ni.push_back(ni);
+	sources.V.push_back(V);
+	sources.lhs_coeffs.push_back(1.0);
+	sources.rhs_coeffs.push_back(0.0);
+	sources.rhs_coeffs.push_back(0.0);
+}
+
+/**
+ * @brief Resolves every stamp in the program to the entry of the linear
+ * system it updates.
+ *
+ * Every LHS entry the program touches is first registered with the system,
+ * so that in sparse mode the full nonzero pattern exists before any slot
+ * addresses are taken. The program must be relinked if it is to be run
+ * against a different linear system.
+ *
+ * @param sys The linear system the program will be run against.
+ */
+template <typename Scalar>
+void StampProgram::link(BasicLinearSystem<Scalar>& sys) {
+	vector<PendingStamp> lhs[4];
+	vector<PendingStamp> rhs[4];
+	Group *groups[4] = { &resistors, &capacitors, &diodes, &sources };
+
+	layout_two_terminal(resistors, lhs[0], rhs[0]);
+	layout_two_terminal(capacitors, lhs[1], rhs[1]);
+	layout_two_terminal(diodes, lhs[2], rhs[2]);
+	layout_sources(sources, lhs[3], rhs[3]);
+
+	/* make sure every entry exists before taking any addresses */
+	for (int i = 0; i < 4; i++) {
+		for (const PendingStamp& p : lhs[i])
+			sys.increment_lhs(p.row, p.col, 0.0);
+	}
+	sys.clear();
+
+	for (int i = 0; i < 4; i++)
+		resolve(*groups[i], sys, lhs[i], rhs[i]);
+
+	/* size the saved LHS now, so that `run_cached` never allocates */
+	sys.save_lhs();
+	base_valid = false;
+}
+
+/**
+ * @brief Lists every entry of the LHS the program stamps, e.g. to work out
+ * a reduction of the system before it is linked.
+ *
+ * @param entries Filled in with the (row, column) of each stamp, as
+ * unknowns. Entries stamped by several devices are listed once per stamp.
+ */
+void StampProgram::lhs_pattern(vector<pair<int, int>>& entries) const {
+	vector<PendingStamp> lhs, rhs;
+	layout_two_terminal(resistors, lhs, rhs);
+	layout_two_terminal(capacitors, lhs, rhs);
+	layout_two_terminal(diodes, lhs, rhs);
+	layout_sources(sources, lhs, rhs);
+
+	entries.clear();
+	for (const PendingStamp& p : lhs)
+		entries.push_back(std::make_pair(p.row, p.col));
+}
+
+/**
+ * @brief Makes every nonlinear device linearize about a solution the next
+ * time the program runs, e.g. when newton's method restarts a timestep.
+ *
+ * @param soln The solution.
+ */
+void StampProgram::reset_junctions(const VectorXd& soln) {
+	for (int k = 0; k < (int) diodes.vj.size(); k++)
+		diodes.vj[k] = soln(diodes.n1[k]) - soln(diodes.n2[k]);
+	diodes.limited = false;
+}
+
+/**
+ * @brief Checks whether running the program at a guess would limit a
+ * nonlinear device's voltage, i.e. whether the guess lies outside the
+ * region newton's method may move the devices to in one iteration from
+ * the voltages they were last linearized about.
+ *
+ * @param guess The guess.
+ *
+ * @return True if any device would be limited and false otherwise.
+ */
+bool StampProgram::would_limit(const VectorXd& guess) const {
+	for (int k = 0; k < (int) diodes.vj.size(); k++) {
+		double v = guess(diodes.n1[k]) - guess(diodes.n2[k]);
+		if (Diode::limit(v, diodes.vj[k], diodes.nvt_inv[k],
+		                 diodes.vcrit[k]) != v)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Selects the integration method capacitors are discretized with.
+ * Their history should be reset before the program is run again.
+ *
+ * @param method The integration method.
+ */
+void StampProgram::set_integration(integration_t method) {
+	capacitors.method = method;
+	base_valid = false;
+}
+
+/**
+ * @brief Gets the number of history values the integration method carries
+ * between timesteps, on top of the last solution: none for backward Euler
+ * and one per capacitor otherwise.
+ */
+int StampProgram::num_history() const {
+	if (capacitors.method == INTEGRATE_BE)
+		return 0;
+	return capacitors.c.size();
+}
+
+/**
+ * @brief Starts each capacitor's history as if the circuit had been resting
+ * at a solution, i.e. with no current through any capacitor.
+ *
+ * @param soln The solution.
+ */
+void StampProgram::reset_history(const VectorXd& soln) {
+	for (int k = 0; k < (int) capacitors.c.size(); k++) {
+		double v = soln(capacitors.n1[k]) - soln(capacitors.n2[k]);
+		capacitors.aux[k] = (capacitors.method == INTEGRATE_BDF2) ? v : 0.0;
+		capacitors.vlast[k] = v;
+		capacitors.ilast[k] = 0.0;
+	}
+	capacitors.last_step = 0.0;
+}
+
+/**
+ * @brief Estimates the local truncation error of the timestep just solved
+ * (see `CapacitorGroup::truncation_ratio`).
+ *
+ * @param soln The timestep's solution.
+ * @param reltol Relative tolerance on each capacitor's charge.
+ * @param chgtol Absolute tolerance on each capacitor's charge, in coulombs.
+ *
+ * @return The largest ratio of a capacitor's error to its tolerance.
+ */
+double StampProgram::truncation_ratio(const VectorXd& soln, double reltol,
+	double chgtol) const {
+
+	return capacitors.truncation_ratio(soln, reltol, chgtol);
+}
+
+/**
+ * @brief Advances the history carried between timesteps once a timestep's
+ * solution has been accepted.
+ *
+ * @param soln The accepted solution.
+ */
+void StampProgram::accept(const VectorXd& soln) {
+	capacitors.accept(soln);
+}
+
+/**
+ * @brief Gets the history the integration method carries between timesteps
+ * (see `num_history`).
+ *
+ * @param history Filled in with the history.
+ */
+void StampProgram::get_history(VectorXd& history) const {
+	history.resize(num_history());
+	for (int k = 0; k < history.size(); k++)
+		history(k) = capacitors.aux[k];
+}
+
+/**
+ * @brief Overwrites the history the integration method carries between
+ * timesteps (see `num_history`).
+ *
+ * @param history The new history.
+ */
+void StampProgram::set_history(const VectorXd& history) {
+	for (int k = 0; k < history.size(); k++)
+		capacitors.aux[k] = history(k);
+}
+
+/**
+ * @brief Gets the human readable name of an integration method.
+ *
+ * @param method The integration method.
+ *
+ * @return Name of the method, as accepted by `parse_integration`.
+ */
+const char *StampProgram::integration_name(integration_t method) {
+	switch (method) {
+		case INTEGRATE_TRAP: return "trap";
+		case INTEGRATE_BDF2: return "bdf2";
+		default:             return "be";
+	}
+}
+
+/**
+ * @brief Looks up an integration method by its name (see
+ * `integration_name`), ignoring case.
+ *
+ * @param name The name.
+ * @param method Filled in with the matching method.
+ *
+ * @return True if the name matched a method and false otherwise.
+ */
+bool StampProgram::parse_integration(const char *name,
+	integration_t *method) {
+
+	integration_t methods[] = { INTEGRATE_BE, INTEGRATE_TRAP, INTEGRATE_BDF2 };
+	for (integration_t m : methods) {
+		if (strcasecmp(name, integration_name(m)) == 0) {
+			*method = m;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Stamps devices in the program into the linear system it was linked
+ * against. The system is expected to have been cleared.
+ *
+ * @param soln The solution from the previous timestep.
+ * @param guess The solution from the previous newton iteration.
+ * @param dt The sampling period.
+ * @param devices Which devices to stamp: all of them (the default), only the
+ * linear ones, or only the nonlinear ones.
+ */
+void StampProgram::run(const VectorXd& soln, const VectorXd& guess,
+	double dt, devices_t devices) {
+
+	if (devices != DEVICES_NONLINEAR) {
+		resistors.evaluate(guess);
+		resistors.apply();
+
+		capacitors.evaluate(soln, guess, dt);
+		capacitors.apply();
+
+		sources.evaluate(guess);
+		sources.apply();
+	}
+
+	if (devices != DEVICES_LINEAR) {
+		diodes.evaluate(guess);
+		diodes.apply();
+	}
+}
+
+/**
+ * @brief Stamps every device into the linear system it was linked against,
+ * like `run` after clearing the system, but restamping the LHS of only the
+ * nonlinear devices where it can.
+ *
+ * The linear devices' LHS only changes with the timestep, so it is stamped
+ * into a cleared system and saved the first time, and again whenever the
+ * timestep changes. Other calls start over from the saved LHS, and only
+ * restamp the linear devices' RHS, which is their residual at the guess.
+ * Devices are stamped in the same order either way, so the system comes
+ * out the same to the last bit.
+ *
+ * @param soln The solution from the previous timestep.
+ * @param guess The solution from the previous newton iteration.
+ * @param dt The sampling period.
+ * @param sys The linear system the program was linked against.
+ */
+template <typename Scalar>
+void StampProgram::run_cached(const VectorXd& soln, const VectorXd& guess,
+	double dt, BasicLinearSystem<Scalar>& sys) {
+
+	double last_step = (capacitors.method == INTEGRATE_BDF2)
+	                   ? capacitors.last_step : 0.0;
+	if (base_valid && dt == base_step && last_step == base_last_step) {
+		sys.restore_lhs();
+		run_rhs(soln, guess, dt, DEVICES_LINEAR);
+	} else {
+		sys.clear();
+		run(soln, guess, dt, DEVICES_LINEAR);
+		sys.save_lhs();
+		base_valid = true;
+		base_step = dt;
+		base_last_step = last_step;
+	}
+
+	run(soln, guess, dt, DEVICES_NONLINEAR);
+}
+
+/**
+ * @brief Stamps only the RHS contributions of devices into the linear
+ * system it was linked against. Used when the LHS is known not to change,
+ * so that its existing factorization can be reused. The RHS is expected to
+ * have been cleared.
+ *
+ * @param soln The solution from the previous timestep.
+ * @param guess The solution from the previous newton iteration.
+ * @param dt The sampling period.
+ * @param devices Which devices to stamp: all of them (the default), only the
+ * linear ones, or only the nonlinear ones.
+ */
+void StampProgram::run_rhs(const VectorXd& soln, const VectorXd& guess,
+	double dt, devices_t devices) {
+
+	if (devices != DEVICES_NONLINEAR) {
+		resistors.evaluate(guess);
+		resistors.apply_rhs();
+
+		capacitors.evaluate(soln, guess, dt);
+		capacitors.apply_rhs();
+
+		sources.evaluate(guess);
+		sources.apply_rhs();
+	}
+
+	if (devices != DEVICES_LINEAR) {
+		diodes.evaluate(guess);
+		diodes.apply_rhs();
+	}
+}
+
+template void StampProgram::link(LinearSystem& sys);
+template void StampProgram::link(LinearSystemF& sys);
+template void StampProgram::run_cached(const VectorXd& soln,
+	const VectorXd& guess, double dt, LinearSystem& sys);
+template void StampProgram::run_cached(const VectorXd& soln,
+	const VectorXd& guess, double dt, LinearSystemF& sys);
@@ -0,0 +1,407 @@
+/**
+ *
+ * @file sweep.cpp
+ *
+ * @brief This file contains the implementation of component sweeps, which
+ * run one input through every combination of a set of component values.
+ *
+ */
+
+#include <sweep.hpp>
+#include <batch.hpp>
+#include <pool.hpp>
+#include <file_output.hpp>
+#include <errors.hpp>
+#include <components/component.hpp>
+#include <unsupported/Eigen/FFT>
+#include <algorithm>
+#include <complex>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <math.h>
+
+using std::vector;
+using std::string;
+
+/**
+ * @brief Accumulates the metrics of one output signal as it streams by.
+ *
+ * The spectral centroid is taken over the power spectrum summed across
+ * back to back Hann windowed frames, so that louder frames count for more.
+ */
+class MetricAccumulator
+{
+public:
+	MetricAccumulator() : sum_squares(0.0), peak(0.0), samples(0), fill(0),
+		frame(Sweep::SPECTRUM_SIZE, 0.0),
+		power(Sweep::SPECTRUM_SIZE / 2 + 1, 0.0) { }
+
+	/**
+	 * @brief Adds a block of samples.
+	 *
+	 * @param buf The samples.
+	 * @param n Number of samples.
+	 */
+	void push(const float *buf, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			sum_squares += (double) buf[i] * buf[i];
+			peak = fmax(peak, fabs(buf[i]));
+			frame[fill++] = buf[i];
+			if (fill == Sweep::SPECTRUM_SIZE)
+				add_frame();
+		}
+		samples += n;
+	}
+
+	/**
+	 * @brief Finishes the metrics, once every sample has been pushed.
+	 *
+	 * @param samplerate Sampling rate of the signal, in hertz.
+	 */
+	Sweep::Metrics finish(double samplerate) {
+		if (fill > 0) {
+			std::fill(frame.begin() + fill, frame.end(), 0.0);
+			add_frame();
+		}
+
+		double total = 0.0;
+		double moment = 0.0;
+		for (int k = 0; k < (int) power.size(); k++) {
+			total += power[k];
+			moment += power[k] * k * samplerate / Sweep::SPECTRUM_SIZE;
+		}
+
+		Sweep::Metrics m;
+		m.rms = samples > 0 ? sqrt(sum_squares / samples) : 0.0;
+		m.peak = peak;
+		m.centroid = total > 0 ? moment / total : 0.0;
+		return m;
+	}
+
+private:
+	double sum_squares;  /**< Sum of every squared sample */
+	double peak;         /**< Largest absolute sample */
+	long samples;        /**< Number of samples pushed */
+	int fill;            /**< Samples in the current frame */
+	vector<double> frame;  /**< Frame being filled */
+	vector<double> power;  /**< Power spectrum summed over every frame */
+	vector<std::complex<double>> spectrum;  /**< Spectrum of one frame */
+	Eigen::FFT<double> fft;  /**< Transforms frames */
+
+	/**
+	 * @brief Windows the current frame and adds its power spectrum.
+	 */
+	void add_frame() {
+		int n = Sweep::SPECTRUM_SIZE;
+		for (int i = 0; i < n; i++)
+			frame[i] *= 0.5 - 0.5 * cos(2 * M_PI * i / n);
+
+		fft.fwd(spectrum, frame);
+		for (int k = 0; k < (int) power.size(); k++)
+			power[k] += std::norm(spectrum[k]);
+		fill = 0;
+	}
+};
+
+/**
+ * @brief Parses the values one component takes across a sweep. Values may
+ * carry the same unit suffixes as the netlist (e.g. 10k, 22n). The
+ * specification takes one of three forms:
+ *
+ *     NAME=START:STOP:COUNT      COUNT values evenly spaced from START to STOP
+ *     NAME=START:STOP:COUNTlog   COUNT values evenly spaced on a log scale
+ *     NAME={V1,V2,...}           the values listed (the braces are optional)
+ *
+ * @param spec The specification.
+ * @param axis Filled in with the axis.
+ *
+ * @return True if the specification was valid and false otherwise.
+ */
+bool Sweep::parse_axis(const string& spec, Axis *axis) {
+	size_t eq = spec.find('=');
+	if (eq == string::npos || eq == 0)
+		return false;
+
+	axis->name = spec.substr(0, eq);
+	axis->values.clear();
+	string range = spec.substr(eq + 1);
+
+	try {
+		/* a range */
+		if (std::count(range.begin(), range.end(), ':') == 2) {
+			size_t c1 = range.find(':');
+			size_t c2 = range.find(':', c1 + 1);
+			double start = Component::parse_by_unit(range.substr(0, c1));
+			double stop = Component::parse_by_unit(
+				range.substr(c1 + 1, c2 - c1 - 1));
+
+			string steps = range.substr(c2 + 1);
+			size_t used;
+			int count = std::stoi(steps, &used);
+			bool log_scale = steps.substr(used) == "log";
+			if (count < 1 || (!log_scale && used != steps.size()) ||
+				(log_scale && (start <= 0 || stop <= 0)))
+				return false;
+
+			for (int i = 0; i < count; i++) {
+				double t = (count > 1) ? (double) i / (count - 1) : 0.0;
+				axis->values.push_back(log_scale
+					? start * pow(stop / start, t)
+					: start + (stop - start) * t);
+			}
+		}
+
+		/* a list */
+		else {
+			if (range.size() >= 2 && range.front() == '{' &&
+				range.back() == '}')
+				range = range.substr(1, range.size() - 2);
+
+			std::istringstream list(range);
+			string value;
+			while (std::getline(list, value, ','))
+				axis->values.push_back(Component::parse_by_unit(value));
+		}
+	} catch (const std::logic_error& e) {
+		return false;
+	}
+
+	/* every value must make a physical component */
+	for (double v : axis->values) {
+		if (!(v > 0))
+			return false;
+	}
+	return !axis->values.empty();
+}
+
+/**
+ * @brief Gets the number of variants in the sweep: one for every
+ * combination of the axes' values.
+ */
+int Sweep::num_variants() const {
+	int n = 1;
+	for (const Axis& axis : axes)
+		n *= axis.values.size();
+	return n;
+}
+
+/**
+ * @brief Gets the value a variant gives one axis's component. The first
+ * axis varies slowest.
+ *
+ * @param variant The variant.
+ * @param axis The axis.
+ */
+double Sweep::value(int variant, int axis) const {
+	for (int a = axes.size() - 1; a > axis; a--)
+		variant /= axes[a].values.size();
+	return axes[axis].values[variant % axes[axis].values.size()];
+}
+
+/**
+ * @brief Finds the resistor or capacitor each axis changes, by its name in
+ * the netlist. Unknown names are fatal.
+ *
+ * @param parser The netlist parser.
+ */
+void Sweep::resolve(NetlistParser& parser) {
+	vector<Component*> components = parser.get_components();
+	targets.clear();
+
+	for (const Axis& axis : axes) {
+		Target target = { false, -1 };
+		for (Component *comp : components) {
+			Resistor *r = dynamic_cast<Resistor*>(comp);
+			Capacitor *cap = dynamic_cast<Capacitor*>(comp);
+			if (r != NULL && r->get_name() == axis.name)
+				target = { true, r->get_device() };
+			else if (cap != NULL && cap->get_name() == axis.name)
+				target = { false, cap->get_device() };
+		}
+
+		if (target.device < 0) {
+			sim_error("No resistor or capacitor named %s to sweep.",
+				axis.name.c_str());
+		}
+		targets.push_back(target);
+	}
+}
+
+/**
+ * @brief Names the file a variant is written to: its index, padded so that
+ * the files sort in order.
+ *
+ * @param outdir The output directory.
+ * @param variant The variant.
+ */
+string Sweep::output_path(const char *outdir, int variant) const {
+	int width = std::to_string(num_variants() - 1).size();
+	std::ostringstream path;
+	path << outdir << "/variant_" << std::setw(width) << std::setfill('0')
+	     << variant << ".txt";
+	return path.str();
+}
+
+/**
+ * @brief Renders a range of variants as the lanes of one batch, filling in
+ * their metrics.
+ *
+ * @param c The circuit.
+ * @param input The decoded input signal.
+ * @param dt Sampling period of the input.
+ * @param outdir Directory the outputs are written to, or NULL.
+ * @param first The first variant in the range.
+ * @param last One past the last variant in the range.
+ */
+void Sweep::render(Circuit& c, const vector<float>& input, double dt,
+	const char *outdir, int first, int last) {
+
+	int lanes = last - first;
+	BatchCircuit batch(c, lanes);
+	for (int l = 0; l < lanes; l++) {
+		for (int a = 0; a < (int) axes.size(); a++) {
+			double v = value(first + l, a);
+			if (targets[a].resistor)
+				batch.set_resistance(l, targets[a].device, v);
+			else
+				batch.set_capacitance(l, targets[a].device, v);
+		}
+	}
+
+	double samplerate = 1.0 / dt;
+	vector<FileOutput*> files(lanes, NULL);
+	if (outdir != NULL) {
+		for (int l = 0; l < lanes; l++) {
+			string path = output_path(outdir, first + l);
+			files[l] = new FileOutput(path.c_str(), lrint(samplerate));
+		}
+	}
+
+	vector<MetricAccumulator> acc(lanes);
+	size_t block_size = FILE_FRAMES_PER_BLOCK;
+	vector<vector<float>> out(lanes, vector<float>(block_size));
+	vector<float> tail(block_size);
+	vector<const float*> in_ptrs(lanes);
+	vector<float*> out_ptrs(lanes);
+	for (int l = 0; l < lanes; l++)
+		out_ptrs[l] = out[l].data();
+
+	/* every lane reads the same input, and is run on past its end for as
+	   long as the resampling filters delay it */
+	batch.start(dt);
+	long len = input.size();
+	long lag = batch.latency();
+	for (long pos = 0; pos < len + lag; pos += block_size) {
+		size_t n = std::min((long) block_size, len + lag - pos);
+		const float *in = input.data() + pos;
+		if (pos + (long) n > len) {
+			std::fill(tail.begin(), tail.end(), 0.0f);
+			if (pos < len)
+				std::copy(input.begin() + pos, input.end(), tail.begin());
+			in = tail.data();
+		}
+		std::fill(in_ptrs.begin(), in_ptrs.end(), in);
+		batch.process(in_ptrs.data(), out_ptrs.data(), n);
+
+		/* output t answers input t - lag */
+		long from = std::max(pos, lag) - pos;
+		if (from >= (long) n)
+			continue;
+		for (int l = 0; l < lanes; l++) {
+			acc[l].push(out[l].data() + from, n - from);
+			if (files[l] != NULL)
+				files[l]->set_next_block(out[l].data() + from, n - from);
+		}
+	}
+	batch.stop();
+
+	for (int l = 0; l < lanes; l++) {
+		metrics[first + l] = acc[l].finish(samplerate);
+		if (files[l] != NULL) {
+			files[l]->finish();
+			delete files[l];
+		}
+	}
+}
+
+/**
+ * @brief Renders the input through every variant of the circuit, then
+ * prints a summary of their metrics (also written to `summary.csv` in the
+ * output directory, if there is one).
+ *
+ * @param parser The netlist parser, whose circuit is swept.
+ * @param input The input signal, which is decoded into memory once.
+ * @param outdir Directory each variant's output is written to, or NULL to
+ * only measure them.
+ * @param jobs Number of worker threads, or 0 for one per core.
+ * @param lanes Number of variants each task runs as one batch.
+ */
+void Sweep::run(NetlistParser& parser, AudioManager *input,
+	const char *outdir, int jobs, int lanes) {
+
+	resolve(parser);
+	Circuit& c = parser.as_circuit();
+
+	/* decode the whole input once */
+	vector<float> signal;
+	input->read_all(signal);
+	double dt = input->get_sampling_period();
+
+	int variants = num_variants();
+	metrics.assign(variants, Metrics());
+
+	WorkPool pool(jobs);
+	std::cout << "Sweeping " << variants << " variant(s) on "
+	          << pool.num_workers() << " thread(s), " << lanes
+	          << " per batch." << std::endl;
+
+	for (int first = 0; first < variants; first += lanes) {
+		int last = std::min(first + lanes, variants);
+		pool.submit([this, &c, &signal, dt, outdir, first, last](int) {
+			render(c, signal, dt, outdir, first, last);
+		});
+	}
+	pool.wait();
+
+	report(std::cout);
+	if (outdir != NULL) {
+		string path = string(outdir) + "/summary.csv";
+		std::ofstream csv(path);
+		if (!csv)
+			sim_error("Failed to write sweep summary %s.", path.c_str());
+		report(csv, ',');
+	}
+}
+
+/**
+ * @brief Prints the component values and metrics of every variant, one
+ * variant per row.
+ *
+ * @param out Stream to print to.
+ * @param separator Character between columns. Spaces pad the columns into
+ * a table, and anything else (e.g. commas) leaves them unpadded.
+ */
+void Sweep::report(std::ostream& out, char separator) const {
+	bool table = separator == ' ';
+	int width = table ? 12 : 0;
+
+	out << std::setw(table ? 8 : 0) << "variant";
+	for (const Axis& axis : axes)
+		out << separator << std::setw(width) << axis.name;
+	out << separator << std::setw(width) << "rms"
+	    << separator << std::setw(width) << "peak"
+	    << separator << std::setw(width) << "centroid_hz" << std::endl;
+
+	for (int v = 0; v < (int) metrics.size(); v++) {
+		out << std::setw(table ? 8 : 0) << v;
+		for (int a = 0; a < (int) axes.size(); a++)
+			out << separator << std::setw(width) << value(v, a);
+		out << separator << std::setw(width) << metrics[v].rms
+		    << separator << std::setw(width) << metrics[v].peak
+		    << separator << std::setw(width) << metrics[v].centroid
+		    << std::endl;
+	}
+}
@@ -0,0 +1,314 @@
+/**
+ *
+ * @file table.cpp
+ *
+ * @brief This file contains the implementation of precomputed port tables,
+ * including building them from a DK model and caching them on disk.
+ *
+ */
+
+#include <table.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+using std::vector;
+using std::string;
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+/** @brief Times a step between grid points may be halved while building */
+static const int MAX_BISECTIONS = 4;
+
+/** @brief Identifies (and versions) table files */
+static const char TABLE_MAGIC[8] = { 'C', 'S', 'I', 'M', 'T', 'B', 'L', '1' };
+
+/**
+ * @brief Sets up the grid for a DK model: finds a basis of the port drives
+ * it can reach, then fits as many points along each dimension as MAX_POINTS
+ * allows.
+ *
+ * @param dk The DK model.
+ *
+ * @return True if the model's drives fit in a grid of at most MAX_DIMS
+ * dimensions and false otherwise.
+ */
+bool PortTable::layout(const DkModel& dk) {
+	ports = 0;
+	dims = 0;
+
+	int k = dk.num_ports();
+	if (k == 0)
+		return false;
+
+	MatrixXd drives(k, dk.order() + 1);
+	drives << dk.Dp, dk.Ep;
+
+	Eigen::ColPivHouseholderQR<MatrixXd> qr;
+	qr.setThreshold(RANK_TOLERANCE);
+	qr.compute(drives);
+
+	int m = qr.rank();
+	if (m == 0 || m > MAX_DIMS)
+		return false;
+
+	ports = k;
+	dims = m;
+	basis = qr.householderQ() * MatrixXd::Identity(k, m);
+	points = (int) floor(pow((double) MAX_POINTS, 1.0 / dims) + 1.0e-9);
+	lo = -RANGE;
+	inv_step = (points - 1) / (2 * RANGE);
+
+	stride[0] = 1;
+	for (int d = 1; d < dims; d++)
+		stride[d] = stride[d - 1] * points;
+	return true;
+}
+
+/**
+ * @brief Collects every parameter of a DK model that the table's contents
+ * depend on, i.e. how the drives are reached, K and the port models.
+ *
+ * @param dk The DK model.
+ */
+vector<double> PortTable::model_key(const DkModel& dk) {
+	vector<double> key(dk.K.data(), dk.K.data() + dk.K.size());
+	key.insert(key.end(), dk.Dp.data(), dk.Dp.data() + dk.Dp.size());
+	key.insert(key.end(), dk.Ep.data(), dk.Ep.data() + dk.Ep.size());
+	key.insert(key.end(), dk.is.begin(), dk.is.end());
+	key.insert(key.end(), dk.nvt_inv.begin(), dk.nvt_inv.end());
+	return key;
+}
+
+/**
+ * @brief Solves a DK model's nonlinear equation at one set of port drives,
+ * starting from the solution at another. If newton's method fails to make
+ * the jump, the path between the two is split in half and each half solved
+ * in turn.
+ *
+ * @param solver The DK model, whose port voltages hold the solution at `from`.
+ * @param from The port drives the current solution belongs to.
+ * @param to The port drives to solve at.
+ * @param depth How many more times the path may be split.
+ *
+ * @return True if newton's method converged at `to` and false otherwise.
+ */
+static bool solve_between(DkModel& solver, const VectorXd& from,
+	const VectorXd& to, int depth) {
+
+	VectorXd start = solver.v;
+	if (solver.solve_ports(to))
+		return true;
+	if (depth == 0)
+		return false;
+
+	VectorXd mid = (from + to) / 2;
+	solver.v = start;
+	return solve_between(solver, from, mid, depth - 1) &&
+	       solve_between(solver, mid, to, depth - 1);
+}
+
+/**
+ * @brief Builds the table by solving a DK model's nonlinear equation at every
+ * grid point, then bounds the interpolation error by solving it again at the
+ * center of every cell.
+ *
+ * Each grid point starts newton's method from an already solved neighbor,
+ * whose port voltages follow from its currents as v = p - K i. Starting far
+ * from zero drive instead would leave newton's method crawling down a
+ * forward biased junction's exponential. Points newton's method cannot solve
+ * (typically drives far beyond what the circuit sees, where junctions carry
+ * absurd currents) are stored as NaN, so lookups near them fail and fall
+ * back to newton's method at run time.
+ *
+ * @param dk The DK model.
+ *
+ * @return True if the table was built and false if the model's drives need
+ * too many dimensions or no grid point could be solved.
+ */
+bool PortTable::build(const DkModel& dk) {
+	if (!layout(dk))
+		return false;
+
+	int k = ports;
+	int total = stride[dims - 1] * points;
+	key = model_key(dk);
+	values.assign((size_t) total * k, 0.0);
+
+	DkModel solver = dk;
+	solver.reset();
+	VectorXd p(k);
+	VectorXd q(k);
+	int coords[MAX_DIMS];
+	int solved = 0;
+
+	/* sweep outward from zero drive along each dimension, so every point but
+	 * the first has an already solved neighbor one step closer to zero */
+	int center = points / 2;
+	for (int n = 0; n < total; n++) {
+		int at = 0;
+		int along = -1;
+		int toward[MAX_DIMS];
+		p.setZero();
+		for (int d = 0; d < dims; d++) {
+			int rank = (n / stride[d]) % points;
+			coords[d] = (rank < points - center) ? center + rank
+			                                     : points - 1 - rank;
+			toward[d] = (coords[d] > center) ? -1 : 1;
+			at += coords[d] * stride[d];
+			p += (lo + coords[d] / inv_step) * basis.col(d);
+			if (along < 0 && coords[d] != center)
+				along = d;
+		}
+
+		if (along < 0) {
+			q.setZero();
+			solver.v.setZero();
+		} else {
+			int nearest = at + toward[along] * stride[along];
+			q = p + toward[along] * basis.col(along) / inv_step;
+			solver.v = q - dk.K * Eigen::Map<VectorXd>(&values[nearest * k], k);
+		}
+
+		/* points past one that could not be solved are left unsolved too */
+		bool converged = solver.v.allFinite() &&
+		                 solve_between(solver, q, p, MAX_BISECTIONS);
+		for (int j = 0; j < k; j++)
+			values[at * k + j] = converged ? solver.i(j) : NAN;
+		solved += converged;
+	}
+
+	if (solved == 0) {
+		ports = 0;
+		return false;
+	}
+	coverage = (double) solved / total;
+
+	/* compare against newton's method at the center of every cell */
+	error = 0.0;
+	VectorXd interpolated(k);
+	for (int at = 0; at < total; at++) {
+		bool interior = true;
+		p.setZero();
+		for (int d = 0; d < dims; d++) {
+			coords[d] = (at / stride[d]) % points;
+			interior = interior && (coords[d] < points - 1);
+			p += (lo + (coords[d] + 0.5) / inv_step) * basis.col(d);
+		}
+		if (!interior)
+			continue;
+
+		/* cells next to unsolved points are never interpolated in */
+		if (!lookup(p, interpolated))
+			continue;
+
+		solver.v = p - dk.K * Eigen::Map<VectorXd>(&values[at * k], k);
+		if (!solver.solve_ports(p))
+			continue;
+
+		VectorXd dv = dk.K * (interpolated - solver.i);
+		error = fmax(error, dv.cwiseAbs().maxCoeff());
+	}
+
+	return true;
+}
+
+/**
+ * @brief Reads a table back from disk. The table is only accepted if it was
+ * built with the same grid for a model with the same parameters.
+ *
+ * @param path The table file.
+ * @param dk The DK model the table should belong to.
+ *
+ * @return True if a matching table was loaded and false otherwise.
+ */
+bool PortTable::load(const string& path, const DkModel& dk) {
+	if (!layout(dk))
+		return false;
+
+	FILE *f = fopen(path.c_str(), "rb");
+	if (f == NULL)
+		return false;
+
+	char magic[sizeof(TABLE_MAGIC)];
+	int32_t header[3];
+	double saved_error[2];
+	vector<double> expected_key = model_key(dk);
+	vector<double> saved_key(expected_key.size());
+
+	bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+	          memcmp(magic, TABLE_MAGIC, sizeof(magic)) == 0 &&
+	          fread(header, sizeof(header), 1, f) == 1 &&
+	          header[0] == ports && header[1] == dims && header[2] == points &&
+	          fread(saved_error, sizeof(saved_error), 1, f) == 1 &&
+	          fread(saved_key.data(), sizeof(double), saved_key.size(), f) ==
+	          saved_key.size() && saved_key == expected_key;
+
+	if (ok) {
+		values.resize((size_t) stride[dims - 1] * points * ports);
+		ok = fread(values.data(), sizeof(double), values.size(), f) ==
+		     values.size();
+	}
+	fclose(f);
+
+	if (!ok) {
+		ports = 0;
+		values.clear();
+		return false;
+	}
+
+	key = expected_key;
+	error = saved_error[0];
+	coverage = saved_error[1];
+	return true;
+}
+
+/**
+ * @brief Writes the table to disk.
+ *
+ * @param path The table file.
+ *
+ * @return True on success and false otherwise.
+ */
+bool PortTable::save(const string& path) const {
+	if (!valid())
+		return false;
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (f == NULL)
+		return false;
+
+	int32_t header[3] = { ports, dims, points };
+	double accuracy[2] = { error, coverage };
+	bool ok = fwrite(TABLE_MAGIC, sizeof(TABLE_MAGIC), 1, f) == 1 &&
+	          fwrite(header, sizeof(header), 1, f) == 1 &&
+	          fwrite(accuracy, sizeof(accuracy), 1, f) == 1 &&
+	          fwrite(key.data(), sizeof(double), key.size(), f) == key.size() &&
+	          fwrite(values.data(), sizeof(double), values.size(), f) ==
+	          values.size();
+
+	return (fclose(f) == 0) && ok;
+}
+
+/**
+ * @brief Hashes the contents of a file with 64-bit FNV-1a.
+ *
+ * @param path The file.
+ *
+ * @return The hash, or 0 if the file could not be read.
+ */
+uint64_t PortTable::hash_file(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return 0;
+
+	uint64_t hash = 14695981039346656037ULL;
+	int c;
+	while ((c = fgetc(f)) != EOF) {
+		hash ^= (uint64_t) (unsigned char) c;
+		hash *= 1099511628211ULL;
+	}
+
+	fclose(f);
+	return hash;
+}
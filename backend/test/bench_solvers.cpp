@@ -0,0 +1,86 @@
+/**
+ *
+ * @file bench_solvers.cpp
+ *
+ * @brief Microbenchmark comparing the dense and fixed-size linear solver
+ * backends on small systems shaped like MNA systems.
+ *
+ */
+
+#include <linsys.hpp>
+#include <components/component.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdio.h>
+
+#define REPEATS 200000
+
+using namespace std;
+
+/* builds a conductance matrix of n nodes (node 0 being ground) connected
+ * by random resistors, with a voltage source on its last row and column */
+static void stamp(LinearSystem& sys, int n, mt19937& rng) {
+	uniform_real_distribution<double> g(1.0e-5, 1.0e-2);
+	uniform_int_distribution<int> node(0, n - 2);
+
+	sys.clear();
+	for (int k = 0; k < 2 * n; k++) {
+		int a = node(rng), b = node(rng);
+		double gk = g(rng);
+		sys.increment_lhs(a, a, gk);
+		sys.increment_lhs(b, b, gk);
+		sys.increment_lhs(a, b, -gk);
+		sys.increment_lhs(b, a, -gk);
+	}
+	for (int a = 1; a < n - 1; a++)
+		sys.increment_lhs(a, a, 1.0e-9);
+	sys.increment_lhs(1, n - 1, 1.0);
+	sys.increment_lhs(n - 1, 1, 1.0);
+	for (int a = 1; a < n; a++)
+		sys.increment_rhs(a, g(rng));
+}
+
+/* times factoring and solving one system, in nanoseconds per call */
+static void time_solver(LinearSystem& sys, double *factor_ns,
+                        double *solve_ns) {
+	auto t0 = chrono::high_resolution_clock::now();
+	for (int i = 0; i < REPEATS; i++)
+		sys.factor();
+	auto t1 = chrono::high_resolution_clock::now();
+	for (int i = 0; i < REPEATS; i++)
+		sys.back_substitute();
+	auto t2 = chrono::high_resolution_clock::now();
+
+	*factor_ns = chrono::duration<double, nano>(t1 - t0).count() / REPEATS;
+	*solve_ns = chrono::duration<double, nano>(t2 - t1).count() / REPEATS;
+}
+
+int main() {
+	cout << "unknowns  dense factor  fixed factor  dense solve  fixed solve"
+	     << "  max difference" << endl;
+
+	/* the smallest system with a node besides ground and a source */
+	for (int n = 3; n <= FixedSolver::MAX_UNKNOWNS; n++) {
+		unordered_map<string, int> unknowns;
+		for (int i = 0; i < n; i++)
+			unknowns[Component::unknown_voltage(i)] = i;
+
+		LinearSystem dense(n, 0, unknowns, LinearSystem::SOLVER_DENSE);
+		LinearSystem fixed(n, 0, unknowns, LinearSystem::SOLVER_FIXED);
+		mt19937 rng_dense(n), rng_fixed(n);
+		stamp(dense, n, rng_dense);
+		stamp(fixed, n, rng_fixed);
+
+		double dense_factor, dense_solve, fixed_factor, fixed_solve;
+		time_solver(dense, &dense_factor, &dense_solve);
+		time_solver(fixed, &fixed_factor, &fixed_solve);
+		double difference = (dense.x - fixed.x).cwiseAbs().maxCoeff();
+
+		printf("%8d  %9.0f ns  %9.0f ns  %8.0f ns  %8.0f ns  %14.3g\n", n,
+		       dense_factor, fixed_factor, dense_solve, fixed_solve,
+		       difference);
+	}
+
+	return 0;
+}
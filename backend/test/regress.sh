@@ -0,0 +1,203 @@
+#!/bin/sh
+#
+# regress.sh - Renders the netlists in circuits/ with each of csim's
+# solvers, orderings, methods, integration methods, predictors and
+# precisions, and as batches, and checks every render against the
+# reference render: the full MNA method with the dense solver (and the
+# same integration or substepping, where a check changes those).
+#
+# A render passes if no sample strays from the reference by more than
+# TOLERANCE times the reference's peak, plus VNTOL volts. That is the
+# newton tolerance (--reltol, --vntol) a sample converges to, well above
+# the rounding of the six digits csim writes samples with. Checks that
+# cannot be held to it give their own tolerance, and say why.
+#
+# Usage: test/regress.sh [SIGNAL...], from backend/ once csim is built
+# (or with CSIM set to the binary to check).
+# Renders waves/sinusoid.txt and waves/noise.txt by default. Exits with a
+# failure if any render fails.
+#
+
+CSIM=${CSIM:-./csim}
+CIRCUITS=$(ls circuits/*.nls | grep -v test_blocks)
+SIGNALS=${*:-"waves/sinusoid.txt waves/noise.txt"}
+TOLERANCE=1e-3
+VNTOL=1e-6
+LANES=2
+REFERENCE=
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+failures=0
+
+# compare REFERENCE FILE TOLERANCE, printing the largest difference and
+# failing if it is out of tolerance
+compare() {
+	awk -F, -v tol="$3" -v vntol="$VNTOL" '
+		FNR == 3 { sub(/,$/, "") }
+		FNR == 3 && NR == FNR { n = split($0, ref); next }
+		FNR == 3 {
+			if (split($0, got) != n) { print "length differs"; exit 1 }
+			for (i = 1; i <= n; i++) {
+				if (got[i] !~ /^-?[0-9.]+(e[-+]?[0-9]+)?$/) {
+					print "sample " i - 1 " is " got[i]; exit 1
+				}
+				d = ref[i] - got[i]; if (d < 0) d = -d
+				p = ref[i]; if (p < 0) p = -p
+				if (d > worst) worst = d
+				if (p > peak) peak = p
+			}
+			printf "maxdiff %g V (peak %g V)\n", worst, peak
+			exit !(worst <= tol * peak + vntol)
+		}' "$1" "$2"
+}
+
+# render CIRCUIT from SIGNAL with the given csim options into FILE
+render() {
+	circuit=$1 signal=$2 file=$3
+	shift 3
+	$CSIM -c "$circuit" -s "$signal" -o "$file" "$@" > "$file.log" 2>&1
+}
+
+# reference CIRCUIT SIGNAL: render the reference for CIRCUIT and SIGNAL,
+# with any options in REFERENCE, unless it already has been, and print
+# where it is
+reference() {
+	ref="$out/$(basename "$1" .nls)-$(basename "$2" .txt)-reference"
+	ref="$ref$(echo $REFERENCE | tr -c 'a-z0-9' '-').txt"
+	[ -f "$ref" ] ||
+		render "$1" "$2" "$ref" --method mna --solver dense $REFERENCE
+	echo "$ref"
+}
+
+# verdict LABEL NAME REFERENCE FILE TOLERANCE: compare a render that csim
+# produced against the reference and report it
+verdict() {
+	if [ -s "$4" ] && result=$(compare "$3" "$4" "$5"); then
+		echo "PASS $1 $2: $result"
+	else
+		echo "FAIL $1 $2: ${result:-csim failed}"
+		failures=$((failures + 1))
+	fi
+	result=
+}
+
+# check LABEL TOLERANCE CIRCUITS [OPTION...]: render each of CIRCUITS
+# from each signal with the options and compare it against the reference
+check() {
+	label=$1 tolerance=$2 circuits=$3
+	shift 3
+	for circuit in $circuits; do
+		name=$(basename "$circuit" .nls)
+		for signal in $SIGNALS; do
+			wave=$(basename "$signal" .txt)
+			ref=$(reference "$circuit" "$signal")
+			file="$out/$name-$wave-$label.txt"
+			render "$circuit" "$signal" "$file" "$@" || rm -f "$file"
+			verdict "$label" "$name $wave" "$ref" "$file" "$tolerance"
+		done
+	done
+}
+
+# check_batch LABEL TOLERANCE CIRCUITS [OPTION...]: render each signal
+# through each of CIRCUITS as a batch of LANES lanes, all fed the same
+# signal, and then every signal at once from a pool of batches of LANES.
+# Compare every lane against the reference
+check_batch() {
+	label=$1 tolerance=$2 circuits=$3
+	shift 3
+	for circuit in $circuits; do
+		name=$(basename "$circuit" .nls)
+		for signal in $SIGNALS; do
+			wave=$(basename "$signal" .txt)
+			ref=$(reference "$circuit" "$signal")
+			lanes=
+			for lane in $(seq $LANES); do
+				file="$out/$name-$wave-$label$lane.txt"
+				lanes="$lanes -s $signal -o $file"
+			done
+			$CSIM -c "$circuit" $lanes "$@" > "$file.log" 2>&1 ||
+				rm -f "$out/$name-$wave-$label"*.txt
+			for lane in $(seq $LANES); do
+				verdict "$label" "$name $wave lane $lane" "$ref" \
+					"$out/$name-$wave-$label$lane.txt" "$tolerance"
+			done
+		done
+
+		pool="$out/$name-$label-pool"
+		mkdir -p "$pool"
+		printf '%s\n' $SIGNALS > "$pool.list"
+		$CSIM -c "$circuit" --inputs "@$pool.list" --outdir "$pool" \
+			--lanes $LANES --jobs 2 "$@" > "$pool.log" 2>&1 ||
+			rm -f "$pool"/*
+		for signal in $SIGNALS; do
+			verdict "$label-pool" "$name $(basename "$signal" .txt)" \
+				"$(reference "$circuit" "$signal")" \
+				"$pool/$(basename "$signal")" "$tolerance"
+		done
+	done
+}
+
+# linear solver backends
+check fixed $TOLERANCE "$CIRCUITS" --solver fixed
+check sparse $TOLERANCE "$CIRCUITS" --solver sparse
+
+# the same, on the full MNA system. At the peaks of a loud signal, the
+# bridge's floating source leaves its LHS singular to working precision,
+# and which of its unknowns QR settles depends on whether ground is part
+# of the system, so its output is only held to within 1%
+check dense-full 1e-2 "$CIRCUITS" --solver dense --no-reduce
+check fixed-full 1e-2 "$CIRCUITS" --solver fixed --no-reduce
+check sparse-full 1e-2 "$CIRCUITS" --solver sparse --no-reduce
+
+# the other orderings of the reduced system (amd is the default), which
+# only change the order sparse LU eliminates the unknowns in
+check rcm $TOLERANCE "$CIRCUITS" --solver sparse --ordering rcm
+check natural $TOLERANCE "$CIRCUITS" --solver sparse --ordering natural
+
+# the linear devices' LHS, which is cached between newton iterations and
+# rebuilt whenever its coefficients change, under the other integration
+# methods, against a reference integrated the same way
+for integration in trap bdf2; do
+	REFERENCE="--integration $integration"
+	check $integration $TOLERANCE "$CIRCUITS" $REFERENCE
+	check $integration-sparse $TOLERANCE "$CIRCUITS" $REFERENCE --solver sparse
+	check $integration-fixed $TOLERANCE "$CIRCUITS" $REFERENCE --solver fixed
+	check $integration-full 1e-2 "$CIRCUITS" $REFERENCE --no-reduce
+done
+REFERENCE=
+
+# DK method, with newton over the ports and with port tables. Circuits
+# with no DK model (the bridge) fall back to MNA
+check dk $TOLERANCE "$CIRCUITS" --method dk
+check table $TOLERANCE "$CIRCUITS" --method table --table-cache "$out"
+
+# linear circuits as a state space model and biquads. Nonlinear circuits
+# fall back to MNA
+check iir $TOLERANCE "$CIRCUITS" --method iir
+
+# circuits compiled into shared objects. They never split timesteps into
+# substeps, so they are checked against a reference that does not either
+REFERENCE="--max-substeps 1"
+check compiled $TOLERANCE "$CIRCUITS" $REFERENCE --method compiled \
+	--table-cache "$out"
+REFERENCE=
+
+# newton predictors, which should only change how many iterations newton
+# takes, never the solution it converges to
+check poly $TOLERANCE "$CIRCUITS" --predictor poly
+check input $TOLERANCE "$CIRCUITS" --predictor input
+
+# batches of lanes, which solve the full MNA system like --no-reduce
+check_batch batch 1e-2 "$CIRCUITS"
+
+# single precision MNA systems. Newton still converges against a double
+# precision residual, so renders hold to the usual tolerance - except the
+# bridge's: float's rank threshold is coarser than double's, so QR leaves
+# a different unknown unsettled at the peaks and its output stalls at a
+# different level, which no tolerance would capture
+check single $TOLERANCE "$(echo "$CIRCUITS" | grep -v bridge)" \
+	--precision single
+
+echo "$failures render(s) failed"
+[ $failures -eq 0 ]